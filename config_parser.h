@@ -71,6 +71,34 @@ DECLARE_string(SSmode);
 
 DECLARE_string(Dripmode);
 
+DECLARE_string(backend);
+
+DECLARE_string(solver);
+
+DECLARE_string(eigensolver);
+
+DECLARE_int32(n_modes);
+
+DECLARE_string(precision);
+
+DECLARE_double(mp_tol);
+
+DECLARE_string(filter_engine);
+
+DECLARE_double(coeff_tol);
+
+DECLARE_double(bg_band);
+
+DECLARE_int32(spline_levels);
+
+DECLARE_int32(refine_interval);
+
+DECLARE_int32(coarse_reso);
+
+DECLARE_int32(coarse_itn);
+
+DECLARE_int32(coarse_partition_factor);
+
 DECLARE_string(testname);
 
 DECLARE_bool(logdensity);
@@ -4,6 +4,11 @@
 #include"lib.cuh"
 #include"vector"
 #include"gpuVector.cuh"
+#include"cstdlib"
+#include"cstring"
+#include"algorithm"
+#include"unordered_map"
+#include"mutex"
 
 //#define __DEBUG_GVECTOR
 
@@ -11,10 +16,136 @@
 namespace gv {
 	gVector buf_vector;
 
+#ifdef GVECTOR_HOST_BACKEND
+	bool gVector::host_backend = true;
+#else
+	bool gVector::host_backend = false;
+#endif
+
+	// buffers of the vectors are taken from and given back to a pool. The freed buffers are kept by their size
+	// class and handed out again, so the vectors rebuilt at each iteration stop calling the backend allocator.
+	// The pool is locked, vectors may be built and freed from several threads
+	struct scalar_pool_t {
+		std::mutex lock;
+		// size class -> free buffers of that class
+		std::unordered_map<size_t, std::vector<Scalar*>> free_list;
+		gVector::PoolStats stats;
+	};
+
+	// never destroyed, vectors with static storage may be freed after this translation unit is torn down
+	static scalar_pool_t& scalar_pool(void) {
+		static scalar_pool_t* pool = new scalar_pool_t();
+		return *pool;
+	}
+
+	// size class of n scalars in bytes, rounded to 64 bytes which is also the host alignment for the simd loops
+	static size_t size_class(size_t n) {
+		return (std::max)(size_t(64), (n * sizeof(Scalar) + 63) / 64 * 64);
+	}
+
+	static Scalar* alloc_scalars(size_t n) {
+		scalar_pool_t& pool = scalar_pool();
+		size_t bytes = size_class(n);
+		std::lock_guard<std::mutex> guard(pool.lock);
+		pool.stats.n_requests++;
+		Scalar* ptr = nullptr;
+		auto& bucket = pool.free_list[bytes];
+		if (!bucket.empty()) {
+			ptr = bucket.back();
+			bucket.pop_back();
+			pool.stats.cached_bytes -= bytes;
+		}
+		else if (gVector::onHost()) {
+			ptr = (Scalar*)std::aligned_alloc(64, bytes);
+			pool.stats.n_allocs++;
+		}
+		else {
+			cudaMalloc(&ptr, bytes);
+			pool.stats.n_allocs++;
+		}
+		pool.stats.live_bytes += bytes;
+		return ptr;
+	}
+
+	// n is the length the buffer was allocated with
+	static void free_scalars(Scalar* ptr, size_t n) {
+		if (ptr == nullptr) return;
+		scalar_pool_t& pool = scalar_pool();
+		size_t bytes = size_class(n);
+		std::lock_guard<std::mutex> guard(pool.lock);
+		pool.free_list[bytes].push_back(ptr);
+		pool.stats.live_bytes -= bytes;
+		pool.stats.cached_bytes += bytes;
+	}
+
+	// kind tells the side of the other pointer on the device backend, on host both are plain memory
+	static void copy_scalars(Scalar* dst, const Scalar* src, size_t n, cudaMemcpyKind kind) {
+		if (n == 0) return;
+		if (gVector::onHost()) {
+			std::memcpy(dst, src, n * sizeof(Scalar));
+			return;
+		}
+		cudaMemcpy(dst, src, n * sizeof(Scalar), kind);
+		cuda_error_check;
+	}
+
+	// dst[i] = func(i) for i < n on the backend
+	template<typename Lambda>
+	static void map_vector(Scalar* dst, size_t n, Lambda func) {
+		if (gVector::onHost()) {
+#pragma omp parallel for simd schedule(static)
+			for (int i = 0; i < int(n); i++) {
+				dst[i] = func(i);
+			}
+			return;
+		}
+		size_t grid_size, block_size;
+		make_kernel_param(&grid_size, &block_size, n, 512);
+		map << <grid_size, block_size >> > (dst, n, func);
+		cudaDeviceSynchronize();
+		cuda_error_check;
+	}
+
+	void gVector::setHostBackend(bool on_host) {
+		// the cached buffers belong to the old backend
+		if (on_host != host_backend) releasePool();
+		host_backend = on_host;
+	}
+
+	gVector::PoolStats gVector::poolStats(void) {
+		scalar_pool_t& pool = scalar_pool();
+		std::lock_guard<std::mutex> guard(pool.lock);
+		return pool.stats;
+	}
+
+	void gVector::resetPoolCounters(void) {
+		scalar_pool_t& pool = scalar_pool();
+		std::lock_guard<std::mutex> guard(pool.lock);
+		pool.stats.n_requests = 0;
+		pool.stats.n_allocs = 0;
+	}
+
+	void gVector::releasePool(void) {
+		scalar_pool_t& pool = scalar_pool();
+		std::lock_guard<std::mutex> guard(pool.lock);
+		for (auto& bucket : pool.free_list) {
+			for (Scalar* ptr : bucket.second) {
+				if (host_backend) {
+					std::free(ptr);
+				}
+				else {
+					cudaFree(ptr);
+				}
+			}
+		}
+		pool.free_list.clear();
+		pool.stats.cached_bytes = 0;
+	}
+
 	void gVector::build(size_t dim) {
 		if (_size != dim) {
 			clear();
-			cudaMalloc(&_data, dim * sizeof(Scalar));
+			_data = alloc_scalars(dim);
 #ifdef __DEBUG_GVECTOR
 			std::cout << "vector " << _data << " calling build with size " << dim << std::endl;
 #endif
@@ -28,7 +159,7 @@ namespace gv {
 
 	void gv::gVector::Init(size_t max_vec_size)
 	{
-		if (std::is_same<Scalar, double>::value) {
+		if (std::is_same<Scalar, double>::value && !host_backend) {
 			init_cuda();
 		}
 		if (max_vec_size > buf_vector.size()) {
@@ -38,7 +169,7 @@ namespace gv {
 
 	void gv::gVector::resize(size_t dim, int)
 	{
-		cudaMalloc(&_data, dim * sizeof(Scalar));
+		_data = alloc_scalars(dim);
 		_size = dim;
 	}
 
@@ -47,6 +178,14 @@ namespace gv {
 		if (v2.size() != v1.size()) printf("warning : using two vectors with unmatched size !");
 		Scalar* v1data = v1.data();
 		const Scalar* v2data = v2.data();
+		if (gVector::onHost()) {
+			int n = v1.size();
+#pragma omp parallel for simd schedule(static)
+			for (int eid = 0; eid < n; eid++) {
+				v1data[eid] = func(v1data[eid], v2data[eid]);
+			}
+			return;
+		}
 		auto merge = [=] __device__(int eid) {
 			v1data[eid] = func(v1data[eid], v2data[eid]);
 		};
@@ -61,7 +200,7 @@ namespace gv {
 		if (_data == nullptr) {
 			if (_size == 0) { return; }
 		}
-		cudaFree(_data);
+		free_scalars(_data, _size);
 #ifdef __DEBUG_GVECTOR
 		std::cout << "vector " << _data << " calling clear " << std::endl;
 #endif
@@ -71,22 +210,21 @@ namespace gv {
 
 	gVector::gVector(size_t dim, Scalar default_value) {
 		_size = dim;
-		cudaMalloc(&_data, _size * sizeof(Scalar));
+		_data = alloc_scalars(_size);
 #ifdef __DEBUG_GVECTOR
 		std::cout << "vector " << _data << " constructing with size " << dim << std::endl;
 #endif
-		init_array(_data, default_value, _size);
-		cuda_error_check;
+		set(default_value);
 	}
 
 	gVector::~gVector(void) {
 		if (_data != nullptr) {
-			cudaFree(_data);
+			free_scalars(_data, _size);
 		}
 #ifdef __DEBUG_GVECTOR
 		std::cout << "vector " << _data << " deconstructing with size " << _size << std::endl;
 #endif
-		cuda_error_check;
+		if (!host_backend) cuda_error_check;
 	}
 
 	//gVector::gVector(Scalar* host_ptr, size_t size) {
@@ -97,56 +235,61 @@ namespace gv {
 	//}
 
 	gVector::gVector(const gVector& v) {
-		cudaMalloc(&_data, v.size() * sizeof(Scalar));
+		_data = alloc_scalars(v.size());
 #ifdef __DEBUG_GVECTOR
 		std::cout << "vector " << _data << " copy constructing with size " << v.size() << " from vector " << v.data() << std::endl;
 #endif
 		_size = v.size();
-		cudaMemcpy(_data, v.data(), _size * sizeof(Scalar), cudaMemcpyDeviceToDevice);
-		cuda_error_check;
+		copy_scalars(_data, v.data(), _size, cudaMemcpyDeviceToDevice);
 	}
 
-	//gv::gVector::gVector(gVector&& v) noexcept {
-	//	Scalar* pt = _data;
-	//	int ps = _size;
-	//	_data = v.data();
-	//	_size = v._size;
-	//	v._data = pt;
-	//	v._size = ps;
-	//}
+	gv::gVector::gVector(gVector&& v) noexcept :_data(nullptr), _size(0) {
+		if (!v.owns_data()) {
+			*this = v;
+			return;
+		}
+		std::swap(_data, v._data);
+		std::swap(_size, v._size);
+	}
+
+	// the old buffer goes to v2 and back to the pool when v2 dies
+	const gVector& gVector::operator=(gVector&& v2) noexcept {
+		if (!owns_data() || !v2.owns_data()) {
+			return *this = static_cast<const gVector&>(v2);
+		}
+		std::swap(_data, v2._data);
+		std::swap(_size, v2._size);
+		return *this;
+	}
 
 	const gVector& gVector::operator=(const gVector& v2) {
 		if (size() != v2.size()) {
 			clear();
 			build(v2.size());
 		}
-		cudaMemcpy(data(), v2.data(), sizeof(Scalar)*v2.size(), cudaMemcpyDeviceToDevice);
+		copy_scalars(data(), v2.data(), v2.size(), cudaMemcpyDeviceToDevice);
 #ifdef __DEBUG_GVECTOR
 		std::cout << "vector " << _data << " copying from vector " << v2.data() << std::endl;
 #endif
-		cuda_error_check;
 		return (*this);
 	}
 
 	const gv::gVectorMap& gv::gVectorMap::operator=(const gVector& v2) const
 	{
-		cudaMemcpy(_data, v2.data(), v2.size(), cudaMemcpyDeviceToDevice);
-		cuda_error_check;
+		copy_scalars(_data, v2.data(), v2.size(), cudaMemcpyDeviceToDevice);
 		return *this;
 	}
 
 	void gVector::download(Scalar* host_ptr) const {
-		cudaMemcpy(host_ptr, data(), sizeof(Scalar)*size(), cudaMemcpyDeviceToHost);
-		cuda_error_check;
+		copy_scalars(host_ptr, data(), size(), cudaMemcpyDeviceToHost);
 	}
 
 	void gVector::set(const Scalar* host_ptr) {
-		cudaMemcpy(data(), host_ptr, sizeof(Scalar)*size(), cudaMemcpyHostToDevice);
-		cuda_error_check;
+		copy_scalars(data(), host_ptr, size(), cudaMemcpyHostToDevice);
 	}
 
 	const gVector& gVector::operator+=(const gVector& v2) {
-		auto add = [=] __device__(Scalar v1, Scalar v2) {
+		auto add = [=] __host__ __device__(Scalar v1, Scalar v2) {
 			return v1 + v2;
 		};
 		apply_vector(*this, v2, add);
@@ -154,7 +297,7 @@ namespace gv {
 	}
 
 	const gVector& gVector::operator-=(const gVector& v2) {
-		auto minus = [=] __device__(Scalar v1, Scalar v2) {
+		auto minus = [=] __host__ __device__(Scalar v1, Scalar v2) {
 			return v1 - v2;
 		};
 		apply_vector(*this, v2, minus);
@@ -162,7 +305,7 @@ namespace gv {
 	}
 
 	const gVector& gVector::operator*=(const gVector& v2) {
-		auto multiply = [=] __device__(Scalar v1, Scalar v2) {
+		auto multiply = [=] __host__ __device__(Scalar v1, Scalar v2) {
 			return v1 * v2;
 		};
 		apply_vector(*this, v2, multiply);
@@ -170,7 +313,7 @@ namespace gv {
 	}
 
 	const gVector& gVector::operator/=(const gVector& v2) {
-		auto divide = [=]__device__(Scalar v1, Scalar v2) {
+		auto divide = [=] __host__ __device__(Scalar v1, Scalar v2) {
 			return v1 / v2;
 		};
 		apply_vector(*this, v2, divide);
@@ -266,22 +409,14 @@ namespace gv {
 
 	const gVector& gVector::operator/=(Scalar s) {
 		Scalar* ptr = _data;
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map << <grid_size, block_size >> > (_data, size(), [=] __device__(int tid) { return ptr[tid] / s; });
-		cudaDeviceSynchronize();
-		cuda_error_check;
+		map_vector(_data, size(), [=] __host__ __device__(int tid) { return ptr[tid] / s; });
 		return *this;
 	}
 
 	void gVector::invInPlace(void)
 	{
 		Scalar* ptr = data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map << <grid_size, block_size >> > (ptr, size(), [=] __device__(int tid) { return 1 / ptr[tid]; });
-		cudaDeviceSynchronize();
-		cuda_error_check;
+		map_vector(ptr, size(), [=] __host__ __device__(int tid) { return 1 / ptr[tid]; });
 		return;
 	}
 
@@ -297,20 +432,20 @@ namespace gv {
 
 	const gVector& gVector::operator*=(Scalar s) {
 		Scalar* ptr = data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map<<<grid_size,block_size>>>(data(), size(), [=] __device__(int tid) { return ptr[tid] * s; });
-		cudaDeviceSynchronize();
-		cuda_error_check;
+		map_vector(data(), size(), [=] __host__ __device__(int tid) { return ptr[tid] * s; });
 		return *this;
 	}
 
 
 	void gVector::set(Scalar val) {
+		if (host_backend) {
+			std::fill(data(), data() + size(), val);
+			return;
+		}
 		init_array(data(), val, size());
 	}
 
-	__device__ bool read_bit(int* flag, int offset) {
+	__host__ __device__ bool read_bit(int* flag, int offset) {
 		int bit32 = flag[offset / 32];
 		return bit32 & (offset % 32);
 	}
@@ -319,6 +454,13 @@ namespace gv {
 	{
 		int len = size();
 		Scalar* ptr = data();
+		if (host_backend) {
+#pragma omp parallel for
+			for (int tid = 0; tid < len; tid++) {
+				if (read_bit(filter, tid)) ptr[tid] = val;
+			}
+			return;
+		}
 		size_t grid_size, block_size;
 		make_kernel_param(&grid_size, &block_size, len, 512);
 		map << <grid_size, block_size >> > (size(), [=] __device__(int tid) {
@@ -334,57 +476,41 @@ namespace gv {
 	void gVector::maximize(Scalar s)
 	{
 		Scalar* ptr = data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map<<<grid_size,block_size>>>(ptr, size(), [=]  __device__(int tid) {
+		map_vector(ptr, size(), [=] __host__ __device__(int tid) {
 			Scalar v = ptr[tid];
 			return v > s ? v : s;
 		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
 	}
 
 	void gVector::maximize(const gVector& v2)
 	{
 		Scalar* v1data = data();
 		const Scalar* v2data = v2.data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map<<<grid_size,block_size>>>(v1data, size(), [=] __device__(int tid) {
+		map_vector(v1data, size(), [=] __host__ __device__(int tid) {
 			Scalar val1 = v1data[tid];
 			Scalar val2 = v2data[tid];
 			return val1 > val2 ? val1 : val2;
 		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
 	}
 
 	void gVector::minimize(Scalar s)
 	{
 		Scalar* ptr = data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map<<<grid_size,block_size>>>(ptr, size(), [=] __device__(int tid) {
+		map_vector(ptr, size(), [=] __host__ __device__(int tid) {
 			Scalar v = ptr[tid];
 			return v < s ? v : s;
 		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
 	}
 
 	void gVector::minimize(const gVector& v2)
 	{
 		Scalar* v1data = data();
 		const Scalar* v2data = v2.data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map<<<grid_size,block_size>>>(v1data, size(), [=] __device__(int tid) {
+		map_vector(v1data, size(), [=] __host__ __device__(int tid) {
 			Scalar val1 = v1data[tid];
 			Scalar val2 = v2data[tid];
 			return val1 < val2 ? val1 : val2;
 		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
 	}
 
 #ifndef __USE_GVECTOR_LAZY_EVALUATION
@@ -421,6 +547,10 @@ namespace gv {
 
 	Scalar gVector::sum(void) const
 	{
+		if (host_backend) {
+			const Scalar* ptr = data();
+			return reduce_graph_host<double>(size(), 0., [=](int eid) { return double(ptr[eid]); }, std::plus<double>());
+		}
 		//gVector tmp((size() + 511) / 512);
 		Scalar res = parallel_sum(data(), buf_vector.data(), size());
 		return res;
@@ -437,33 +567,25 @@ namespace gv {
 	void gVector::clamp(Scalar lower, Scalar upper)
 	{
 		Scalar* ptr = data();
-		auto clamp_kernel = [=] __device__(int eid) {
+		auto clamp_kernel = [=] __host__ __device__(int eid) {
 			Scalar val = ptr[eid];
 			if (lower > val) return lower;
 			if (upper < val) return upper;
 			return  val;
 		};
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map<<<grid_size,block_size>>>(ptr, size(), clamp_kernel);
-		cudaDeviceSynchronize();
-		cuda_error_check;
+		map_vector(ptr, size(), clamp_kernel);
 	}
 
 	void gVector::clamp(Scalar* lower, Scalar* upper)
 	{
 		Scalar* ptr = data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, _size, 512);
-		map<<<grid_size,block_size>>>(ptr, size(), [=] __device__(int eid) {
+		map_vector(ptr, size(), [=] __host__ __device__(int eid) {
 			Scalar val = ptr[eid];
 			Scalar low = lower[eid], up = upper[eid];
 			if (low > val) return low;
 			if (up < val) return up;
 			return val;
 		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
 	}
 	//Scalar gVector::operator[](int eid) const
 	//{
@@ -483,6 +605,10 @@ namespace gv {
 #ifdef __DEBUG_GVECTOR
 		std::cout << "proxy assignment is called, val = " << val << std::endl;
 #endif
+		if (gVector::onHost()) {
+			*address = val;
+			return (*this);
+		}
 		/// DEBUG
 		//cuda_error_check;
 		cudaMemcpy(address, &val, sizeof(Scalar), cudaMemcpyHostToDevice);
@@ -497,6 +623,7 @@ namespace gv {
 #ifdef __DEBUG_GVECTOR
 		std::cout << "type conversion is called, address = " << address << std::endl;
 #endif
+		if (gVector::onHost()) return *address;
 		cudaMemcpy(&val, address, sizeof(Scalar), cudaMemcpyDeviceToHost);
 		return val;
 	}
@@ -684,14 +811,7 @@ namespace gv {
 	gv::gVector gVector::slice(int start, int end) const
 	{
 		gVector res(end - start);
-		const Scalar* ptr = data();
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, res.size(), 512);
-		map<<<grid_size,block_size>>>(res.data(), res.size(), [=]  __device__(int eid) {
-			return ptr[eid + start];
-		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
+		copy_scalars(res.data(), data() + start, res.size(), cudaMemcpyDeviceToDevice);
 		return res;
 	}
 
@@ -702,25 +822,36 @@ namespace gv {
 			throw std::string("invalid indices !");
 		}
 		std::vector<Scalar> res(end - start);
-		cudaMemcpy(res.data(), data(), sizeof(Scalar)*size(), cudaMemcpyDeviceToHost);
-		cuda_error_check;
+		copy_scalars(res.data(), data() + start, res.size(), cudaMemcpyDeviceToHost);
 		return res;
 	}
 
 	Scalar gVector::dot(const gVector& v2) const
 	{
+		if (host_backend) {
+			const Scalar* p1 = data(), *p2 = v2.data();
+			return reduce_graph_host<double>(size(), 0., [=](int eid) { return double(p1[eid]) * p2[eid]; }, std::plus<double>());
+		}
 		//gVector tmp((size() + 511) / 512);
 		return ::dot(data(), v2.data(), buf_vector.data(), size());
 	}
 
 	Scalar gVector::max(void) const
 	{
+		if (host_backend) {
+			const Scalar* ptr = data();
+			return reduce_graph_host<Scalar>(size(), -1e30, [=](int eid) { return ptr[eid]; }, max_op_t<Scalar>());
+		}
 		//gVector tmp((size() + 511) / 512);
 		return parallel_max(data(), buf_vector.data(), size());
 	}
 
 	Scalar gVector::min(void) const
 	{
+		if (host_backend) {
+			const Scalar* ptr = data();
+			return reduce_graph_host<Scalar>(size(), 1e30, [=](int eid) { return ptr[eid]; }, min_op_t<Scalar>());
+		}
 		//gVector tmp((size() + 511) / 512);
 		return parallel_min(data(), buf_vector.data(), size());
 	}
@@ -729,17 +860,13 @@ namespace gv {
 	{
 		gVector tmp(size());
 		Scalar* src = _data;
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, size(), 512);
-		map << <grid_size, block_size >> > (tmp.data(), size(), [=] __device__(int eid) {
+		map_vector(tmp.data(), size(), [=] __host__ __device__(int eid) {
 			Scalar val = src[eid];
 			if (val < 0) {
 				val = 1e30;
 			}
 			return val;
 		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
 
 		return tmp.min();
 	}
@@ -751,6 +878,10 @@ namespace gv {
 
 	Scalar gv::gVector::infnorm(void) const
 	{
+		if (host_backend) {
+			const Scalar* ptr = data();
+			return reduce_graph_host<Scalar>(size(), 0, [=](int eid) { return std::abs(ptr[eid]); }, max_op_t<Scalar>());
+		}
 		//gv::gVector tmp((size() + 511) / 512);
 		return parallel_maxabs(_data, buf_vector.data(), size());
 	}
@@ -762,14 +893,10 @@ namespace gv {
 
 	void gv::gVector::Sqrt(void)
 	{
-		size_t grid_size, block_size;
-		make_kernel_param(&grid_size, &block_size, size(), 512);
 		Scalar* src = _data;
-		map << <grid_size, block_size >> > (_data, size(), [=] __device__(int tid) {
+		map_vector(_data, size(), [=] __host__ __device__(int tid) {
 			return sqrt(src[tid]);
 		});
-		cudaDeviceSynchronize();
-		cuda_error_check;
 	}
 
 	gVectorMap gVector::Map(Scalar* ptr, size_t size) {
@@ -780,18 +907,16 @@ namespace gv {
 	gv::gVector gv::gVector::concated_one(const gVector& v2) const
 	{
 		gVector result(size() + v2.size());
-		cudaMemcpy(result.data(), data(), sizeof(Scalar)*size(), cudaMemcpyDeviceToDevice);
-		cudaMemcpy(result.data() + size(), v2.data(), sizeof(Scalar)*v2.size(), cudaMemcpyDeviceToDevice);
-		cuda_error_check;
+		copy_scalars(result.data(), data(), size(), cudaMemcpyDeviceToDevice);
+		copy_scalars(result.data() + size(), v2.data(), v2.size(), cudaMemcpyDeviceToDevice);
 		return result;
 	}
 
 	gv::gVector gv::gVector::concated_one(Scalar val) const
 	{
 		gVector result(size() + 1);
-		cudaMemcpy(result.data(), data(), size() * sizeof(Scalar), cudaMemcpyDeviceToDevice);
+		copy_scalars(result.data(), data(), size(), cudaMemcpyDeviceToDevice);
 		result[size()] = val;
-		cuda_error_check;
 		return result;
 	}
 
@@ -801,9 +926,8 @@ namespace gv {
 		size_t new_size = v2.size() + size();
 		clear();
 		build(new_size);
-		cudaMemcpy(data(), old_vec.data(), sizeof(Scalar)*old_vec.size(), cudaMemcpyDeviceToDevice);
-		cudaMemcpy(data() + old_vec.size(), v2.data(), sizeof(Scalar)*v2.size(), cudaMemcpyDeviceToDevice);
-		cuda_error_check;
+		copy_scalars(data(), old_vec.data(), old_vec.size(), cudaMemcpyDeviceToDevice);
+		copy_scalars(data() + old_vec.size(), v2.data(), v2.size(), cudaMemcpyDeviceToDevice);
 	}
 
 	void gv::gVector::concate_one(Scalar val)
@@ -812,9 +936,8 @@ namespace gv {
 		size_t new_size = size() + 1;
 		clear();
 		build(new_size);
-		cudaMemcpy(data(), old_vec.data(), old_vec.size() * sizeof(Scalar), cudaMemcpyDeviceToDevice);
-		cudaMemcpy(data() + old_vec.size(), &val, sizeof(Scalar), cudaMemcpyHostToDevice);
-		cuda_error_check;
+		copy_scalars(data(), old_vec.data(), old_vec.size(), cudaMemcpyDeviceToDevice);
+		copy_scalars(data() + old_vec.size(), &val, 1, cudaMemcpyHostToDevice);
 	}
 
 	void test_lazy_eval(void) {
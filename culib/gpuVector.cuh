@@ -9,6 +9,10 @@
 #include"iostream"
 #include"lib.cuh"
 #include"type_traits"
+#include"functional"
+#include"vector"
+#include"utility"
+#include"omp.h"
 
 namespace gv {
 
@@ -153,6 +157,97 @@ __global__ void min_graph_kernel(T* odata, size_t n, graph_t graph) {
 	if (tid == 0) odata[blockIdx.x] = sdata[0];
 }
 
+// block sums of squares go to dump[0, gridDim.x), block max of abs to dump[gridDim.x, 2 * gridDim.x)
+template<typename T, typename graph_t, int blockSize = 512>
+__global__ void sqrnorm_infnorm_graph_kernel(T* dump, int array_size, graph_t graph) {
+	__shared__ T ssqr[blockSize];
+	__shared__ T sabs[blockSize];
+	if (blockDim.x != blockSize) {
+		printf("error block size does not match at line %d ! \n", __LINE__);
+	}
+	int tid = threadIdx.x;
+	size_t element_id = threadIdx.x + blockIdx.x*blockDim.x;
+	T val = 0.f;
+	if (element_id < array_size) {
+		val = graph.eval(element_id);
+	}
+	ssqr[tid] = val * val;
+	sabs[tid] = fabs(val);
+	__syncthreads();
+
+	// block reduce sum and max
+	if (blockSize >= 512) { if (tid < 256) { ssqr[tid] += ssqr[tid + 256]; T v = sabs[tid + 256]; if (sabs[tid] < v) sabs[tid] = v; } __syncthreads(); }
+	if (blockSize >= 256) { if (tid < 128) { ssqr[tid] += ssqr[tid + 128]; T v = sabs[tid + 128]; if (sabs[tid] < v) sabs[tid] = v; } __syncthreads(); }
+	if (blockSize >= 128) { if (tid < 64) { ssqr[tid] += ssqr[tid + 64]; T v = sabs[tid + 64]; if (sabs[tid] < v) sabs[tid] = v; } __syncthreads(); }
+
+	if (tid < 32) { warpReduce<T, blockSize>(ssqr, tid); warpMax<T, blockSize>(sabs, tid); }
+	if (tid == 0) { dump[blockIdx.x] = ssqr[0]; dump[gridDim.x + blockIdx.x] = sabs[0]; }
+}
+
+// host backend, the whole expression is evaluated per element in one simd loop without temporaries
+template<typename graph_t>
+void compute_graph_host(Scalar* dst, int array_size, const graph_t& graph) {
+#pragma omp parallel for simd schedule(static)
+	for (int i = 0; i < array_size; i++) {
+		dst[i] = graph.eval(i);
+	}
+}
+
+// elements reduced by one host task, and below which a range is reduced sequentially
+constexpr int host_reduce_block = 4096;
+constexpr int host_reduce_leaf = 32;
+
+// op over eval(first), ..., eval(last - 1) by recursive halving
+template<typename T, typename Eval, typename Op>
+T pairwise_reduce_host(int first, int last, T init, const Eval& eval, const Op& op) {
+	if (last - first <= host_reduce_leaf) {
+		T s = init;
+		for (int i = first; i < last; i++) {
+			s = op(s, eval(i));
+		}
+		return s;
+	}
+	int mid = first + (last - first) / 2;
+	return op(pairwise_reduce_host(first, mid, init, eval, op), pairwise_reduce_host(mid, last, init, eval, op));
+}
+
+// op over eval(0), ..., eval(n - 1) on host, the fixed blocks are reduced in parallel then their results pairwise.
+// The order only depends on n so the sums are the same for any number of threads, and their rounding error grows with log(n)
+template<typename T, typename Eval, typename Op>
+T reduce_graph_host(int n, T init, const Eval& eval, const Op& op) {
+	int nblock = (n + host_reduce_block - 1) / host_reduce_block;
+	if (nblock <= 1) return pairwise_reduce_host(0, n, init, eval, op);
+	// kept between the calls, a reduction does not allocate
+	static thread_local std::vector<T> block_res;
+	if (block_res.size() < nblock) block_res.resize(nblock);
+	T* res = block_res.data();
+#pragma omp parallel for schedule(static)
+	for (int b = 0; b < nblock; b++) {
+		res[b] = pairwise_reduce_host(b * host_reduce_block, (std::min)(n, (b + 1) * host_reduce_block), init, eval, op);
+	}
+	return pairwise_reduce_host(0, nblock, init, [=](int b) { return res[b]; }, op);
+}
+
+template<typename T>
+struct max_op_t {
+	T operator()(T a, T b) const { return a < b ? b : a; }
+};
+
+template<typename T>
+struct min_op_t {
+	T operator()(T a, T b) const { return a > b ? b : a; }
+};
+
+// squared 2-norm and inf-norm reduced in the same pass
+struct sqr_abs_t {
+	double sqr;
+	Scalar abs;
+};
+
+struct sqr_abs_op_t {
+	sqr_abs_t operator()(sqr_abs_t a, sqr_abs_t b) const { return sqr_abs_t{ a.sqr + b.sqr, a.abs < b.abs ? b.abs : a.abs }; }
+};
+
 //struct exp_base_t {
 //	//int a = 1;
 //	//__host__ __device__ exp_base_t(void) {}
@@ -178,6 +273,10 @@ struct exp_t
 	void launch(Scalar* dst, int n) const {
 		const subExp_t* p_graph = static_cast<const subExp_t*>(this);
 		subExp_t graph = *p_graph;
+		if (gVector::onHost()) {
+			compute_graph_host(dst, n, graph);
+			return;
+		}
 		size_t grid_size, block_size;
 		make_kernel_param(&grid_size, &block_size, n, 512);
 		//std::cout << "launcing with size " << n << std::endl;
@@ -239,14 +338,17 @@ struct exp_t
 		return map_exp_t<subExp_t, Lambda>(*p_ex, func);
 	}
 
-	template<typename opExp_t, typename std::enable_if<is_expression<opExp_t>::value, int>::type = 0>
+	template<typename opExp_t, typename std::enable_if<opExp_t::is_exp, int>::type = 0>
 	Scalar dot(const opExp_t& op2) const {
 		const subExp_t* p_ex = static_cast<const subExp_t*>(this);
 		subExp_t graph1 = *p_ex;
 		opExp_t graph2 = op2;
+		int n = op2.size();
+		if (gVector::onHost()) {
+			return reduce_graph_host<double>(n, 0., [&](int i) { return double(graph1.eval(i)) * graph2.eval(i); }, std::plus<double>());
+		}
 		Scalar* pbuf = gVector::get_dump_buf();
 		//printf("pbuf = %p\n", pbuf);
-		int n = op2.size();
 		size_t grid_size, block_size;
 		make_kernel_param(&grid_size, &block_size, n, 512);
 		cuda_error_check;
@@ -262,6 +364,9 @@ struct exp_t
 		subExp_t graph = *p_ex;
 		Scalar* pbuf = gVector::get_dump_buf();
 		int n = graph.size();
+		if (gVector::onHost()) {
+			return reduce_graph_host<double>(n, 0., [&](int i) { return double(graph.eval(i)); }, std::plus<double>());
+		}
 		size_t grid_size, block_size;
 		make_kernel_param(&grid_size, &block_size, n, 512);
 		cuda_error_check;
@@ -272,11 +377,14 @@ struct exp_t
 		return dump_array_sum(pbuf, n);
 	}
 
-	Scalar sqrnorm(void) {
+	Scalar sqrnorm(void) const {
 		const subExp_t* p_ex = static_cast<const subExp_t*>(this);
 		subExp_t graph = *p_ex;
 		Scalar* pbuf = gVector::get_dump_buf();
 		int n = graph.size();
+		if (gVector::onHost()) {
+			return reduce_graph_host<double>(n, 0., [&](int i) { double val = graph.eval(i); return val * val; }, std::plus<double>());
+		}
 		size_t grid_size, block_size;
 		make_kernel_param(&grid_size, &block_size, n, 512);
 		cuda_error_check;
@@ -287,11 +395,14 @@ struct exp_t
 		return dump_array_sum(pbuf, n);
 	}
 
-	Scalar max(void) {
+	Scalar max(void) const {
 		const subExp_t* p_ex = static_cast<const subExp_t*>(this);
 		subExp_t graph = *p_ex;
 		Scalar* pbuf = gVector::get_dump_buf();
 		int n = graph.size();
+		if (gVector::onHost()) {
+			return reduce_graph_host<Scalar>(n, -1e30, [&](int i) { return graph.eval(i); }, max_op_t<Scalar>());
+		}
 		size_t grid_size, block_size;
 		make_kernel_param(&grid_size, &block_size, n, 512);
 		cuda_error_check;
@@ -302,11 +413,14 @@ struct exp_t
 		return dump_max(pbuf, n);
 	}
 
-	Scalar min(void) {
+	Scalar min(void) const {
 		const subExp_t* p_ex = static_cast<const subExp_t*>(this);
 		subExp_t graph = *p_ex;
 		Scalar* pbuf = gVector::get_dump_buf();
 		int n = graph.size();
+		if (gVector::onHost()) {
+			return reduce_graph_host<Scalar>(n, 1e30, [&](int i) { return graph.eval(i); }, min_op_t<Scalar>());
+		}
 		size_t grid_size, block_size;
 		make_kernel_param(&grid_size, &block_size, n, 512);
 		cuda_error_check;
@@ -317,10 +431,36 @@ struct exp_t
 		return dump_min(pbuf, n);
 	}
 
-	Scalar norm(void) {
+	Scalar norm(void) const {
 		return sqrt(sqrnorm());
 	}
 
+	// <squared 2-norm, inf-norm> in one pass
+	std::pair<Scalar, Scalar> sqrnorm_infnorm(void) const {
+		const subExp_t* p_ex = static_cast<const subExp_t*>(this);
+		subExp_t graph = *p_ex;
+		int n = graph.size();
+		if (gVector::onHost()) {
+			sqr_abs_t res = reduce_graph_host(n, sqr_abs_t{ 0., 0 }, [&](int i) { Scalar val = graph.eval(i); return sqr_abs_t{ double(val) * val, std::abs(val) }; }, sqr_abs_op_t());
+			return std::pair<Scalar, Scalar>(res.sqr, res.abs);
+		}
+		if (n == 0) return std::pair<Scalar, Scalar>(0, 0);
+		Scalar* pbuf = gVector::get_dump_buf();
+		size_t grid_size, block_size;
+		make_kernel_param(&grid_size, &block_size, n, 512);
+		cuda_error_check;
+		sqrnorm_infnorm_graph_kernel << <grid_size, block_size >> > (pbuf, n, graph);
+		cudaDeviceSynchronize();
+		cuda_error_check;
+		n = (n + 511) / 512;
+		Scalar inf = dump_max(pbuf + n, n);
+		return std::pair<Scalar, Scalar>(dump_array_sum(pbuf, n), inf);
+	}
+
+	Scalar infnorm(void) const {
+		return sqrnorm_infnorm().second;
+	}
+
 	void toMatlab(const char* name) {
 #if defined(__GVECTOR_WITH_MATLAB)  
 		const subExp_t* p_ex = static_cast<const subExp_t*>(this);
@@ -339,7 +479,7 @@ struct var_t
 	int vec_dim;
 	__host__ __device__ var_t(const Scalar* ptr_) :ptr(ptr_) {}
 	__host__ __device__ var_t(const gVector& var) : ptr(var.data()), vec_dim(var.size()) {}
-	__device__ Scalar eval(int eid)const {
+	__host__ __device__ Scalar eval(int eid)const {
 		return ptr[eid];
 	}
 	__host__ __device__ int size(void)const {
@@ -353,7 +493,7 @@ struct scalar_t
 {
 	T scalar;
 	__host__ __device__ scalar_t(T s) :scalar(s) {}
-	__device__ T eval(int eid) const {
+	__host__ __device__ T eval(int eid) const {
 		return scalar;
 	}
 	__host__ __device__ int size(void) const {
@@ -377,7 +517,7 @@ struct negat_exp_t
 	:public unary_exp_t<negat_exp_t<opExp_t>, opExp_t>
 {
 	__host__ __device__ negat_exp_t(const opExp_t& ex) : unary_exp_t<negat_exp_t<opExp_t>, opExp_t>(ex) {}
-	__device__ Scalar eval(int eid) const{
+	__host__ __device__ Scalar eval(int eid) const{
 		return -unary_exp_t<negat_exp_t<opExp_t>, opExp_t>::exp.eval(eid);
 	}
 };
@@ -387,7 +527,7 @@ struct sqrt_exp_t
 	:public unary_exp_t<sqrt_exp_t<opExp_t>, opExp_t> 
 {
 	__host__ __device__ sqrt_exp_t(const opExp_t& ex) :unary_exp_t<sqrt_exp_t<opExp_t>, opExp_t>(ex) {}
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		return sqrt(unary_exp_t<sqrt_exp_t<opExp_t>, opExp_t>::exp.eval(eid));
 	}
 };
@@ -400,7 +540,7 @@ struct map_exp_t
 	__host__ __device__ map_exp_t(const opExp_t& ex, Lambda map) 
 		: unary_exp_t<map_exp_t<opExp_t, Lambda>, opExp_t>(ex), _map(map)
 	{ }
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		return _map(unary_exp_t<map_exp_t<opExp_t, Lambda>, opExp_t>::exp.eval(eid));
 	}
 };
@@ -424,7 +564,7 @@ struct add_exp_t
 	typedef binary_exp_t<add_exp_t<opExp1_t, opExp2_t>, opExp1_t, opExp2_t> baseType;
 	__host__ __device__ add_exp_t(const opExp1_t& op1, const opExp2_t& op2) :binary_exp_t<add_exp_t, opExp1_t, opExp2_t>(op1, op2) {}
 	// add_exp_t(const add_exp_t<opExp1_t,opExp2_t>& ex): binary_exp_t<add_exp_t,opExp1_t,opExp2_t>(ex.exp1,ex.exp2){}
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		return baseType::exp1.eval(eid) + baseType::exp2.eval(eid);
 	}
 };
@@ -436,7 +576,7 @@ struct minus_exp_t
 	typedef binary_exp_t<minus_exp_t<opExp1_t, opExp2_t>, opExp1_t, opExp2_t> baseType;
 	__host__ __device__ minus_exp_t(const opExp1_t& op1, const opExp2_t& op2) :binary_exp_t<minus_exp_t, opExp1_t, opExp2_t >(op1, op2) {}
 
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		return baseType::exp1.eval(eid) - baseType::exp2.eval(eid);
 	}
 };
@@ -448,7 +588,7 @@ struct div_exp_t
 	typedef binary_exp_t<div_exp_t<opExp1_t, opExp2_t>, opExp1_t, opExp2_t> baseType;
 	__host__ __device__ div_exp_t(const opExp1_t& op1, const opExp2_t& op2) :binary_exp_t<div_exp_t, opExp1_t, opExp2_t >(op1, op2) {}
 
-	__device__ Scalar eval(int eid)const {
+	__host__ __device__ Scalar eval(int eid)const {
 		return baseType::exp1.eval(eid) / baseType::exp2.eval(eid);
 	}
 };
@@ -460,7 +600,7 @@ struct multiply_exp_t
 	typedef  binary_exp_t<multiply_exp_t<opExp1_t, opExp2_t>, opExp1_t, opExp2_t> baseType;
 	__host__ __device__ multiply_exp_t(const opExp1_t& op1, const opExp2_t& op2) : binary_exp_t<multiply_exp_t/*<opExp1_t, opExp2_t>*/, opExp1_t, opExp2_t>(op1, op2) {}
 	// multiply_exp_t(const multiply_exp_t& ex) :baseType(ex.exp1, ex.exp2) {}
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		return baseType::exp1.eval(eid)*baseType::exp2.eval(eid);
 	}
 };
@@ -472,7 +612,7 @@ struct pow_exp_t
 	typedef binary_exp_t<pow_exp_t<opExp1_t, opExp2_t>, opExp1_t, opExp2_t> baseType;
 	__host__ __device__ pow_exp_t(const opExp1_t& op1, const opExp2_t& op2) :binary_exp_t<pow_exp_t, opExp1_t, opExp2_t >(op1, op2) {}
 
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		return std::is_same<Scalar, float>::value ? powf(baseType::exp1.eval(eid), baseType::exp2.eval(eid)) : pow(baseType::exp1.eval(eid), baseType::exp2.eval(eid));
 	}
 };
@@ -483,7 +623,7 @@ struct min_exp_t
 {
 	typedef binary_exp_t<min_exp_t<opExp1_t, opExp2_t>, opExp1_t, opExp2_t> baseType;
 	__host__ __device__ min_exp_t(const opExp1_t& op1, const opExp2_t& op2) :binary_exp_t<min_exp_t, opExp1_t, opExp2_t >(op1, op2) {}
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		Scalar val1 = baseType::exp1.eval(eid);
 		Scalar val2 = baseType::exp2.eval(eid);
 		return val1 < val2 ? val1 : val2;
@@ -509,7 +649,7 @@ struct max_exp_t
 {
 	typedef binary_exp_t<max_exp_t<opExp1_t, opExp2_t>, opExp1_t, opExp2_t> baseType;
 	__host__ __device__ max_exp_t(const opExp1_t& op1, const opExp2_t& op2) :binary_exp_t<max_exp_t, opExp1_t, opExp2_t >(op1, op2) {}
-	__device__ Scalar eval(int eid) const {
+	__host__ __device__ Scalar eval(int eid) const {
 		Scalar val1 = baseType::exp1.eval(eid);
 		Scalar val2 = baseType::exp2.eval(eid);
 		return val1 > val2 ? val1 : val2;
@@ -906,6 +1046,60 @@ extern pow_exp_t<scalar_t<>, var_t<>> operator^(Scalar s, const gVector& v2);
 
 extern pow_exp_t<var_t<>, scalar_t<>> operator^(const gVector& v1, Scalar s);
 
+/*****************************************************************************
+	reductions
+****************************************************************************/
+// take vectors or expressions, an expression is evaluated inside the reduction and never written to a vector
+
+inline var_t<> as_exp(const gVector& v) {
+	return var_t<>(v);
+}
+
+template<typename opExp_t, typename std::enable_if<is_expression<opExp_t>::value, int>::type = 0>
+const opExp_t& as_exp(const opExp_t& ex) {
+	return ex;
+}
+
+template<typename T1, typename T2>
+auto dot(const T1& op1, const T2& op2) -> decltype(as_exp(op1).dot(as_exp(op2))) {
+	return as_exp(op1).dot(as_exp(op2));
+}
+
+template<typename T>
+auto sum(const T& op) -> decltype(as_exp(op).sum()) {
+	return as_exp(op).sum();
+}
+
+template<typename T>
+auto sqrnorm(const T& op) -> decltype(as_exp(op).sqrnorm()) {
+	return as_exp(op).sqrnorm();
+}
+
+template<typename T>
+auto norm(const T& op) -> decltype(as_exp(op).norm()) {
+	return as_exp(op).norm();
+}
+
+template<typename T>
+auto infnorm(const T& op) -> decltype(as_exp(op).infnorm()) {
+	return as_exp(op).infnorm();
+}
+
+template<typename T>
+auto sqrnorm_infnorm(const T& op) -> decltype(as_exp(op).sqrnorm_infnorm()) {
+	return as_exp(op).sqrnorm_infnorm();
+}
+
+template<typename T>
+auto max(const T& op) -> decltype(as_exp(op).max()) {
+	return as_exp(op).max();
+}
+
+template<typename T>
+auto min(const T& op) -> decltype(as_exp(op).min()) {
+	return as_exp(op).min();
+}
+
 };
 
 #endif
@@ -8,6 +8,10 @@
 
 //#define GVector_USE_DOUBLE
 
+// gVector buffers in host memory and expressions evaluated by OpenMP loops, can also be set at run time by
+// gVector::setHostBackend
+//#define GVECTOR_HOST_BACKEND
+
 #include "vector"
 #include "cusolverDn.h"
 #include <string>
@@ -67,9 +71,14 @@ private:
 
 	template<typename Lambda>friend  void apply_vector(gVector& v1, const gVector& v2, Lambda func);
 
+	static bool host_backend;
+
 protected:
 	gVector(Scalar* data_ptr, size_t size) :_data(data_ptr), _size(size) {}
 
+	// a map views memory it does not own, moving from it copies
+	virtual bool owns_data(void) const { return true; }
+
 protected:
 	auto& _Get_data(void) { return _data; }
 	auto& _Get_size(void) { return _size; }
@@ -107,11 +116,13 @@ public:
 
 	gVector(const gVector& v);
 
-	//gVector(gVector&& v) noexcept;
+	gVector(gVector&& v) noexcept;
 
 public:
 	const gVector& operator=(const gVector& v2);
 
+	const gVector& operator=(gVector&& v2) noexcept;
+
 	void download(Scalar* host_ptr) const;
 
 	const gVector& operator+=(const gVector& v2);
@@ -313,6 +324,7 @@ public:
 		return max_exp_t<var_t<vec_t>, scalar_t<Scalar_type>>(var_t<vec_t>(*this), op2);
 	}
 
+	// func is evaluated where the vector lives, pass a __host__ __device__ lambda to run on both backends
 	template<typename Lambda, typename vec_t = gVector>
 	map_exp_t<var_t<vec_t>, Lambda> fmap(Lambda func) {
 		return map_exp_t<var_t<vec_t>, Lambda>(var_t<vec_t>(*this), func);
@@ -375,6 +387,26 @@ public:
 
 	static void Init(size_t max_vec_size);
 
+	// switch the buffers and kernels to the host, must be set before any gVector is built
+	static void setHostBackend(bool on_host);
+
+	static bool onHost(void) { return host_backend; }
+
+	// the buffers come from a pool keeping the freed ones by size, n_allocs only grows when the pool has none to reuse
+	struct PoolStats {
+		size_t n_requests = 0;    // buffers asked for
+		size_t n_allocs = 0;      // of which allocated by cudaMalloc or on host
+		size_t live_bytes = 0;    // held by vectors
+		size_t cached_bytes = 0;  // free in the pool
+	};
+
+	static PoolStats poolStats(void);
+
+	static void resetPoolCounters(void);
+
+	// returns the free buffers of the pool to the backend
+	static void releasePool(void);
+
 	static Scalar* get_dump_buf(void);
 
 	Scalar sum(void) const;
@@ -412,7 +444,12 @@ class gVectorMap
 {
 public:
 	gVectorMap(Scalar* data_ptr, size_t size) :gVector(data_ptr, size) {}
+	// views the same memory
+	gVectorMap(const gVectorMap& map) :gVector(map._data, map._size) {}
 	~gVectorMap(void) override;
+protected:
+	bool owns_data(void) const override { return false; }
+public:
 	const gVectorMap& operator=(const gVector& v2) const;
 
 	template<typename expr_t, typename std::enable_if<is_expression<expr_t>::value, int>::type = 0>
@@ -1528,13 +1528,13 @@ struct gBitSAT {
 	__host__ __device__ gBitSAT(void) = default;
 
 	__host__ __device__ int operator[](size_t id) const {
-		int ent = id >> firstOne<sizeof(T) * 8>::value;
+		size_t ent = id >> firstOne<sizeof(T) * 8>::value;
 		int mod = id & size_mask;
 		return _chunksat[ent] + countOne(_bitarray[ent] & ((T{ 1 } << mod) - 1));
 	}
 
 	__host__ __device__ int operator()(size_t id) const {
-		int ent = id >> firstOne<sizeof(T) * 8>::value;
+		size_t ent = id >> firstOne<sizeof(T) * 8>::value;
 		int mod = id & size_mask;
 		T resword = _bitarray[ent];
 		if ((resword & (T{ 1 } << mod)) == 0) {
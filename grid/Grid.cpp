@@ -43,6 +43,7 @@
 //using Generator = CGAL::Random_points_in_sphere_3<Point_3>;
 
 #include "MCrender.h"
+#include "marchingCubeBase_t.h"
 #include "TriMesh3D.h"
 
 //#include "fmm.h"
@@ -71,11 +72,16 @@ Mesh mesh_entity;
 extern HierarchyGrid grids;
 
 static Eigen::SparseMatrix<double> Klast;
-static Eigen::Matrix<double, -1, -1> fullK;
 static Eigen::Matrix<double, -1, -1> Klastkernel;
 static std::vector<int> vlastrowid;
 static int nvlastrows;
+// factorization of Klast with the kernel pinned, rebuilt lazily after update_stencil
+static Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> Klastldlt;
+static std::vector<int> Klastpinned;
+static bool Klastfactorized = false;
+// dense fallback if the sparse factorization fails
 static Eigen::BDCSVD<Eigen::MatrixXd> svd;
+static bool Klastdense = false;
 
 namespace Me {
 	template<typename T>
@@ -223,6 +229,7 @@ void HierarchyGrid::buildAABBTree(const std::vector<float>& pcoords, const std::
 	aabb_tree.rebuild(aabb_tris.begin(), aabb_tris.end());
 
 	// build cgal mesh
+	cmesh.clear();
 	std::vector<CGMesh::Vertex_index>  vidlist;
 	for (int i = 0; i < pcoords.size(); i += 3) {
 		vidlist.emplace_back(cmesh.add_vertex(Point(pcoords[i], pcoords[i + 1], pcoords[i + 2])));
@@ -294,7 +301,7 @@ void HierarchyGrid::setSolidShellElement(const std::vector<unsigned int>& ebitfi
 					ec[2] = (z + 0.5)* eh + box[0][2];
 					double d = aabb_tree.squared_distance(Point(ec[0], ec[1], ec[2]));
 					if (d < sh2) {
-						int ebid = x + y * ereso + z * ereso * ereso;
+						index_t ebid = x + y * ereso + index_t(z) * ereso * ereso;
 						int eid = esat(ebid);
 						if (eid != -1) {
 							eidshell.emplace_back(eid);
@@ -368,7 +375,7 @@ void HierarchyGrid::setinModelVertice(const std::vector<unsigned int>& vbitfine,
 					// MARK[TODO]
 					// UPDATE to nodes in model
 					if (d < sh2) {
-						int ebid = x + y * ereso + z * ereso * ereso;
+						index_t ebid = x + y * ereso + index_t(z) * ereso * ereso;
 						int eid = vsat(ebid);
 						if (eid != -1) {
 							eidshell.emplace_back(eid);
@@ -439,7 +446,7 @@ void HierarchyGrid::setinModelElement(const std::vector<unsigned int>& ebitfine,
 					ec[2] = (z + 0.5) * eh + box[0][2];
 					double d = aabb_tree.squared_distance(Point(ec[0], ec[1], ec[2]));
 					if (d < sh2) {
-						int ebid = x + y * ereso + z * ereso * ereso;
+						index_t ebid = x + y * ereso + index_t(z) * ereso * ereso;
 						int eid = esat(ebid);
 						if (eid != -1) {
 							eidshell.emplace_back(eid);
@@ -674,7 +681,33 @@ void grid::HierarchyGrid::enable_logs(int flag)
 	_logFlag = flag;
 }
 
+// box ids are index_t, but the compact vertex ids stored in the device tables are int
+static void checkActiveIdRange(const std::vector<unsigned int>& vbit)
+{
+	index_t nactive = 0;
+	for (auto word : vbit) nactive += countOne(word);
+	if (nactive > std::numeric_limits<int>::max()) {
+		printf("\033[31m-- %lld active vertices exceed the int id range\033[0m\n", nactive);
+		exit(-1);
+	}
+}
+
 // MAEK[USED]
+void grid::HierarchyGrid::clear(void)
+{
+	for (size_t i = 0; i < _gridlayer.size(); i++) {
+		// dummy layers allocate nothing and have no name
+		if (!_gridlayer[i]->_name.empty()) get_gmem().delete_bufs(_gridlayer[i]->_name);
+		delete _gridlayer[i];
+	}
+	_gridlayer.clear();
+	elesatlist.clear();
+	vrtsatlist.clear();
+	eletilelist.clear();
+	vrttilelist.clear();
+	_nlayer = 0;
+}
+
 void grid::HierarchyGrid::genFromMesh(const std::vector<float>& pcoords, const std::vector<int>& facevertices, Mesh& inputmesh)
 {
 	//_pcoords = pcoords;
@@ -721,11 +754,11 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<float>& pcoords, const s
 
 	std::vector<unsigned int> inci_vbit; // vertices info (in solid or not)
 	
-	int nfineelements = out_reso[0] * out_reso[1] * out_reso[2];
+	index_t nfineelements = index_t(out_reso[0]) * out_reso[1] * out_reso[2];
 	
 	int vreso[3] = { out_reso[0] + 1,out_reso[1] + 1,out_reso[2] + 1 };
 
-	int nfinevertices = vreso[0] * vreso[1] * vreso[2];
+	index_t nfinevertices = index_t(vreso[0]) * vreso[1] * vreso[2];
 
 	//size_t inci_vsize = nfinevertices / (sizeof(unsigned int) * 8) + 1;
 	size_t inci_vsize = snippet::Round<BitCount<unsigned int>::value>(nfinevertices) / BitCount<unsigned int>::value; // make sure inci_vsize / 32 == 0
@@ -733,6 +766,8 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<float>& pcoords, const s
 	//cubeGridSetSolidVertices(out_reso[0], solid_bit, inci_vbit);
 	cubeGridSetSolidVertices_g(out_reso[0], solid_bit, inci_vbit);
 
+	checkActiveIdRange(inci_vbit);
+
 	//array2ConnectedMatlab("solid_vbits", inci_vbit.data(), inci_vbit.size());
 
 	int reso = out_reso[0];
@@ -756,8 +791,8 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<float>& pcoords, const s
 		_nlayer++;
 		std::vector<unsigned int> coarse_bit;
 		std::vector<unsigned int> coarse_vbit;
-		int nCoarseElements = pow(reso, 3);
-		int nCoarseVertices = pow(reso + 1, 3);
+		index_t nCoarseElements = index_t(reso) * reso * reso;
+		index_t nCoarseVertices = index_t(reso + 1) * (reso + 1) * (reso + 1);
 		coarse_bit.resize(snippet::Round<BitCount<unsigned int>::value>(nCoarseElements) / BitCount<unsigned int>::value, 0);
 		coarse_vbit.resize(snippet::Round<BitCount<unsigned int>::value>(nCoarseVertices) / BitCount<unsigned int>::value, 0);
 
@@ -973,6 +1008,7 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<float>& pcoords, const s
 		_gridlayer.emplace_back(grd);
 	}
 
+	buildTileTopology();
 }
 
 void grid::HierarchyGrid::genFromMesh(const std::vector<unsigned int> &solid_bit, int out_reso[3])
@@ -984,11 +1020,11 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<unsigned int> &solid_bit
 	}
 	std::vector<unsigned int> inci_vbit;
 
-	int nfineelements = out_reso[0] * out_reso[1] * out_reso[2];
+	index_t nfineelements = index_t(out_reso[0]) * out_reso[1] * out_reso[2];
 	
 	int vreso[3] = { out_reso[0] + 1,out_reso[1] + 1,out_reso[2] + 1 };
 
-	int nfinevertices = vreso[0] * vreso[1] * vreso[2];
+	index_t nfinevertices = index_t(vreso[0]) * vreso[1] * vreso[2];
 
 	//size_t inci_vsize = nfinevertices / (sizeof(unsigned int) * 8) + 1;
 	size_t inci_vsize = snippet::Round<BitCount<unsigned int>::value>(nfinevertices) / BitCount<unsigned int>::value;
@@ -996,6 +1032,8 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<unsigned int> &solid_bit
 	//cubeGridSetSolidVertices(out_reso[0], solid_bit, inci_vbit);
 	cubeGridSetSolidVertices_g(out_reso[0], solid_bit, inci_vbit);
 
+	checkActiveIdRange(inci_vbit);
+
 	//array2ConnectedMatlab("solid_vbits", inci_vbit.data(), inci_vbit.size());
 
 	int reso = out_reso[0];
@@ -1019,8 +1057,8 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<unsigned int> &solid_bit
 		_nlayer++;
 		std::vector<unsigned int> coarse_bit;
 		std::vector<unsigned int> coarse_vbit;
-		int nCoarseElements = pow(reso, 3);
-		int nCoarseVertices = pow(reso + 1, 3);
+		index_t nCoarseElements = index_t(reso) * reso * reso;
+		index_t nCoarseVertices = index_t(reso + 1) * (reso + 1) * (reso + 1);
 		coarse_bit.resize(snippet::Round<BitCount<unsigned int>::value>(nCoarseElements) / BitCount<unsigned int>::value, 0);
 		coarse_vbit.resize(snippet::Round<BitCount<unsigned int>::value>(nCoarseVertices) / BitCount<unsigned int>::value, 0);
 
@@ -1234,6 +1272,26 @@ void grid::HierarchyGrid::genFromMesh(const std::vector<unsigned int> &solid_bit
 		_gridlayer.emplace_back(grd);
 	}
 
+	buildTileTopology();
+}
+
+void grid::HierarchyGrid::buildTileTopology(void)
+{
+	eletilelist.clear();
+	vrttilelist.clear();
+	size_t densebytes = 0, tilebytes = 0;
+	for (int i = 0; i < elesatlist.size(); i++) {
+		int ereso = _gridlayer[i]->_ereso;
+		eletilelist.emplace_back(elesatlist[i], ereso);
+		vrttilelist.emplace_back(vrtsatlist[i], ereso + 1);
+		densebytes += (elesatlist[i]._bitArray.size() + vrtsatlist[i]._bitArray.size()) * sizeof(unsigned int)
+			+ (elesatlist[i]._chunkSat.size() + vrtsatlist[i]._chunkSat.size()) * sizeof(int);
+		tilebytes += eletilelist[i].memoryBytes() + vrttilelist[i].memoryBytes();
+	}
+	// the element traversals of the finest layer run on its tiles, the dense words are not uploaded
+	_gridlayer[0]->setElementTiles(get_gmem(), eletilelist[0]);
+	printf("-- tile topology : %zu of %zu element tiles active on finest layer, %.1f MB (dense %.1f MB)\n",
+		eletilelist[0].n_leaves(), eletilelist[0].n_tiles(), tilebytes / 1024.0 / 1024, densebytes / 1024.0 / 1024);
 }
 
 void HierarchyGrid::writeSupportForce(const std::string& filename)
@@ -1281,24 +1339,14 @@ void HierarchyGrid::writeDensity(const std::string& filename)
 
 	int reso = _gridlayer[0]->_ereso;
 
-	auto& esat = elesatlist[0];
-
-	for (int i = 0; i < esat._bitArray.size(); i++) {
-		int eword = esat._bitArray[i];
-		int eidbase = esat._chunkSat[i];
+	auto& esat = eletilelist[0];
 
-		int eidoffset = 0;
-		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
-			if (!read_bit(eword, ji)) continue;
-			int bitid = i * BitCount<unsigned int>::value + ji;
-			int bitpos[3] = { bitid % reso, bitid / reso % reso, bitid / reso / reso };
-			int eid = eidoffset + eidbase;
-			int rhoid = eidmaphost[eid];
-			for (int k = 0; k < 3; k++) epos[k][eid] = bitpos[k];
-			evalue[eid] = rhohost[rhoid];
-			eidoffset++;
-		}
-	}
+	esat.forEachActive([&](size_t bitid, int eid) {
+		int bitpos[3] = { int(bitid % reso), int(bitid / reso % reso), int(bitid / reso / reso) };
+		int rhoid = eidmaphost[eid];
+		for (int k = 0; k < 3; k++) epos[k][eid] = bitpos[k];
+		evalue[eid] = rhohost[rhoid];
+	});
 
 	if (boundingind[0][0] == std::numeric_limits<int>::max())
 	{
@@ -1334,31 +1382,21 @@ void HierarchyGrid::writeDensityac(const std::string& filename)
 
 	int ereso = _gridlayer[0]->_ereso;
 
-	auto& esat = elesatlist[0];
+	auto& esat = eletilelist[0];
 
 	int element_count = 0;
 	
-	for (int i = 0; i < esat._bitArray.size(); i++) {
-		int eword = esat._bitArray[i];
-		int eidbase = esat._chunkSat[i];
-
-		int eidoffset = 0;
-		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
-			if (!read_bit(eword, ji)) continue;
-			int bitid = i * BitCount<unsigned int>::value + ji;
-			int bitpos[3] = { bitid % ereso, bitid / ereso % ereso, bitid / ereso / ereso };
-			int eid = eidoffset + eidbase;
-			int rhoid = eidmaphost[eid];
-			for (int k = 0; k < 3; k++)
-			{
-				epos[k][eid] = bitpos[k];
-				eposf[k][eid] = bitpos[k] * eh + 0.5 * eh + boxOrigin[k];
-			}
-			evalue[eid] = rhohost[rhoid];
-			eidoffset++;
-			element_count++;
+	esat.forEachActive([&](size_t bitid, int eid) {
+		int bitpos[3] = { int(bitid % ereso), int(bitid / ereso % ereso), int(bitid / ereso / ereso) };
+		int rhoid = eidmaphost[eid];
+		for (int k = 0; k < 3; k++)
+		{
+			epos[k][eid] = bitpos[k];
+			eposf[k][eid] = bitpos[k] * eh + 0.5 * eh + boxOrigin[k];
 		}
-	}
+		evalue[eid] = rhohost[rhoid];
+		element_count++;
+	});
 
 	printf("-- rho element to %d\n", element_count);
 
@@ -1439,18 +1477,38 @@ void HierarchyGrid::writeDensityac_symmetry(const std::string& filename, int typ
 
 	int ereso = _gridlayer[0]->_ereso;
 
-	auto& esat = elesatlist[0];
+	auto& esat = eletilelist[0];
 
-	for (int i = 0; i < esat._bitArray.size(); i++) {
-		int eword = esat._bitArray[i];
-		int eidbase = esat._chunkSat[i];
+	esat.forEachActive([&](size_t bitid, int eid) {
+		int bitpos[3] = { int(bitid % ereso), int(bitid / ereso % ereso), int(bitid / ereso / ereso) };
+		int rhoid = eidmaphost[eid];
 
-		int eidoffset = 0;
-		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
-			if (!read_bit(eword, ji)) continue;
-			int bitid = i * BitCount<unsigned int>::value + ji;
-			int bitpos[3] = { bitid % ereso, bitid / ereso % ereso, bitid / ereso / ereso };
-			int eid = eidoffset + eidbase;
+		std::vector<int> sybitpos = SymmetryPoint(bitpos[0], bitpos[1], bitpos[2], type_);
+		for (int k = 0; k < 3; k++)
+		{
+			epos[k][eid] = bitpos[k];
+			eposf[k][eid] = bitpos[k] * eh + 0.5 * eh + boxOrigin[k];
+			if (boundingind[0][0] != std::numeric_limits<int>::max())
+			{
+				epos[k][eid + _gridlayer[0]->n_elements] = sybitpos[k];
+				eposf[k][eid + _gridlayer[0]->n_elements] = sybitpos[k] * eh + 0.5 * eh + boxOrigin[k];
+			}				
+		}
+		evalue[eid] = rhohost[rhoid];
+		if (boundingind[0][0] != std::numeric_limits<int>::max())
+		{
+			evalue[eid + _gridlayer[0]->n_elements] = rhohost[rhoid];
+		}
+	});
+
+	if (boundingind[0][0] == std::numeric_limits<int>::max())
+	{
+		findVdbBoundingbox(epos);
+		printf("%s Finish Find Vdb Bounding Box : %s\n", GREEN, RESET);
+		std::cout << boundingind[0][0] << ", " << boundingind[0][1] << ", " << boundingind[0][2] << " | " << boundingind[1][0] << ", " << boundingind[1][1] << ", " << boundingind[1][2] << std::endl;
+
+		esat.forEachActive([&](size_t bitid, int eid) {
+			int bitpos[3] = { int(bitid % ereso), int(bitid / ereso % ereso), int(bitid / ereso / ereso) };
 			int rhoid = eidmaphost[eid];
 
 			std::vector<int> sybitpos = SymmetryPoint(bitpos[0], bitpos[1], bitpos[2], type_);
@@ -1462,54 +1520,14 @@ void HierarchyGrid::writeDensityac_symmetry(const std::string& filename, int typ
 				{
 					epos[k][eid + _gridlayer[0]->n_elements] = sybitpos[k];
 					eposf[k][eid + _gridlayer[0]->n_elements] = sybitpos[k] * eh + 0.5 * eh + boxOrigin[k];
-				}				
+				}
 			}
 			evalue[eid] = rhohost[rhoid];
 			if (boundingind[0][0] != std::numeric_limits<int>::max())
 			{
 				evalue[eid + _gridlayer[0]->n_elements] = rhohost[rhoid];
 			}
-			eidoffset++;		
-		}
-	}
-
-	if (boundingind[0][0] == std::numeric_limits<int>::max())
-	{
-		findVdbBoundingbox(epos);
-		printf("%s Finish Find Vdb Bounding Box : %s\n", GREEN, RESET);
-		std::cout << boundingind[0][0] << ", " << boundingind[0][1] << ", " << boundingind[0][2] << " | " << boundingind[1][0] << ", " << boundingind[1][1] << ", " << boundingind[1][2] << std::endl;
-
-		for (int i = 0; i < esat._bitArray.size(); i++) {
-			int eword = esat._bitArray[i];
-			int eidbase = esat._chunkSat[i];
-
-			int eidoffset = 0;
-			for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
-				if (!read_bit(eword, ji)) continue;
-				int bitid = i * BitCount<unsigned int>::value + ji;
-				int bitpos[3] = { bitid % ereso, bitid / ereso % ereso, bitid / ereso / ereso };
-				int eid = eidoffset + eidbase;
-				int rhoid = eidmaphost[eid];
-
-				std::vector<int> sybitpos = SymmetryPoint(bitpos[0], bitpos[1], bitpos[2], type_);
-				for (int k = 0; k < 3; k++)
-				{
-					epos[k][eid] = bitpos[k];
-					eposf[k][eid] = bitpos[k] * eh + 0.5 * eh + boxOrigin[k];
-					if (boundingind[0][0] != std::numeric_limits<int>::max())
-					{
-						epos[k][eid + _gridlayer[0]->n_elements] = sybitpos[k];
-						eposf[k][eid + _gridlayer[0]->n_elements] = sybitpos[k] * eh + 0.5 * eh + boxOrigin[k];
-					}
-				}
-				evalue[eid] = rhohost[rhoid];
-				if (boundingind[0][0] != std::numeric_limits<int>::max())
-				{
-					evalue[eid + _gridlayer[0]->n_elements] = rhohost[rhoid];
-				}
-				eidoffset++;
-			}
-		}
+		});
 	}
 
 
@@ -1768,35 +1786,25 @@ void HierarchyGrid::writeDensityac_shell(const std::string& filename, const std:
 
 	int ereso = _gridlayer[0]->_ereso;
 
-	auto& esat = elesatlist[0];
-
-	for (int i = 0; i < esat._bitArray.size(); i++) {
-		int eword = esat._bitArray[i];
-		int eidbase = esat._chunkSat[i];
+	auto& esat = eletilelist[0];
 
-		int eidoffset = 0;
-		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
-			if (!read_bit(eword, ji)) continue;
-			int bitid = i * BitCount<unsigned int>::value + ji;
-			int bitpos[3] = { bitid % ereso, bitid / ereso % ereso, bitid / ereso / ereso };
-			int eid = eidoffset + eidbase;
-			int rhoid = eidmaphost[eid];
-			for (int k = 0; k < 3; k++)
-			{
-				epos[k][eid] = bitpos[k];
-				eposf[k][eid] = bitpos[k] * eh + 0.5 * eh + boxOrigin[k];
-			}
-			evalue[eid] = rhohost[rhoid];
-			evalue_noshell[eid] = rhohost[rhoid];
-			evalue_shell[eid] = 0;
-			if (eflags[eid] & grid::Grid::mask_shellelement)
-			{				
-				evalue_noshell[eid] = 0;
-				evalue_shell[eid] = 1;
-			}
-			eidoffset++;
+	esat.forEachActive([&](size_t bitid, int eid) {
+		int bitpos[3] = { int(bitid % ereso), int(bitid / ereso % ereso), int(bitid / ereso / ereso) };
+		int rhoid = eidmaphost[eid];
+		for (int k = 0; k < 3; k++)
+		{
+			epos[k][eid] = bitpos[k];
+			eposf[k][eid] = bitpos[k] * eh + 0.5 * eh + boxOrigin[k];
 		}
-	}
+		evalue[eid] = rhohost[rhoid];
+		evalue_noshell[eid] = rhohost[rhoid];
+		evalue_shell[eid] = 0;
+		if (eflags[eid] & grid::Grid::mask_shellelement)
+		{				
+			evalue_noshell[eid] = 0;
+			evalue_shell[eid] = 1;
+		}
+	});
 
 	if (boundingind[0][0] == std::numeric_limits<int>::max())
 	{
@@ -1879,7 +1887,7 @@ void grid::HierarchyGrid::writeSurfaceElement(const std::string& filename)
 	gpu_manager_t::download_buf(eflags.data(), _gridlayer[0]->_gbuf.eBitflag, sizeof(int) * _gridlayer[0]->n_gselements);
 	std::vector<int> eidmap(_gridlayer[0]->n_gselements);
 	gpu_manager_t::download_buf(eidmap.data(), _gridlayer[0]->_gbuf.eidmap, sizeof(int) * _gridlayer[0]->n_elements);
-	auto& esat = elesatlist[0];
+	auto& esat = eletilelist[0];
 
 	std::vector<float> surfpos[3];
 
@@ -1889,23 +1897,15 @@ void grid::HierarchyGrid::writeSurfaceElement(const std::string& filename)
 
 	int ereso = _gridlayer[0]->_ereso;
 
-	for (int i = 0; i < esat._bitArray.size(); i++) {
-		if (esat._bitArray[i] == 0) continue;
-		int eid = esat._chunkSat[i];
-		int bitword = esat._bitArray[i];
-		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
-			int ebitid = i * BitCount<unsigned int>::value + ji;
-			int epos[3] = { ebitid % ereso, ebitid / ereso % ereso, ebitid / ereso / ereso };
-			if (!read_bit(bitword, ji))  continue;
-			int egsid = eidmap[eid];
-			if (egsid == -1) printf("-- error on eidmap\n");
-			int efw = eflags[egsid];
-			if (efw & Grid::Bitmask::mask_surfaceelements) {
-				for (int k = 0; k < 3; k++)  surfpos[k].emplace_back(epos[k] * eh + boxOrigin[k]);
-			}
-			eid++;
+	esat.forEachActive([&](size_t ebitid, int eid) {
+		int epos[3] = { int(ebitid % ereso), int(ebitid / ereso % ereso), int(ebitid / ereso / ereso) };
+		int egsid = eidmap[eid];
+		if (egsid == -1) printf("-- error on eidmap\n");
+		int efw = eflags[egsid];
+		if (efw & Grid::Bitmask::mask_surfaceelements) {
+			for (int k = 0; k < 3; k++)  surfpos[k].emplace_back(epos[k] * eh + boxOrigin[k]);
 		}
-	}
+	});
 	
 	printf("-- writing surface element pos to file %s\n", filename.c_str());
 	bio::write_vectors(filename, surfpos);
@@ -1923,14 +1923,14 @@ void grid::HierarchyGrid::readDensity(const std::string& filename)
 	openvdb_wrapper_t<float>::openVDBfile2grid(filename, epos, evalue);
 	
 	int ereso = _gridlayer[0]->_ereso;
-	auto& esat = elesatlist[0];
+	auto& esat = eletilelist[0];
 
 	for (int i = 0; i < epos->size(); i++) {
 		if (epos[0][i] >= ereso || epos[1][i] >= ereso || epos[2][i] >= ereso) {
 			printf("\033[31m-- unmatched grid and file \033[0m\n");
 			exit(-1);
 		}
-		int ebid = epos[0][i] + epos[1][i] * ereso + epos[2][i] * ereso * ereso;
+		index_t ebid = epos[0][i] + epos[1][i] * ereso + index_t(epos[2][i]) * ereso * ereso;
 		int eid = esat(ebid);
 		if (eid == -1 || eid >= eidmaphost.size()) {
 			printf("\033[31m-- unmatched grid and file\033[0m\n");
@@ -2075,24 +2075,14 @@ void grid::HierarchyGrid::writeSensitivity(const std::string& filename)
 
 	int reso = _gridlayer[0]->_ereso;
 
-	auto& esat = elesatlist[0];
-
-	for (int i = 0; i < esat._bitArray.size(); i++) {
-		int eword = esat._bitArray[i];
-		int eidbase = esat._chunkSat[i];
+	auto& esat = eletilelist[0];
 
-		int eidoffset = 0;
-		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
-			if (!read_bit(eword, ji)) continue;
-			int bitid = i * BitCount<unsigned int>::value + ji;
-			int bitpos[3] = { bitid % reso, bitid / reso % reso, bitid / reso / reso };
-			int eid = eidoffset + eidbase;
-			int rhoid = eidmaphost[eid];
-			for (int k = 0; k < 3; k++) epos[k][eid] = bitpos[k];
-			evalue[eid] = senshost[rhoid];
-			eidoffset++;
-		}
-	}
+	esat.forEachActive([&](size_t bitid, int eid) {
+		int bitpos[3] = { int(bitid % reso), int(bitid / reso % reso), int(bitid / reso / reso) };
+		int rhoid = eidmaphost[eid];
+		for (int k = 0; k < 3; k++) epos[k][eid] = bitpos[k];
+		evalue[eid] = senshost[rhoid];
+	});
 	
 	openvdb_wrapper_t<float>::grid2openVDBfile(filename, epos, evalue);
 }
@@ -2116,14 +2106,14 @@ void grid::HierarchyGrid::readCoeff(const std::string& filename)
 	openvdb_wrapper_t<float>::openVDBfile2grid(filename, epos, evalue);
 
 	int ereso = _gridlayer[0]->_ereso;
-	auto& esat = elesatlist[0];
+	auto& esat = eletilelist[0];
 
 	for (int i = 0; i < epos->size(); i++) {
 		if (epos[0][i] >= ereso || epos[1][i] >= ereso || epos[2][i] >= ereso) {
 			printf("\033[31m-- unmatched grid and file \033[0m\n");
 			exit(-1);
 		}
-		int ebid = epos[0][i] + epos[1][i] * ereso + epos[2][i] * ereso * ereso;
+		index_t ebid = epos[0][i] + epos[1][i] * ereso + index_t(epos[2][i]) * ereso * ereso;
 		int eid = esat(ebid);
 		if (eid == -1 || eid >= eidmaphost.size()) {
 			printf("\033[31m-- unmatched grid and file\033[0m\n");
@@ -2430,6 +2420,15 @@ bool HierarchyGrid::areALLCoeffsEqual(void)
 
 double HierarchyGrid::v_cycle(int pre_relax, int post_relax)
 {
+	v_cycle_sweep(pre_relax, post_relax);
+
+	_gridlayer[0]->update_residual();
+	return _gridlayer[0]->relative_residual();
+}
+
+void HierarchyGrid::v_cycle_sweep(int pre_relax, int post_relax)
+{
+	_n_vcycles++;
 	int depth = n_grid() - 1;
 	// downside
 	for (int i = 0; i < depth + 1; i++) {
@@ -2470,9 +2469,138 @@ double HierarchyGrid::v_cycle(int pre_relax, int post_relax)
 		//printf("-- [%d] rr=  %lf%%\n", i, _gridlayer[i]->relative_residual() * 100);
 		//_gridlayer[i]->displacement2matlab("ur");
 	}
+}
 
-	_gridlayer[0]->update_residual();
-	return _gridlayer[0]->relative_residual();
+void HierarchyGrid::v_cycle_precondition(double* r[3], double* z[3], int pre_relax /*= 1*/, int post_relax /*= 1*/)
+{
+	Grid& g = *_gridlayer[0];
+	g.v3_copy(r, g.getForce());
+	g.reset_displacement();
+	v_cycle_sweep(pre_relax, post_relax);
+	g.v3_copy(g.getDisplacement(), z);
+}
+
+void HierarchyGrid::alloc_pcg_workspace(void)
+{
+	Grid& g = *_gridlayer[0];
+	if (_pcg_nv == g.n_gsvertices) return;
+	gpu_manager_t& gm = get_gmem();
+	gm.delete_bufs("pcg ");
+	for (int i = 0; i < 7; i++) {
+		for (int j = 0; j < 3; j++) {
+			_pcgbuf[i][j] = (double*)gm.add_buf("pcg " + std::to_string(i * 3 + j), sizeof(double) * g.n_gsvertices);
+		}
+	}
+	_pcg_nv = g.n_gsvertices;
+}
+
+double HierarchyGrid::pcg_solve(double rel_tol, int max_itn, bool flexible, std::function<void(double**)> project /*= nullptr*/)
+{
+	Grid& g = *_gridlayer[0];
+
+	// the V-cycle works on F, U, R of the finest layer, keep the system in separate buffers
+	alloc_pcg_workspace();
+	double** b = _pcgbuf[0], ** x = _pcgbuf[1], ** r = _pcgbuf[2], ** z = _pcgbuf[3];
+	double** p = _pcgbuf[4], ** q = _pcgbuf[5], ** rold = _pcgbuf[6];
+
+	g.v3_copy(g.getForce(), b);
+	g.v3_copy(g.getDisplacement(), x);
+
+	// r = b - K x
+	g.applyK(x, q);
+	g.v3_minus(r, b, 1, q);
+	if (project) project(r);
+
+	double bnorm = g.v3_norm(b);
+	if (bnorm == 0) bnorm = 1;
+	double rel_res = g.v3_norm(r) / bnorm;
+	double rz = 0;
+
+	int itn = 0;
+	while (rel_res > rel_tol && itn < max_itn) {
+		v_cycle_precondition(r, z);
+		if (project) project(z);
+
+		double rz_new = g.v3_dot(r, z);
+		if (itn == 0) {
+			g.v3_copy(z, p);
+		}
+		else {
+			// Polak-Ribiere beta tolerates the non symmetric multicolor Gauss-Seidel V-cycle
+			double beta = flexible ? (rz_new - g.v3_dot(z, rold)) / rz : rz_new / rz;
+			g.v3_add(beta, p, 1, z);
+		}
+		rz = rz_new;
+		if (flexible) g.v3_copy(r, rold);
+
+		g.applyK(p, q);
+		double pq = g.v3_dot(p, q);
+		if (pq <= 0) {
+			printf("\033[31m-- pcg breakdown, pKp = %6.4e\033[0m\n", pq);
+			break;
+		}
+		double alpha = rz / pq;
+
+		g.v3_add(x, alpha, p);
+		g.v3_minus(r, alpha, q);
+
+		itn++;
+		rel_res = g.v3_norm(r) / bnorm;
+	}
+
+	// restore the system and the true residual
+	g.v3_copy(b, g.getForce());
+	g.v3_copy(x, g.getDisplacement());
+	g.update_residual();
+
+	return g.relative_residual();
+}
+
+void HierarchyGrid::enable_block(int nrhs)
+{
+	for (int i = 0; i < n_grid(); i++) {
+		if (_gridlayer[i]->is_dummy()) continue;
+		_gridlayer[i]->alloc_block(get_gmem(), nrhs);
+	}
+}
+
+double HierarchyGrid::v_cycle_block(int pre_relax /*= 1*/, int post_relax /*= 1*/)
+{
+	_n_vcycles++;
+	int depth = n_grid() - 1;
+	// downside
+	for (int i = 0; i < depth + 1; i++) {
+		if (_gridlayer[i]->is_dummy()) { continue; }
+		if (i > 0) {
+			_gridlayer[i]->fineGrid->update_residual_block();
+			_gridlayer[i]->restrict_residual_block();
+			_gridlayer[i]->reset_block(_gridlayer[i]->_gbuf.Ublock);
+		}
+		if (i < n_grid() - 1) {
+			_gridlayer[i]->gs_relax_block(pre_relax);
+		}
+		else {
+			_gridlayer[i]->solve_fem_block_host();
+		}
+	}
+	// upside
+	for (int i = depth - 1; i >= 0; i--) {
+		if (_gridlayer[i]->is_dummy()) { continue; }
+		_gridlayer[i]->prolongate_correction_block();
+		_gridlayer[i]->gs_relax_block(post_relax);
+	}
+
+	Grid& g = *_gridlayer[0];
+	g.update_residual_block();
+	std::vector<double> rnorm(g.n_rhs), fnorm(g.n_rhs);
+	g.block_norm(g._gbuf.Rblock, rnorm.data());
+	g.block_norm(g._gbuf.Fblock, fnorm.data());
+	double rel_res = 0;
+	for (int k = 0; k < g.n_rhs; k++) {
+		if (fnorm[k] == 0) continue;
+		rel_res = (std::max)(rel_res, rnorm[k] / fnorm[k]);
+	}
+	return rel_res;
 }
 
 double grid::HierarchyGrid::v_halfcycle(int depth, int pre_relax /*= 1*/, int post_relax /*= 1*/)
@@ -2603,6 +2731,10 @@ size_t grid::Grid::_tmp_buf2_size = 0;
 grid::Mode grid::Grid::_mode;
 grid::GlobalSSMode grid::Grid::_ssmode;
 grid::GlobalDripMode grid::Grid::_dripmode;
+grid::Backend grid::Grid::_backend = grid::cuda_backend;
+grid::Precision grid::Grid::_precision = grid::double_precision;
+grid::FilterMode grid::Grid::_filterMode = grid::gather_filter;
+float grid::Grid::_power_penalty = 3;
 
 float grid::Grid::_default_print_angle = 3 * M_PI / 4;
 float grid::Grid::_opt_print_angle = 3 * M_PI / 4;
@@ -2721,8 +2853,8 @@ void Grid::computeProjectionMatrix(int nv, int nv_gs, int vreso, const std::vect
 			if (read_bit(word, j)) {
 				int flag = vflaghost[vidoffset + nv_word];
 				if (flag & Bitmask::mask_surfacenodes) {
-					int bitid = i * BitCount<unsigned int>::value + j;
-					int id[3] = { bitid % vreso, bitid % vreso2 / vreso, bitid / vreso2 };
+					index_t bitid = index_t(i) * BitCount<unsigned int>::value + j;
+					int id[3] = { int(bitid % vreso), int(bitid % vreso2 / vreso), int(bitid / vreso2) };
 					double vpos[3] = { _box[0][0] + id[0] * eh,_box[0][1] + id[1] * eh,_box[0][2] + id[2] * eh };
 					bool isFix = false, isLoad = false;
 					// set support nodes flag
@@ -2864,11 +2996,11 @@ void Grid::setVerticesPosFlag(int vreso, BitSAT<unsigned int>& vrtsat, int* flag
 		if (word == 0) continue;
 		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 			if (!read_bit(word, ji)) continue;
-			int vbitid = j * BitCount<unsigned int>::value + ji;
+			index_t vbitid = index_t(j) * BitCount<unsigned int>::value + ji;
 			int flagword = 0;
 
 			// position mod 8 flag
-			int vpos[3] = { vbitid % vreso, vbitid / vreso % vreso, vbitid / vreso2 };
+			int vpos[3] = { int(vbitid % vreso), int(vbitid / vreso % vreso), int(vbitid / vreso2) };
 			flagword |= vpos[0] % 8;
 			flagword |= (vpos[1] % 8) << 3;
 			flagword |= (vpos[2] % 8) << 6;
@@ -2892,11 +3024,11 @@ void Grid::setElementsPosFlag(int ereso, BitSAT<unsigned int>& elesat, int* flag
 		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++)
 		{
 			if (!read_bit(word, ji)) continue;
-			int ebitid = j * BitCount<unsigned int>::value + ji;
+			index_t ebitid = index_t(j) * BitCount<unsigned int>::value + ji;
 			int flagword = 0;
 
 			// position mod 8 flag
-			int epos[3] = { ebitid * ereso, ebitid / ereso % ereso, ebitid / ereso2 };
+			int epos[3] = { int(ebitid % ereso), int(ebitid / ereso % ereso), int(ebitid / ereso2) };
 			flagword |= epos[0] % 8;
 			flagword |= (epos[1] % 8) << 3;
 			flagword |= (epos[2] % 8) << 6;
@@ -2923,10 +3055,10 @@ void Grid::setV2E(int vreso, BitSAT<unsigned int>& vrtsat, BitSAT<unsigned int>&
 			if (word == 0) continue;
 			for (int ji = 0; ji < sizeof(unsigned int) * 8; ji++) {
 				if (!read_bit(word, ji)) continue;
-				int eid = j * sizeof(unsigned int) * 8 + ji;
-				int epos[3] = { eid % elementreso, (eid % elementreso2) / elementreso, eid / elementreso2 };
+				index_t eid = index_t(j) * BitCount<unsigned int>::value + ji;
+				int epos[3] = { int(eid % elementreso), int((eid % elementreso2) / elementreso), int(eid / elementreso2) };
 				int vloc[3] = { epos[0] + loc[0],epos[1] + loc[1],epos[2] + loc[2] };
-				int vid = vloc[0] + vloc[1] * vreso + vloc[2] * vreso2;
+				index_t vid = vloc[0] + vloc[1] * vreso + index_t(vloc[2]) * vreso2;
 				v2e[vrtsat[vid]] = elsat[eid];
 			}
 		}
@@ -2947,10 +3079,10 @@ void Grid::setV2V(int vreso, BitSAT<unsigned int>& vrtsat, int* v2vlist[27])
 			if (word == 0) continue;
 			for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 				if (!read_bit(word, ji)) continue;
-				int vid = BitCount<unsigned int>::value*j + ji;
-				int vloc[3] = { vid % vertexreso + loc[0], (vid % vertexreso2) / vertexreso + loc[1], vid / vertexreso2 + loc[2] };
+				index_t vid = index_t(j) * BitCount<unsigned int>::value + ji;
+				int vloc[3] = { int(vid % vertexreso) + loc[0], int((vid % vertexreso2) / vertexreso) + loc[1], int(vid / vertexreso2) + loc[2] };
 				if (vloc[0] < 0 || vloc[1] < 0 || vloc[2] < 0) continue;
-				int neighid = vloc[0] + vloc[1] * vertexreso + vloc[2] * vertexreso2;
+				index_t neighid = vloc[0] + vloc[1] * vertexreso + index_t(vloc[2]) * vertexreso2;
 				v2v[vrtsat[vid]] = vrtsat[neighid];
 			}
 		}
@@ -3049,9 +3181,6 @@ size_t grid::Grid::build(
 		_isosurface_value = (_min_coeff + _max_coeff) / 2;
 
 		_gbuf.rho_e = (float*)gm.add_buf(_name + "rho_e ", sizeof(float) * ne_gs); gbuf_size += sizeof(float) * ne_gs;		
-		_gbuf.eActiveBits = (unsigned int*)gm.add_buf(_name + "eActiveBits", sizeof(unsigned int)*ebit._bitArray.size(), ebit._bitArray.data()); gbuf_size += sizeof(unsigned int) * ebit._bitArray.size();
-		_gbuf.eActiveChunkSum = (int*)gm.add_buf(_name + "eActiveChunkSum", sizeof(int)*ebit._chunkSat.size(), ebit._chunkSat.data()); gbuf_size += sizeof(int) * ebit._chunkSat.size();
-		_gbuf.nword_ebits = ebit._bitArray.size();
 
 		_gbuf.init_rho_e = (float*)gm.add_buf(_name + "init_rho_e ", sizeof(float) * ne_gs); gbuf_size += sizeof(float) * ne_gs;
 		_gbuf.coeffs = (float*)gm.add_buf(_name + " coeff ", sizeof(float) * n_im * n_in * n_il); gbuf_size += sizeof(float) * n_im * n_in * n_il;
@@ -3119,6 +3248,7 @@ size_t grid::Grid::build(
 		_gbuf.bg_ele_flag = (float*)gm.add_buf(_name + "bg_ele_flag", sizeof(float) * ne); gbuf_size += sizeof(float) * ne;
 		_gbuf.bg_ele_flag_virtual = (float*)gm.add_buf(_name + "bg_ele_flag_virtual", sizeof(float) * ne); gbuf_size += sizeof(float) * ne;
 		_gbuf.bg_ele_buf = (float*)gm.add_buf(_name + "bg_ele_buf ", sizeof(float) * ne); gbuf_size += sizeof(float) * ne;
+		_gbuf.bg_band = (int*)gm.add_buf(_name + "bg_band ", sizeof(int) * ne); gbuf_size += sizeof(int) * ne;
 
 	}
 
@@ -3205,8 +3335,7 @@ size_t grid::Grid::build(
 	lexico2gsorder_g(eidmap, ne, _gbuf.eBitflag, ne_gs, _gbuf.eBitflag);
 
 	if (_layer != 0) {
-		_gbuf.rxStencil = (double*)gm.add_buf(_name + " rxStencil ", sizeof(double) * nv_gs * 27 * 9); gbuf_size += sizeof(double) * nv_gs * 27 * 9;
-		gpu_manager_t::initMem(_gbuf.rxStencil, sizeof(double) * nv_gs * 27 * 9);
+		alloc_stencil(gm); gbuf_size += stencil_bytes();
 	}
 
 	printf("-- Allocate %d MB buffer\n", gbuf_size / 1024 / 1024);
@@ -3214,6 +3343,18 @@ size_t grid::Grid::build(
 	return nv_gs;
 }
 
+void grid::Grid::setElementTiles(gpu_manager_t& gm, const TileSAT& etiles)
+{
+	_etiles = &etiles;
+	const auto& root = etiles.root();
+	const auto& leaves = etiles.leaves();
+	const auto& rowsat = etiles.rowSat();
+	_gbuf.eTileRoot = (int*)gm.add_buf(_name + "eTileRoot", sizeof(int) * root.size(), root.data());
+	_gbuf.eTileLeaves = (TileSAT::Leaf*)gm.add_buf(_name + "eTileLeaves", sizeof(TileSAT::Leaf) * leaves.size(), leaves.data());
+	_gbuf.eTileRowSat = (int*)gm.add_buf(_name + "eTileRowSat", sizeof(int) * rowsat.size(), rowsat.data());
+	_gbuf.n_etileleaves = leaves.size();
+}
+
 void grid::Grid::readForce(std::string forcefile)
 {
 	std::vector<double> fhost;
@@ -3306,10 +3447,7 @@ void grid::Grid::readSupportForce(std::string fsfile)
 
 void grid::Grid::set_spline_knot_series(void)
 {
-	int i, j, k;
-	float tmp;
 	float scale_bound = 2.0f;
-	int sorder = n_order;
 	int spartx = n_partitionx;
 	int sparty = n_partitiony;
 	int spartz = n_partitionz;
@@ -3331,6 +3469,24 @@ void grid::Grid::set_spline_knot_series(void)
 	m_3sBoundMax[2] += scale_bound * deltaz / (float)(spartz + 1);
 	m_3sBoundMin[2] -= scale_bound * deltaz / (float)(spartz + 1);
 
+	set_spline_knot_series(m_3sBoundMin, m_3sBoundMax);
+}
+
+void grid::Grid::set_spline_knot_series(const float boundmin[3], const float boundmax[3])
+{
+	int i, j, k;
+	float tmp;
+	int sorder = n_order;
+	int spartx = n_partitionx;
+	int sparty = n_partitiony;
+	int spartz = n_partitionz;
+
+	for (int i = 0; i < 3; i++)
+	{
+		m_3sBoundMin[i] = boundmin[i];
+		m_3sBoundMax[i] = boundmax[i];
+	}
+
 	// calculate the step
 	m_sStepX = (m_3sBoundMax[0] - m_3sBoundMin[0]) / (float)(spartx + 1);
 	m_sStepY = (m_3sBoundMax[1] - m_3sBoundMin[1]) / (float)(sparty + 1);
@@ -3459,6 +3615,102 @@ void grid::Grid::uploadSurfacePoints(void)
 #endif
 }
 
+void grid::Grid::set_bg_band(float width)
+{
+	if (width == _bgBandWidth) return;
+	_bgBandWidth = width;
+	// start over from a full evaluation
+	_bgBandValue.clear();
+}
+
+void grid::Grid::select_bg_band_candidates(void)
+{
+	std::vector<float> cnew(n_cijk());
+	gpu_manager_t::download_buf(cnew.data(), _gbuf.coeffs, sizeof(float) * cnew.size());
+
+	_bgBandList.clear();
+	if (_bgBandValue.size() != n_elements || _bgBandCoeffs.size() != cnew.size()) {
+		_bgBandValue.assign(n_elements, 0.f);
+		_bgBandStamp.assign(n_elements, 0.f);
+		_bgBandDrift = 0;
+		for (int i = 0; i < n_elements; i++) _bgBandList.push_back(i);
+	}
+	else {
+		// the basis is a partition of unity, so no spline value moved by more than the largest coefficient
+		// move since it was evaluated. Elements that cannot have reached the band keep their old value
+		float dmax = 0;
+		for (size_t i = 0; i < cnew.size(); i++) dmax = std::max(dmax, std::abs(cnew[i] - _bgBandCoeffs[i]));
+		_bgBandDrift += dmax;
+		for (int i = 0; i < n_elements; i++) {
+			float bound = std::abs(_bgBandValue[i] - _isosurface_value) - (_bgBandDrift - _bgBandStamp[i]);
+			if (bound < _bgBandWidth) _bgBandList.push_back(i);
+		}
+	}
+	_bgBandCoeffs = cnew;
+
+	_nBgBand = _bgBandList.size();
+	gpu_manager_t::upload_buf(_gbuf.bg_band, _bgBandList.data(), sizeof(int) * _nBgBand);
+}
+
+void grid::Grid::rebuild_bg_band(const float* value)
+{
+	int ncandidate = _bgBandList.size();
+	int nband = 0;
+	for (int k = 0; k < ncandidate; k++) {
+		int i = _bgBandList[k];
+		_bgBandValue[i] = value[i];
+		_bgBandStamp[i] = _bgBandDrift;
+		if (std::abs(value[i] - _isosurface_value) < _bgBandWidth) _bgBandList[nband++] = i;
+	}
+	_bgBandList.resize(nband);
+
+	_nBgBand = nband;
+	gpu_manager_t::upload_buf(_gbuf.bg_band, _bgBandList.data(), sizeof(int) * _nBgBand);
+	printf("-- background band %d / %d elements (%d evaluated)\n", nband, n_elements, ncandidate);
+}
+
+void grid::Grid::set_spline_hierarchy(int nlevel)
+{
+	int nspan[3] = { sppartition[0] + 1, sppartition[1] + 1, sppartition[2] + 1 };
+	int nused = _spHierarchy.init(n_order, nspan, nlevel);
+	if (nused != nlevel) {
+		printf("\033[33m-- spline partition does not halve %d times, using %d levels\033[0m\n", nlevel - 1, nused);
+	}
+	printf("-- spline hierarchy of %d levels, %d / %d design variables\n", nused, n_design(), n_cijk());
+}
+
+void grid::Grid::design2coeff(const float* design)
+{
+	std::vector<float> x(n_design()), c(n_cijk());
+	gpu_manager_t::download_buf(x.data(), design, sizeof(float) * x.size());
+	_spHierarchy.forward(x.data(), c.data());
+	gpu_manager_t::upload_buf(_gbuf.coeffs, c.data(), sizeof(float) * c.size());
+}
+
+void grid::Grid::dcoeff2design(const float* dcoeff, float* ddesign)
+{
+	std::vector<float> dc(n_cijk()), dx(n_design());
+	gpu_manager_t::download_buf(dc.data(), dcoeff, sizeof(float) * dc.size());
+	_spHierarchy.transpose(dc.data(), dx.data());
+	gpu_manager_t::upload_buf(ddesign, dx.data(), sizeof(float) * dx.size());
+}
+
+int grid::Grid::refine_spline_hierarchy(const float* dcoeff, float sens_ratio, std::vector<float>& design)
+{
+	std::vector<float> c(n_cijk()), dc;
+	gpu_manager_t::download_buf(c.data(), _gbuf.coeffs, sizeof(float) * c.size());
+	if (dcoeff) {
+		dc.resize(n_cijk());
+		gpu_manager_t::download_buf(dc.data(), dcoeff, sizeof(float) * dc.size());
+	}
+	int nrefine = _spHierarchy.refine(c.data(), dcoeff ? dc.data() : nullptr, _isosurface_value, sens_ratio);
+	// the refined space contains the old one, so the current coefficients are carried over exactly
+	design.resize(n_design());
+	_spHierarchy.project(c.data(), design.data());
+	printf("-- refined %d spline cells, %d / %d design variables\n", nrefine, n_design(), n_cijk());
+	return nrefine;
+}
+
 void grid::Grid::uploadBgEle(void)
 {
 	// upload to device
@@ -3696,8 +3948,8 @@ void Grid::eidmap2matlab(const std::string & nam)
 
 void Grid::buildCoarsestSystem(void)
 {
-	std::vector<double> rxdata(n_gsvertices * 27 * 9);
-	gpu_manager_t::download_buf(rxdata.data(), _gbuf.rxStencil, sizeof(double) * n_gsvertices * 27 * 9);
+	std::vector<double> rxdata;
+	download_stencil(rxdata);
 
 	std::vector<Eigen::Triplet<double>> triplist;
 
@@ -3716,8 +3968,6 @@ void Grid::buildCoarsestSystem(void)
 	nvlastrows = rowid;
 
 	Klast.resize(rowid * 3, rowid * 3);
-	fullK.resize(rowid * 3, rowid * 3);
-	fullK.fill(0);
 
 	for (int i = 0; i < rxdata.size(); i++) {
 		double rxvalue = rxdata[i];
@@ -3729,33 +3979,154 @@ void Grid::buildCoarsestSystem(void)
 		int nei = i / (n_gsvertices * 9);
 		int nid = _v2v[nei][vid];
 		if (nid == -1) continue;
+		if (rxvalue == 0) continue;
 		triplist.emplace_back(vlastrowid[vid] * 3 + krow, vlastrowid[nid] * 3 + kcol, rxvalue);
-		fullK(vlastrowid[vid] * 3 + krow, vlastrowid[nid] * 3 + kcol) = rxvalue;
+		// symmetric stencil, the stored lower block also gives the transposed upper block
+		if (nei != 13) triplist.emplace_back(vlastrowid[nid] * 3 + kcol, vlastrowid[vid] * 3 + krow, rxvalue);
 	}
 
 	Klast.setFromTriplets(triplist.begin(), triplist.end());
 
-	//fullK = Klast;
-	//svd.setThreshold(1e-11);
-	svd.compute(fullK, Eigen::ComputeFullU | Eigen::ComputeFullV);
-	int lossrank = fullK.rows() - svd.rank();
-	printf("-- degenerate rank = %d\n", lossrank);
-	if (lossrank > 0) {
-		Klastkernel = svd.matrixV().block(0, fullK.cols() - lossrank, fullK.rows(), lossrank);
+	computeCoarsestKernel();
+	printf("-- degenerate rank = %d\n", Klastkernel.isZero() ? 0 : int(Klastkernel.cols()));
+
+	// factorization is postponed to the first solve
+	Klastfactorized = false;
+
+	eigen2ConnectedMatlab("Klast", Klast);
+	eigen2ConnectedMatlab("Klastker", Klastkernel);
+}
+
+void Grid::computeCoarsestKernel(void)
+{
+	// integer lattice position of each row vertex, traversing v2v from a seed of each connected part
+	std::vector<Eigen::Vector3d> pos(nvlastrows, Eigen::Vector3d::Zero());
+	std::vector<int> part(nvlastrows, -1);
+	std::vector<int> vlastvid(nvlastrows);
+	for (int i = 0; i < n_gsvertices; i++) {
+		if (vlastrowid[i] != -1) vlastvid[vlastrowid[i]] = i;
+	}
+	int npart = 0;
+	for (int seed = 0; seed < nvlastrows; seed++) {
+		if (part[seed] != -1) continue;
+		std::vector<int> front{ seed };
+		part[seed] = npart;
+		while (!front.empty()) {
+			int row = front.back();
+			front.pop_back();
+			int vid = vlastvid[row];
+			for (int nei = 0; nei < 27; nei++) {
+				int nid = _v2v[nei][vid];
+				if (nid == -1 || vlastrowid[nid] == -1) continue;
+				int nrow = vlastrowid[nid];
+				if (part[nrow] != -1) continue;
+				part[nrow] = npart;
+				pos[nrow] = pos[row] + Eigen::Vector3d(nei % 3 - 1, nei % 9 / 3 - 1, nei / 9 - 1);
+				front.push_back(nrow);
+			}
+		}
+		npart++;
 	}
-	else {
-		Klastkernel = Eigen::VectorXd::Zero(fullK.rows(), 1);
+
+	// rigid body modes of each part, centered for conditioning
+	std::vector<Eigen::Vector3d> center(npart, Eigen::Vector3d::Zero());
+	std::vector<int> count(npart, 0);
+	for (int i = 0; i < nvlastrows; i++) { center[part[i]] += pos[i]; count[part[i]]++; }
+	for (int i = 0; i < npart; i++) center[i] /= count[i];
+
+	Eigen::Matrix<double, -1, -1> modes(nvlastrows * 3, npart * 6);
+	modes.fill(0);
+	for (int i = 0; i < nvlastrows; i++) {
+		Eigen::Vector3d p = pos[i] - center[part[i]];
+		int c = part[i] * 6;
+		for (int k = 0; k < 3; k++) modes(i * 3 + k, c + k) = 1;
+		modes(i * 3 + 1, c + 3) = -p[2]; modes(i * 3 + 2, c + 3) = p[1];
+		modes(i * 3 + 0, c + 4) = p[2]; modes(i * 3 + 2, c + 4) = -p[0];
+		modes(i * 3 + 0, c + 5) = -p[1]; modes(i * 3 + 1, c + 5) = p[0];
 	}
 
-	eigen2ConnectedMatlab("Klast", fullK);
-	eigen2ConnectedMatlab("Klastker", Klastkernel);
+	// keep the modes which are in the kernel, fixed supports remove them. In mixed precision Klast is assembled
+	// from the float stencil, its rounding leaves a residual of about 1e-6 on the rigid modes
+	double kscale = Klast.diagonal().cwiseAbs().maxCoeff();
+	double kerneltol = mixedPrecision() ? 1e-4 : 1e-8;
+	std::vector<int> kerid;
+	for (int i = 0; i < modes.cols(); i++) {
+		double rel = (Klast * modes.col(i)).norm() / (kscale * modes.col(i).norm());
+		if (rel < kerneltol) kerid.emplace_back(i);
+	}
+
+	if (kerid.empty()) {
+		Klastkernel = Eigen::VectorXd::Zero(Klast.rows(), 1);
+		return;
+	}
+
+	// orthonormal basis of the kernel
+	Eigen::Matrix<double, -1, -1> ker(modes.rows(), kerid.size());
+	for (int i = 0; i < kerid.size(); i++) ker.col(i) = modes.col(kerid[i]);
+	Eigen::HouseholderQR<Eigen::Matrix<double, -1, -1>> qr(ker);
+	Klastkernel = qr.householderQ() * Eigen::Matrix<double, -1, -1>::Identity(ker.rows(), ker.cols());
+}
+
+void Grid::factorizeCoarsestSystem(void)
+{
+	Klastpinned.clear();
+	bool hasKernel = !Klastkernel.isZero();
+
+	// pin one dof per kernel vector, chosen by pivoted QR so that the kernel is regular on them
+	if (hasKernel) {
+		Eigen::ColPivHouseholderQR<Eigen::Matrix<double, -1, -1>> qr(Klastkernel.transpose());
+		for (int i = 0; i < Klastkernel.cols(); i++) Klastpinned.emplace_back(qr.colsPermutation().indices()[i]);
+	}
+
+	Eigen::SparseMatrix<double> Kpin = Klast;
+	if (hasKernel) {
+		std::vector<char> ispin(Klast.rows(), 0);
+		for (int p : Klastpinned) ispin[p] = 1;
+		double dscale = Klast.diagonal().cwiseAbs().mean();
+		Kpin.prune([&](int row, int col, double) { return !ispin[row] && !ispin[col]; });
+		for (int p : Klastpinned) Kpin.coeffRef(p, p) = dscale;
+		Kpin.makeCompressed();
+	}
+
+	Klastldlt.compute(Kpin);
+	Klastdense = Klastldlt.info() != Eigen::Success;
+	if (Klastdense) {
+		printf("-- \033[31mSparse factorization of coarsest system failed, fall back to dense SVD \033[0m\n");
+		svd.compute(Eigen::Matrix<double, -1, -1>(Klast), Eigen::ComputeThinU | Eigen::ComputeThinV);
+	}
+	Klastfactorized = true;
+}
+
+void Grid::download_stencil(std::vector<double>& rxdata)
+{
+	rxdata.resize(n_gsvertices * n_stencil_blocks * 9);
+	if (mixedPrecision()) {
+		std::vector<float> rxfloat(rxdata.size());
+		gpu_manager_t::download_buf(rxfloat.data(), _gbuf.rxStencilF, sizeof(float) * rxfloat.size());
+		std::copy(rxfloat.begin(), rxfloat.end(), rxdata.begin());
+	}
+	else {
+		gpu_manager_t::download_buf(rxdata.data(), _gbuf.rxStencil, sizeof(double) * rxdata.size());
+	}
 }
 
 void Grid::stencil2matlab(const std::string& nam)
 {
+	std::vector<double> rxdata;
+	download_stencil(rxdata);
+
+	// expand the symmetric storage to the full [vertex][27 * 9] layout
 	Eigen::Matrix<double, -1, -1> stencilarray;
-	stencilarray.resize(n_gsvertices, 27 * 9);
-	gpu_manager_t::download_buf(stencilarray.data(), _gbuf.rxStencil, sizeof(double) * 27 * 9 * n_gsvertices);
+	stencilarray.setZero(n_gsvertices, 27 * 9);
+	for (int nei = 0; nei < 27; nei++) {
+		for (int vid = 0; vid < n_gsvertices; vid++) {
+			int nid = _v2v[nei][vid];
+			if (nid == -1) continue;
+			for (int k = 0; k < 9; k++) {
+				stencilarray(vid, nei * 9 + k) = stencil_entry(rxdata.data(), n_gsvertices, nei, k, vid, nid);
+			}
+		}
+	}
 	eigen2ConnectedMatlab(nam, stencilarray);
 }
 
@@ -3804,28 +4175,21 @@ void::Grid::pass_spline_surf_node2matlab(void)
 
 void Grid::generate_surface_nodes_by_MC(const std::string& fileName, int Nodes[3], std::vector<float>& surface_node_x, std::vector<float>& surface_node_y, std::vector<float>& surface_node_z, std::vector<float> bg_node[3], std::vector<float> mcPoints_in)
 {
-	MCImplicitRender* mc_render;
-	TriMesh3D* ptr_mesh_;
-	ptr_mesh_ = new TriMesh3D;
-	std::string filename = fileName;
-	//std::cout << filename << std::endl;
-	std::string key_file;
-	ptr_mesh_->LoadFile(filename.data());
-	//mc_render = new MCImplicitRender(0, 1e-6, Nodes, ptr_mesh_, key_file);
-	mc_render = new MCImplicitRender();
-
-	float boxOrigin[3] = { _box[0][0],_box[0][1],_box[0][2] };
-	float boxEnd[3] = { _box[1][0],_box[1][1],_box[1][2] };
-
-	mc_render->AddSetting(0, 1e-6, Nodes, ptr_mesh_, boxOrigin, boxEnd);
-	//mc_render = new MCImplicitRender();
-	//mc_render->DoMC();
-	//mc_render->InitData();
+	// the background nodes are a regular lattice, the parallel extractor reads the values in place and
+	// outputs each surface node once instead of once per adjacent triangle
 	float minValue = 0.f;
-	//std::vector<mp4vector> mcPoints;
-
-	mc_render->RunMarchingCubesTestPotential(minValue, bg_node, mcPoints_in);
-	mc_render->save_to_surface_node(surface_node_x, surface_node_y, surface_node_z);
+	int n = bg_node[0].size();
+	if (n == 0 || mcPoints_in.size() != n || n != Nodes[0] * Nodes[1] * Nodes[2]) {
+		printf("\033[31mmarching cube nodes do not match the lattice %d x %d x %d\033[0m\n", Nodes[0], Nodes[1], Nodes[2]);
+		surface_node_x.clear(); surface_node_y.clear(); surface_node_z.clear();
+		return;
+	}
+
+	marchingCubeBase_t mc;
+	mc.setLattice(Nodes, bg_node);
+	mc.extract(mcPoints_in, minValue);
+	mc.getVertices(surface_node_x, surface_node_y, surface_node_z);
+	std::cout << "Surface node number( before sampled ): " << surface_node_x.size() << std::endl;
 }
 
 std::vector<int> generateEquidistantIntegers(int range, int num_sample) {
@@ -4067,10 +4431,6 @@ void Grid::compute_surface_nodes_in_model(std::vector<float>& surface_node_x, st
 void Grid::generate_spline_surface_nodes(float beta)
 {
 	// To correct
-	std::vector<float> mcPoints_val;
-	std::vector<float> bgnodex;
-	std::vector<float> bgnodey;
-	std::vector<float> bgnodez;
 	int cur_ereso = 64;
 	//if (_ereso > 250)
 	//{
@@ -4080,27 +4440,25 @@ void Grid::generate_spline_surface_nodes(float beta)
 	//{
 	//	cur_ereso = _ereso;
 	//}
-	
-	compute_background_mcPoints_value(bgnodex, bgnodey, bgnodez, mcPoints_val, cur_ereso, beta);
 
-	std::vector<float> bgnode[3];
-	bgnode[0].insert(bgnode[0].end(), bgnodex.begin(), bgnodex.end());
-	bgnode[1].insert(bgnode[1].end(), bgnodey.begin(), bgnodey.end());
-	bgnode[2].insert(bgnode[2].end(), bgnodez.begin(), bgnodez.end());
-	//int ereso3 = cur_ereso * cur_ereso * cur_ereso;
-	int ereso3 = bgnodex.size();
 #ifdef ENABLE_MATLAB
+	std::vector<float> mcPoints_val;
+	std::vector<float> bgnodex;
+	std::vector<float> bgnodey;
+	std::vector<float> bgnodez;
+	compute_background_mcPoints_value(bgnodex, bgnodey, bgnodez, mcPoints_val, cur_ereso, beta);
+	int ereso3 = bgnodex.size();
 	Eigen::Matrix<float, -1, 1> node_value;
 	node_value.resize(ereso3, 1);
 	std::copy(mcPoints_val.begin(), mcPoints_val.end(), node_value.begin());
 	eigen2ConnectedMatlab("rhomc1", node_value);
 #endif
 
-	int N[3] = { cur_ereso + 2, cur_ereso + 2, cur_ereso + 2 };
-	// MARK[TOCHECK] sometime crash in mc points generation
-			// solve worst displacement by modified power method
+	// the spline is only sampled in the blocks around its isosurface
 	auto t0 = tictoc::getTag();
-	generate_surface_nodes_by_MC(_meshfile, N, spline_surface_node[0], spline_surface_node[1], spline_surface_node[2], bgnode, mcPoints_val);
+	marchingCubeBase_t mc;
+	extract_spline_isosurface(cur_ereso, mc);
+	mc.getVertices(spline_surface_node[0], spline_surface_node[1], spline_surface_node[2]);
 	auto t1 = tictoc::getTag();
 	double time_tmp =  tictoc::Duration<tictoc::ms>(t0, t1);
 	std::cout << "Element Resolution for marching cube ----- " << cur_ereso << "----- Time: " << time_tmp << "ms" << std::endl;
@@ -4122,48 +4480,57 @@ double Grid::compliance(void)
 
 void Grid::solve_fem_host(void)
 {
-	static Eigen::BiCGSTAB<Eigen::SparseMatrix<double>, Eigen::IncompleteLUT<double>> solverhost;
-	//auto& solverhost = svd;
-	//static Eigen::ColPivHouseholderQR<Eigen::MatrixXd> solverhost;
 	static Eigen::Matrix<double, -1, 1> fhost;
 	static std::vector<double> v3host[3];
 	static Eigen::Matrix<double, -1, 1> uhost;
 
+	if (!Klastfactorized) factorizeCoarsestSystem();
+
 	int nrow = nvlastrows;
-	// copy data from device to host
+	// copy data from device to host, host resident buffers are used directly
+	double* f[3];
+	double* u[3];
 	for (int i = 0; i < 3; i++) {
-		v3host[i].resize(n_gsvertices);
-		gpu_manager_t::download_buf(v3host[i].data(), _gbuf.F[i], sizeof(double) * n_gsvertices);
+		if (onHost()) {
+			f[i] = _gbuf.F[i];
+			u[i] = _gbuf.U[i];
+		}
+		else {
+			v3host[i].resize(n_gsvertices);
+			gpu_manager_t::download_buf(v3host[i].data(), _gbuf.F[i], sizeof(double) * n_gsvertices);
+			f[i] = v3host[i].data();
+			u[i] = v3host[i].data();
+		}
 	}
 	fhost.resize(nrow * 3, 1);
-	for (int i = 0; i < v3host->size(); i++) {
+	for (int i = 0; i < n_gsvertices; i++) {
 		if (vlastrowid[i] == -1) continue;
-		fhost[vlastrowid[i] * 3] = v3host[0][i];
-		fhost[vlastrowid[i] * 3 + 1] = v3host[1][i];
-		fhost[vlastrowid[i] * 3 + 2] = v3host[2][i];
+		fhost[vlastrowid[i] * 3] = f[0][i];
+		fhost[vlastrowid[i] * 3 + 1] = f[1][i];
+		fhost[vlastrowid[i] * 3 + 2] = f[2][i];
 	}
 
-	// solver compute matrix
-	//solverhost.compute(fullK);
-	//solverhost.compute(Klast);
+	bool hasKernel = !Klastkernel.isZero();
 
-	//// remove degenerate eigenvectors
-	//fhost = fhost - Klastkernel * (Klastkernel.transpose() * fhost);
+	// remove degenerate eigenvectors
+	if (hasKernel) fhost -= Klastkernel * (Klastkernel.transpose() * fhost);
 
-	//// solve
-	//uhost = solverhost.solve(fhost);
-	uhost = svd.solve(fhost);
+	if (Klastdense) {
+		uhost = svd.solve(fhost);
+	}
+	else {
+		for (int p : Klastpinned) fhost[p] = 0;
+		uhost = Klastldlt.solve(fhost);
+	}
 
 	// remove degenerate eigenvectors
-	//uhost = uhost - Klastkernel * (Klastkernel.transpose() * uhost);
+	if (hasKernel) uhost -= Klastkernel * (Klastkernel.transpose() * uhost);
 
 	// DEBUG
 	eigen2ConnectedMatlab("uhost", uhost);
 	eigen2ConnectedMatlab("fhost", fhost);
-	//printf("-- coarse system error %lf\n", (fullK*uhost - fhost).norm());
 
-	// if preffered solver failed, try alternative solver
-	if (solverhost.info() != Eigen::Success) {
+	if (!Klastdense && Klastldlt.info() != Eigen::Success) {
 		printf("-- \033[31mHost solver failed \033[0m\n");
 		uhost.fill(0);
 	}
@@ -4173,17 +4540,86 @@ void Grid::solve_fem_host(void)
 		int rowid = vlastrowid[j];
 		for (int i = 0; i < 3; i++) {
 			if (rowid == -1)
-				v3host[i][j] = 0;
+				u[i][j] = 0;
 			else
-				v3host[i][j] = uhost[rowid * 3 + i];
+				u[i][j] = uhost[rowid * 3 + i];
 		}
 	}
 
+	if (onHost()) return;
+
 	for (int i = 0; i < 3; i++) {
 		gpu_manager_t::upload_buf(_gbuf.U[i], v3host[i].data(), sizeof(double) * n_gsvertices);
 	}
 }
 
+void Grid::solve_fem_block_host(void)
+{
+	static std::vector<double> blockhost;
+
+	if (!Klastfactorized) factorizeCoarsestSystem();
+
+	int nrow = nvlastrows;
+	int K = n_rhs;
+	size_t len = (size_t)3 * K * n_gsvertices;
+	double* fb;
+	double* ub;
+	if (onHost()) {
+		fb = _gbuf.Fblock;
+		ub = _gbuf.Ublock;
+	}
+	else {
+		blockhost.resize(len);
+		gpu_manager_t::download_buf(blockhost.data(), _gbuf.Fblock, sizeof(double) * len);
+		fb = blockhost.data();
+		ub = blockhost.data();
+	}
+
+	// each right hand side is a column
+	Eigen::Matrix<double, -1, -1> fhost(nrow * 3, K);
+	for (int i = 0; i < n_gsvertices; i++) {
+		int rowid = vlastrowid[i];
+		if (rowid == -1) continue;
+		for (int c = 0; c < 3; c++) {
+			for (int k = 0; k < K; k++) fhost(rowid * 3 + c, k) = fb[((size_t)i * 3 + c) * K + k];
+		}
+	}
+
+	bool hasKernel = !Klastkernel.isZero();
+
+	// remove degenerate eigenvectors
+	if (hasKernel) fhost -= Klastkernel * (Klastkernel.transpose() * fhost);
+
+	Eigen::Matrix<double, -1, -1> uhost;
+	if (Klastdense) {
+		uhost = svd.solve(fhost);
+	}
+	else {
+		for (int p : Klastpinned) fhost.row(p).setZero();
+		uhost = Klastldlt.solve(fhost);
+	}
+
+	if (hasKernel) uhost -= Klastkernel * (Klastkernel.transpose() * uhost);
+
+	if (!Klastdense && Klastldlt.info() != Eigen::Success) {
+		printf("-- \033[31mHost solver failed \033[0m\n");
+		uhost.setZero();
+	}
+
+	for (int j = 0; j < n_gsvertices; j++) {
+		int rowid = vlastrowid[j];
+		for (int c = 0; c < 3; c++) {
+			for (int k = 0; k < K; k++) {
+				ub[((size_t)j * 3 + c) * K + k] = rowid == -1 ? 0 : uhost(rowid * 3 + c, k);
+			}
+		}
+	}
+
+	if (onHost()) return;
+
+	gpu_manager_t::upload_buf(_gbuf.Ublock, blockhost.data(), sizeof(double) * len);
+}
+
 void Grid::enumerate_gs_subset(
 	int nv, int ne,
 	int* vflags, int* eflags,
@@ -10,6 +10,7 @@
 //// #define GLM_FORCE_PURE (not needed anymore with recent GLM versions)
 //#include <glm/glm.hpp>
 #include "matlab_utils.h"
+#include <algorithm>
 
 #define DIRICHLET_DIAGONAL_WEIGHT 1e6f
 //#define DIRICHLET_DIAGONAL_WEIGHT 1
@@ -424,15 +425,16 @@ __device__ void loadNeighborNodes(int vid, int v2v[27]) {
 }
 
 // Spline
+template<int Order>
 __device__ void SplineBasisX(float x, float* pNX)
 {
-	//float* left = new float[m_iM];
-	//float* right = new float[m_iM];
-	float left[m_iM], right[m_iM];
+	//float* left = new float[Order];
+	//float* right = new float[Order];
+	float left[Order], right[Order];
 	pNX[0] = 1.0;
 
-	int l = (int)((x - gnBoundMin[0]) / gnstep[0]) + m_iM - 1;
-	for (int j = 1; j < m_iM; j++)
+	int l = (int)((x - gnBoundMin[0]) / gnstep[0]) + Order - 1;
+	for (int j = 1; j < Order; j++)
 	{
 		//left[j] = x - gpu_ptrfKnotSerX[l + 1 - j];
 		//right[j] = gpu_ptrfKnotSerX[l + j] - x;
@@ -449,18 +451,19 @@ __device__ void SplineBasisX(float x, float* pNX)
 
 		pNX[j] = saved;
 	}
-	pNX[m_iM] = 0.0;
+	pNX[Order] = 0.0;
 }
 
+template<int Order>
 __device__ void SplineBasisY(float y, float* pNY)
 {
-	//float* left = new float[m_iM];
-	//float* right = new float[m_iM];
-	float left[m_iM], right[m_iM];
+	//float* left = new float[Order];
+	//float* right = new float[Order];
+	float left[Order], right[Order];
 	pNY[0] = 1.0;
 
-	int l = (int)((y - gnBoundMin[1]) / gnstep[1]) + m_iM - 1;
-	for (int j = 1; j < m_iM; j++)
+	int l = (int)((y - gnBoundMin[1]) / gnstep[1]) + Order - 1;
+	for (int j = 1; j < Order; j++)
 	{
 		//left[j] = y - gpu_ptrfKnotSerY[l + 1 - j];
 		//right[j] = gpu_ptrfKnotSerY[l + j] - y;
@@ -477,18 +480,19 @@ __device__ void SplineBasisY(float y, float* pNY)
 
 		pNY[j] = saved;
 	}
-	pNY[m_iM] = 0.0;
+	pNY[Order] = 0.0;
 }
 
+template<int Order>
 __device__ void SplineBasisZ(float z, float* pNZ)
 {
-	//float* left = new float[m_iM];
-	//float* right = new float[m_iM];
-	float left[m_iM], right[m_iM];
+	//float* left = new float[Order];
+	//float* right = new float[Order];
+	float left[Order], right[Order];
 	pNZ[0] = 1.0;
 
-	int l = (int)((z - gnBoundMin[2]) / gnstep[2]) + m_iM - 1;
-	for (int j = 1; j < m_iM; j++)
+	int l = (int)((z - gnBoundMin[2]) / gnstep[2]) + Order - 1;
+	for (int j = 1; j < Order; j++)
 	{
 		//left[j] = z - gpu_ptrfKnotSerZ[l + 1 - j];
 		//right[j] = gpu_ptrfKnotSerZ[l + j] - z;
@@ -505,28 +509,29 @@ __device__ void SplineBasisZ(float z, float* pNZ)
 
 		pNZ[j] = saved;
 	}
-	pNZ[m_iM] = 0.0;
+	pNZ[Order] = 0.0;
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // SplineBasisDeriX:
 //		calculate the derivative of spline basis of x direction
+template<int Order>
 __device__ void SplineBasisDeriX(float x, const int n, float* value)
 {
-	int l = (int)((x - gnBoundMin[0]) / gnstep[0]) + m_iM - 1;
+	int l = (int)((x - gnBoundMin[0]) / gnstep[0]) + Order - 1;
 
 	// allocate the array
 	int i, j, k, r;
-	float ders[10][m_iM] = { {0.f} };
-	float test[m_iM] = { 0.0f };
-	float ndu[m_iM][m_iM] = { {0.f} };
-	float a[2][m_iM] = { {0.f} };
+	float ders[10][Order] = { {0.f} };
+	float test[Order] = { 0.0f };
+	float ndu[Order][Order] = { {0.f} };
+	float a[2][Order] = { {0.f} };
 
-	float left[m_iM], right[m_iM];
+	float left[Order], right[Order];
 
 	// store functions and knot differences
 	ndu[0][0] = 1.0f;
-	for (j = 1; j < m_iM; j++)
+	for (j = 1; j < Order; j++)
 	{
 		//left[j] = x - gpu_ptrfKnotSerX[l + 1 - j];
 		//right[j] = gpu_ptrfKnotSerX[l + j] - x;
@@ -545,11 +550,11 @@ __device__ void SplineBasisDeriX(float x, const int n, float* value)
 	}
 
 	// load the basis functions
-	for (j = 0; j < m_iM; j++)
-		ders[0][j] = ndu[j][m_iM - 1];
+	for (j = 0; j < Order; j++)
+		ders[0][j] = ndu[j][Order - 1];
 
 	// compute the derivatives
-	for (r = 0; r < m_iM; r++)
+	for (r = 0; r < Order; r++)
 	{
 		int s1 = 0, s2 = 1;
 		a[0][0] = 1.0f;
@@ -558,7 +563,7 @@ __device__ void SplineBasisDeriX(float x, const int n, float* value)
 		{
 			int j1, j2;
 			float d = 0.0f;
-			int rk = r - k, pk = m_iM - 1 - k;
+			int rk = r - k, pk = Order - 1 - k;
 
 			if (r >= k)
 			{
@@ -574,7 +579,7 @@ __device__ void SplineBasisDeriX(float x, const int n, float* value)
 			if (r - 1 <= pk)
 				j2 = k - 1;
 			else
-				j2 = m_iM - 1 - r;
+				j2 = Order - 1 - r;
 
 			for (j = j1; j <= j2; j++)
 			{
@@ -593,15 +598,15 @@ __device__ void SplineBasisDeriX(float x, const int n, float* value)
 		}
 	}
 
-	r = m_iM - 1;
+	r = Order - 1;
 	for (k = 1; k < n; k++)
 	{
-		for (j = 0; j < m_iM; j++)
+		for (j = 0; j < Order; j++)
 			ders[k][j] *= r;
-		r *= (m_iM - 1 - k);
+		r *= (Order - 1 - k);
 	}
 
-	for (i = 0; i < m_iM; i++)
+	for (i = 0; i < Order; i++)
 	{
 		value[i] = ders[n - 1][i];
 	}
@@ -611,34 +616,35 @@ __device__ void SplineBasisDeriX(float x, const int n, float* value)
 /////////////////////////////////////////////////////////////////////////////
 // SplineBasisDeriY:
 //		calculate the derivative of spline basis of y direction
+template<int Order>
 __device__ void SplineBasisDeriY(float y, int n, float* value)
 {
-	int l = (int)((y - gnBoundMin[1]) / gnstep[1]) + m_iM - 1;
+	int l = (int)((y - gnBoundMin[1]) / gnstep[1]) + Order - 1;
 
 	// allocate the array
 	int i, j, k, r;
-	float ders[10][m_iM] = { {0.f} };
-	float test[m_iM] = { 0.0f };
-	float ndu[m_iM][m_iM] = { {0.f} };
-	float a[2][m_iM] = { {0.f} };
+	float ders[10][Order] = { {0.f} };
+	float test[Order] = { 0.0f };
+	float ndu[Order][Order] = { {0.f} };
+	float a[2][Order] = { {0.f} };
 
-	float left[m_iM], right[m_iM];
+	float left[Order], right[Order];
 
-	//float** ndu = new float* [m_iM];
+	//float** ndu = new float* [Order];
 	//float** a = new float* [2];
-	//for (i = 0; i < m_iM; i++)
+	//for (i = 0; i < Order; i++)
 	//{
-	//	ndu[i] = new float[m_iM];
+	//	ndu[i] = new float[Order];
 	//	if (i < 2)
-	//		a[i] = new float[m_iM];
+	//		a[i] = new float[Order];
 	//}
 
-	//float* left = new float[m_iM];
-	//float* right = new float[m_iM];
+	//float* left = new float[Order];
+	//float* right = new float[Order];
 
 	// store functions and knot differences
 	ndu[0][0] = 1.0f;
-	for (j = 1; j < m_iM; j++)
+	for (j = 1; j < Order; j++)
 	{
 		//left[j] = y - gpu_ptrfKnotSerY[l + 1 - j];
 		//right[j] = gpu_ptrfKnotSerY[l + j] - y;
@@ -657,11 +663,11 @@ __device__ void SplineBasisDeriY(float y, int n, float* value)
 	}
 
 	// load the basis functions
-	for (j = 0; j < m_iM; j++)
-		ders[0][j] = ndu[j][m_iM - 1];
+	for (j = 0; j < Order; j++)
+		ders[0][j] = ndu[j][Order - 1];
 
 	// compute the derivatives
-	for (r = 0; r < m_iM; r++)
+	for (r = 0; r < Order; r++)
 	{
 		int s1 = 0, s2 = 1;
 		a[0][0] = 1.0f;
@@ -670,7 +676,7 @@ __device__ void SplineBasisDeriY(float y, int n, float* value)
 		{
 			int j1, j2;
 			float d = 0.0f;
-			int rk = r - k, pk = m_iM - 1 - k;
+			int rk = r - k, pk = Order - 1 - k;
 
 			if (r >= k)
 			{
@@ -686,7 +692,7 @@ __device__ void SplineBasisDeriY(float y, int n, float* value)
 			if (r - 1 <= pk)
 				j2 = k - 1;
 			else
-				j2 = m_iM - 1 - r;
+				j2 = Order - 1 - r;
 
 			for (j = j1; j <= j2; j++)
 			{
@@ -705,20 +711,20 @@ __device__ void SplineBasisDeriY(float y, int n, float* value)
 		}
 	}
 
-	r = m_iM - 1;
+	r = Order - 1;
 	for (k = 1; k < n; k++)
 	{
-		for (j = 0; j < m_iM; j++)
+		for (j = 0; j < Order; j++)
 			ders[k][j] *= r;
-		r *= (m_iM - 1 - k);
+		r *= (Order - 1 - k);
 	}
 
-	for (i = 0; i < m_iM; i++)
+	for (i = 0; i < Order; i++)
 	{
 		value[i] = ders[n - 1][i];
 	}
 	//// free the array
-	//for (i = 0; i < m_iM; i++)
+	//for (i = 0; i < Order; i++)
 	//{
 	//	delete[] ndu[i];
 	//	if (i < 2)
@@ -734,34 +740,35 @@ __device__ void SplineBasisDeriY(float y, int n, float* value)
 /////////////////////////////////////////////////////////////////////////////
 // SplineBasisDeriZ:
 //		calculate the derivative of spline basis of z direction
+template<int Order>
 __device__ void SplineBasisDeriZ(float z, int n, float* value)
 {
-	int l = (int)((z - gnBoundMin[2]) / gnstep[2]) + gorder[0] - 1;
+	int l = (int)((z - gnBoundMin[2]) / gnstep[2]) + Order - 1;
 
 	// allocate the array
 	int i, j, k, r;
-	float ders[10][m_iM] = { {0.f} };
-	float test[m_iM] = { 0.0f };
-	float ndu[m_iM][m_iM] = { {0.f} };
-	float a[2][m_iM] = { {0.f} };
+	float ders[10][Order] = { {0.f} };
+	float test[Order] = { 0.0f };
+	float ndu[Order][Order] = { {0.f} };
+	float a[2][Order] = { {0.f} };
 
-	float left[m_iM], right[m_iM];
+	float left[Order], right[Order];
 
-	//float** ndu = new float* [m_iM];
+	//float** ndu = new float* [Order];
 	//float** a = new float* [2];
-	//for (i = 0; i < m_iM; i++)
+	//for (i = 0; i < Order; i++)
 	//{
-	//	ndu[i] = new float[m_iM];
+	//	ndu[i] = new float[Order];
 	//	if (i < 2)
-	//		a[i] = new float[m_iM];
+	//		a[i] = new float[Order];
 	//}
 
-	//float* left = new float[m_iM];
-	//float* right = new float[m_iM];
+	//float* left = new float[Order];
+	//float* right = new float[Order];
 
 	// store functions and knot differences
 	ndu[0][0] = 1.0f;
-	for (j = 1; j < m_iM; j++)
+	for (j = 1; j < Order; j++)
 	{
 		//left[j] = z - gpu_ptrfKnotSerZ[l + 1 - j];
 		//right[j] = gpu_ptrfKnotSerZ[l + j] - z;
@@ -780,11 +787,11 @@ __device__ void SplineBasisDeriZ(float z, int n, float* value)
 	}
 
 	// load the basis functions
-	for (j = 0; j < m_iM; j++)
-		ders[0][j] = ndu[j][m_iM - 1];
+	for (j = 0; j < Order; j++)
+		ders[0][j] = ndu[j][Order - 1];
 
 	// compute the derivatives
-	for (r = 0; r < m_iM; r++)
+	for (r = 0; r < Order; r++)
 	{
 		int s1 = 0, s2 = 1;
 		a[0][0] = 1.0f;
@@ -793,7 +800,7 @@ __device__ void SplineBasisDeriZ(float z, int n, float* value)
 		{
 			int j1, j2;
 			float d = 0.0f;
-			int rk = r - k, pk = m_iM - 1 - k;
+			int rk = r - k, pk = Order - 1 - k;
 
 			if (r >= k)
 			{
@@ -809,7 +816,7 @@ __device__ void SplineBasisDeriZ(float z, int n, float* value)
 			if (r - 1 <= pk)
 				j2 = k - 1;
 			else
-				j2 = m_iM - 1 - r;
+				j2 = Order - 1 - r;
 
 			for (j = j1; j <= j2; j++)
 			{
@@ -828,20 +835,20 @@ __device__ void SplineBasisDeriZ(float z, int n, float* value)
 		}
 	}
 
-	r = m_iM - 1;
+	r = Order - 1;
 	for (k = 1; k < n; k++)
 	{
-		for (j = 0; j < m_iM; j++)
+		for (j = 0; j < Order; j++)
 			ders[k][j] *= r;
-		r *= (m_iM - 1 - k);
+		r *= (Order - 1 - k);
 	}
 
-	for (i = 0; i < m_iM; i++)
+	for (i = 0; i < Order; i++)
 	{
 		value[i] = ders[n - 1][i];
 	}
 	//// free the array
-	//for (i = 0; i < m_iM; i++)
+	//for (i = 0; i < Order; i++)
 	//{
 	//	delete[] ndu[i];
 	//	if (i < 2)
@@ -854,6 +861,154 @@ __device__ void SplineBasisDeriZ(float z, int n, float* value)
 	//delete[] right;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// SplineBasisDers:
+//		values, first and second derivatives of the spline basis along one axis from a single
+//		recursion, ders[d][r] is the d-th derivative of the r-th basis function of the span of x
+template<int Order>
+__device__ void SplineBasisDers(int axis, float x, float ders[3][Order])
+{
+	int l = (int)((x - gnBoundMin[axis]) / gnstep[axis]) + Order - 1;
+	const float* knot = gpu_KnotSer[axis];
+
+	float ndu[Order][Order];
+	float a[2][Order];
+	float left[Order], right[Order];
+
+	ndu[0][0] = 1.0f;
+	for (int j = 1; j < Order; j++)
+	{
+		left[j] = x - knot[l + 1 - j];
+		right[j] = knot[l + j] - x;
+
+		float saved = 0.0f;
+		for (int r = 0; r < j; r++)
+		{
+			ndu[j][r] = right[r + 1] + left[j - r];
+			float temp = ndu[r][j - 1] / ndu[j][r];
+			ndu[r][j] = saved + right[r + 1] * temp;
+			saved = left[j - r] * temp;
+		}
+		ndu[j][j] = saved;
+	}
+
+	for (int j = 0; j < Order; j++)
+	{
+		ders[0][j] = ndu[j][Order - 1];
+		ders[1][j] = 0.0f;
+		ders[2][j] = 0.0f;
+	}
+
+	// derivatives beyond the degree vanish
+	const int nder = Order - 1 < 2 ? Order - 1 : 2;
+	for (int r = 0; r < Order; r++)
+	{
+		int s1 = 0, s2 = 1;
+		a[0][0] = 1.0f;
+
+		for (int k = 1; k <= nder; k++)
+		{
+			float d = 0.0f;
+			int rk = r - k, pk = Order - 1 - k;
+
+			if (r >= k)
+			{
+				a[s2][0] = a[s1][0] / ndu[pk + 1][rk];
+				d = a[s2][0] * ndu[rk][pk];
+			}
+
+			int j1 = rk >= -1 ? 1 : -rk;
+			int j2 = r - 1 <= pk ? k - 1 : Order - 1 - r;
+
+			for (int j = j1; j <= j2; j++)
+			{
+				a[s2][j] = (a[s1][j] - a[s1][j - 1]) / ndu[pk + 1][rk + j];
+				d += a[s2][j] * ndu[rk + j][pk];
+			}
+
+			if (r <= pk)
+			{
+				a[s2][k] = -a[s1][k - 1] / ndu[pk + 1][r];
+				d += a[s2][k] * ndu[r][pk];
+			}
+
+			ders[k][r] = d;
+			int j = s1; s1 = s2; s2 = j;
+		}
+	}
+
+	int r = Order - 1;
+	for (int k = 1; k <= nder; k++)
+	{
+		for (int j = 0; j < Order; j++)
+			ders[k][j] *= r;
+		r *= (Order - 1 - k);
+	}
+}
+
+// value, gradient and Hessian (3x3 row major) of the spline at p from one set of basis tables, the
+// coefficients are contracted along x, then y, then z. Zero outside the knot range
+template<int Order>
+__device__ void SplineFields(const float p[3], float& val, float grad[3], float hess[9])
+{
+	float f[10] = { 0.f };                   // v, gx, gy, gz, hxx, hyy, hzz, hxy, hxz, hyz
+	int first[3];
+	bool inside = true;
+	for (int i = 0; i < 3; i++)
+	{
+		int span = (int)((p[i] - gnBoundMin[i]) / gnstep[i]) + Order;
+		if (span < Order || span > gnbasis[i]) inside = false;
+		first[i] = span - Order;
+	}
+
+	if (inside)
+	{
+		float D[3][3][Order];
+		for (int i = 0; i < 3; i++) SplineBasisDers<Order>(i, p[i], D[i]);
+
+		const int nb0 = gnbasis[0], nb01 = gnbasis[0] * gnbasis[1];
+		for (int t = 0; t < Order; t++)
+		{
+			// (dx, dy) = 00 10 20 01 11 02
+			float cxy[6] = { 0.f };
+			for (int s = 0; s < Order; s++)
+			{
+				const float* c = gpu_cijk + first[0] + (first[1] + s) * nb0 + (first[2] + t) * nb01;
+				float cx[3] = { 0.f };
+				for (int r = 0; r < Order; r++)
+				{
+					cx[0] += c[r] * D[0][0][r];
+					cx[1] += c[r] * D[0][1][r];
+					cx[2] += c[r] * D[0][2][r];
+				}
+				cxy[0] += cx[0] * D[1][0][s];
+				cxy[1] += cx[1] * D[1][0][s];
+				cxy[2] += cx[2] * D[1][0][s];
+				cxy[3] += cx[0] * D[1][1][s];
+				cxy[4] += cx[1] * D[1][1][s];
+				cxy[5] += cx[0] * D[1][2][s];
+			}
+			float n0 = D[2][0][t], n1 = D[2][1][t], n2 = D[2][2][t];
+			f[0] += cxy[0] * n0;
+			f[1] += cxy[1] * n0;
+			f[2] += cxy[3] * n0;
+			f[3] += cxy[0] * n1;
+			f[4] += cxy[2] * n0;
+			f[5] += cxy[5] * n0;
+			f[6] += cxy[0] * n2;
+			f[7] += cxy[4] * n0;
+			f[8] += cxy[1] * n1;
+			f[9] += cxy[3] * n1;
+		}
+	}
+
+	val = f[0];
+	grad[0] = f[1]; grad[1] = f[2]; grad[2] = f[3];
+	hess[0] = f[4]; hess[1] = f[7]; hess[2] = f[8];
+	hess[3] = f[7]; hess[4] = f[5]; hess[5] = f[9];
+	hess[6] = f[8]; hess[7] = f[9]; hess[8] = f[6];
+}
+
 
 __device__ float norm(float v[3]) {
 #ifndef USE_CUDA_FAST_MATH
@@ -877,22 +1032,21 @@ __device__ float dot(float v1[3], float v2[3]) {
 
 /*
 	//rxcoarse[32(27)][9][nv]
-	rxcoarse[27][9][nv]
+	rxcoarse[14][9][nv], symmetric stencil format, stored in T and accumulated in double
 */
-template<int BlockSize = 32 * 9>
-__global__ void restrict_stencil_dyadic_kernel(int nv_coarse, double* rxcoarse_, int nv_fine, double* rxfine_) {
+template<int BlockSize = 32 * 9, typename T = double>
+__global__ void restrict_stencil_dyadic_kernel(int nv_coarse, T* rxcoarse_, int nv_fine, T* rxfine_) {
 	size_t tid = blockDim.x*blockIdx.x + threadIdx.x;
 	int ke_id = tid / nv_coarse;
 	int vid = tid % nv_coarse;
 
 	if (ke_id >= 9) return;
 
-	GraftArray<double, 27, 9> rxCoarse(rxcoarse_, nv_coarse);
-	GraftArray<double, 27, 9> rxFine(rxfine_, nv_fine);
+	GraftArray<T, n_stencil_blocks, 9> rxCoarse(rxcoarse_, nv_coarse);
 
 	//__shared__ double coarseStencil[27][BlockSize / 32][32];
 	//initSharedMem(&coarseStencil[0][0][0], sizeof(coarseStencil) / sizeof(double));
-	double coarseStencil[27] = { 0. };
+	double coarseStencil[n_stencil_blocks] = { 0. };
 
 	int warpid = threadIdx.x / 32;
 	int warptid = threadIdx.x % 32;
@@ -914,15 +1068,16 @@ __global__ void restrict_stencil_dyadic_kernel(int nv_coarse, double* rxcoarse_,
 		// traverse fine stencil component (each neighbor vertex has a component)
 		for (int j = 0; j < 27; j++) {
 
-			double kij = rxFine[j][ke_id][vn] * weight;
+			int vjn = gVfine2Vfine[j][vn];
 
-			// DEBUG
-			if (gVfine2Vfine[j][vn] == -1) { if (kij != 0) { printf("-- error on stencil 1\n"); } continue; }
+			if (vjn == -1) continue;
+
+			double kij = stencil_entry(rxfine_, nv_fine, j, ke_id, vn, vjn) * weight;
 
 			int vjpos[3] = { neipos[0] + j % 3 - 1 ,neipos[1] + j % 9 / 3 - 1 ,neipos[2] + j / 9 - 1 };
 
-			// traverse coarse vertices to scatter the stencil component to them
-			for (int vsplit = 0; vsplit < 27; vsplit++) {
+			// traverse coarse vertices to scatter the stencil component to them, only the stored blocks
+			for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
 				int vsplitpos[3] = { vsplit % 3 * 2, vsplit % 9 / 3 * 2, vsplit / 9 * 2 };
 				int wsplitpos[3] = { abs(vsplitpos[0] - vjpos[0]), abs(vsplitpos[1] - vjpos[1]), abs(vsplitpos[2] - vjpos[2]) };
 				if (wsplitpos[0] >= 2 || wsplitpos[1] >= 2 || wsplitpos[2] >= 2) continue;
@@ -932,15 +1087,15 @@ __global__ void restrict_stencil_dyadic_kernel(int nv_coarse, double* rxcoarse_,
 		}
 	}
 
-	for (int i = 0; i < 27; i++) {
+	for (int i = 0; i < n_stencil_blocks; i++) {
 		//rxCoarse[i][ke_id][vid] = coarseStencil[i][warpid][warpid];
 		rxCoarse[i][ke_id][vid] = coarseStencil[i];
 	}
 }
 
 // on the fly assembly
-template<int BlockSize = 32 * 9>
-__global__ void restrict_stencil_dyadic_OTFA_kernel(int nv_coarse, double* rxcoarse_, int nv_fine, float* rhofine) {
+template<int BlockSize = 32 * 9, typename T = double>
+__global__ void restrict_stencil_dyadic_OTFA_kernel(int nv_coarse, T* rxcoarse_, int nv_fine, float* rhofine) {
 	int tid = blockIdx.x*blockDim.x + threadIdx.x;
 
 	//__shared__ int restrict_elements[64];
@@ -957,12 +1112,12 @@ __global__ void restrict_stencil_dyadic_OTFA_kernel(int nv_coarse, double* rxcoa
 
 	if (ke_id >= 9) return;
 
-	GraftArray<double, 27, 9> rxCoarse(rxcoarse_, nv_coarse);
+	GraftArray<T, n_stencil_blocks, 9> rxCoarse(rxcoarse_, nv_coarse);
 
 	//__shared__ double coarseStencil[27][BlockSize / 32][32];
 	//initSharedMem(&coarseStencil[0][0][0], sizeof(coarseStencil) / sizeof(double));
 
-	double coarseStencil[27] = { 0. };
+	double coarseStencil[n_stencil_blocks] = { 0. };
 
 	
 	//for (int i = 0; i < 27; i++) {
@@ -1014,8 +1169,8 @@ __global__ void restrict_stencil_dyadic_OTFA_kernel(int nv_coarse, double* rxcoa
 					double ke = 0;
 					double wk = wi_p * KE[vi * 3 + k3row][vj * 3 + k3col];
 
-					// scatter 3x3 Ke to coarse nodes, traverse coarse nodes
-					for (int vsplit = 0; vsplit < 27; vsplit++) {
+					// scatter 3x3 Ke to coarse nodes, traverse the coarse nodes of stored blocks
+					for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
 						int vsplitpos[3] = { vsplit % 3 * 2, vsplit % 9 / 3 * 2, vsplit / 9 * 2 };
 						int wspos[3] = { abs(vsplitpos[0] - vjpos[0]), abs(vsplitpos[1] - vjpos[1]), abs(vsplitpos[2] - vjpos[2]) };
 						if (wspos[0] >= 2 || wspos[1] >= 2 || wspos[2] >= 2) continue;
@@ -1029,7 +1184,7 @@ __global__ void restrict_stencil_dyadic_OTFA_kernel(int nv_coarse, double* rxcoa
 
 	}
 
-	for (int i = 0; i < 27; i++) {
+	for (int i = 0; i < n_stencil_blocks; i++) {
 		//rxCoarse[i][ke_id][vid] = coarseStencil[i][warpid][warptid];
 		rxCoarse[i][ke_id][vid] = coarseStencil[i];
 	}
@@ -1037,32 +1192,46 @@ __global__ void restrict_stencil_dyadic_OTFA_kernel(int nv_coarse, double* rxcoa
 
 void HierarchyGrid::restrict_stencil_dyadic(Grid& dstcoarse, Grid& srcfine)
 {
+	if (dstcoarse.onHost()) {
+		restrict_stencil_dyadic_host(dstcoarse, srcfine);
+		return;
+	}
 	dstcoarse.use_grid();
 	size_t grid_size, block_size;
 	constexpr int BlockSize = 32 * 6;
 	if (dstcoarse._layer == 0 && srcfine._layer == 1) {
 		make_kernel_param(&grid_size, &block_size, dstcoarse.n_gsvertices * 9, BlockSize);
-		restrict_stencil_dyadic_OTFA_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencil, srcfine.n_gsvertices, dstcoarse._gbuf.rho_e);
+		if (dstcoarse.mixedPrecision()) {
+			restrict_stencil_dyadic_OTFA_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencilF, srcfine.n_gsvertices, dstcoarse._gbuf.rho_e);
+		}
+		else {
+			restrict_stencil_dyadic_OTFA_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencil, srcfine.n_gsvertices, dstcoarse._gbuf.rho_e);
+		}
 		cudaDeviceSynchronize();
 		cuda_error_check;
 	}
 	else {
 		make_kernel_param(&grid_size, &block_size, dstcoarse.n_gsvertices * 9, BlockSize);
-		restrict_stencil_dyadic_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencil, srcfine.n_gsvertices, srcfine._gbuf.rxStencil);
+		if (dstcoarse.mixedPrecision()) {
+			restrict_stencil_dyadic_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencilF, srcfine.n_gsvertices, srcfine._gbuf.rxStencilF);
+		}
+		else {
+			restrict_stencil_dyadic_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencil, srcfine.n_gsvertices, srcfine._gbuf.rxStencil);
+		}
 		cudaDeviceSynchronize();
 		cuda_error_check;
 	}
 }
 
 // on the fly assembly
-template<int BlockSize = 32 * 9>
-__global__ void restrict_stencil_nondyadic_OTFA_NS_kernel(int nv_coarse, double* rxcoarse_, int nv_fine, float* rhofine, int* vfineflag) {
+template<int BlockSize = 32 * 9, typename T = double>
+__global__ void restrict_stencil_nondyadic_OTFA_NS_kernel(int nv_coarse, T* rxcoarse_, int nv_fine, float* rhofine, int* vfineflag) {
 	int tid = blockDim.x*blockIdx.x + threadIdx.x;
 	int warpid = threadIdx.x / 32;
 	int warptid = threadIdx.x % 32;
 
 
-	GraftArray<double, 27, 9> rxCoarse(rxcoarse_, nv_coarse);
+	GraftArray<T, n_stencil_blocks, 9> rxCoarse(rxcoarse_, nv_coarse);
 
 	__shared__ double KE[24][24];
 	__shared__ double W[4][4][4];
@@ -1082,7 +1251,7 @@ __global__ void restrict_stencil_nondyadic_OTFA_NS_kernel(int nv_coarse, double*
 	
 	// init coarseStencil
 	//initSharedMem(&coarseStencil[0][0][0], sizeof(coarseStencil) / sizeof(double));
-	double coarseStencil[27] = { 0. };
+	double coarseStencil[n_stencil_blocks] = { 0. };
 
 	int ke_id = tid / nv_coarse;
 
@@ -1132,8 +1301,8 @@ __global__ void restrict_stencil_nondyadic_OTFA_NS_kernel(int nv_coarse, double*
 				for (int kj = 0; kj < 8; kj++) {
 					int kjpos[3] = { epos[0] + kj % 2 , epos[1] + kj % 4 / 2 , epos[2] + kj / 4 };
 					double wk = w_ki * KE[ki * 3 + k3row][kj * 3 + k3col];
-					//  the weighted element matrix should split to coarse vertex, traverse the coarse vertices and split 3x3 Ke to coarse vertex by splitting weights
-					for (int vsplit = 0; vsplit < 27; vsplit++) {
+					//  the weighted element matrix should split to coarse vertex, traverse the coarse vertices of stored blocks and split 3x3 Ke to them by splitting weights
+					for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
 						int vsplitpos[3] = { vsplit % 3 * 4, vsplit % 9 / 3 * 4,vsplit / 9 * 4 };
 						int wjpos[3] = { abs(vsplitpos[0] - kjpos[0]), abs(vsplitpos[1] - kjpos[1]), abs(vsplitpos[2] - kjpos[2]) };
 						if (wjpos[0] >= 4 || wjpos[1] >= 4 || wjpos[2] >= 4) continue;
@@ -1145,20 +1314,20 @@ __global__ void restrict_stencil_nondyadic_OTFA_NS_kernel(int nv_coarse, double*
 		}
 	}
 
-	for (int i = 0; i < 27; i++) {
+	for (int i = 0; i < n_stencil_blocks; i++) {
 		rxCoarse[i][ke_id][vid] = coarseStencil[i]/*[warpid][warptid]*/;
 	}
 }
 
 // on the fly assembly
-template<int BlockSize = 32 * 9>
-__global__ void restrict_stencil_nondyadic_OTFA_WS_kernel(int nv_coarse, double* rxcoarse_, int nv_fine, float* rhofine, int* vfineflag) {
+template<int BlockSize = 32 * 9, typename T = double>
+__global__ void restrict_stencil_nondyadic_OTFA_WS_kernel(int nv_coarse, T* rxcoarse_, int nv_fine, float* rhofine, int* vfineflag) {
 	int tid = blockDim.x*blockIdx.x + threadIdx.x;
 	int warpid = threadIdx.x / 32;
 	int warptid = threadIdx.x % 32;
 
 
-	GraftArray<double, 27, 9> rxCoarse(rxcoarse_, nv_coarse);
+	GraftArray<T, n_stencil_blocks, 9> rxCoarse(rxcoarse_, nv_coarse);
 
 	__shared__ double KE[24][24];
 	__shared__ double W[4][4][4];
@@ -1178,7 +1347,7 @@ __global__ void restrict_stencil_nondyadic_OTFA_WS_kernel(int nv_coarse, double*
 	
 	// init coarseStencil
 	//initSharedMem(&coarseStencil[0][0][0], sizeof(coarseStencil) / sizeof(double));
-	double coarseStencil[27] = { 0. };
+	double coarseStencil[n_stencil_blocks] = { 0. };
 
 	int ke_id = tid / nv_coarse;
 
@@ -1249,8 +1418,8 @@ __global__ void restrict_stencil_nondyadic_OTFA_WS_kernel(int nv_coarse, double*
 						}
 					}
 
-					//  the weighted element matrix should split to coarse vertex, traverse the coarse vertices and split 3x3 Ke to coarse vertex by splitting weights
-					for (int vsplit = 0; vsplit < 27; vsplit++) {
+					//  the weighted element matrix should split to coarse vertex, traverse the coarse vertices of stored blocks and split 3x3 Ke to them by splitting weights
+					for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
 						int vsplitpos[3] = { vsplit % 3 * 4, vsplit % 9 / 3 * 4,vsplit / 9 * 4 };
 						int wjpos[3] = { abs(vsplitpos[0] - kjpos[0]), abs(vsplitpos[1] - kjpos[1]), abs(vsplitpos[2] - kjpos[2]) };
 						if (wjpos[0] >= 4 || wjpos[1] >= 4 || wjpos[2] >= 4) continue;
@@ -1262,7 +1431,7 @@ __global__ void restrict_stencil_nondyadic_OTFA_WS_kernel(int nv_coarse, double*
 		}
 	}
 
-	for (int i = 0; i < 27; i++) {
+	for (int i = 0; i < n_stencil_blocks; i++) {
 		rxCoarse[i][ke_id][vid] = coarseStencil[i]/*[warpid][warptid]*/;
 	}
 }
@@ -1273,15 +1442,27 @@ void HierarchyGrid::restrict_stencil_nondyadic(Grid& dstcoarse, Grid& srcfine)
 		std::cout << "\033[31m" << "Non dyadic restriction is only applied on finest grid" << "\033[0m" << std::endl;
 	}
 
+	if (dstcoarse.onHost()) {
+		restrict_stencil_nondyadic_host(dstcoarse, srcfine);
+		return;
+	}
+
 	dstcoarse.use_grid();
 
 	constexpr int BlockSize = 32 * 4;
 	size_t grid_size, block_size;
 	make_kernel_param(&grid_size, &block_size, dstcoarse.n_gsvertices * 9, BlockSize);
-	if (_mode == no_support_constrain_force_direction || _mode == no_support_free_force) {
+	bool withSupport = _mode == with_support_constrain_force_direction || _mode == with_support_free_force;
+	if (!withSupport && dstcoarse.mixedPrecision()) {
+		restrict_stencil_nondyadic_OTFA_NS_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencilF, srcfine.n_gsvertices, srcfine._gbuf.rho_e, srcfine._gbuf.vBitflag);
+	}
+	else if (!withSupport) {
 		restrict_stencil_nondyadic_OTFA_NS_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencil, srcfine.n_gsvertices, srcfine._gbuf.rho_e, srcfine._gbuf.vBitflag);
 	}
-	else if (_mode == with_support_constrain_force_direction || _mode == with_support_free_force) {
+	else if (dstcoarse.mixedPrecision()) {
+		restrict_stencil_nondyadic_OTFA_WS_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencilF, srcfine.n_gsvertices, srcfine._gbuf.rho_e, srcfine._gbuf.vBitflag);
+	}
+	else {
 		restrict_stencil_nondyadic_OTFA_WS_kernel<BlockSize> << <grid_size, block_size >> > (dstcoarse.n_gsvertices, dstcoarse._gbuf.rxStencil, srcfine.n_gsvertices, srcfine._gbuf.rho_e, srcfine._gbuf.vBitflag);
 	}
 	cudaDeviceSynchronize();
@@ -1293,7 +1474,7 @@ void HierarchyGrid::restrict_stencil(Grid& dstcoarse, Grid& srcfine)
 	if (dstcoarse.is_dummy()) return;
 	if (dstcoarse._layer == 0) return;
 
-	init_array(dstcoarse._gbuf.rxStencil, double{ 0 }, 27 * 9 * dstcoarse.n_gsvertices);
+	gpu_manager_t::initMem(dstcoarse.stencil_buf(), dstcoarse.stencil_bytes());
 
 	if (_setting.skiplayer1 && dstcoarse._layer == 2 && srcfine._layer == 0) {
 		restrict_stencil_nondyadic(dstcoarse, srcfine);
@@ -1331,13 +1512,13 @@ void Grid::compute_gscolor(gpu_manager_t& gm, BitSAT<unsigned int>& vbit, BitSAT
 		unsigned int word = gvsat._bitarray[tid];
 		int vid = gvsat._chunksat[tid];
 		int vreso2 = vreso * vreso;
-		int nvbit = vreso2 * vreso;
+		index_t nvbit = index_t(vreso2) * vreso;
 		if (word != 0) {
 			for (int ji = 0; ji < sizeof(unsigned int) * 8; ji++) {
 				if (!read_gbit(word, ji)) continue;
-				int vbitid = tid * BitCount<unsigned int>::value + ji;
+				index_t vbitid = index_t(tid) * BitCount<unsigned int>::value + ji;
 				if (vbitid >= nvbit) break;
-				int pos[3] = { vbitid % vreso, (vbitid % vreso2) / vreso, vbitid / vreso2 };
+				int pos[3] = { int(vbitid % vreso), int((vbitid % vreso2) / vreso), int(vbitid / vreso2) };
 				int m2 = pos[0] % 2 + pos[1] % 2 * 2 + pos[2] % 2 * 4;
 				// set vertex gs color id
 				int bitword = vbitflagdevice[vid];
@@ -1355,12 +1536,12 @@ void Grid::compute_gscolor(gpu_manager_t& gm, BitSAT<unsigned int>& vbit, BitSAT
 		int eid = gesat._chunksat[tid];
 		int ereso = vreso - 1;
 		int ereso2 = ereso * ereso;
-		int nebit = ereso * ereso2;
+		index_t nebit = index_t(ereso) * ereso2;
 		for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 			if (!read_gbit(word, ji)) continue;
-			int ebitid = tid * BitCount<unsigned int>::value + ji;
+			index_t ebitid = index_t(tid) * BitCount<unsigned int>::value + ji;
 			if (ebitid >= nebit) break;
-			int pos[3] = { ebitid % ereso, (ebitid % ereso2) / ereso, ebitid / ereso2 };
+			int pos[3] = { int(ebitid % ereso), int((ebitid % ereso2) / ereso), int(ebitid / ereso2) };
 			int m2 = pos[0] % 2 + pos[1] % 2 * 2 + pos[2] % 2 * 4;
 			int bitword = ebitflagdevice[eid];
 			bitword &= ~(int)Bitmask::mask_gscolor;
@@ -1464,6 +1645,10 @@ void Grid::clearBuf2(void)
 
 void Grid::lexico2gsorder_g(int* idmap, int n_id, int* ids, int n_mapid, int* mapped_ids, int* valuemap /*= nullptr*/)
 {
+	if (onHost()) {
+		lexico2gsorder_host(idmap, n_id, ids, n_mapid, mapped_ids, valuemap);
+		return;
+	}
 	int* pid = ids;
 	int* old_ptr;
 	if (ids == mapped_ids) {
@@ -1494,9 +1679,9 @@ void Grid::lexico2gsorder_g(int* idmap, int n_id, int* ids, int n_mapid, int* ma
 	
 }
 
-template<int BlockSize = 32 * 13>
-__global__ void gs_relax_kernel(int n_vgstotal, int nv_gsset, double* rxstencil, int gs_offset) {
-	GraftArray<double, 27, 9> stencil(rxstencil, n_vgstotal);
+template<int BlockSize = 32 * 13, typename T = double>
+__global__ void gs_relax_kernel(int n_vgstotal, int nv_gsset, T* rxstencil, int gs_offset) {
+	GraftArray<T, n_stencil_blocks, 9> stencil(rxstencil, n_vgstotal);
 	int tid = blockIdx.x*blockDim.x + threadIdx.x;
 
 	//int mode = gmode[0];
@@ -1530,13 +1715,13 @@ __global__ void gs_relax_kernel(int n_vgstotal, int nv_gsset, double* rxstencil,
 
 			for (int j = 0; j < 3; j++) displacement[j] = gU[j][neigh];
 
-			// K3 is ordered in row major 
+			// K3 is ordered in row major, blocks of the upper half are fetched transposed from the neighbor
 			// traverse rows 
 			for (int j = 0; j < 3; j++) {
 				int jrows = j * 3;
 				// traverse columns, dot u 
 				for (int k = 0; k < 3; k++) {
-					Au[j] += stencil[neigh_th][jrows + k][node_id] * displacement[k];
+					Au[j] += stencil_entry(rxstencil, n_vgstotal, neigh_th, jrows + k, node_id, neigh) * displacement[k];
 				}
 			}
 
@@ -1887,6 +2072,10 @@ _blocksum:
 void Grid::gs_relax(int n_times)
 {
 	if (is_dummy()) return;
+	if (onHost()) {
+		gs_relax_host(n_times);
+		return;
+	}
 	use_grid();
 	cuda_error_check;
 	if (_layer == 0) {
@@ -1911,14 +2100,24 @@ void Grid::gs_relax(int n_times)
 		}
 	}
 	else {
-		check_array_len(_gbuf.rxStencil, 27 * 9 * n_gsvertices);
+		if (mixedPrecision()) {
+			check_array_len(_gbuf.rxStencilF, n_stencil_blocks * 9 * n_gsvertices);
+		}
+		else {
+			check_array_len(_gbuf.rxStencil, n_stencil_blocks * 9 * n_gsvertices);
+		}
 		for (int n = 0; n < n_times; n++) {
 			int gs_offset = 0;
 			for (int i = 0; i < 8; i++) {
 				size_t grid_size, block_size;
 				constexpr int BlockSize = 32 * 13;
 				make_kernel_param(&grid_size, &block_size, gs_num[i] * 13, BlockSize);
-				gs_relax_kernel<BlockSize> << <grid_size, block_size >> > (n_gsvertices, gs_num[i], _gbuf.rxStencil, gs_offset);
+				if (mixedPrecision()) {
+					gs_relax_kernel<BlockSize> << <grid_size, block_size >> > (n_gsvertices, gs_num[i], _gbuf.rxStencilF, gs_offset);
+				}
+				else {
+					gs_relax_kernel<BlockSize> << <grid_size, block_size >> > (n_gsvertices, gs_num[i], _gbuf.rxStencil, gs_offset);
+				}
 				//cudaDeviceSynchronize();
 				//cuda_error_check;
 				gs_offset += gs_num[i];
@@ -1938,12 +2137,12 @@ __global__ void restrict_adjoint_stencil_nondyadic_OTFA_constrain_force_directio
 	int warpid = threadIdx.x / 32;
 	int warptid = threadIdx.x % 32;
 
-	GraftArray<double, 27, 9> rxCoarse(rxcoarse_, nv_coarse);
+	GraftArray<double, n_stencil_blocks, 9> rxCoarse(rxcoarse_, nv_coarse);
 
 	__shared__ double KE[24][24];
 	__shared__ double W[4][4][4];
 
-	__shared__ double sumCoarseStencil[BlockSize / 32][27][32];
+	__shared__ double sumCoarseStencil[BlockSize / 32][n_stencil_blocks][32];
 
 	// load template matrix from constant memory to shared memory
 	loadTemplateMatrix(KE);
@@ -1959,7 +2158,7 @@ __global__ void restrict_adjoint_stencil_nondyadic_OTFA_constrain_force_directio
 	
 	// init coarseStencil
 	//initSharedMem(&coarseStencil[0][0][0], sizeof(coarseStencil) / sizeof(double));
-	double coarseStencil[27] = { 0. };
+	double coarseStencil[n_stencil_blocks] = { 0. };
 
 	bool validthread = true;
 
@@ -2077,8 +2276,8 @@ __global__ void restrict_adjoint_stencil_nondyadic_OTFA_constrain_force_directio
 					wk *= w_ki;
 
 				_splitwk:
-					//  the weighted element matrix should split to coarse vertex, traverse the coarse vertices and split 3x3 Ke to coarse vertex by splitting weights
-					for (int vsplit = 0; vsplit < 27; vsplit++) {
+					//  the weighted element matrix should split to coarse vertex, traverse the coarse vertices of stored blocks and split 3x3 Ke to them by splitting weights
+					for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
 						int vsplitpos[3] = { vsplit % 3 * 4, vsplit % 9 / 3 * 4,vsplit / 9 * 4 };
 						int wjpos[3] = { abs(vsplitpos[0] - kjpos[0]), abs(vsplitpos[1] - kjpos[1]), abs(vsplitpos[2] - kjpos[2]) };
 						if (wjpos[0] >= 4 || wjpos[1] >= 4 || wjpos[2] >= 4) continue;
@@ -2093,7 +2292,7 @@ __global__ void restrict_adjoint_stencil_nondyadic_OTFA_constrain_force_directio
 
 __blocksum:
 
-	for (int i = 0; i < 27; i++) {
+	for (int i = 0; i < n_stencil_blocks; i++) {
 		sumCoarseStencil[warpid][i][warptid] = coarseStencil[i];
 	}
 
@@ -2102,34 +2301,34 @@ __blocksum:
 #if 1
 	// warp reduce sum on sumCoarseStencil[][][*]
 	if (warptid < 16) {
-		for (int i = 0; i < 27; i++) {
+		for (int i = 0; i < n_stencil_blocks; i++) {
 			sumCoarseStencil[warpid][i][warptid] += sumCoarseStencil[warpid][i][warptid + 16];
 		}
 	}
 	if (warptid < 8) {
-		for (int i = 0; i < 27; i++) {
+		for (int i = 0; i < n_stencil_blocks; i++) {
 			sumCoarseStencil[warpid][i][warptid] += sumCoarseStencil[warpid][i][warptid + 8];
 		}
 	}
 	if (warptid < 4) {
-		for (int i = 0; i < 27; i++) {
+		for (int i = 0; i < n_stencil_blocks; i++) {
 			sumCoarseStencil[warpid][i][warptid] += sumCoarseStencil[warpid][i][warptid + 4];
 		}
 	}
 	if (warptid < 2) {
-		for (int i = 0; i < 27; i++) {
+		for (int i = 0; i < n_stencil_blocks; i++) {
 			sumCoarseStencil[warpid][i][warptid] += sumCoarseStencil[warpid][i][warptid + 2];
 		}
 	}
 	if (warptid < 1 && validthread) {
-		for (int i = 0; i < 27; i++) {
+		for (int i = 0; i < n_stencil_blocks; i++) {
 			rxCoarse[i][ke_id][vid] = sumCoarseStencil[warpid][i][0] + sumCoarseStencil[warpid][i][1];
 		}
 	}
 #else
 
 	if (warptid == 0 && validthread) {
-		for (int i = 0; i < 27; i++) {
+		for (int i = 0; i < n_stencil_blocks; i++) {
 			double sumst = 0;
 			for (int j = 0; j < 32; j++) {
 				sumst += sumCoarseStencil[warpid][i][j];
@@ -2141,12 +2340,12 @@ __blocksum:
 #endif
 }
 
-__global__ void update_residual_kernel(int nv, double* rxstencil) {
+template<typename T = double>
+__global__ void update_residual_kernel(int nv, T* rxstencil) {
 	int tid = blockIdx.x * blockDim.x + threadIdx.x;
 	if (tid >= nv) return;
 	int vid = tid;
 
-	GraftArray<double, 27, 9> stencil(rxstencil, nv);
 	//double f[3] = { gF[0][vid],gF[1][vid],gF[2][vid] };
 	double KU[3] = { 0. };
 	for (int i = 0; i < 27; i++) {
@@ -2155,7 +2354,7 @@ __global__ void update_residual_kernel(int nv, double* rxstencil) {
 		double u[3] = { gU[0][vj],gU[1][vj],gU[2][vj] };
 		for (int row = 0; row < 3; row++) {
 			for (int col = 0; col < 3; col++) {
-				KU[row] += stencil[i][row * 3 + col][vid] * u[col];
+				KU[row] += stencil_entry(rxstencil, nv, i, row * 3 + col, vid, vj) * u[col];
 			}
 		}
 	}
@@ -2166,9 +2365,9 @@ __global__ void update_residual_kernel(int nv, double* rxstencil) {
 }
 
 // map 32 vertices to 13 warp
-template<int SetBlockSize = 32 * 13>
-__global__ void update_residual_kernel_1(int nv, double* rxstencil) {
-	GraftArray<double, 27, 9> stencil(rxstencil, nv);
+template<int SetBlockSize = 32 * 13, typename T = double>
+__global__ void update_residual_kernel_1(int nv, T* rxstencil) {
+	GraftArray<T, n_stencil_blocks, 9> stencil(rxstencil, nv);
 	int tid = blockIdx.x*blockDim.x + threadIdx.x;
 
 	//int mode = gmode[0];
@@ -2196,13 +2395,13 @@ __global__ void update_residual_kernel_1(int nv, double* rxstencil) {
 
 			for (int j = 0; j < 3; j++) displacement[j] = gU[j][neigh];
 
-			// K3 is ordered in row major 
+			// K3 is ordered in row major, blocks of the upper half are fetched transposed from the neighbor
 			// traverse rows 
 			for (int j = 0; j < 3; j++) {
 				int jrows = j * 3;
 				// traverse columns, dot u 
 				for (int k = 0; k < 3; k++) {
-					Au[j] += stencil[neigh_th][jrows + k][vid] * displacement[k];
+					Au[j] += stencil_entry(rxstencil, nv, neigh_th, jrows + k, vid, neigh) * displacement[k];
 				}
 			}
 
@@ -2463,6 +2662,10 @@ __blocksum:
 void Grid::update_residual(void)
 {
 	if (is_dummy()) return;
+	if (onHost()) {
+		update_residual_host();
+		return;
+	}
 	use_grid();
 	size_t grid_size, block_size;
 	if (_layer == 0) {
@@ -2488,7 +2691,12 @@ void Grid::update_residual(void)
 		update_residual_kernel << <grid_size, block_size >> > (n_gsvertices, _gbuf.rxStencil);
 #else
 		make_kernel_param(&grid_size, &block_size, n_gsvertices * 13, 32 * 13);
-		update_residual_kernel_1 << <grid_size, block_size >> > (n_gsvertices, _gbuf.rxStencil);
+		if (mixedPrecision()) {
+			update_residual_kernel_1 << <grid_size, block_size >> > (n_gsvertices, _gbuf.rxStencilF);
+		}
+		else {
+			update_residual_kernel_1 << <grid_size, block_size >> > (n_gsvertices, _gbuf.rxStencil);
+		}
 
 #endif
 		cudaDeviceSynchronize();
@@ -2614,6 +2822,10 @@ __global__ void restrict_residual_nondyadic_kernel(int nv) {
 
 void Grid::restrict_residual(void)
 {
+	if (onHost()) {
+		restrict_residual_host();
+		return;
+	}
 	use_grid();
 
 	size_t grid_size, block_size;
@@ -2717,6 +2929,10 @@ __global__ void prolongate_correction_nondyadic_kernel(int nv, int* vbitflag) {
 void Grid::prolongate_correction(void)
 {
 	if (is_dummy()) return;
+	if (onHost()) {
+		prolongate_correction_host();
+		return;
+	}
 	use_grid();
 	size_t grid_size, block_size;
 	if (_layer == 0 && is_skip()) {
@@ -2735,28 +2951,26 @@ void Grid::prolongate_correction(void)
 
 void Grid::reset_displacement(void)
 {
-	for (int i = 0; i < 3; i++) {
-		init_array(_gbuf.U[i], 0., n_gsvertices);
-	}
+	double zeros[3] = { 0. };
+	v3_init(_gbuf.U, zeros);
 }
 
 void Grid::reset_force(void)
 {
 	cuda_error_check;
-	for (int i = 0; i < 3; i++) {
-		init_array(_gbuf.F[i], 0., n_gsvertices);
-	}
+	double zeros[3] = { 0. };
+	v3_init(_gbuf.F, zeros);
 }
 
 void Grid::reset_residual(void)
 {
-	for (int i = 0; i < 3; i++) {
-		init_array(_gbuf.R[i], 0., n_gsvertices);
-	}
+	double zeros[3] = { 0. };
+	v3_init(_gbuf.R, zeros);
 }
 
 double Grid::v3norm(double* v[3])
 {
+	if (onHost()) return sqrt(v3_dot_host(n_nodes(), v, v));
 	double* tmp = (double*)getTempBuf(n_nodes() * sizeof(double) / 100);
 	double s = norm(v[0], v[1], v[2], tmp, n_nodes());
 	return s;
@@ -2774,121 +2988,621 @@ double Grid::residual(void)
 	return v3norm(_gbuf.R);
 }
 
+// dispatch runtime number of right hand sides to kernels templated on it
+template<typename Func>
+static void dispatch_nrhs(int nrhs, Func func) {
+	switch (nrhs) {
+	case 1: func(std::integral_constant<int, 1>()); break;
+	case 2: func(std::integral_constant<int, 2>()); break;
+	case 3: func(std::integral_constant<int, 3>()); break;
+	case 4: func(std::integral_constant<int, 4>()); break;
+	case 5: func(std::integral_constant<int, 5>()); break;
+	case 6: func(std::integral_constant<int, 6>()); break;
+	case 7: func(std::integral_constant<int, 7>()); break;
+	case 8: func(std::integral_constant<int, 8>()); break;
+	default:
+		printf("\033[31m-- unsupported number of right hand sides %d\033[0m\n", nrhs);
+		break;
+	}
+}
+
+// block vectors are interleaved as [vertex][3][K], one thread handles all K right hand sides of a vertex
+// so that each stencil entry is loaded once
+template<int K>
+__device__ inline void blockGaussSeidel(const double s[9], double Au[3][K], double* u, const double* f) {
+	for (int k = 0; k < K; k++) {
+		double u0 = u[k], u1 = u[K + k], u2 = u[2 * K + k];
+		u0 = (f[k] - s[1] * u1 - s[2] * u2 - Au[0][k]) / s[0];
+		u1 = (f[K + k] - s[3] * u0 - s[5] * u2 - Au[1][k]) / s[4];
+		u2 = (f[2 * K + k] - s[6] * u0 - s[7] * u1 - Au[2][k]) / s[8];
+		u[k] = u0; u[K + k] = u1; u[2 * K + k] = u2;
+	}
+}
+
+template<int K, typename T>
+__device__ inline void blockStencilKU(int vid, int n_vgstotal, T* rxstencil, const double* U, bool skipCenter, double KU[3][K]) {
+	for (int nei = 0; nei < 27; nei++) {
+		if (skipCenter && nei == 13) continue;
+		int neigh = gV2V[nei][vid];
+		if (neigh == -1) continue;
+		double s[9];
+		for (int i = 0; i < 9; i++) s[i] = stencil_entry(rxstencil, n_vgstotal, nei, i, vid, neigh);
+		const double* un = U + index_t(neigh) * 3 * K;
+		for (int k = 0; k < K; k++) {
+			double u0 = un[k], u1 = un[K + k], u2 = un[2 * K + k];
+			for (int row = 0; row < 3; row++) {
+				KU[row][k] += s[row * 3] * u0 + s[row * 3 + 1] * u1 + s[row * 3 + 2] * u2;
+			}
+		}
+	}
+}
 
-//__global__ void mark_surface_nodes_kernel(int nv, int* vflag, int* eflag) {
-//	int tid = threadIdx.x + blockDim.x*blockIdx.x;
-//	if (tid >= nv) return;
-//
-//	int vid = tid;
-//
-//	bool surf = false;
-//
-//	bool axisHasNeighbor[3] = { false, false, false };
-//
-//	bool solid_flag[2][2][2];
-//	for (int i = 0; i < 8; i++) {
-//		int eid = gV2E[i][vid];
-//		solid_flag[i % 2][i % 4 / 2][i / 4] = (eid != -1);
-//	}
-//
-//	for (int i = 0; i < 2; i++) {
-//		for (int j = 0; j < 2; j++) {
-//			axisHasNeighbor[0] |= solid_flag[0][i][j] && solid_flag[1][i][j];
-//			axisHasNeighbor[1] |= solid_flag[i][0][j] && solid_flag[i][1][j];
-//			axisHasNeighbor[2] |= solid_flag[i][j][0] && solid_flag[i][j][1];
-//		}
-//	}
-//
-//	surf = (!axisHasNeighbor[0]) || (!axisHasNeighbor[1]) || (!axisHasNeighbor[2]);
-//
-//	int word = vflag[vid];
-//	if (surf) {
-//		word |= Grid::Bitmask::mask_surfacenodes;
-//	}
-//	else {
-//		word &= ~(int)Grid::Bitmask::mask_surfacenodes;
-//	}
-//	vflag[vid] = word;
-//}
+// K*u over the elements around vid, fixed neighbors contribute zero displacement.
+// if S is given, the center vertex is excluded and its diagonal block is summed to S
+template<int K, bool WithSupport>
+__device__ inline void blockElementKU(int vid, float* rholist, double KE[24][24], const double* U, double KU[3][K], double* S) {
+	float power = power_penalty[0];
+	for (int e = 0; e < 8; e++) {
+		int eid = gV2E[e][vid];
+		if (eid == -1) continue;
+		double penalty = powf(rholist[eid], power);
+		int vi = 7 - e;
+		if (S != nullptr) {
+			for (int i = 0; i < 9; i++) S[i] += penalty * KE[vi * 3 + i / 3][vi * 3 + i % 3];
+		}
+		for (int vj = 0; vj < 8; vj++) {
+			int vj_lid = (vj % 2 + e % 2) + (vj % 4 / 2 + e % 4 / 2) * 3 + (vj / 4 + e / 4) * 9;
+			if (S != nullptr && vj_lid == 13) continue;
+			int vj_vid = gV2V[vj_lid][vid];
+			if (vj_vid == -1) continue;
+			if (WithSupport && (gVflag[0][vj_vid] & Grid::Bitmask::mask_supportnodes)) continue;
+			const double* un = U + index_t(vj_vid) * 3 * K;
+			for (int row = 0; row < 3; row++) {
+				double ke[3] = {
+					penalty * KE[vi * 3 + row][vj * 3],
+					penalty * KE[vi * 3 + row][vj * 3 + 1],
+					penalty * KE[vi * 3 + row][vj * 3 + 2]
+				};
+				for (int k = 0; k < K; k++) {
+					KU[row][k] += ke[0] * un[k] + ke[1] * un[K + k] + ke[2] * un[2 * K + k];
+				}
+			}
+		}
+	}
+}
 
-//void Grid::mark_surface_nodes_g(void)
-//{
-//	use_grid();
-//	size_t grid_size, block_size;
-//	make_kernel_param(&grid_size, &block_size, n_gsvertices, 512);
-//	mark_surface_nodes_kernel << <grid_size, block_size >> > (n_gsvertices, _gbuf.vBitflag, _gbuf.eBitflag);
-//	cudaDeviceSynchronize();
-//	cuda_error_check;
-//}
+template<int K, typename T>
+__global__ void gs_relax_block_kernel(int n_vgstotal, int nv_gsset, int gs_offset, T* rxstencil, double* U, const double* F) {
+	int tid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (tid >= nv_gsset) return;
+	int vid = gs_offset + tid;
+	if (gVflag[0][vid] & Grid::Bitmask::mask_invalid) return;
 
-__global__ void mark_surface_nodes_kernel(int nv, devArray_t<int*, 8> v2elist, int* vflag) {
-	int tid = threadIdx.x + blockDim.x*blockIdx.x;
-	if (tid >= nv) return;
+	double Au[3][K] = { 0. };
+	blockStencilKU<K>(vid, n_vgstotal, rxstencil, U, true, Au);
 
-	int vid = tid;
+	GraftArray<T, n_stencil_blocks, 9> stencil(rxstencil, n_vgstotal);
+	double s[9];
+	for (int i = 0; i < 9; i++) s[i] = stencil[13][i][vid];
+	blockGaussSeidel<K>(s, Au, U + index_t(vid) * 3 * K, F + index_t(vid) * 3 * K);
+}
 
-	bool surf = false;
+template<int K, bool WithSupport>
+__global__ void gs_relax_OTFA_block_kernel(int nv_gsset, int gs_offset, float* rholist, double* U, const double* F) {
+	__shared__ double KE[24][24];
 
-	bool axisHasNeighbor[3] = { false, false, false };
+	loadTemplateMatrix(KE);
 
-	bool solid_flag[2][2][2];
-	for (int i = 0; i < 8; i++) {
-		int eid = v2elist[i][vid];
-		solid_flag[i % 2][i % 4 / 2][i / 4] = (eid != -1);
-	}
+	int tid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (tid >= nv_gsset) return;
+	int vid = gs_offset + tid;
+	int flag = gVflag[0][vid];
+	if (flag & Grid::Bitmask::mask_invalid) return;
+	if (gV2V[13][vid] == -1) return;
 
-	for (int i = 0; i < 2; i++) {
-		for (int j = 0; j < 2; j++) {
-			axisHasNeighbor[0] |= solid_flag[0][i][j] && solid_flag[1][i][j];
-			axisHasNeighbor[1] |= solid_flag[i][0][j] && solid_flag[i][1][j];
-			axisHasNeighbor[2] |= solid_flag[i][j][0] && solid_flag[i][j][1];
+	double KeU[3][K] = { 0. };
+	double S[9] = { 0. };
+	if (WithSupport && (flag & Grid::Bitmask::mask_supportnodes)) {
+		// fixed node, the diagonal block is identity on each element
+		for (int e = 0; e < 8; e++) {
+			if (gV2E[e][vid] == -1) continue;
+			S[0] += 1; S[4] += 1; S[8] += 1;
 		}
 	}
-
-	surf = (!axisHasNeighbor[0]) || (!axisHasNeighbor[1]) || (!axisHasNeighbor[2]);
-
-	int word = vflag[vid];
-	if (surf) {
-		word |= Grid::Bitmask::mask_surfacenodes;
-	}
 	else {
-		word &= ~(int)Grid::Bitmask::mask_surfacenodes;
+		blockElementKU<K, WithSupport>(vid, rholist, KE, U, KeU, S);
 	}
-	vflag[vid] = word;
+	blockGaussSeidel<K>(S, KeU, U + index_t(vid) * 3 * K, F + index_t(vid) * 3 * K);
 }
 
-void Grid::mark_surface_nodes_g(int nv, int* v2e[8], int* vflag)
-{
-	devArray_t<int*, 8> v2elist;
-	for (int i = 0; i < 8; i++) v2elist[i] = v2e[i];
-
-	size_t grid_size, block_size;
-	make_kernel_param(&grid_size, &block_size, nv, 512);
-	mark_surface_nodes_kernel << <grid_size, block_size >> > (nv, v2elist, _gbuf.vBitflag);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+template<int K, typename T>
+__global__ void update_residual_block_kernel(int nv, T* rxstencil, const double* U, const double* F, double* R) {
+	int vid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (vid >= nv) return;
+	if (gVflag[0][vid] & Grid::Bitmask::mask_invalid) return;
+	double KU[3][K] = { 0. };
+	blockStencilKU<K>(vid, nv, rxstencil, U, false, KU);
+	for (int row = 0; row < 3; row++) {
+		for (int k = 0; k < K; k++) {
+			R[(index_t(vid) * 3 + row) * K + k] = F[(index_t(vid) * 3 + row) * K + k] - KU[row][k];
+		}
+	}
 }
 
-__global__ void mark_surface_elements_kernel(int nv, devArray_t<int*, 8> v2elist, int* vflag, int* eflag) {
-	size_t tid = blockIdx.x * blockDim.x + threadIdx.x;
-	if (tid >= nv) return;
+template<int K, bool WithSupport>
+__global__ void update_residual_OTFA_block_kernel(int nv, float* rholist, const double* U, const double* F, double* R) {
+	__shared__ double KE[24][24];
 
-	int vfw = vflag[tid];
+	loadTemplateMatrix(KE);
 
-	if (vfw & Grid::Bitmask::mask_surfacenodes) {
-		for (int i = 0; i < 8; i++) {
-			int eid = v2elist[i][tid];
-			if (eid == -1) continue;
-			atomic_set_gbit(eflag, sizeof(int) * 8 * eid + Grid::Bitmask::offset_surfaceelements);
+	int vid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (vid >= nv) return;
+
+	double KU[3][K] = { 0. };
+	if (!(WithSupport && (gVflag[0][vid] & Grid::Bitmask::mask_supportnodes))) {
+		blockElementKU<K, WithSupport>(vid, rholist, KE, U, KU, nullptr);
+	}
+	for (int row = 0; row < 3; row++) {
+		for (int k = 0; k < K; k++) {
+			R[(index_t(vid) * 3 + row) * K + k] = F[(index_t(vid) * 3 + row) * K + k] - KU[row][k];
 		}
 	}
+}
 
+template<int K>
+__global__ void restrict_residual_block_kernel(int nv, const double* Rfine, double* F) {
+	int vid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (vid >= nv) return;
+	const double w[4] = { 1.0,1.0 / 2,1.0 / 4,1.0 / 8 };
+	double res[3][K] = { 0. };
+	for (int j = 0; j < 27; j++) {
+		int neigh = gV2Vfine[j][vid];
+		if (neigh == -1) continue;
+		double weight = w[abs(j % 3 - 1) + abs(j % 9 / 3 - 1) + abs(j / 9 - 1)];
+		const double* rn = Rfine + index_t(neigh) * 3 * K;
+		for (int i = 0; i < 3; i++) {
+			for (int k = 0; k < K; k++) res[i][k] += weight * rn[i * K + k];
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		for (int k = 0; k < K; k++) F[(index_t(vid) * 3 + i) * K + k] = res[i][k];
+	}
 }
 
-void grid::Grid::mark_surface_elements_g(int nv, int ne, int* v2e[8], int* vflag, int* eflag)
-{
-	devArray_t<int*, 8> v2elist;
-	for (int i = 0; i < 8; i++) v2elist[i] = v2e[i];
+template<int K>
+__global__ void restrict_residual_nondyadic_block_kernel(int nv, const double* Rfine, double* F) {
+	__shared__ double W[4][4][4];
+	__shared__ int* vfine2vfine[27];
+
+	if (threadIdx.x < 64) {
+		int k = threadIdx.x % 4;
+		int j = threadIdx.x / 4 % 4;
+		int i = threadIdx.x / 16;
+		W[i][j][k] = ((4 - i)*(4 - j)*(4 - k)) / 64.0;
+		if (threadIdx.x < 27) {
+			vfine2vfine[threadIdx.x] = gVfine2Vfine[threadIdx.x];
+		}
+	}
+	__syncthreads();
+
+	int vid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (vid >= nv) return;
+
+	int aFlag[(7 * 7 * 7) / (sizeof(int) * 8) + 1] = { 0 };
+	double sumR[3][K] = { 0. };
+
+	for (int i = 0; i < 64; i++) {
+		int vff = gV2VfineC[i][vid];
+		if (vff == -1) continue;
+		int basepos[3] = { i % 4 * 2 - 3,i % 16 / 4 * 2 - 3,i / 16 * 2 - 3 };
+		for (int dx = -1; dx <= 1; dx++) {
+			int xj = basepos[0] + dx;
+			if (xj <= -4 || xj >= 4) continue;
+			for (int dy = -1; dy <= 1; dy++) {
+				int yj = basepos[1] + dy;
+				if (yj <= -4 || yj >= 4) continue;
+				for (int dz = -1; dz <= 1; dz++) {
+					int zj = basepos[2] + dz;
+					if (zj <= -4 || zj >= 4) continue;
+					int jid = xj + 3 + (yj + 3) * 7 + (zj + 3) * 49;
+					if (read_gbit(aFlag, jid)) continue;
+					set_gbit(aFlag, jid);
+					int djid = (dx + 1) + (dy + 1) * 3 + (dz + 1) * 9;
+					int vj_vid = vfine2vfine[djid][vff];
+					if (vj_vid == -1) continue;
+					double weight = W[abs(xj)][abs(yj)][abs(zj)];
+					const double* rn = Rfine + index_t(vj_vid) * 3 * K;
+					for (int c = 0; c < 3; c++) {
+						for (int k = 0; k < K; k++) sumR[c][k] += weight * rn[c * K + k];
+					}
+				}
+			}
+		}
+	}
+
+	for (int c = 0; c < 3; c++) {
+		for (int k = 0; k < K; k++) F[(index_t(vid) * 3 + c) * K + k] = sumR[c][k];
+	}
+}
+
+// span is 4 on the non dyadic layer, 2 otherwise
+template<int K>
+__global__ void prolongate_correction_block_kernel(int nv, int span, const double* Ucoarse, double* U) {
+	int vid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (vid >= nv) return;
+
+	int flag = gVflag[0][vid];
+	if (flag & Grid::Bitmask::mask_invalid) return;
+
+	int posInE[3] = {
+		((flag & Grid::Bitmask::mask_xmod7) >> Grid::Bitmask::offset_xmod7) % span,
+		((flag & Grid::Bitmask::mask_ymod7) >> Grid::Bitmask::offset_ymod7) % span,
+		((flag & Grid::Bitmask::mask_zmod7) >> Grid::Bitmask::offset_zmod7) % span
+	};
+	double wnorm = span * span * span;
+
+	double c[3][K] = { 0. };
+	for (int i = 0; i < 8; i++) {
+		int vcoarsepos[3] = { i % 2 * span, i % 4 / 2 * span, i / 4 * span };
+		int wpos[3] = { abs(vcoarsepos[0] - posInE[0]), abs(vcoarsepos[1] - posInE[1]), abs(vcoarsepos[2] - posInE[2]) };
+		if (wpos[0] >= span || wpos[1] >= span || wpos[2] >= span) continue;
+		int vcoarseid = gV2Vcoarse[i][vid];
+		if (vcoarseid == -1) continue;
+		double weight = (span - wpos[0]) * (span - wpos[1]) * (span - wpos[2]) / wnorm;
+		const double* uc = Ucoarse + index_t(vcoarseid) * 3 * K;
+		for (int j = 0; j < 3; j++) {
+			for (int k = 0; k < K; k++) c[j][k] += weight * uc[j * K + k];
+		}
+	}
+
+	for (int j = 0; j < 3; j++) {
+		for (int k = 0; k < K; k++) U[(index_t(vid) * 3 + j) * K + k] += c[j][k];
+	}
+}
+
+void Grid::alloc_stencil(gpu_manager_t& gm)
+{
+	if (_gbuf.rxStencil != nullptr) { gm.delete_buf(_gbuf.rxStencil); _gbuf.rxStencil = nullptr; }
+	if (_gbuf.rxStencilF != nullptr) { gm.delete_buf(_gbuf.rxStencilF); _gbuf.rxStencilF = nullptr; }
+	if (mixedPrecision()) {
+		_gbuf.rxStencilF = (float*)gm.add_buf(_name + " rxStencilF ", stencil_bytes());
+	}
+	else {
+		_gbuf.rxStencil = (double*)gm.add_buf(_name + " rxStencil ", stencil_bytes());
+	}
+	gpu_manager_t::initMem(stencil_buf(), stencil_bytes());
+}
+
+void Grid::alloc_block(gpu_manager_t& gm, int nrhs)
+{
+	if (is_dummy() || nrhs == n_rhs) return;
+	if (nrhs < 1 || nrhs > max_block_rhs) {
+		printf("\033[31m-- unsupported number of right hand sides %d\033[0m\n", nrhs);
+		return;
+	}
+	if (n_rhs != 0) {
+		gm.delete_buf(_gbuf.Ublock);
+		gm.delete_buf(_gbuf.Fblock);
+		gm.delete_buf(_gbuf.Rblock);
+	}
+	size_t len = sizeof(double) * 3 * nrhs * n_gsvertices;
+	_gbuf.Ublock = (double*)gm.add_buf(_name + " Ublock", len);
+	_gbuf.Fblock = (double*)gm.add_buf(_name + " Fblock", len);
+	_gbuf.Rblock = (double*)gm.add_buf(_name + " Rblock", len);
+	n_rhs = nrhs;
+	reset_block(_gbuf.Ublock);
+	reset_block(_gbuf.Fblock);
+	reset_block(_gbuf.Rblock);
+}
+
+void Grid::reset_block(double* blockv)
+{
+	gpu_manager_t::initMem(blockv, sizeof(double) * 3 * n_rhs * n_gsvertices);
+}
+
+void Grid::gs_relax_block(int n_times)
+{
+	if (is_dummy()) return;
+	if (onHost()) {
+		gs_relax_block_host(n_times);
+		return;
+	}
+	use_grid();
+	double* U = _gbuf.Ublock;
+	double* F = _gbuf.Fblock;
+	for (int n = 0; n < n_times; n++) {
+		int gs_offset = 0;
+		for (int i = 0; i < 8; i++) {
+			size_t grid_size, block_size;
+			int nv_gsset = gs_num[i];
+			dispatch_nrhs(n_rhs, [&](auto nrhs) {
+				constexpr int K = decltype(nrhs)::value;
+				if (_layer != 0) {
+					make_kernel_param(&grid_size, &block_size, nv_gsset, 256);
+					if (mixedPrecision()) {
+						gs_relax_block_kernel<K> << <grid_size, block_size >> > (n_gsvertices, nv_gsset, gs_offset, _gbuf.rxStencilF, U, F);
+					}
+					else {
+						gs_relax_block_kernel<K> << <grid_size, block_size >> > (n_gsvertices, nv_gsset, gs_offset, _gbuf.rxStencil, U, F);
+					}
+				}
+				else if (hasSupport()) {
+					make_kernel_param(&grid_size, &block_size, nv_gsset, 128);
+					gs_relax_OTFA_block_kernel<K, true> << <grid_size, block_size >> > (nv_gsset, gs_offset, _gbuf.rho_e, U, F);
+				}
+				else {
+					make_kernel_param(&grid_size, &block_size, nv_gsset, 128);
+					gs_relax_OTFA_block_kernel<K, false> << <grid_size, block_size >> > (nv_gsset, gs_offset, _gbuf.rho_e, U, F);
+				}
+			});
+			gs_offset += gs_num[i];
+		}
+		cudaDeviceSynchronize();
+		cuda_error_check;
+	}
+}
+
+void Grid::update_residual_block(void)
+{
+	if (is_dummy()) return;
+	if (onHost()) {
+		update_residual_block_host();
+		return;
+	}
+	use_grid();
+	size_t grid_size, block_size;
+	dispatch_nrhs(n_rhs, [&](auto nrhs) {
+		constexpr int K = decltype(nrhs)::value;
+		if (_layer != 0) {
+			make_kernel_param(&grid_size, &block_size, n_gsvertices, 256);
+			if (mixedPrecision()) {
+				update_residual_block_kernel<K> << <grid_size, block_size >> > (n_gsvertices, _gbuf.rxStencilF, _gbuf.Ublock, _gbuf.Fblock, _gbuf.Rblock);
+			}
+			else {
+				update_residual_block_kernel<K> << <grid_size, block_size >> > (n_gsvertices, _gbuf.rxStencil, _gbuf.Ublock, _gbuf.Fblock, _gbuf.Rblock);
+			}
+		}
+		else if (hasSupport()) {
+			make_kernel_param(&grid_size, &block_size, n_gsvertices, 128);
+			update_residual_OTFA_block_kernel<K, true> << <grid_size, block_size >> > (n_gsvertices, _gbuf.rho_e, _gbuf.Ublock, _gbuf.Fblock, _gbuf.Rblock);
+		}
+		else {
+			make_kernel_param(&grid_size, &block_size, n_gsvertices, 128);
+			update_residual_OTFA_block_kernel<K, false> << <grid_size, block_size >> > (n_gsvertices, _gbuf.rho_e, _gbuf.Ublock, _gbuf.Fblock, _gbuf.Rblock);
+		}
+	});
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+void Grid::restrict_residual_block(void)
+{
+	if (onHost()) {
+		restrict_residual_block_host();
+		return;
+	}
+	if (_layer == 0) {
+		msg() << "\033[31mCannot restrict residual to finest layer" << "\033[0m" << std::endl;
+		return;
+	}
+	use_grid();
+	size_t grid_size, block_size;
+	double* Rfine = fineGrid->_gbuf.Rblock;
+	dispatch_nrhs(n_rhs, [&](auto nrhs) {
+		constexpr int K = decltype(nrhs)::value;
+		if (_layer == 2 && is_skip()) {
+			make_kernel_param(&grid_size, &block_size, n_gsvertices, 256);
+			restrict_residual_nondyadic_block_kernel<K> << <grid_size, block_size >> > (n_gsvertices, Rfine, _gbuf.Fblock);
+		}
+		else {
+			make_kernel_param(&grid_size, &block_size, n_gsvertices, 512);
+			restrict_residual_block_kernel<K> << <grid_size, block_size >> > (n_gsvertices, Rfine, _gbuf.Fblock);
+		}
+	});
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+void Grid::prolongate_correction_block(void)
+{
+	if (is_dummy()) return;
+	if (onHost()) {
+		prolongate_correction_block_host();
+		return;
+	}
+	use_grid();
+	size_t grid_size, block_size;
+	int span = (_layer == 0 && is_skip()) ? 4 : 2;
+	make_kernel_param(&grid_size, &block_size, n_gsvertices, 512);
+	dispatch_nrhs(n_rhs, [&](auto nrhs) {
+		constexpr int K = decltype(nrhs)::value;
+		prolongate_correction_block_kernel<K> << <grid_size, block_size >> > (n_gsvertices, span, coarseGrid->_gbuf.Ublock, _gbuf.Ublock);
+	});
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+void Grid::block_norm(double* blockv, double* norms)
+{
+	if (onHost()) {
+		block_norm_host(blockv, norms);
+		return;
+	}
+	int nv = n_gsvertices;
+	int K = n_rhs;
+	// squared entries of each column are gathered to [column][vertex] and reduced separately
+	double* sqr = (double*)getTempBuf1(sizeof(double) * K * nv);
+	double* dump = (double*)getTempBuf2(sizeof(double) * (nv / 512 + 1));
+	size_t grid_size, block_size;
+	make_kernel_param(&grid_size, &block_size, nv, 512);
+	traverse_noret << <grid_size, block_size >> > (nv, [=] __device__(int vid) {
+		const double* bv = blockv + index_t(vid) * 3 * K;
+		for (int k = 0; k < K; k++) {
+			double s = 0;
+			for (int i = 0; i < 3; i++) s += bv[i * K + k] * bv[i * K + k];
+			sqr[index_t(k) * nv + vid] = s;
+		}
+	});
+	cudaDeviceSynchronize();
+	cuda_error_check;
+	for (int k = 0; k < K; k++) {
+		norms[k] = sqrt(parallel_sum(sqr + index_t(k) * nv, dump, nv));
+	}
+}
+
+void Grid::v3_to_block(double* v[3], double* blockv, int col)
+{
+	if (onHost()) {
+		v3_to_block_host(v, blockv, col);
+		return;
+	}
+	int K = n_rhs;
+	devArray_t<double*, 3> vlist{ v[0],v[1],v[2] };
+	size_t grid_size, block_size;
+	make_kernel_param(&grid_size, &block_size, n_gsvertices, 512);
+	traverse_noret << <grid_size, block_size >> > (n_gsvertices, [=] __device__(int vid) {
+		for (int i = 0; i < 3; i++) blockv[(index_t(vid) * 3 + i) * K + col] = vlist[i][vid];
+	});
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+void Grid::block_to_v3(double* blockv, int col, double* v[3])
+{
+	if (onHost()) {
+		block_to_v3_host(blockv, col, v);
+		return;
+	}
+	int K = n_rhs;
+	devArray_t<double*, 3> vlist{ v[0],v[1],v[2] };
+	size_t grid_size, block_size;
+	make_kernel_param(&grid_size, &block_size, n_gsvertices, 512);
+	traverse_noret << <grid_size, block_size >> > (n_gsvertices, [=] __device__(int vid) {
+		for (int i = 0; i < 3; i++) vlist[i][vid] = blockv[(index_t(vid) * 3 + i) * K + col];
+	});
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+
+//__global__ void mark_surface_nodes_kernel(int nv, int* vflag, int* eflag) {
+//	int tid = threadIdx.x + blockDim.x*blockIdx.x;
+//	if (tid >= nv) return;
+//
+//	int vid = tid;
+//
+//	bool surf = false;
+//
+//	bool axisHasNeighbor[3] = { false, false, false };
+//
+//	bool solid_flag[2][2][2];
+//	for (int i = 0; i < 8; i++) {
+//		int eid = gV2E[i][vid];
+//		solid_flag[i % 2][i % 4 / 2][i / 4] = (eid != -1);
+//	}
+//
+//	for (int i = 0; i < 2; i++) {
+//		for (int j = 0; j < 2; j++) {
+//			axisHasNeighbor[0] |= solid_flag[0][i][j] && solid_flag[1][i][j];
+//			axisHasNeighbor[1] |= solid_flag[i][0][j] && solid_flag[i][1][j];
+//			axisHasNeighbor[2] |= solid_flag[i][j][0] && solid_flag[i][j][1];
+//		}
+//	}
+//
+//	surf = (!axisHasNeighbor[0]) || (!axisHasNeighbor[1]) || (!axisHasNeighbor[2]);
+//
+//	int word = vflag[vid];
+//	if (surf) {
+//		word |= Grid::Bitmask::mask_surfacenodes;
+//	}
+//	else {
+//		word &= ~(int)Grid::Bitmask::mask_surfacenodes;
+//	}
+//	vflag[vid] = word;
+//}
+
+//void Grid::mark_surface_nodes_g(void)
+//{
+//	use_grid();
+//	size_t grid_size, block_size;
+//	make_kernel_param(&grid_size, &block_size, n_gsvertices, 512);
+//	mark_surface_nodes_kernel << <grid_size, block_size >> > (n_gsvertices, _gbuf.vBitflag, _gbuf.eBitflag);
+//	cudaDeviceSynchronize();
+//	cuda_error_check;
+//}
+
+__global__ void mark_surface_nodes_kernel(int nv, devArray_t<int*, 8> v2elist, int* vflag) {
+	int tid = threadIdx.x + blockDim.x*blockIdx.x;
+	if (tid >= nv) return;
+
+	int vid = tid;
+
+	bool surf = false;
+
+	bool axisHasNeighbor[3] = { false, false, false };
+
+	bool solid_flag[2][2][2];
+	for (int i = 0; i < 8; i++) {
+		int eid = v2elist[i][vid];
+		solid_flag[i % 2][i % 4 / 2][i / 4] = (eid != -1);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			axisHasNeighbor[0] |= solid_flag[0][i][j] && solid_flag[1][i][j];
+			axisHasNeighbor[1] |= solid_flag[i][0][j] && solid_flag[i][1][j];
+			axisHasNeighbor[2] |= solid_flag[i][j][0] && solid_flag[i][j][1];
+		}
+	}
+
+	surf = (!axisHasNeighbor[0]) || (!axisHasNeighbor[1]) || (!axisHasNeighbor[2]);
+
+	int word = vflag[vid];
+	if (surf) {
+		word |= Grid::Bitmask::mask_surfacenodes;
+	}
+	else {
+		word &= ~(int)Grid::Bitmask::mask_surfacenodes;
+	}
+	vflag[vid] = word;
+}
+
+void Grid::mark_surface_nodes_g(int nv, int* v2e[8], int* vflag)
+{
+	if (onHost()) {
+		mark_surface_nodes_host(nv, v2e, _gbuf.vBitflag);
+		return;
+	}
+	devArray_t<int*, 8> v2elist;
+	for (int i = 0; i < 8; i++) v2elist[i] = v2e[i];
+
+	size_t grid_size, block_size;
+	make_kernel_param(&grid_size, &block_size, nv, 512);
+	mark_surface_nodes_kernel << <grid_size, block_size >> > (nv, v2elist, _gbuf.vBitflag);
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+__global__ void mark_surface_elements_kernel(int nv, devArray_t<int*, 8> v2elist, int* vflag, int* eflag) {
+	size_t tid = blockIdx.x * blockDim.x + threadIdx.x;
+	if (tid >= nv) return;
+
+	int vfw = vflag[tid];
+
+	if (vfw & Grid::Bitmask::mask_surfacenodes) {
+		for (int i = 0; i < 8; i++) {
+			int eid = v2elist[i][tid];
+			if (eid == -1) continue;
+			atomic_set_gbit(eflag, sizeof(int) * 8 * eid + Grid::Bitmask::offset_surfaceelements);
+		}
+	}
+
+}
+
+void grid::Grid::mark_surface_elements_g(int nv, int ne, int* v2e[8], int* vflag, int* eflag)
+{
+	devArray_t<int*, 8> v2elist;
+	for (int i = 0; i < 8; i++) v2elist[i] = v2e[i];
 
 	size_t grid_size, block_size;
 	make_kernel_param(&grid_size, &block_size, nv, 512);
@@ -2902,37 +3616,36 @@ void grid::Grid::mark_surface_elements_g(int nv, int ne, int* v2e[8], int* vflag
 std::vector<int> Grid::getVflags(void)
 {
 	std::vector<int> hostflag(n_gsvertices);
-	cudaMemcpy(hostflag.data(), _gbuf.vBitflag, sizeof(int)*n_gsvertices, cudaMemcpyDeviceToHost);
-	cuda_error_check;
+	gpu_manager_t::download_buf(hostflag.data(), _gbuf.vBitflag, sizeof(int) * n_gsvertices);
 	return hostflag;
 }
 
 std::vector<int> Grid::getEflags(void)
 {
 	std::vector<int> hostflag(n_gselements);
-	cudaMemcpy(hostflag.data(), _gbuf.eBitflag, sizeof(int)*n_gselements, cudaMemcpyDeviceToHost);
-	cuda_error_check;
+	gpu_manager_t::download_buf(hostflag.data(), _gbuf.eBitflag, sizeof(int) * n_gselements);
 	return hostflag;
 }
 
 void Grid::getVflags(int nv, int* dst)
 {
-	cudaMemcpy(dst, _gbuf.vBitflag, sizeof(int)* nv, cudaMemcpyDeviceToHost);
+	gpu_manager_t::download_buf(dst, _gbuf.vBitflag, sizeof(int) * nv);
 }
 
 void Grid::setVflags(int nv, int *src)
 {
-	cudaMemcpy(_gbuf.vBitflag, src, sizeof(int)* nv, cudaMemcpyHostToDevice);
+	gpu_manager_t::upload_buf(_gbuf.vBitflag, src, sizeof(int) * nv);
 }
 
 void Grid::getEflags(int nv, int* dst)
 {
-	cudaMemcpy(dst, _gbuf.eBitflag, sizeof(int) * nv, cudaMemcpyDeviceToHost);
+	gpu_manager_t::download_buf(dst, _gbuf.eBitflag, sizeof(int) * nv);
 }
 
 
 void Grid::v3_init(double* v[3], double val[3])
 {
+	if (onHost()) { v3_init_host(n_gsvertices, v, val); return; }
 	for (int i = 0; i < 3; i++) {
 		init_array(v[i], val[i], n_gsvertices);
 	}
@@ -2941,6 +3654,7 @@ void Grid::v3_init(double* v[3], double val[3])
 
 void Grid::v3_minus(double* a[3], double alpha, double* b[3])
 {
+	if (onHost()) { v3_axpby_host(n_nodes(), a, 1, a, -alpha, b); return; }
 	double* ax = a[0], *ay = a[1], *az = a[2];
 	double* bx = b[0], *by = b[1], *bz = b[2];
 	size_t grid_dim, block_dim;
@@ -2960,6 +3674,7 @@ void Grid::v3_minus(double* a[3], double alpha, double* b[3])
 
 void Grid::v3_minus(double* dst[3], double* a[3], double alpha, double* b[3])
 {
+	if (onHost()) { v3_axpby_host(n_nodes(), dst, 1, a, -alpha, b); return; }
 	double* ax = a[0], *ay = a[1], *az = a[2];
 	double* bx = b[0], *by = b[1], *bz = b[2];
 	double* dstx = dst[0], *dsty = dst[1], *dstz = dst[2];
@@ -2981,6 +3696,7 @@ void Grid::v3_minus(double* dst[3], double* a[3], double alpha, double* b[3])
 
 void Grid::v3_add(double* a[3], double alpha, double* b[3])
 {
+	if (onHost()) { v3_axpby_host(n_nodes(), a, 1, a, alpha, b); return; }
 	double* ax = a[0], *ay = a[1], *az = a[2];
 	double* bx = b[0], *by = b[1], *bz = b[2];
 	size_t grid_dim, block_dim;
@@ -3000,6 +3716,7 @@ void Grid::v3_add(double* a[3], double alpha, double* b[3])
 
 void Grid::v3_add(double alpha, double* a[3], double beta, double* b[3])
 {
+	if (onHost()) { v3_axpby_host(n_nodes(), a, alpha, a, beta, b); return; }
 	double* ax = a[0], *ay = a[1], *az = a[2];
 	double* bx = b[0], *by = b[1], *bz = b[2];
 	size_t grid_dim, block_dim;
@@ -3019,6 +3736,7 @@ void Grid::v3_add(double alpha, double* a[3], double beta, double* b[3])
 
 double Grid::v3_dot(double* v[3], double* u[3])
 {
+	if (onHost()) return v3_dot_host(n_gsvertices, v, u);
 	double* tmp = (double*)getTempBuf(n_gsvertices / 100 * sizeof(double));
 	double s = dot(v[0], v[1], v[2], u[0], u[1], u[2], tmp, n_gsvertices);
 	return s;
@@ -3033,6 +3751,7 @@ double Grid::v3_diffdot(double* v1[3], double* v2[3], double* v3[3], double* v4[
 
 double Grid::v3_norm(double* v[3])
 {
+	if (onHost()) return sqrt(v3_dot_host(n_nodes(), v, v));
 	double* tmp = (double*)getTempBuf(n_gsvertices / 100 * sizeof(double));
 	double s = norm(v[0], v[1], v[2], tmp, n_nodes());
 	return s;
@@ -3048,6 +3767,7 @@ double grid::Grid::v3_normalize(double* v[3])
 void grid::Grid::v3_destroy(double* dstv[3])
 {
 	for (int i = 0; i < 3; i++) {
+		if (onHost()) { std::free(dstv[i]); continue; }
 		cudaFree(dstv[i]);
 	}
 	cuda_error_check;
@@ -3055,6 +3775,7 @@ void grid::Grid::v3_destroy(double* dstv[3])
 
 void Grid::v3_rand(double* v[3], double low, double upp)
 {
+	if (onHost()) { v3_rand_host(v, low, upp); return; }
 	randArray(v, 3, n_gsvertices, low, upp);
 }
 
@@ -3106,6 +3827,7 @@ double Grid::supportForceNorm(void)
 
 void Grid::v3_scale(double* v[3], double ampl)
 {
+	if (onHost()) { v3_axpby_host(n_nodes(), v, ampl, v, 0, v); return; }
 	double *vx = v[0], *vy = v[1], *vz = v[2];
 	size_t grid_dim, block_dim;
 	make_kernel_param(&grid_dim, &block_dim, n_nodes(), 512);
@@ -3125,6 +3847,7 @@ void Grid::v3_scale(double* v[3], double ampl)
 
 void Grid::v3_copy(double* vsrc[3], double* vdst[3])
 {
+	if (onHost()) { v3_axpby_host(n_nodes(), vdst, 1, vsrc, 0, vsrc); return; }
 	for (int i = 0; i < 3; i++) {
 		cudaMemcpy(vdst[i], vsrc[i], sizeof(double)*n_nodes(), cudaMemcpyDeviceToDevice);
 		cuda_error_check;
@@ -3158,6 +3881,37 @@ void HierarchyGrid::setDripMode(GlobalDripMode mode)
 	cudaMemcpyToSymbol(gdripmode, &modeid, sizeof(int));
 }
 
+void HierarchyGrid::setBackend(Backend backend)
+{
+	int backendid = backend;
+	std::cout << "--[TEST] backend id: " << backendid << std::endl;
+	Grid::_backend = backend;
+	// buffers of the grids built afterwards are allocated on host
+	gpu_manager_t::setHostMemory(backend == host_backend);
+}
+
+void HierarchyGrid::setPrecision(Precision precision)
+{
+	int precisionid = precision;
+	std::cout << "--[TEST] precision id: " << precisionid << std::endl;
+	if (precision == Grid::_precision) return;
+	Grid::_precision = precision;
+	if (_gridlayer.empty()) return;
+	// grids are built, move the coarse stencils to the new precision
+	for (int i = 1; i < _gridlayer.size(); i++) {
+		if (_gridlayer[i]->is_dummy()) continue;
+		_gridlayer[i]->alloc_stencil(get_gmem());
+	}
+	update_stencil();
+}
+
+void HierarchyGrid::setSolverMode(SolverMode mode)
+{
+	int modeid = mode;
+	std::cout << "--[TEST] solver mode id: " << modeid << std::endl;
+	_solvermode = mode;
+}
+
 void HierarchyGrid::setPrintAngle(float default_angle_ratio, float opt_angle_ratio)
 {
 	float sdefault = default_angle_ratio * M_PI;
@@ -3402,49 +4156,91 @@ void grid::Grid::uploadBgEleSymbol(void)
 }
 
 
-template<typename coeffdensity>
-__global__ void coeff2density_kernel(int nebitword, float mindensity, gBitSAT<unsigned int> esat, int ereso, float* g_dst, coeffdensity calc_node, const int* eidmap, const int* eflag) {
-	int tid = threadIdx.x + blockIdx.x * blockDim.x;
-	if (tid >= nebitword) return;
-
-	const unsigned int* ebit = esat._bitarray;
-	const int* sat = esat._chunksat;
+// device view of the element TileSAT of the finest layer, thread tid visits the voxel row tid % 64 of the leaf
+// tid / 64, so only the active tiles are launched and the ranks are the BitSAT ranks as on host
+struct gTileSAT {
+	static constexpr int tile_bits = grid::TileSAT::tile_bits;
+	static constexpr int tile_dim = grid::TileSAT::tile_dim;
+	static constexpr int tile_mask = grid::TileSAT::tile_mask;
+	const int* _root;
+	const grid::TileSAT::Leaf* _leaves;
+	const int* _rowsat;
+	int _nleaves;
+	int _reso;
+	int _ntile;
+
+	__host__ gTileSAT(const int* root, const grid::TileSAT::Leaf* leaves, const int* rowsat, int nleaves, int reso)
+		: _root(root), _leaves(leaves), _rowsat(rowsat), _nleaves(nleaves), _reso(reso), _ntile((reso + tile_mask) >> tile_bits)
+	{ }
+
+	__host__ __device__ index_t n_rows(void) const { return index_t(_nleaves) * tile_dim * tile_dim; }
+
+	// the active bits of the row tid, the id of its first voxel and the rank of its first active voxel
+	__device__ int row(index_t tid, index_t& rowbid, int& rank) const {
+		const grid::TileSAT::Leaf& leaf = _leaves[tid / (tile_dim * tile_dim)];
+		int ly = tid & tile_mask, lz = (tid >> tile_bits) & tile_mask;
+		int seg = (leaf.mask[lz] >> (ly * tile_dim)) & 0xff;
+		if (seg == 0) return 0;
+		int tpos[3] = { leaf.tileid % _ntile * tile_dim, leaf.tileid / _ntile % _ntile * tile_dim, leaf.tileid / _ntile / _ntile * tile_dim };
+		index_t row = tpos[1] + ly + index_t(tpos[2] + lz) * _reso;
+		rowbid = tpos[0] + row * _reso;
+		rank = _rowsat[row] + leaf.rowOffset[ly + lz * tile_dim];
+		return seg;
+	}
+
+	// the rank of id-th element, -1 if it is not active
+	__device__ int operator()(index_t id) const {
+		int pos[3] = { int(id % _reso), int(id / _reso % _reso), int(id / _reso / _reso) };
+		int leafid = _root[(pos[0] >> tile_bits) + ((pos[1] >> tile_bits) + (pos[2] >> tile_bits) * _ntile) * _ntile];
+		if (leafid == -1) return -1;
+		const grid::TileSAT::Leaf& leaf = _leaves[leafid];
+		int ly = pos[1] & tile_mask, lz = pos[2] & tile_mask, lx = pos[0] & tile_mask;
+		int seg = (leaf.mask[lz] >> (ly * tile_dim)) & 0xff;
+		if (!(seg & (1 << lx))) return -1;
+		return _rowsat[pos[1] + index_t(pos[2]) * _reso] + leaf.rowOffset[ly + lz * tile_dim] + __popc(seg & ((1 << lx) - 1));
+	}
+};
 
-	unsigned int eword = ebit[tid];
+template<typename coeffdensity>
+__global__ void coeff2density_kernel(gTileSAT esat, float mindensity, float* g_dst, coeffdensity calc_node, const int* eidmap, const int* eflag) {
+	index_t tid = threadIdx.x + index_t(blockIdx.x) * blockDim.x;
+	if (tid >= esat.n_rows()) return;
 
-	if (eword == 0) return;
+	index_t rowbid;
+	int eid;
+	int seg = esat.row(tid, rowbid, eid);
 
-	int eidoffset = sat[tid];
-	int ewordoffset = 0;
-	for (int j = 0; j < BitCount<unsigned int>::value; j++) {
-		if (read_gbit(eword, j)) {
-			int bid = tid * BitCount<unsigned int>::value + j;
-			int bpos[3] = { bid % ereso, bid % (ereso * ereso) / ereso, bid / (ereso * ereso) };
-			int eid = eidoffset + ewordoffset;
+	for (int lx = 0; seg != 0; lx++, seg >>= 1) {
+		if (seg & 1) {
+			index_t bid = rowbid + lx;
 			float node_value = calc_node(bid);
-			if (eidmap != nullptr) eid = eidmap[eid];
+			int egsid = eidmap != nullptr ? eidmap[eid] : eid;
 
 			// check the shell element of rho_e
 			node_value = clamp(node_value, mindensity, 1.f);
-			if (eflag[eid] & grid::Grid::mask_shellelement)
+			if (eflag[egsid] & grid::Grid::mask_shellelement)
 			{
 				node_value = 1;
 			}
-	     	// rhoknew = clamp(rhoknew, rhomin, 1.f);
-	     	// if (gEflag[0][eid] & grid::Grid::Bitmask::mask_shellelement) rhonew = 1;
-			g_dst[eid] = node_value;
-			ewordoffset++;
+			g_dst[egsid] = node_value;
+			eid++;
 		}
 	}
 }
 
-void Grid::coeff2density(void)
+template<int Order>
+void Grid::coeff2density_order(void)
 {
+	if (_layer != 0) return;
+
+	if (onHost()) {
+		coeff2density_host();
+		return;
+	}
+
 	size_t free_mem, total_mem;
 	cudaMemGetInfo(&free_mem, &total_mem);
 	std::cout << "Free Memory: " << free_mem / (1024 * 1024) << " MB  |  Total Memory: " << total_mem / (1024 * 1024) << " MB" << std::endl;
-
-	if (_layer != 0) return;
 	// computation
 	float* cijk_value = _gbuf.coeffs;
 	float* knotx_ = _gbuf.KnotSer[0];
@@ -3458,9 +4254,10 @@ void Grid::coeff2density(void)
 	float min_Density = _min_density;
 		
 	size_t grid_size, block_size;
-	make_kernel_param(&grid_size, &block_size, _gbuf.nword_ebits, 512);
+	gTileSAT esat(_gbuf.eTileRoot, _gbuf.eTileLeaves, _gbuf.eTileRowSat, _gbuf.n_etileleaves, _ereso);
+	make_kernel_param(&grid_size, &block_size, esat.n_rows(), 512);
 
-	auto calc_node = [=] __device__(int id) {
+	auto calc_node = [=] __device__(index_t id) {
 		int xCoordi = id % ereso;
 		int yCoordi = (id % (ereso * ereso)) / ereso;
 		int zCoordi = id / (ereso * ereso);
@@ -3469,35 +4266,35 @@ void Grid::coeff2density(void)
 		float val;
 		int i, j, k, ir, it, is, index;
 
-		float pNX[m_iM + 1];
-		float pNY[m_iM + 1];
-		float pNZ[m_iM + 1];
+		float pNX[Order + 1];
+		float pNY[Order + 1];
+		float pNZ[Order + 1];
 
 		// the first knot index (order ... order + partion + 1) in knotspan(1 ... 2*order + partion)
-		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + gorder[0];
-		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + gorder[0];
-		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + gorder[0];
+		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < gorder[0]) || (i > gnbasis[0]) || (j < gorder[0]) || (j > gnbasis[1]) || (k < gorder[0]) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = -0.2f;
 		}
 		else
 		{
-			SplineBasisX(pos[0], pNX);
-			SplineBasisY(pos[1], pNY);
-			SplineBasisZ(pos[2], pNZ);
+			SplineBasisX<Order>(pos[0], pNX);
+			SplineBasisY<Order>(pos[1], pNY);
+			SplineBasisZ<Order>(pos[2], pNZ);
 
 			val = 0.0f;
 			//index = i + j * m_im + k * m_im * m_in;
-			for (ir = i - gorder[0]; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - gorder[0]; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - gorder[0]; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						val += cijk_value[index] * pNX[ir - i + gorder[0]] * pNY[is - j + gorder[0]] * pNZ[it - k + gorder[0]];
+						val += cijk_value[index] * pNX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 					}
 				}
 			}
@@ -3509,11 +4306,9 @@ void Grid::coeff2density(void)
 		//return Heaviside(val);
 	};
 
-	gBitSAT<unsigned int> esat(_gbuf.eActiveBits, _gbuf.eActiveChunkSum);
-
 	init_array(_gbuf.rho_e, float{ 0 }, n_gselements);
 
-	coeff2density_kernel << <grid_size, block_size >> > (_gbuf.nword_ebits, min_Density, esat, _ereso, _gbuf.rho_e, calc_node, _gbuf.eidmap, _gbuf.eBitflag);
+	coeff2density_kernel << <grid_size, block_size >> > (esat, min_Density, _gbuf.rho_e, calc_node, _gbuf.eidmap, _gbuf.eBitflag);
 	cudaDeviceSynchronize();
 	cuda_error_check;
 
@@ -3535,38 +4330,204 @@ void Grid::coeff2density(void)
 	rhohost = nullptr;
 }
 
-template<typename Func>
-__global__ void ddensity2dcoeff_kernel(int nebitword, gBitSAT<unsigned int> esat, int ereso, Func func, const int* eidmap) {
-	int tid = threadIdx.x + blockIdx.x * blockDim.x;
-	if (tid >= nebitword) return;
+void Grid::coeff2density(void)
+{
+	// the densities no longer match the tracked coefficients, the next incremental update evaluates everything
+	_coeffsEvaluated.clear();
+	dispatchSplineOrder(n_order, [&](auto order) { coeff2density_order<decltype(order)::value>(); });
+}
 
-	const unsigned int* ebit = esat._bitarray;
-	const int* sat = esat._chunksat;
+template<typename coeffdensity, typename supportFunc>
+__global__ void coeff2density_incremental_kernel(gTileSAT esat, float mindensity, float* g_dst, coeffdensity calc_node, supportFunc in_dirty_support, const int* eidmap, const int* eflag, int* changed) {
+	index_t tid = threadIdx.x + index_t(blockIdx.x) * blockDim.x;
+	if (tid >= esat.n_rows()) return;
 
-	unsigned int eword = ebit[tid];
+	index_t rowbid;
+	int eid;
+	int seg = esat.row(tid, rowbid, eid);
 
-	if (eword == 0) return;
+	for (int lx = 0; seg != 0; lx++, seg >>= 1) {
+		if (!(seg & 1)) continue;
+		index_t bid = rowbid + lx;
+		int egsid = eidmap != nullptr ? eidmap[eid] : eid;
+		eid++;
+		if (!in_dirty_support(bid)) continue;
 
-	int eidoffset = sat[tid];
-	int ewordoffset = 0;
-	for (int j = 0; j < BitCount<unsigned int>::value; j++) {
-		if (read_gbit(eword, j)) {
-			int bid = tid * BitCount<unsigned int>::value + j;
-			int bpos[3] = { bid % ereso, bid % (ereso * ereso) / ereso, bid / (ereso * ereso) };
-			int eid = eidoffset + ewordoffset;
-			if (eidmap != nullptr) eid = eidmap[eid];
-			func(bid, eid);
-			
-			//g_sens[eid] = node_value;
-			ewordoffset++;
+		float node_value = calc_node(bid);
+
+		node_value = clamp(node_value, mindensity, 1.f);
+		if (eflag[egsid] & grid::Grid::mask_shellelement)
+		{
+			node_value = 1;
 		}
+		g_dst[egsid] = node_value;
+		// changed[0] counts the recomputed elements listed after it
+		changed[atomicAdd(changed, 1) + 1] = egsid;
 	}
 }
 
-void Grid::ddensity2dcoeff(void)
+template<int Order>
+int Grid::coeff2density_incremental_order(float tol)
+{
+	if (_layer != 0) return 0;
+
+	size_t nc = n_cijk();
+	std::vector<float> cnew(nc);
+	if (onHost()) {
+		std::copy(_gbuf.coeffs, _gbuf.coeffs + nc, cnew.begin());
+	}
+	else {
+		gpu_manager_t::download_buf(cnew.data(), _gbuf.coeffs, sizeof(float) * nc);
+	}
+
+	_changedElements.clear();
+
+	if (_coeffsEvaluated.size() != nc) {
+		coeff2density_order<Order>();
+		_coeffsEvaluated = cnew;
+		_changedElements.resize(n_gselements);
+		for (int i = 0; i < n_gselements; i++) _changedElements[i] = i;
+		return n_gselements;
+	}
+
+	// only coefficients beyond the tolerance are taken over, smaller moves accumulate until they cross it
+	const int nb[3] = { spbasis[0], spbasis[1], spbasis[2] };
+	std::vector<char> moved(nc, 0);
+	int nmoved = 0;
+	for (size_t i = 0; i < nc; i++) {
+		if (std::abs(cnew[i] - _coeffsEvaluated[i]) > tol) {
+			moved[i] = 1;
+			_coeffsEvaluated[i] = cnew[i];
+			nmoved++;
+		}
+	}
+	if (nmoved == 0) return 0;
+
+	// an element depends on the Order^3 coefficients starting at its support box q = span - Order,
+	// a moved coefficient c dirties the boxes c - Order + 1 ... c along each axis
+	const int nq[3] = { nb[0] - Order + 1, nb[1] - Order + 1, nb[2] - Order + 1 };
+	std::vector<char> dirtybox(size_t(nq[0]) * nq[1] * nq[2], 0);
+	for (int it = 0; it < nb[2]; it++) {
+		for (int is = 0; is < nb[1]; is++) {
+			for (int ir = 0; ir < nb[0]; ir++) {
+				if (!moved[ir + is * nb[0] + size_t(it) * nb[0] * nb[1]]) continue;
+				for (int qz = std::max(0, it - Order + 1); qz <= std::min(it, nq[2] - 1); qz++) {
+					for (int qy = std::max(0, is - Order + 1); qy <= std::min(is, nq[1] - 1); qy++) {
+						for (int qx = std::max(0, ir - Order + 1); qx <= std::min(ir, nq[0] - 1); qx++) {
+							dirtybox[qx + qy * nq[0] + size_t(qz) * nq[0] * nq[1]] = 1;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if (onHost()) {
+		coeff2density_host_masked_order<Order>(dirtybox.data(), _changedElements);
+		std::sort(_changedElements.begin(), _changedElements.end());
+		return _changedElements.size();
+	}
+
+	float* cijk_value = _gbuf.coeffs;
+	int ereso = _ereso;
+	float eh = elementLength();
+	float boxOrigin[3] = { _box[0][0], _box[0][1], _box[0][2] };
+	int nq0 = nq[0], nq1 = nq[1];
+
+	char* dirty_dev = (char*)getTempBuf1(dirtybox.size());
+	gpu_manager_t::upload_buf(dirty_dev, dirtybox.data(), dirtybox.size());
+	int* changed_dev = (int*)getTempBuf2(sizeof(int) * (n_gselements + 1));
+	cudaMemset(changed_dev, 0, sizeof(int));
+
+	auto in_dirty_support = [=] __device__(index_t id) {
+		int coord[3] = { int(id % ereso), int((id % (ereso * ereso)) / ereso), int(id / (ereso * ereso)) };
+		int q[3];
+		for (int i = 0; i < 3; i++) {
+			float pos = boxOrigin[i] + coord[i] * eh + 0.5 * eh;
+			int span = (int)((pos - gnBoundMin[i]) / gnstep[i]) + Order;
+			if (span < Order || span > gnbasis[i]) return false;
+			q[i] = span - Order;
+		}
+		return dirty_dev[q[0] + q[1] * nq0 + q[2] * nq0 * nq1] != 0;
+	};
+
+	auto calc_node = [=] __device__(index_t id) {
+		int xCoordi = id % ereso;
+		int yCoordi = (id % (ereso * ereso)) / ereso;
+		int zCoordi = id / (ereso * ereso);
+		float pos[3] = { boxOrigin[0] + xCoordi * eh + 0.5 * eh,boxOrigin[1] + yCoordi * eh + 0.5 * eh, boxOrigin[2] + zCoordi * eh + 0.5 * eh };
+
+		float pNX[Order + 1];
+		float pNY[Order + 1];
+		float pNZ[Order + 1];
+
+		// in_dirty_support already rejected the elements outside the knot range
+		int i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		int j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		int k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + Order;
+
+		SplineBasisX<Order>(pos[0], pNX);
+		SplineBasisY<Order>(pos[1], pNY);
+		SplineBasisZ<Order>(pos[2], pNZ);
+
+		float val = 0.0f;
+		for (int ir = i - Order; ir < i; ir++)
+		{
+			for (int is = j - Order; is < j; is++)
+			{
+				for (int it = k - Order; it < k; it++)
+				{
+					int index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
+					val += cijk_value[index] * pNX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
+				}
+			}
+		}
+		return val;
+	};
+
+	gTileSAT esat(_gbuf.eTileRoot, _gbuf.eTileLeaves, _gbuf.eTileRowSat, _gbuf.n_etileleaves, _ereso);
+
+	size_t grid_size, block_size;
+	make_kernel_param(&grid_size, &block_size, esat.n_rows(), 512);
+	coeff2density_incremental_kernel << <grid_size, block_size >> > (esat, _min_density, _gbuf.rho_e, calc_node, in_dirty_support, _gbuf.eidmap, _gbuf.eBitflag, changed_dev);
+	cudaDeviceSynchronize();
+	cuda_error_check;
+
+	int nchanged = 0;
+	gpu_manager_t::download_buf(&nchanged, changed_dev, sizeof(int));
+	_changedElements.resize(nchanged);
+	if (nchanged > 0) gpu_manager_t::download_buf(_changedElements.data(), changed_dev + 1, sizeof(int) * nchanged);
+	std::sort(_changedElements.begin(), _changedElements.end());
+
+	return nchanged;
+}
+
+int Grid::coeff2density_incremental(float tol)
+{
+	return dispatchSplineOrder(n_order, [&](auto order) { return coeff2density_incremental_order<decltype(order)::value>(tol); });
+}
+
+template<typename Func>
+__global__ void ddensity2dcoeff_kernel(gTileSAT esat, Func func, const int* eidmap) {
+	index_t tid = threadIdx.x + index_t(blockIdx.x) * blockDim.x;
+	if (tid >= esat.n_rows()) return;
+
+	index_t rowbid;
+	int eid;
+	int seg = esat.row(tid, rowbid, eid);
+
+	for (int lx = 0; seg != 0; lx++, seg >>= 1) {
+		if (!(seg & 1)) continue;
+		func(rowbid + lx, eidmap != nullptr ? eidmap[eid] : eid);
+		eid++;
+	}
+}
+
+template<int Order>
+void Grid::ddensity2dcoeff_order(void)
 {
 	if (_layer != 0) return;
-	int order3 = m_iM * m_iM * m_iM;
+	int order3 = Order * Order * Order;
 
 	//int* coeffindex = (int*)getTempBuf1(sizeof(int) * n_gselements * order3);
 	//init_array(coeffindex, int{ 0 }, n_gselements * order3);
@@ -3601,9 +4562,10 @@ void Grid::ddensity2dcoeff(void)
 	float boxOrigin[3] = { _box[0][0], _box[0][1], _box[0][2] };
 
 	size_t grid_size, block_size;
-	make_kernel_param(&grid_size, &block_size, _gbuf.nword_ebits, 512);
+	gTileSAT esat(_gbuf.eTileRoot, _gbuf.eTileLeaves, _gbuf.eTileRowSat, _gbuf.n_etileleaves, _ereso);
+	make_kernel_param(&grid_size, &block_size, esat.n_rows(), 512);
 	
-	auto node_diff = [ = ] __device__(int id, int eid) {
+	auto node_diff = [ = ] __device__(index_t id, int eid) {
 		int xCoordi = id % ereso;
 		int yCoordi = (id % (ereso * ereso)) / ereso;
 		int zCoordi = id / (ereso * ereso);
@@ -3612,32 +4574,32 @@ void Grid::ddensity2dcoeff(void)
 		float val;
 		int i, j, k, ir, it, is, index;
 
-		float pNX[m_iM + 1];
-		float pNY[m_iM + 1];
-		float pNZ[m_iM + 1];
+		float pNX[Order + 1];
+		float pNY[Order + 1];
+		float pNZ[Order + 1];
 
 		// the first knot index (order ... order + partion + 1) in knotspan(1 ... 2*order + partion)
-		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + gorder[0];
-		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + gorder[0];
-		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + gorder[0];
+		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < gorder[0]) || (i > gnbasis[0]) || (j < gorder[0]) || (j > gnbasis[1]) || (k < gorder[0]) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = -0.2f;
 		}
 		else
 		{
-			SplineBasisX(pos[0], pNX);
-			SplineBasisY(pos[1], pNY);
-			SplineBasisZ(pos[2], pNZ);
+			SplineBasisX<Order>(pos[0], pNX);
+			SplineBasisY<Order>(pos[1], pNY);
+			SplineBasisZ<Order>(pos[2], pNZ);
 
 			val = 0.0f;
 			int count4coeff = 0;
-			for (ir = i - gorder[0]; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - gorder[0]; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - gorder[0]; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 						coeffindex[order3 * eid + count4coeff] = index;
@@ -3647,21 +4609,19 @@ void Grid::ddensity2dcoeff(void)
 						}
 						else
 						{
-							val = /*Dirac(rholist[eid]) * */rho_diff[eid] * pNX[ir - i + gorder[0]] * pNY[is - j + gorder[0]] * pNZ[it - k + gorder[0]];
+							val = /*Dirac(rholist[eid]) * */rho_diff[eid] * pNX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 							part2c_value[order3 * eid + count4coeff] = val;
 
 						}
 						count4coeff++;
-						//dc_tmp[index] = /* rho_diff[cur_element] */  pNX[ir - i + gorder[0]] * pNY[is - j + gorder[0]] * pNZ[it - k + gorder[0]];
+						//dc_tmp[index] = /* rho_diff[cur_element] */  pNX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 					}
 				}
 			}
 		}
 	};
 
-	gBitSAT<unsigned int> esat(_gbuf.eActiveBits, _gbuf.eActiveChunkSum);
-
-	ddensity2dcoeff_kernel << <grid_size, block_size >> > (_gbuf.nword_ebits, esat, _ereso, node_diff, _gbuf.eidmap);
+	ddensity2dcoeff_kernel << <grid_size, block_size >> > (esat, node_diff, _gbuf.eidmap);
 	cudaDeviceSynchronize();
 	cuda_error_check;
 
@@ -3720,16 +4680,28 @@ void Grid::ddensity2dcoeff(void)
 	c_sens = nullptr;
 }
 
-void Grid::ddensity2dcoeff_update(void)
+void Grid::ddensity2dcoeff(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { ddensity2dcoeff_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+void Grid::ddensity2dcoeff_update_order(void)
 {
 	if (_layer != 0) return;
+	if (onHost()) {
+		const float* dfield[1] = { _gbuf.g_sens };
+		float* dcoeff[1] = { _gbuf.c_sens };
+		dfield2dcoeff_host(1, dfield, dcoeff);
+		return;
+	}
 	// computation
 	float* dc_tmp;
 	cudaMalloc(&dc_tmp, sizeof(float) * n_cijk());
 	init_array(dc_tmp, float{ 0 }, n_cijk());
 	cuda_error_check;
 
-	int order3 = m_iM * m_iM * m_iM;
+	int order3 = Order * Order * Order;
 
 	float* cijk_value = _gbuf.coeffs;
 	float* knotx_ = _gbuf.KnotSer[0];
@@ -3746,9 +4718,10 @@ void Grid::ddensity2dcoeff_update(void)
 	float boxOrigin[3] = { _box[0][0], _box[0][1], _box[0][2] };
 
 	size_t grid_size, block_size;
-	make_kernel_param(&grid_size, &block_size, _gbuf.nword_ebits, 512);
+	gTileSAT esat(_gbuf.eTileRoot, _gbuf.eTileLeaves, _gbuf.eTileRowSat, _gbuf.n_etileleaves, _ereso);
+	make_kernel_param(&grid_size, &block_size, esat.n_rows(), 512);
 
-	auto node_diff = [=] __device__(int id, int eid) {
+	auto node_diff = [=] __device__(index_t id, int eid) {
 		int xCoordi = id % ereso;
 		int yCoordi = (id % (ereso * ereso)) / ereso;
 		int zCoordi = id / (ereso * ereso);
@@ -3757,44 +4730,41 @@ void Grid::ddensity2dcoeff_update(void)
 		float val;
 		int i, j, k, ir, it, is, index;
 
-		float pNX[m_iM + 1];
-		float pNY[m_iM + 1];
-		float pNZ[m_iM + 1];
+		float pNX[Order + 1];
+		float pNY[Order + 1];
+		float pNZ[Order + 1];
 
 		// the first knot index (order ... order + partion + 1) in knotspan(1 ... 2*order + partion)
-		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + gorder[0];
-		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + gorder[0];
-		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + gorder[0];
+		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < gorder[0]) || (i > gnbasis[0]) || (j < gorder[0]) || (j > gnbasis[1]) || (k < gorder[0]) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = -0.2f;
 		}
 		else
 		{
-			SplineBasisX(pos[0], pNX);
-			SplineBasisY(pos[1], pNY);
-			SplineBasisZ(pos[2], pNZ);
+			SplineBasisX<Order>(pos[0], pNX);
+			SplineBasisY<Order>(pos[1], pNY);
+			SplineBasisZ<Order>(pos[2], pNZ);
 
 			val = 0.0f;
 			int count4coeff = 0;
 			//index = i + j * m_im + k * m_im * m_in;
-			for (ir = i - gorder[0]; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - gorder[0]; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - gorder[0]; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						if (eflag[eid] & grid::Grid::mask_shellelement)
-						{
-							dc_tmp[index] += 0;
-						}
-						else
+						// several elements share a coefficient, the scatter must be atomic
+						if (!(eflag[eid] & grid::Grid::mask_shellelement))
 						{
-							val = /*Dirac(rholist[eid]) * */rho_diff[eid] * pNX[ir - i + gorder[0]] * pNY[is - j + gorder[0]] * pNZ[it - k + gorder[0]];
+							val = /*Dirac(rholist[eid]) * */rho_diff[eid] * pNX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 							//val = rho_diff[eid];
-							dc_tmp[index] += val;
+							atomicAdd(&dc_tmp[index], val);
 						}
 						count4coeff++;
 					}
@@ -3803,9 +4773,7 @@ void Grid::ddensity2dcoeff_update(void)
 		}
 	};
 
-	gBitSAT<unsigned int> esat(_gbuf.eActiveBits, _gbuf.eActiveChunkSum);
-
-	ddensity2dcoeff_kernel << <grid_size, block_size >> > (_gbuf.nword_ebits, esat, _ereso, node_diff, _gbuf.eidmap);
+	ddensity2dcoeff_kernel << <grid_size, block_size >> > (esat, node_diff, _gbuf.eidmap);
 	cudaDeviceSynchronize();
 	cuda_error_check;
 
@@ -3827,16 +4795,28 @@ void Grid::ddensity2dcoeff_update(void)
 	dc_host = nullptr;
 }
 
-void Grid::dvol2dcoeff(void)
+void Grid::ddensity2dcoeff_update(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { ddensity2dcoeff_update_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+void Grid::dvol2dcoeff_order(void)
 {
 	if (_layer != 0) return;
+	if (onHost()) {
+		const float* dfield[1] = { _gbuf.vol_sens };
+		float* dcoeff[1] = { _gbuf.volc_sens };
+		dfield2dcoeff_host(1, dfield, dcoeff);
+		return;
+	}
 	// computation
 	float* dc_tmp;
 	cudaMalloc(&dc_tmp, sizeof(float) * n_cijk());
 	init_array(dc_tmp, float{ 0 }, n_cijk());
 	cuda_error_check;
 
-	int order3 = m_iM * m_iM * m_iM;
+	int order3 = Order * Order * Order;
 
 	float* cijk_value = _gbuf.coeffs;
 	float* knotx_ = _gbuf.KnotSer[0];
@@ -3857,9 +4837,10 @@ void Grid::dvol2dcoeff(void)
 	//std::cout << "-- [TEST] " << n_gselements << std::endl;
 
 	size_t grid_size, block_size;
-	make_kernel_param(&grid_size, &block_size, _gbuf.nword_ebits, 512);
+	gTileSAT esat(_gbuf.eTileRoot, _gbuf.eTileLeaves, _gbuf.eTileRowSat, _gbuf.n_etileleaves, _ereso);
+	make_kernel_param(&grid_size, &block_size, esat.n_rows(), 512);
 
-	auto node1_diff = [=] __device__(int id, int eid) {
+	auto node1_diff = [=] __device__(index_t id, int eid) {
 		int xCoordi = id % ereso;
 		int yCoordi = (id % (ereso * ereso)) / ereso;
 		int zCoordi = id / (ereso * ereso);
@@ -3868,44 +4849,41 @@ void Grid::dvol2dcoeff(void)
 		float val;
 		int i, j, k, ir, it, is, index;
 
-		float pNX[m_iM + 1];
-		float pNY[m_iM + 1];
-		float pNZ[m_iM + 1];
+		float pNX[Order + 1];
+		float pNY[Order + 1];
+		float pNZ[Order + 1];
 
 		// the first knot index (order ... order + partion + 1) in knotspan(1 ... 2*order + partion)
-		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + gorder[0];
-		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + gorder[0];
-		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + gorder[0];
+		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < gorder[0]) || (i > gnbasis[0]) || (j < gorder[0]) || (j > gnbasis[1]) || (k < gorder[0]) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = -0.2f;
 		}
 		else
 		{
-			SplineBasisX(pos[0], pNX);
-			SplineBasisY(pos[1], pNY);
-			SplineBasisZ(pos[2], pNZ);
+			SplineBasisX<Order>(pos[0], pNX);
+			SplineBasisY<Order>(pos[1], pNY);
+			SplineBasisZ<Order>(pos[2], pNZ);
 
 			val = 0.0f;
 			int count4coeff = 0;
 			//index = i + j * m_im + k * m_im * m_in;
-			for (ir = i - gorder[0]; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - gorder[0]; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - gorder[0]; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						if (eflag[eid] & grid::Grid::mask_shellelement)
+						// several elements share a coefficient, the scatter must be atomic
+						if (!(eflag[eid] & grid::Grid::mask_shellelement))
 						{
-							dc_tmp[index] += 0;
-						}
-						else
-						{
-							val = vol_diff[eid] * pNX[ir - i + gorder[0]] * pNY[is - j + gorder[0]] * pNZ[it - k + gorder[0]];
+							val = vol_diff[eid] * pNX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 							//val = vol_diff[eid];
-							dc_tmp[index] += val;
+							atomicAdd(&dc_tmp[index], val);
 						}
 						count4coeff++;
 					}
@@ -3914,9 +4892,7 @@ void Grid::dvol2dcoeff(void)
 		}
 	};
 
-	gBitSAT<unsigned int> esat(_gbuf.eActiveBits, _gbuf.eActiveChunkSum);
-
-	ddensity2dcoeff_kernel << <grid_size, block_size >> > (_gbuf.nword_ebits, esat, _ereso, node1_diff, _gbuf.eidmap);
+	ddensity2dcoeff_kernel << <grid_size, block_size >> > (esat, node1_diff, _gbuf.eidmap);
 	cudaDeviceSynchronize();
 	cuda_error_check;
 
@@ -3938,6 +4914,24 @@ void Grid::dvol2dcoeff(void)
 	dc_host = nullptr;
 }
 
+void Grid::dvol2dcoeff(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { dvol2dcoeff_order<decltype(order)::value>(); });
+}
+
+void Grid::dsens2dcoeff(void)
+{
+	if (_layer != 0) return;
+	if (onHost()) {
+		const float* dfield[2] = { _gbuf.g_sens, _gbuf.vol_sens };
+		float* dcoeff[2] = { _gbuf.c_sens, _gbuf.volc_sens };
+		dfield2dcoeff_host(2, dfield, dcoeff);
+		return;
+	}
+	ddensity2dcoeff_update();
+	dvol2dcoeff();
+}
+
 template <class T>
 struct CudaAllocator {
 	using value_type = T;
@@ -4063,7 +5057,17 @@ void HierarchyGrid::lambdatest(void)
 	delete[] drr_data;
 }
 
-void Grid::compute_background_mcPoints_value(std::vector<float>& bgnode_x, std::vector<float>& bgnode_y, std::vector<float>& bgnode_z, std::vector<float>& spline_value, int mc_ereso, float beta)
+// dense traversal of n boxes, n may leave the int range
+template<typename Lambda>
+__global__ void traverse_boxes_kernel(index_t n, Lambda func) {
+	index_t tid = index_t(blockIdx.x) * blockDim.x + threadIdx.x;
+	if (tid < n) {
+		func(tid);
+	}
+}
+
+template<int Order>
+void Grid::compute_background_mcPoints_value_order(std::vector<float>& bgnode_x, std::vector<float>& bgnode_y, std::vector<float>& bgnode_z, std::vector<float>& spline_value, int mc_ereso, float beta)
 {
 	if (_layer != 0) return;
 
@@ -4090,59 +5094,60 @@ void Grid::compute_background_mcPoints_value(std::vector<float>& bgnode_x, std::
 	float* nodey;
 	float* nodez;
 	float* node_value;
-	int ereso3 = ereso * ereso * ereso;
-	int vreso3 = vreso * vreso * vreso;
+	// ereso^3 leaves the int range past 1290^3
+	index_t ereso3 = index_t(ereso) * ereso * ereso;
+	index_t vreso3 = index_t(vreso) * vreso * vreso;
 	float t = 0.25;
 	cudaMalloc(&node_value, sizeof(float) * ereso3);
-	init_array(node_value, float{ 0 }, ereso3);
+	cudaMemset(node_value, 0, sizeof(float) * ereso3);
 	cudaMalloc(&nodex, sizeof(float) * ereso3);
-	init_array(nodex, float{ 0 }, ereso3);
+	cudaMemset(nodex, 0, sizeof(float) * ereso3);
 	cudaMalloc(&nodey, sizeof(float) * ereso3);
-	init_array(nodey, float{ 0 }, ereso3);
+	cudaMemset(nodey, 0, sizeof(float) * ereso3);
 	cudaMalloc(&nodez, sizeof(float) * ereso3);
-	init_array(nodez, float{ 0 }, ereso3);
+	cudaMemset(nodez, 0, sizeof(float) * ereso3);
 	cuda_error_check;
 
 	size_t grid_size, block_size;
 	make_kernel_param(&grid_size, &block_size, ereso3, 512);
 
-	auto calc_node = [=] __device__(int id) {
-		int xCoordi = id % ereso;
-		int yCoordi = (id % (ereso * ereso)) / ereso;
-		int zCoordi = id / (ereso * ereso);
+	auto calc_node = [=] __device__(index_t id) {
+		int xCoordi = int(id % ereso);
+		int yCoordi = int((id % (ereso * ereso)) / ereso);
+		int zCoordi = int(id / (ereso * ereso));
 		float pos[3] = { boxOrispan[0] + xCoordi * ehx + 0.5 * ehx, boxOrispan[1] + yCoordi * ehy + 0.5 * ehy, boxOrispan[2] + zCoordi * ehz + 0.5 * ehz };
 
 		float val;
 		int i, j, k, ir, it, is, index;
 
-		float pNX[m_iM + 1];
-		float pNY[m_iM + 1];
-		float pNZ[m_iM + 1];
+		float pNX[Order + 1];
+		float pNY[Order + 1];
+		float pNZ[Order + 1];
 
 		// the first knot index (order ... order + partion + 1) in knotspan(1 ... 2*order + partion)
-		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + gorder[0];
-		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + gorder[0];
-		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + gorder[0];
+		i = (int)((pos[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((pos[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((pos[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < gorder[0]) || (i > gnbasis[0]) || (j < gorder[0]) || (j > gnbasis[1]) || (k < gorder[0]) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = -0.2f;
 		}
 		else
 		{
-			SplineBasisX(pos[0], pNX);
-			SplineBasisY(pos[1], pNY);
-			SplineBasisZ(pos[2], pNZ);
+			SplineBasisX<Order>(pos[0], pNX);
+			SplineBasisY<Order>(pos[1], pNY);
+			SplineBasisZ<Order>(pos[2], pNZ);
 
 			val = 0.0f;
-			for (ir = i - gorder[0]; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - gorder[0]; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - gorder[0]; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						val += cijk_value[index] * pNX[ir - i + gorder[0]] * pNY[is - j + gorder[0]] * pNZ[it - k + gorder[0]];
+						val += cijk_value[index] * pNX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 					}
 				}
 			}
@@ -4161,7 +5166,7 @@ void Grid::compute_background_mcPoints_value(std::vector<float>& bgnode_x, std::
 		//node_value[id] = cosf(2 * M_PI * t * pos[0]) + cosf(2 * M_PI * t * pos[1]) + cosf(2 * M_PI * t * pos[2]) + 0.1; // to verify the Marching cube
 	};
 
-	traverse_noret << < grid_size, block_size >> > (ereso3, calc_node);
+	traverse_boxes_kernel << < grid_size, block_size >> > (ereso3, calc_node);
 	cudaDeviceSynchronize();
 	cuda_error_check;
 
@@ -4207,25 +5212,28 @@ void Grid::compute_background_mcPoints_value(std::vector<float>& bgnode_x, std::
 	nodez = nullptr;
 }
 
-template<typename WeightRadius>
-__global__ void filterSensitivity_kernel(int nebitword, gBitSAT<unsigned int> esat, int ereso, const float* g_sens, float* g_dst, float Rfilter, WeightRadius fr, const int* eidmap) {
-	int tid = threadIdx.x + blockIdx.x * blockDim.x;
-	if (tid >= nebitword) return;
-
-	const unsigned int* ebit = esat._bitarray;
-	const int* sat = esat._chunksat;
+void Grid::compute_background_mcPoints_value(std::vector<float>& bgnode_x, std::vector<float>& bgnode_y, std::vector<float>& bgnode_z, std::vector<float>& spline_value, int mc_ereso, float beta)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_background_mcPoints_value_order<decltype(order)::value>(bgnode_x, bgnode_y, bgnode_z, spline_value, mc_ereso, beta); });
+}
 
-	unsigned int eword = ebit[tid];
+// the fields are interleaved in g_src, the field f of the element eid is at g_src[eid * NField + f]
+template<int NField, typename WeightRadius>
+__global__ void filterSensitivities_kernel(gTileSAT esat, const float* g_src, devArray_t<float*, NField> g_dst, float Rfilter, WeightRadius fr, const int* eidmap) {
+	index_t tid = threadIdx.x + index_t(blockIdx.x) * blockDim.x;
+	if (tid >= esat.n_rows()) return;
 
-	if (eword == 0) return;
+	index_t rowbid;
+	int eidoffset;
+	int seg = esat.row(tid, rowbid, eidoffset);
 
+	int ereso = esat._reso;
 	float R2 = Rfilter * Rfilter;
-	int eidoffset = sat[tid];
 	int ewordoffset = 0;
-	for (int j = 0; j < BitCount<unsigned int>::value; j++) {
-		if (read_gbit(eword, j)) {
-			int bid = tid * BitCount<unsigned int>::value + j;
-			int bpos[3] = { bid % ereso, bid % (ereso*ereso) / ereso, bid / (ereso * ereso) };
+	for (int j = 0; seg != 0; j++, seg >>= 1) {
+		if (seg & 1) {
+			index_t bid = rowbid + j;
+			int bpos[3] = { int(bid % ereso), int(bid % (ereso*ereso) / ereso), int(bid / (ereso * ereso)) };
 			int eid = eidoffset + ewordoffset;
 			// traverse its spatial neighbors
 			int R = Rfilter + 0.5;
@@ -4234,9 +5242,8 @@ __global__ void filterSensitivity_kernel(int nebitword, gBitSAT<unsigned int> es
 			int npos[3];
 
 			float weightSum = 0;
-			double g_sum = 0;
-
-			// DEBUG
+			double g_sum[NField];
+			for (int f = 0; f < NField; f++) g_sum[f] = 0;
 
 			for (int x = L; x <= R; x++) {
 
@@ -4262,7 +5269,7 @@ __global__ void filterSensitivity_kernel(int nebitword, gBitSAT<unsigned int> es
 						if (r2 > R2) continue;
 
 						// spatial neighbor bit id
-						int n_bid = npos[0] + npos[1] * ereso + npos[2] * ereso * ereso;
+						index_t n_bid = npos[0] + npos[1] * ereso + index_t(npos[2]) * ereso * ereso;
 
 						// spatial neighbor element id
 						int n_eid = esat(n_bid);
@@ -4272,21 +5279,20 @@ __global__ void filterSensitivity_kernel(int nebitword, gBitSAT<unsigned int> es
 
 						if (eidmap != nullptr) { n_eid = eidmap[n_eid]; }
 
-						// weighted sum
+						// weighted sum, one weight and one neighbor lookup for all the fields
 						float w = fr(sqrtf(r2 / R2));
 
-						g_sum += w * g_sens[n_eid];
+						const float* n_src = g_src + index_t(n_eid) * NField;
+						for (int f = 0; f < NField; f++) g_sum[f] += w * n_src[f];
 						weightSum += w;
 
 					}
 				}
 			} // traverse all spatial neighbor elements
 
-			g_sum /= weightSum;
-
 			if (eidmap != nullptr) eid = eidmap[eid];
 
-			g_dst[eid] = g_sum;
+			for (int f = 0; f < NField; f++) g_dst[f][eid] = g_sum[f] / weightSum;
 
 			ewordoffset++;
 		}
@@ -4295,58 +5301,65 @@ __global__ void filterSensitivity_kernel(int nebitword, gBitSAT<unsigned int> es
 	
 }
 
-void Grid::filterSensitivity(double radii)
-{
-	if (_layer != 0) return;
-	
-	size_t grid_size, block_size;
-
-	make_kernel_param(&grid_size, &block_size, _gbuf.nword_ebits, 512);
-
-	auto fr = [=] __device__(float r) {
-		float r2 = r * r;
-		return 1 - 6 * r2 + 8 * r2 * r - 3 * r2 * r2;
-	};
-
-	gBitSAT<unsigned int> esat(_gbuf.eActiveBits, _gbuf.eActiveChunkSum);
-
-	float* g_sens_copy = (float*)getTempBuf(sizeof(float)* n_gselements);
+// moves the fields into the interleaved copy and clears them, the inactive gs elements stay zero after the filter
+template<int NField>
+__global__ void interleaveFilterFields_kernel(int n, devArray_t<float*, NField> fields, float* dst) {
+	int tid = threadIdx.x + blockIdx.x * blockDim.x;
+	if (tid >= n) return;
+	for (int f = 0; f < NField; f++) {
+		dst[index_t(tid) * NField + f] = fields[f][tid];
+		fields[f][tid] = 0;
+	}
+}
 
-	cudaMemcpy(g_sens_copy, _gbuf.g_sens, sizeof(float) * n_gselements, cudaMemcpyDeviceToDevice);
+void Grid::filterSensitivity(double radii)
+{
+	float* sens[1] = { _gbuf.g_sens };
+	filterSensitivities(1, sens, radii);
+}
 
-	init_array(_gbuf.g_sens, float{ 0 }, n_gselements);
+void Grid::filterVolSensitivity(double radii)
+{
+	float* sens[1] = { _gbuf.vol_sens };
+	filterSensitivities(1, sens, radii);
+}
 
-	filterSensitivity_kernel << <grid_size, block_size >> > (_gbuf.nword_ebits, esat, _ereso, g_sens_copy, _gbuf.g_sens, radii, fr, _gbuf.eidmap);
+void Grid::filterSensitivities(int nfield, float* const sens[], double radii)
+{
+	if (_layer != 0) return;
 
-	cudaDeviceSynchronize();
+	if (_filterMode == separable_filter) { filterSensitivities_separable(nfield, sens, radii); return; }
 
-	clearBuf();
+	if (onHost()) { filterSensitivities_gather_host(nfield, sens, radii); return; }
 
-	cuda_error_check;
+	dispatchFilterFields(nfield, [&](auto nf) { filterSensitivities_gather<decltype(nf)::value>(sens, radii); });
 }
 
-void Grid::filterVolSensitivity(double radii)
+template<int NField>
+void Grid::filterSensitivities_gather(float* const sens[], double radii)
 {
-	if (_layer != 0) return;
-
 	size_t grid_size, block_size;
 
-	make_kernel_param(&grid_size, &block_size, _gbuf.nword_ebits, 512);
-
 	auto fr = [=] __device__(float r) {
 		float r2 = r * r;
 		return 1 - 6 * r2 + 8 * r2 * r - 3 * r2 * r2;
 	};
 
-	gBitSAT<unsigned int> esat(_gbuf.eActiveBits, _gbuf.eActiveChunkSum);
+	gTileSAT esat(_gbuf.eTileRoot, _gbuf.eTileLeaves, _gbuf.eTileRowSat, _gbuf.n_etileleaves, _ereso);
+
+	devArray_t<float*, NField> fields;
+	for (int f = 0; f < NField; f++) fields[f] = sens[f];
 
-	float* vol_sens_copy = (float*)getTempBuf(sizeof(float) * n_gselements);
+	// one scratch buffer for all the fields
+	float* sens_copy = (float*)getTempBuf(sizeof(float) * n_gselements * NField);
+
+	make_kernel_param(&grid_size, &block_size, n_gselements, 512);
 
-	cudaMemcpy(vol_sens_copy, _gbuf.vol_sens, sizeof(float) * n_gselements, cudaMemcpyDeviceToDevice);
+	interleaveFilterFields_kernel<NField> << <grid_size, block_size >> > (n_gselements, fields, sens_copy);
 
-	init_array(_gbuf.vol_sens, float{ 0 }, n_gselements);
+	make_kernel_param(&grid_size, &block_size, esat.n_rows(), 512);
 
-	filterSensitivity_kernel << <grid_size, block_size >> > (_gbuf.nword_ebits, esat, _ereso, vol_sens_copy, _gbuf.vol_sens, radii, fr, _gbuf.eidmap);
+	filterSensitivities_kernel << <grid_size, block_size >> > (esat, sens_copy, fields, radii, fr, _gbuf.eidmap);
 
 	cudaDeviceSynchronize();
 
@@ -4429,7 +5442,8 @@ __global__ void applyK_OTFA_kernel(int nv, devArray_t<double*, 3> u, devArray_t<
 __writef:
 	for (int i = 0; i < 3; i++) {
 		if (use_support && vifix) {
-			KeU[i] = gU[i][vid];
+			// identity on fixed nodes
+			KeU[i] = pU[i][vid];
 		}
 		f[i][vid] = KeU[i];
 	}
@@ -4437,6 +5451,7 @@ __writef:
 
 void Grid::applyK(double* u[3], double* f[3])
 {
+	if (onHost()) { applyK_host(u, f); return; }
 	use_grid();
 	if (_layer == 0) {
 		devArray_t<double*, 3> ulist{ u[0],u[1],u[2] };
@@ -4452,6 +5467,10 @@ void Grid::applyK(double* u[3], double* f[3])
 
 void grid::Grid::resetDirchlet(double* v_dev[3])
 {
+	if (onHost()) {
+		if (_layer == 0) resetDirchlet_host(v_dev);
+		return;
+	}
 	use_grid();
 	if (_layer == 0) {
 		devArray_t<double*, 3> vlist{ v_dev[0],v_dev[1],v_dev[2] };
@@ -4472,14 +5491,13 @@ void grid::Grid::resetDirchlet(double* v_dev[3])
 }
 
 __global__ void cubeGridSetSolidVertices_kernel(int ereso, const unsigned int* ebits, unsigned int* vbits) {
-	int tid = blockIdx.x*blockDim.x + threadIdx.x;
-	int ne = ereso * ereso * ereso;
+	index_t tid = index_t(blockIdx.x) * blockDim.x + threadIdx.x;
 	int vreso = ereso + 1;
-	int nv = vreso * vreso * vreso;
+	index_t nv = index_t(vreso) * vreso * vreso;
 
 	if (tid >= nv) return;
 
-	int vpos[3] = { tid % vreso, tid % (vreso * vreso) / vreso, tid / (vreso * vreso) };
+	int vpos[3] = { int(tid % vreso), int(tid % (vreso * vreso) / vreso), int(tid / (vreso * vreso)) };
 
 	bool has_valid = false;
 	for (int i = 0; i < 8; i++) {
@@ -4488,7 +5506,7 @@ __global__ void cubeGridSetSolidVertices_kernel(int ereso, const unsigned int* e
 			epos[0] >= ereso || epos[1] >= ereso || epos[2] >= ereso ||
 			epos[0] < 0 || epos[1] < 0 || epos[2] < 0
 			) continue;
-		int eid = epos[0] + epos[1] * ereso + epos[2] * ereso * ereso;
+		index_t eid = epos[0] + epos[1] * ereso + index_t(epos[2]) * ereso * ereso;
 		if (read_gbit(ebits, eid)) {
 			has_valid = true;
 			break;
@@ -4504,8 +5522,8 @@ __global__ void cubeGridSetSolidVertices_kernel(int ereso, const unsigned int* e
 void grid::cubeGridSetSolidVertices_g(int reso, const std::vector<unsigned int>& solid_ebit, std::vector<unsigned int>& solid_vbit)
 {
 	int vreso = reso + 1;
-	int nv = pow(vreso, 3);
-	int n_vword = snippet::Round< BitCount<unsigned int>::value >(nv) / BitCount<unsigned int>::value;
+	index_t nv = index_t(vreso) * vreso * vreso;
+	size_t n_vword = snippet::Round< BitCount<unsigned int>::value >(nv) / BitCount<unsigned int>::value;
 
 	unsigned int* g_ebits, *g_vbits;
 	cudaMalloc(&g_ebits, sizeof(unsigned int)*solid_ebit.size());
@@ -4531,9 +5549,9 @@ void grid::cubeGridSetSolidVertices_g(int reso, const std::vector<unsigned int>&
 }
 
 __global__ void setSolidElementFromFineGrid_kernel(int finereso, const unsigned int* ebitsfine, unsigned int* ebitscoarse) {
-	int tid = blockDim.x*blockIdx.x + threadIdx.x;
+	index_t tid = index_t(blockDim.x) * blockIdx.x + threadIdx.x;
 
-	int nvfine = finereso * finereso * finereso;
+	index_t nvfine = index_t(finereso) * finereso * finereso;
 
 	int coarsereso = finereso >> 1;
 
@@ -4542,11 +5560,11 @@ __global__ void setSolidElementFromFineGrid_kernel(int finereso, const unsigned
 	// solid fine elements encountered
 	if (read_gbit(ebitsfine, tid)) {
 		// fine coarse element position
-		int epos[3] = { tid %finereso, tid % (finereso*finereso) / finereso, tid / (finereso*finereso) };
+		int epos[3] = { int(tid % finereso), int(tid % (finereso*finereso) / finereso), int(tid / (finereso*finereso)) };
 		// coarse element position
 		for (int i = 0; i < 3; i++) epos[i] >>= 1;
 		// coarse element id
-		int vcoarse = epos[0] + epos[1] * coarsereso + epos[2] * coarsereso * coarsereso;
+		index_t vcoarse = epos[0] + epos[1] * coarsereso + index_t(epos[2]) * coarsereso * coarsereso;
 		// set solid bit flag
 		atomic_set_gbit(ebitscoarse, vcoarse);
 	}
@@ -4554,9 +5572,9 @@ __global__ void setSolidElementFromFineGrid_kernel(int finereso, const unsigned
 
 void grid::setSolidElementFromFineGrid_g(int finereso, const std::vector<unsigned int>& ebits_fine, std::vector<unsigned int>& ebits_coarse)
 {
-	int nefine = pow(finereso, 3);
-	int necoarse = pow(finereso / 2, 3);
-	int nword_coarse = snippet::Round<BitCount<unsigned int>::value>(necoarse) / BitCount<unsigned int>::value;
+	index_t nefine = index_t(finereso) * finereso * finereso;
+	index_t necoarse = index_t(finereso / 2) * (finereso / 2) * (finereso / 2);
+	size_t nword_coarse = snippet::Round<BitCount<unsigned int>::value>(necoarse) / BitCount<unsigned int>::value;
 
 	unsigned int* g_fine, *g_coarse;
 	cudaMalloc(&g_fine, snippet::Round<BitCount<unsigned int>::value>(nefine) / 8);
@@ -4565,9 +5583,8 @@ void grid::setSolidElementFromFineGrid_g(int finereso, const std::vector<unsigne
 	cudaMemcpy(g_fine, ebits_fine.data(), snippet::Round<BitCount<unsigned int>::value>(nefine) / 8, cudaMemcpyHostToDevice);
 	init_array(g_coarse, (unsigned int)(0), nword_coarse);
 
-	int ne_fine = pow(finereso, 3);
 	size_t grid_size, block_size;
-	make_kernel_param(&grid_size, &block_size, ne_fine, 512);
+	make_kernel_param(&grid_size, &block_size, nefine, 512);
 	setSolidElementFromFineGrid_kernel << <grid_size, block_size >> > (finereso, g_fine, g_coarse);
 	cudaDeviceSynchronize();
 	cuda_error_check;
@@ -4618,7 +5635,7 @@ __global__ void setV2VCoarse_kernel(
 	int vresocoarse = ((vresofine - 1) >> skip) + 1;
 	int vresofine2 = vresofine * vresofine;
 	int vresocoarse2 = vresocoarse * vresocoarse;
-	int nvbfine = vresofine2 * vresofine;
+	index_t nvbfine = index_t(vresofine2) * vresofine;
 
 	unsigned int coarseRatio = (1 << skip) ;
 	double cr3 = coarseRatio * coarseRatio * coarseRatio;
@@ -4626,9 +5643,9 @@ __global__ void setV2VCoarse_kernel(
 	if (word == 0) return;
 	for (int ji = 0; ji < grid::BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(word, ji)) continue;
-		int vbidfine = tid * grid::BitCount<unsigned int>::value + ji;
+		index_t vbidfine = index_t(tid) * grid::BitCount<unsigned int>::value + ji;
 		if (vbidfine >= nvbfine) continue;
-		int vposfine[3] = { vbidfine % vresofine, vbidfine / vresofine % vresofine, vbidfine / vresofine2 };
+		int vposfine[3] = { int(vbidfine % vresofine), int(vbidfine / vresofine % vresofine), int(vbidfine / vresofine2) };
 		int vposInE[3] = { (vposfine[0] % coarseRatio), (vposfine[1] % coarseRatio), (vposfine[2] % coarseRatio) };
 		int vidfine = vsatfine[vbidfine];
 		// traverse coarse element vertex
@@ -4642,7 +5659,7 @@ __global__ void setV2VCoarse_kernel(
 					(vposfine[1] - vposInE[1]) / coarseRatio + i % 4 / 2,
 					(vposfine[2] - vposInE[2]) / coarseRatio + i / 4
 				};
-				int vcoarsebitid = vcoarsebitpos[0] + vcoarsebitpos[1] * vresocoarse + vcoarsebitpos[2] * vresocoarse2;
+				index_t vcoarsebitid = vcoarsebitpos[0] + vcoarsebitpos[1] * vresocoarse + index_t(vcoarsebitpos[2]) * vresocoarse2;
 				vidcoarse = vsatcoarse(vcoarsebitid);
 			}
 			v2vcoarse[i][vidfine] = vidcoarse;
@@ -4708,7 +5725,7 @@ __global__ void setV2VFine_kernel(int nvcoarseword,
 
 	int vresofine = (vresocoarse - 1) * ncoarse + 1;
 
-	int nvbit = vresocoarse * vresocoarse * vresocoarse;
+	index_t nvbit = index_t(vresocoarse) * vresocoarse * vresocoarse;
 
 	unsigned int coarseword = vsatcoarse._bitarray[tid];
 
@@ -4716,13 +5733,13 @@ __global__ void setV2VFine_kernel(int nvcoarseword,
 
 	for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(coarseword, ji)) continue;
-		int vcoarsebid = tid * BitCount<unsigned int>::value + ji;
+		index_t vcoarsebid = index_t(tid) * BitCount<unsigned int>::value + ji;
 
 		if (vcoarsebid >= nvbit) continue;
 
 		int vidcoarse = vsatcoarse[vcoarsebid];
 
-		int vcoarsepos[3] = { vcoarsebid % vresocoarse, vcoarsebid / vresocoarse % vresocoarse, vcoarsebid / vresocoarse2 };
+		int vcoarsepos[3] = { int(vcoarsebid % vresocoarse), int(vcoarsebid / vresocoarse % vresocoarse), int(vcoarsebid / vresocoarse2) };
 
 		if (vcoarsepos[0] < 0 || vcoarsepos[0] >= vresocoarse ||
 			vcoarsepos[1] < 0 || vcoarsepos[1] >= vresocoarse ||
@@ -4743,7 +5760,7 @@ __global__ void setV2VFine_kernel(int nvcoarseword,
 				continue;
 			}
 
-			int vfinenei_id = vfineneipos[0] + vfineneipos[1] * vresofine + vfineneipos[2] * vresofine * vresofine;
+			index_t vfinenei_id = vfineneipos[0] + vfineneipos[1] * vresofine + index_t(vfineneipos[2]) * vresofine * vresofine;
 
 			//if (!read_gbit(vsatcoarse._bitarray, vfinenei_id)) continue;
 			//int vidfine = vsatcoarse[vfinenei_id];
@@ -4809,17 +5826,17 @@ __global__ void setV2VFineC_kernel(int nvcoarseword,int vresocoarse, gBitSAT<uns
 
 	unsigned int word = vsatcoarse._bitarray[tid];
 
-	int nvbit = vresocoarse * vresocoarse * vresocoarse;
+	index_t nvbit = index_t(vresocoarse) * vresocoarse * vresocoarse;
 
 	if (word == 0) return;
 
 	for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(word, ji)) continue;
-		int vcoarsebid = tid * BitCount<unsigned int>::value + ji;
+		index_t vcoarsebid = index_t(tid) * BitCount<unsigned int>::value + ji;
 		if (vcoarsebid >= nvbit) continue;
 		int vidcoarse = vsatcoarse[vcoarsebid];
 		
-		int vfinepos[3] = { vcoarsebid % vresocoarse * 4, vcoarsebid / vresocoarse % vresocoarse * 4, vcoarsebid / (vresocoarse * vresocoarse) * 4 };
+		int vfinepos[3] = { int(vcoarsebid % vresocoarse * 4), int(vcoarsebid / vresocoarse % vresocoarse * 4), int(vcoarsebid / (vresocoarse * vresocoarse) * 4) };
 		if (vfinepos[0] >= vresofinefine || vfinepos[1] >= vresofinefine || vfinepos[2] >= vresofinefine) continue;
 
 		for (int k = 0; k < 64; k++) {
@@ -4878,17 +5895,17 @@ __global__ void setV2E_kernel(int nvword, int nvvalid, int nevalid, int vreso, g
 	int ereso = vreso - 1;
 	if (tid >= nvword) return;
 
-	int nvbit = vreso * vreso * vreso;
+	index_t nvbit = index_t(vreso) * vreso * vreso;
 
 	unsigned int vbitword = vrtsat._bitarray[tid];
 	if (vbitword == 0) return;
 
 	for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(vbitword, ji)) continue;
-		int vbitid = tid * BitCount<unsigned int>::value + ji;
+		index_t vbitid = index_t(tid) * BitCount<unsigned int>::value + ji;
 		if (vbitid >= nvbit) continue;
 		int vid = vrtsat[vbitid];
-		int vpos[3] = { vbitid % vreso, vbitid / vreso % vreso, vbitid / (vreso*vreso) };
+		int vpos[3] = { int(vbitid % vreso), int(vbitid / vreso % vreso), int(vbitid / (vreso*vreso)) };
 		for (int k = 0; k < 8; k++) {
 			int epos[3] = { vpos[0] + k % 2 - 1,vpos[1] + k / 2 % 2 - 1,vpos[2] + k / 4 - 1 };
 
@@ -4898,7 +5915,7 @@ __global__ void setV2E_kernel(int nvword, int nvvalid, int nevalid, int vreso, g
 				continue;
 			}
 
-			int ebitid = epos[0] + epos[1] * ereso + epos[2] * ereso * ereso;
+			index_t ebitid = epos[0] + epos[1] * ereso + index_t(epos[2]) * ereso * ereso;
 
 			int eid = elsat(ebitid);
 
@@ -4941,17 +5958,17 @@ __global__ void setV2V_kernel(int n_vword, int vreso, gBitSAT<unsigned int> vrts
 	int tid = blockDim.x*blockIdx.x + threadIdx.x;
 	if (tid >= n_vword) return;
 
-	int nvbit = vreso * vreso * vreso;
+	index_t nvbit = index_t(vreso) * vreso * vreso;
 
 	unsigned int vbitword = vrtsat._bitarray[tid];
 	if (vbitword == 0) return;
 
 	for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(vbitword, ji)) continue;
-		int vibid = tid * BitCount<unsigned int>::value + ji;
+		index_t vibid = index_t(tid) * BitCount<unsigned int>::value + ji;
 		if (vibid >= nvbit) continue;
 		int viid = vrtsat[vibid];
-		int vipos[3] = { vibid % vreso, vibid / vreso % vreso, vibid / (vreso * vreso) };
+		int vipos[3] = { int(vibid % vreso), int(vibid / vreso % vreso), int(vibid / (vreso * vreso)) };
 
 		for (int k = 0; k < 27; k++) {
 			int vjpos[3] = { vipos[0] + k % 3 - 1,vipos[1] + k / 3 % 3 - 1,vipos[2] + k / 9 - 1 };
@@ -4962,7 +5979,7 @@ __global__ void setV2V_kernel(int n_vword, int vreso, gBitSAT<unsigned int> vrts
 				continue;
 			}
 
-			int vjbid = vjpos[0] + vjpos[1] * vreso + vjpos[2] * vreso * vreso;
+			index_t vjbid = vjpos[0] + vjpos[1] * vreso + index_t(vjpos[2]) * vreso * vreso;
 
 			int vjid = vrtsat(vjbid);
 
@@ -5064,8 +6081,8 @@ __global__ void computeNodePos_kernel(int n_word, int vreso, gBitSAT<unsigned in
 
 	for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(word, ji)) continue;
-		int vbid = tid * BitCount<unsigned int>::value + ji;
-		int vpos[3] = { vbid % vreso, vbid / vreso % vreso, vbid / vreso / vreso };
+		index_t vbid = index_t(tid) * BitCount<unsigned int>::value + ji;
+		int vpos[3] = { int(vbid % vreso), int(vbid / vreso % vreso), int(vbid / vreso / vreso) };
 		int vid = vrtsat[vbid];
 		for (int k = 0; k < 3; k++) {
 			pos[k][vid] = orig[k] + eh * vpos[k];
@@ -5130,8 +6147,8 @@ __global__ void computeElementPos_kernel(int n_word, int vreso, gBitSAT<unsigned
 
 	for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(word, ji)) continue;
-		int ebid = tid * BitCount<unsigned int>::value + ji;
-		int epos[3] = { ebid % ereso, ebid / ereso % ereso, ebid / ereso / ereso };
+		index_t ebid = index_t(tid) * BitCount<unsigned int>::value + ji;
+		int epos[3] = { int(ebid % ereso), int(ebid / ereso % ereso), int(ebid / ereso / ereso) };
 		int eid = elesat[ebid];
 		for (int k = 0; k < 3; k++) {
 			pos[k][eid] = orig[k] + eh * epos[k] + 0.5 * eh;
@@ -5222,8 +6239,8 @@ __global__ void computeElementPos2_kernel(int n_word, int vreso, gBitSAT<unsigne
 
 	for (int ji = 0; ji < BitCount<unsigned int>::value; ji++) {
 		if (!read_gbit(word, ji)) continue;
-		int ebid = tid * BitCount<unsigned int>::value + ji;
-		int epos[3] = { ebid % ereso, ebid / ereso % ereso, ebid / ereso / ereso };
+		index_t ebid = index_t(tid) * BitCount<unsigned int>::value + ji;
+		int epos[3] = { int(ebid % ereso), int(ebid / ereso % ereso), int(ebid / ereso / ereso) };
 		int eid = elesat[ebid];
 		if (eflag[eid] & grid::Grid::mask_shellelement)
 		{
@@ -5471,6 +6488,10 @@ void grid::Grid::applyAjointK(double* usrc[3], double* fdst[3])
 void grid::Grid::v3_create(double* dstv[3])
 {
 	for (int i = 0; i < 3; i++) {
+		if (onHost()) {
+			dstv[i] = (double*)std::aligned_alloc(64, snippet::Round<64>(sizeof(double) * n_gsvertices));
+			continue;
+		}
 		cudaMalloc(&dstv[i], sizeof(double) * n_gsvertices);
 	}
 }
@@ -5706,7 +6727,8 @@ double grid::Grid::densityDiscretiness(void)
 	return Md;
 }
 
-void grid::Grid::compute_spline_surface_point_normal(void)
+template<int Order>
+void grid::Grid::compute_spline_surface_point_normal_order(void)
 {
 	auto calc_normal = [=] __device__(int node_id) {
 		float p[3] = { 0.f };
@@ -5717,18 +6739,18 @@ void grid::Grid::compute_spline_surface_point_normal(void)
 
 		for (i = 0; i < 3; i++) p[i] = gpu_SurfacePoints[i][node_id];
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			normal[0] = 0.0f;
 			normal[1] = 0.0f;
@@ -5736,26 +6758,26 @@ void grid::Grid::compute_spline_surface_point_normal(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);  // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX); // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);  // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX); // 2 means the first order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 
-						normal[0] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal[1] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal[2] += gpu_cijk[index] * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal[0] += gpu_cijk[index] * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal[1] += gpu_cijk[index] * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal[2] += gpu_cijk[index] * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 					}
 				}
 			}
@@ -5797,7 +6819,13 @@ void grid::Grid::compute_spline_surface_point_normal(void)
 #endif
 }
 
-float grid::Grid::correct_spline_surface_point_normal_direction(float beta)
+void grid::Grid::compute_spline_surface_point_normal(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_surface_point_normal_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+float grid::Grid::correct_spline_surface_point_normal_direction_order(float beta)
 {
 	float count = 1;
 	float* direction_tmp;
@@ -5823,33 +6851,33 @@ float grid::Grid::correct_spline_surface_point_normal_direction(float beta)
 		float val;
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM + 1], NX_delta[m_iM + 1];
-		float NY[m_iM + 1], NY_delta[m_iM + 1];
-		float NZ[m_iM + 1], NZ_delta[m_iM + 1];
+		float NX[Order + 1], NX_delta[Order + 1];
+		float NY[Order + 1], NY_delta[Order + 1];
+		float NZ[Order + 1], NZ_delta[Order + 1];
 
-		i = (int)((p_delta[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p_delta[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p_delta[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p_delta[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p_delta[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p_delta[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = -0.1f;
 		}
 		else
 		{
-			SplineBasisX(p_delta[0], NX_delta);
-			SplineBasisY(p_delta[1], NY_delta);
-			SplineBasisZ(p_delta[2], NZ_delta);
+			SplineBasisX<Order>(p_delta[0], NX_delta);
+			SplineBasisY<Order>(p_delta[1], NY_delta);
+			SplineBasisZ<Order>(p_delta[2], NZ_delta);
 
 			val = 0.0f;
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						val += gpu_cijk[index] * NX_delta[ir - i + m_iM] * NY_delta[is - j + m_iM] * NZ_delta[it - k + m_iM];
+						val += gpu_cijk[index] * NX_delta[ir - i + Order] * NY_delta[is - j + Order] * NZ_delta[it - k + Order];
 					}
 				}
 			}
@@ -5942,6 +6970,11 @@ float grid::Grid::correct_spline_surface_point_normal_direction(float beta)
 	return count;
 }
 
+float grid::Grid::correct_spline_surface_point_normal_direction(float beta)
+{
+	return dispatchSplineOrder(n_order, [&](auto order) { return correct_spline_surface_point_normal_direction_order<decltype(order)::value>(beta); });
+}
+
 void grid::Grid::compute_selfsupp_flag_actual(void)
 {
 	float default_print_angle = _default_print_angle;
@@ -6040,7 +7073,8 @@ void grid::Grid::compute_selfsupp_flag_virtual(void)
 #endif
 }
 
-void grid::Grid::compute_spline_surface_point_normal_norm_dcoeff(void)
+template<int Order>
+void grid::Grid::compute_spline_surface_point_normal_norm_dcoeff_order(void)
 {
 	float* normdc_tmp;
 	cudaMalloc(&normdc_tmp, sizeof(float) * n_cijk());
@@ -6080,18 +7114,18 @@ void grid::Grid::compute_spline_surface_point_normal_norm_dcoeff(void)
 
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			normal_der_cijk[0] = 0.0f;
 			normal_der_cijk[1] = 0.0f;
@@ -6099,28 +7133,28 @@ void grid::Grid::compute_spline_surface_point_normal_norm_dcoeff(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);  // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX); // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);  // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX); // 2 means the first order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						normal_der_cijk[0] = direction * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_der_cijk[1] = direction * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_der_cijk[2] = direction * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal_der_cijk[0] = direction * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal_der_cijk[1] = direction * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal_der_cijk[2] = direction * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 
 						float s = dot(normal_vector, normal_der_cijk) / normal_vector_norm;
-						normdc_tmp[index] += s;
+						atomicAdd(&normdc_tmp[index], s);
 					}
 				}
 			}
@@ -6153,6 +7187,11 @@ void grid::Grid::compute_spline_surface_point_normal_norm_dcoeff(void)
 	normdc_host = nullptr;
 }
 
+void grid::Grid::compute_spline_surface_point_normal_norm_dcoeff(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_surface_point_normal_norm_dcoeff_order<decltype(order)::value>(); });
+}
+
 void grid::Grid::compute_spline_surface_point_normal_dcoeff(void)
 {
 
@@ -6327,7 +7366,8 @@ float grid::Grid::global_selfsupp_constraint(void)
 	return val;
 }
 
-void grid::Grid::compute_spline_selfsupp_constraint_dcoeff(void)
+template<int Order>
+void grid::Grid::compute_spline_selfsupp_constraint_dcoeff_order(void)
 {
 	if (_layer != 0) return;
 
@@ -6391,18 +7431,18 @@ void grid::Grid::compute_spline_selfsupp_constraint_dcoeff(void)
 
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			normal_dcijk[0] = 0.0f;
 			normal_dcijk[1] = 0.0f;
@@ -6410,27 +7450,27 @@ void grid::Grid::compute_spline_selfsupp_constraint_dcoeff(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);  // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX); // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);  // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX); // 2 means the first order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						float val = 0.f;
 						float up, down, dinner, inner;
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						normal_dcijk[0] = direction * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[1] = direction * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[2] = direction * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal_dcijk[0] = direction * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[1] = direction * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[2] = direction * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 						norm_dcijk = dot(normal_vector, normal_dcijk) / normal_vector_norm;
 
 						up = normal_dcijk[2] * normal_vector_norm - normal_vector[2] * norm_dcijk;
@@ -6471,7 +7511,7 @@ void grid::Grid::compute_spline_selfsupp_constraint_dcoeff(void)
 						{
 							val = doh(inner, func_para) * dinner;
 						}
-						dc_tmp[index] += val;
+						atomicAdd(&dc_tmp[index], val);
 					}
 				}
 			}
@@ -6503,7 +7543,13 @@ void grid::Grid::compute_spline_selfsupp_constraint_dcoeff(void)
 	dc_host = nullptr;
 }
 
-void grid::Grid::compute_spline_drip_constraint(void)
+void grid::Grid::compute_spline_selfsupp_constraint_dcoeff(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_selfsupp_constraint_dcoeff_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+void grid::Grid::compute_spline_drip_constraint_order(void)
 {
 	float print_angle = _opt_print_angle;
 	float angle_epsilon = drip_angle;
@@ -6532,21 +7578,21 @@ void grid::Grid::compute_spline_drip_constraint(void)
 			normal_vector[i] = gpu_surface_normal[i][node_id];
 		}
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float pPNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float pPNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
-		float pPNZ[m_iM] = { 0.f };
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float pPNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float pPNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
+		float pPNZ[Order] = { 0.f };
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			Hessian[0][0] = 0.0f;
 			Hessian[0][1] = 0.0f;
@@ -6560,37 +7606,37 @@ void grid::Grid::compute_spline_drip_constraint(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);   // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX);  // 2 means the first order derivative value
-			SplineBasisDeriX(p[0], 3, pPNX); // 3 means the second order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);   // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX);  // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 3, pPNX); // 3 means the second order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
-			SplineBasisDeriY(p[1], 3, pPNY); // 3 means the second order derivative value
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 3, pPNY); // 3 means the second order derivative value
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
-			SplineBasisDeriZ(p[2], 3, pPNZ); // 3 means the second order derivative value
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 3, pPNZ); // 3 means the second order derivative value
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 
-						Hessian[0][0] += gpu_cijk[index] * pPNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[1][1] += gpu_cijk[index] * NX[ir - i + m_iM] * pPNY[is - j + m_iM] * NZ[it - k + m_iM];			
-						Hessian[0][1] += gpu_cijk[index] * pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[1][0] += gpu_cijk[index] * pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
+						Hessian[0][0] += gpu_cijk[index] * pPNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						Hessian[1][1] += gpu_cijk[index] * NX[ir - i + Order] * pPNY[is - j + Order] * NZ[it - k + Order];			
+						Hessian[0][1] += gpu_cijk[index] * pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						Hessian[1][0] += gpu_cijk[index] * pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
 
-						Hessian[2][2] += gpu_cijk[index] * NX[ir - i + m_iM] * NY[is - j + m_iM] * pPNZ[it - k + m_iM];
-						Hessian[0][2] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
-						Hessian[1][2] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * pNZ[it - k + m_iM];
+						Hessian[2][2] += gpu_cijk[index] * NX[ir - i + Order] * NY[is - j + Order] * pPNZ[it - k + Order];
+						Hessian[0][2] += gpu_cijk[index] * pNX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
+						Hessian[1][2] += gpu_cijk[index] * NX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 						
-						Hessian[2][0] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
-						Hessian[2][1] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * pNZ[it - k + m_iM];
+						Hessian[2][0] += gpu_cijk[index] * pNX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
+						Hessian[2][1] += gpu_cijk[index] * NX[ir - i + Order] * pNY[is - j + Order] * pNZ[it - k + Order];
 					}
 				}
 			}
@@ -6665,6 +7711,11 @@ void grid::Grid::compute_spline_drip_constraint(void)
 #endif
 }
 
+void grid::Grid::compute_spline_drip_constraint(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_drip_constraint_order<decltype(order)::value>(); });
+}
+
 float grid::Grid::global_drip_constraint(void)
 {
 	float val = 0.f;
@@ -6716,7 +7767,8 @@ float grid::Grid::global_drip_constraint(void)
 }
 
 //  Deal with Dripping
-void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
+template<int Order>
+void grid::Grid::compute_spline_drip_constraint_dcoeff_order(void)
 {
 	if (_layer != 0) return;
 
@@ -6790,21 +7842,21 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
 
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float pPNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float pPNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
-		float pPNZ[m_iM] = { 0.f };
-
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
-
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float pPNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float pPNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
+		float pPNZ[Order] = { 0.f };
+
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
+
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			for (int ii = 0; ii < 9; ii++)
 			{
@@ -6813,23 +7865,23 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);   // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX);  // 2 means the first order derivative value
-			SplineBasisDeriX(p[0], 3, pPNX); // 3 means the second order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);   // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX);  // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 3, pPNX); // 3 means the second order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
-			SplineBasisDeriY(p[1], 3, pPNY); // 3 means the second order derivative value
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 3, pPNY); // 3 means the second order derivative value
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
-			SplineBasisDeriZ(p[2], 3, pPNZ); // 3 means the second order derivative value
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 3, pPNZ); // 3 means the second order derivative value
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						float val = 0.f;
 						float up = 0.f, down = 0.f;
@@ -6841,9 +7893,9 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 
 						// for part.1 h_function
-						normal_dcijk[0] = direction * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[1] = direction * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[2] = direction * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal_dcijk[0] = direction * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[1] = direction * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[2] = direction * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 						norm_dcijk = dot(normal_vector, normal_dcijk) / normal_vector_norm;
 
 						up = normal_dcijk[2] * normal_vector_norm - normal_vector[2] * norm_dcijk;
@@ -6855,10 +7907,10 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
 						dh_ = ddrip_upside(hinner, func_drip_mu, angle_epsilon);
 
 						// for part.2 tilde_q
-						hessian_dcijk[0] += pPNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[4] += NX[ir - i + m_iM] * pPNY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[1] += pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[3] += pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
+						hessian_dcijk[0] += pPNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[4] += NX[ir - i + Order] * pPNY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[1] += pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[3] += pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
 
 						inner1 = hessian_vector[0];
 						inner2 = hessian_vector[0] * hessian_vector[4] - hessian_vector[1] * hessian_vector[3];
@@ -6882,7 +7934,7 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
 						{
 							val = dh_ * hdinner * tilde_q1 * tilde_q2 + h_ * dtilde_q1 * dinner1 * tilde_q2 + h_ * tilde_q1 * dtilde_q2 * dinner2;
 						}
-						dc_tmp[index] += val;
+						atomicAdd(&dc_tmp[index], val);
 					}
 				}
 			}
@@ -6924,7 +7976,13 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
 	dc_host = nullptr;
 }
 
-void grid::Grid::compute_spline_drip_constraint_test(void)
+void grid::Grid::compute_spline_drip_constraint_dcoeff(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_drip_constraint_dcoeff_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+void grid::Grid::compute_spline_drip_constraint_test_order(void)
 {
 	float print_angle = _opt_print_angle;
 	float angle_epsilon = drip_angle;
@@ -6956,75 +8014,11 @@ void grid::Grid::compute_spline_drip_constraint_test(void)
 			normal_vector[i] = gpu_surface_normal[i][node_id];
 		}
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float pPNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float pPNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
-		float pPNZ[m_iM] = { 0.f };
-
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
-
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
-		{
-			Hessian[0][0] = 0.0f;
-			Hessian[0][1] = 0.0f;
-			Hessian[0][2] = 0.0f;
-			Hessian[1][0] = 0.0f;
-			Hessian[1][1] = 0.0f;
-			Hessian[1][2] = 0.0f;
-			Hessian[2][0] = 0.0f;
-			Hessian[2][1] = 0.0f;
-			Hessian[2][2] = 0.0f;
-		}
-		else
-		{
-			SplineBasisDeriX(p[0], 1, NX);   // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX);  // 2 means the first order derivative value
-			SplineBasisDeriX(p[0], 3, pPNX); // 3 means the second order derivative value
-
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
-			SplineBasisDeriY(p[1], 3, pPNY); // 3 means the second order derivative value
-
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
-			SplineBasisDeriZ(p[2], 3, pPNZ); // 3 means the second order derivative value
-
-			for (ir = i - m_iM; ir < i; ir++)
-			{
-				for (is = j - m_iM; is < j; is++)
-				{
-					for (it = k - m_iM; it < k; it++)
-					{
-						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-
-						Hessian[0][0] += gpu_cijk[index] * pPNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[1][1] += gpu_cijk[index] * NX[ir - i + m_iM] * pPNY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[0][1] += gpu_cijk[index] * pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[1][0] += gpu_cijk[index] * pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-
-						Hessian[2][2] += gpu_cijk[index] * NX[ir - i + m_iM] * NY[is - j + m_iM] * pPNZ[it - k + m_iM];
-						Hessian[0][2] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
-						Hessian[1][2] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * pNZ[it - k + m_iM];
-
-						Hessian[2][0] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
-						Hessian[2][1] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * pNZ[it - k + m_iM];
-					}
-				}
-			}
-		}
-
+		// the Hessian was evaluated together with the normal by compute_spline_surface_point_fields
 		for (i = 0; i < 3; i++) {
 			for (j = 0; j < 3; j++)
 			{
-				int tmp = 3 * i + j;
-				gpu_surface_hessian[tmp][node_id] = Hessian[i][j];
+				Hessian[i][j] = gpu_surface_hessian[3 * i + j][node_id];
 			}
 		}
 
@@ -7108,7 +8102,13 @@ void grid::Grid::compute_spline_drip_constraint_test(void)
 #endif
 }
 
-void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
+void grid::Grid::compute_spline_drip_constraint_test(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_drip_constraint_test_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+void grid::Grid::compute_spline_drip_constraint_dcoeff_test_order(void)
 {
 	if (_layer != 0) return;
 
@@ -7186,21 +8186,21 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
 
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float pPNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float pPNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
-		float pPNZ[m_iM] = { 0.f };
-
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
-
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float pPNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float pPNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
+		float pPNZ[Order] = { 0.f };
+
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
+
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			for (int ii = 0; ii < 9; ii++)
 			{
@@ -7209,23 +8209,23 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);   // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX);  // 2 means the first order derivative value
-			SplineBasisDeriX(p[0], 3, pPNX); // 3 means the second order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);   // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX);  // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 3, pPNX); // 3 means the second order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
-			SplineBasisDeriY(p[1], 3, pPNY); // 3 means the second order derivative value
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 3, pPNY); // 3 means the second order derivative value
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
-			SplineBasisDeriZ(p[2], 3, pPNZ); // 3 means the second order derivative value
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 3, pPNZ); // 3 means the second order derivative value
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						float val = 0.f;
 						float up = 0.f, down = 0.f;
@@ -7239,9 +8239,9 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 
 						// for part.1 h_function
-						normal_dcijk[0] = direction * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[1] = direction * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[2] = direction * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal_dcijk[0] = direction * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[1] = direction * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[2] = direction * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 						norm_dcijk = dot(normal_vector, normal_dcijk) / normal_vector_norm;
 
 						up = normal_dcijk[2] * normal_vector_norm - normal_vector[2] * norm_dcijk;
@@ -7263,10 +8263,10 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
 						dg_ = ddrip_upside_test(gphi_x, gphi_y, gdphi_x, gdphi_y, func_drip_alpha);
 						
 						// for part.2 tilde_q
-						hessian_dcijk[0] += pPNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[4] += NX[ir - i + m_iM] * pPNY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[1] += pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[3] += pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
+						hessian_dcijk[0] += pPNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[4] += NX[ir - i + Order] * pPNY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[1] += pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[3] += pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
 
 						inner1 = hessian_vector[0];
 						inner2 = hessian_vector[0] * hessian_vector[4] - hessian_vector[1] * hessian_vector[3];
@@ -7304,7 +8304,7 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
 								val = dh_ * hdinner * tilde_q1 * tilde_q2 + h_ * dtilde_q1 * dinner1 * tilde_q2 + h_ * tilde_q1 * dtilde_q2 * dinner2;
 							}
 						}
-						dc_tmp[index] += val;
+						atomicAdd(&dc_tmp[index], val);
 					}
 				}
 			}
@@ -7338,6 +8338,11 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
 	dc_host = nullptr;
 }
 
+void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_drip_constraint_dcoeff_test_order<decltype(order)::value>(); });
+}
+
 //template<typename bgpoint>
 //__global__ void point_kernel(int nebitword, float mindensity, gBitSAT<unsigned int> esat, int ereso, float* g_dst[3], bgpoint calc_point, const int* eidmap, const int* eflag) {
 //	int tid = threadIdx.x + blockIdx.x * blockDim.x;
@@ -7446,7 +8451,113 @@ void grid::Grid::compute_spline_drip_constraint_dcoeff_test(void)
 //#endif
 //}
 
-void grid::Grid::compute_spline_background_ele_value(void)
+template<typename Lambda>
+__global__ void traverse_list_noret(int num, const int* list, Lambda func) {
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	if (tid >= num) return;
+	func(list[tid]);
+}
+
+template<typename Lambda>
+__global__ void traverse_list(float* dst, int num, const int* list, Lambda func) {
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	if (tid >= num) return;
+	int id = list[tid];
+	dst[id] = func(id);
+}
+
+// func over the n background elements, or only over the nband listed ones when the narrow band is on
+// (band != nullptr). dst is cleared outside the band so that sums over it only see the band
+template<typename Lambda>
+static void traverse_bg_noret(const int* band, int nband, int n, Lambda func) {
+	size_t grid_dim, block_dim;
+	if (band == nullptr) {
+		make_kernel_param(&grid_dim, &block_dim, n, 256);
+		traverse_noret << <grid_dim, block_dim >> > (n, func);
+	}
+	else if (nband > 0) {
+		make_kernel_param(&grid_dim, &block_dim, nband, 256);
+		traverse_list_noret << <grid_dim, block_dim >> > (nband, band, func);
+	}
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+template<typename Lambda>
+static void traverse_bg(float* dst, const int* band, int nband, int n, Lambda func) {
+	size_t grid_dim, block_dim;
+	if (band == nullptr) {
+		make_kernel_param(&grid_dim, &block_dim, n, 256);
+		traverse << <grid_dim, block_dim >> > (dst, n, func);
+	}
+	else {
+		init_array(dst, float{ 0 }, n);
+		if (nband > 0) {
+			make_kernel_param(&grid_dim, &block_dim, nband, 256);
+			traverse_list << <grid_dim, block_dim >> > (dst, nband, band, func);
+		}
+	}
+	cudaDeviceSynchronize();
+	cuda_error_check;
+}
+
+template<int Order>
+void grid::Grid::compute_spline_fields_order(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out)
+{
+	if (onHost()) {
+		compute_spline_fields_host_order<Order>(n, pts, list, nlist, out);
+		return;
+	}
+
+	const float* px = pts[0];
+	const float* py = pts[1];
+	const float* pz = pts[2];
+	SplineFieldsSoA dst = out;
+
+	auto calc_fields = [=] __device__(int node_id) {
+		float p[3] = { px[node_id], py[node_id], pz[node_id] };
+		float val, grad[3], hess[9];
+		SplineFields<Order>(p, val, grad, hess);
+		if (dst.value != nullptr) dst.value[node_id] = val;
+		for (int i = 0; i < 3; i++) if (dst.grad[i] != nullptr) dst.grad[i][node_id] = grad[i];
+		for (int i = 0; i < 9; i++) if (dst.hess[i] != nullptr) dst.hess[i][node_id] = hess[i];
+	};
+
+	traverse_bg_noret(list, nlist, n, calc_fields);
+}
+
+void grid::Grid::compute_spline_fields(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_fields_order<decltype(order)::value>(n, pts, list, nlist, out); });
+}
+
+void grid::Grid::compute_spline_background_ele_fields(void)
+{
+	if (_bgBandWidth > 0) select_bg_band_candidates();
+
+	SplineFieldsSoA out;
+	out.value = _gbuf.bg_ele_value;
+	for (int i = 0; i < 3; i++) out.grad[i] = _gbuf.bg_ele_normal[i];
+	for (int i = 0; i < 9; i++) out.hess[i] = _gbuf.bg_ele_hessian[i];
+	compute_spline_fields(n_elements, _gbuf.bg_ele, bg_band_list(), n_bg_band(), out);
+
+	if (_bgBandWidth > 0) {
+		std::vector<float> value(n_elements);
+		gpu_manager_t::download_buf(value.data(), _gbuf.bg_ele_value, sizeof(float) * n_elements);
+		rebuild_bg_band(value.data());
+	}
+}
+
+void grid::Grid::compute_spline_surface_point_fields(void)
+{
+	SplineFieldsSoA out;
+	for (int i = 0; i < 3; i++) out.grad[i] = _gbuf.surface_normal[i];
+	for (int i = 0; i < 9; i++) out.hess[i] = _gbuf.surface_hessian[i];
+	compute_spline_fields(n_surf_points(), _gbuf.surface_points, nullptr, 0, out);
+}
+
+template<int Order>
+void grid::Grid::compute_spline_background_ele_value_order(void)
 {
 	float* value_tmp;
 	cudaMalloc(&value_tmp, sizeof(float) * n_elements);
@@ -7456,47 +8567,47 @@ void grid::Grid::compute_spline_background_ele_value(void)
 	auto calc_value = [=] __device__(int node_id) {
 		float p[3] = { 0.f };
 		float normal[3] = { 0.f };
-		float val;
+		float val = 0.f;
 		int i, j, k, ir, it, is, index;
 		int d = 2;
 
 		for (i = 0; i < 3; i++) p[i] = gpu_bg_ele[i][node_id];
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = 0.0f;
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);  // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX); // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);  // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX); // 2 means the first order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 
-						val += gpu_cijk[index] * NX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];					}
+						val += gpu_cijk[index] * NX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];					}
 				}
 			}
 		}
@@ -7504,13 +8615,8 @@ void grid::Grid::compute_spline_background_ele_value(void)
 		return;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = spline_bg_ele->size();
-
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse_noret << <grid_dim, block_dim >> > (n, calc_value);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg_noret(bg_band_list(), n_bg_band(), n, calc_value);
 
 	float* spline_bg_node_value;
 	spline_bg_node_value = new float[n];
@@ -7521,6 +8627,8 @@ void grid::Grid::compute_spline_background_ele_value(void)
 	gpu_manager_t::pass_buf_to_matlab("spline_bg_ele_value", spline_bg_node_value, n);
 #endif
 
+	if (_bgBandWidth > 0) rebuild_bg_band(spline_bg_node_value);
+
 	init_array(_gbuf.bg_ele_value, float{ 0 }, n_elements);
 	cudaMemcpy(_gbuf.bg_ele_value, spline_bg_node_value, n_elements * sizeof(float), cudaMemcpyHostToDevice);
 	cuda_error_check;
@@ -7534,7 +8642,15 @@ void grid::Grid::compute_spline_background_ele_value(void)
 
 }
 
-void grid::Grid::compute_spline_background_ele_normal(void)
+void grid::Grid::compute_spline_background_ele_value(void)
+{
+	// the values are only evaluated where the previous ones may have reached the band
+	if (_bgBandWidth > 0) select_bg_band_candidates();
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_background_ele_value_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+void grid::Grid::compute_spline_background_ele_normal_order(void)
 {
 	auto calc_normal = [=] __device__(int node_id) {
 		float p[3] = { 0.f };
@@ -7545,18 +8661,18 @@ void grid::Grid::compute_spline_background_ele_normal(void)
 
 		for (i = 0; i < 3; i++) p[i] = gpu_bg_ele[i][node_id];
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			normal[0] = 0.0f;
 			normal[1] = 0.0f;
@@ -7564,26 +8680,26 @@ void grid::Grid::compute_spline_background_ele_normal(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);  // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX); // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);  // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX); // 2 means the first order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 
-						normal[0] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal[1] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal[2] += gpu_cijk[index] * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal[0] += gpu_cijk[index] * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal[1] += gpu_cijk[index] * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal[2] += gpu_cijk[index] * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 					}
 				}
 			}
@@ -7592,13 +8708,8 @@ void grid::Grid::compute_spline_background_ele_normal(void)
 		return;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = spline_bg_ele->size();
-
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse_noret << <grid_dim, block_dim >> > (n, calc_normal);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg_noret(bg_band_list(), n_bg_band(), n, calc_normal);
 
 #ifdef ENABLE_MATLAB
 	{
@@ -7620,7 +8731,13 @@ void grid::Grid::compute_spline_background_ele_normal(void)
 #endif
 }
 
-float grid::Grid::correct_spline_background_ele_normal_direction(float beta)
+void grid::Grid::compute_spline_background_ele_normal(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_background_ele_normal_order<decltype(order)::value>(); });
+}
+
+template<int Order>
+float grid::Grid::correct_spline_background_ele_normal_direction_order(float beta)
 {
 	float count = 1;
 	float* direction_tmp;
@@ -7648,61 +8765,61 @@ float grid::Grid::correct_spline_background_ele_normal_direction(float beta)
 		float val, val_delta;
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM + 1], NX_delta[m_iM + 1];
-		float NY[m_iM + 1], NY_delta[m_iM + 1];
-		float NZ[m_iM + 1], NZ_delta[m_iM + 1];
+		float NX[Order + 1], NX_delta[Order + 1];
+		float NY[Order + 1], NY_delta[Order + 1];
+		float NZ[Order + 1], NZ_delta[Order + 1];
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val = -0.1f;
 		}
 		else
 		{
-			SplineBasisX(p[0], NX);
-			SplineBasisY(p[1], NY);
-			SplineBasisZ(p[2], NZ);
+			SplineBasisX<Order>(p[0], NX);
+			SplineBasisY<Order>(p[1], NY);
+			SplineBasisZ<Order>(p[2], NZ);
 
 			val = 0.0f;
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						val += gpu_cijk[index] * NX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
+						val += gpu_cijk[index] * NX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
 					}
 				}
 			}
 		}
 
-		i = (int)((p_delta[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p_delta[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p_delta[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p_delta[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p_delta[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p_delta[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			val_delta = -0.1f;
 		}
 		else
 		{
-			SplineBasisX(p_delta[0], NX_delta);
-			SplineBasisY(p_delta[1], NY_delta);
-			SplineBasisZ(p_delta[2], NZ_delta);
+			SplineBasisX<Order>(p_delta[0], NX_delta);
+			SplineBasisY<Order>(p_delta[1], NY_delta);
+			SplineBasisZ<Order>(p_delta[2], NZ_delta);
 
 			val_delta = 0.0f;
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						val_delta += gpu_cijk[index] * NX_delta[ir - i + m_iM] * NY_delta[is - j + m_iM] * NZ_delta[it - k + m_iM];
+						val_delta += gpu_cijk[index] * NX_delta[ir - i + Order] * NY_delta[is - j + Order] * NZ_delta[it - k + Order];
 					}
 				}
 			}
@@ -7720,12 +8837,8 @@ float grid::Grid::correct_spline_background_ele_normal_direction(float beta)
 		direction_tmp[node_id] = s;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = n_elements;
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse_noret << < grid_dim, block_dim >> > (n, calc_node);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg_noret(bg_band_list(), n_bg_band(), n, calc_node);
 
 	float* direction_host = new float[n_elements];
 	cudaMemcpy(direction_host, direction_tmp, sizeof(float) * n_elements, cudaMemcpyDeviceToHost);
@@ -7766,9 +8879,7 @@ float grid::Grid::correct_spline_background_ele_normal_direction(float beta)
 			for (int i = 0; i < 3; i++)	gpu_bg_ele_normal[i][node_id] = -normal[i];
 			return;
 		};
-		traverse_noret << <grid_dim, block_dim >> > (n, calc_normal);
-		cudaDeviceSynchronize();
-		cuda_error_check;
+		traverse_bg_noret(bg_band_list(), n_bg_band(), n, calc_normal);
 
 #ifdef ENABLE_MATLAB
 		float* spline_bg_node_normal[3];
@@ -7787,6 +8898,11 @@ float grid::Grid::correct_spline_background_ele_normal_direction(float beta)
 	return count;
 }
 
+float grid::Grid::correct_spline_background_ele_normal_direction(float beta)
+{
+	return dispatchSplineOrder(n_order, [&](auto order) { return correct_spline_background_ele_normal_direction_order<decltype(order)::value>(beta); });
+}
+
 void grid::Grid::compute_background_selfsupp_flag_actual(void)
 {
 	float default_print_angle = _default_print_angle;
@@ -7820,12 +8936,8 @@ void grid::Grid::compute_background_selfsupp_flag_actual(void)
 		return s;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = n_elements;
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse << <grid_dim, block_dim >> > ((float*)_gbuf.bg_ele_flag, n, calc_node);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg((float*)_gbuf.bg_ele_flag, bg_band_list(), n_bg_band(), n, calc_node);
 
 #ifdef ENABLE_MATLAB 
 	float* host_spline_constrain = new float[n];
@@ -7869,12 +8981,8 @@ void grid::Grid::compute_background_selfsupp_flag_virtual(void)
 		return s;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = n_elements;
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse << <grid_dim, block_dim >> > ((float*)_gbuf.bg_ele_flag_virtual, n, calc_node);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg((float*)_gbuf.bg_ele_flag_virtual, bg_band_list(), n_bg_band(), n, calc_node);
 
 #ifdef ENABLE_MATLAB 
 	float* host_spline_constrain = new float[n];
@@ -7905,12 +9013,8 @@ float grid::Grid::count_bg_points(void)
 		return s;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = n_elements;
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse << <grid_dim, block_dim >> > ((float*)_gbuf.bg_ele_buf, n, calc_node);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg((float*)_gbuf.bg_ele_buf, bg_band_list(), n_bg_band(), n, calc_node);
 
 	float* tmp = (float*)grid::Grid::getTempBuf(sizeof(float) * n / 100);
 	float count = parallel_sum(_gbuf.bg_ele_buf, tmp, n);
@@ -7999,12 +9103,8 @@ void grid::Grid::compute_spline_background_selfsupp_constraint(void)
 		return val;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = n_elements;
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse << <grid_dim, block_dim >> > ((float*)_gbuf.bg_ss_ele_value, n, calc_node);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg((float*)_gbuf.bg_ss_ele_value, bg_band_list(), n_bg_band(), n, calc_node);
 
 #ifdef ENABLE_MATLAB
 	float* host_spline_constrain = new float[n];
@@ -8062,7 +9162,8 @@ float grid::Grid::global_bg_selfsupp_constraint(void)
 	return val;
 }
 
-void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff(void)
+template<int Order>
+void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff_order(void)
 {
 	if (_layer != 0) return;
 
@@ -8133,18 +9234,18 @@ void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff(void)
 
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
 
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
 
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			normal_dcijk[0] = 0.0f;
 			normal_dcijk[1] = 0.0f;
@@ -8152,31 +9253,31 @@ void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff(void)
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);  // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX); // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);  // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX); // 2 means the first order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						// indicator function term
-						float dfunc_val_tmp = NX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
+						float dfunc_val_tmp = NX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
 
 						// overhang term
 						float val = 0.f;
 						float up, down, dinner, inner;
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-						normal_dcijk[0] = direction * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[1] = direction * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[2] = direction * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal_dcijk[0] = direction * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[1] = direction * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[2] = direction * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 						norm_dcijk = dot(normal_vector, normal_dcijk) / normal_vector_norm;
 
 						up = normal_dcijk[2] * normal_vector_norm - normal_vector[2] * norm_dcijk;
@@ -8217,7 +9318,7 @@ void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff(void)
 						{
 							val = dnormal_distri(func_val_tmp, indicator_func_para) * dfunc_val_tmp * overhang(inner, func_mid, func_para) * inner_(inner, inner_para) + normal_distri(func_val_tmp, indicator_func_para) * doverhang(inner, func_mid, func_para) * dinner * inner_(inner, inner_para) + normal_distri(func_val_tmp, indicator_func_para) * overhang(inner, func_mid, func_para) * dinner * dinner_(inner, inner_para);
 						}
-						dc_tmp[index] += val;
+						atomicAdd(&dc_tmp[index], val);
 					}
 				}
 			}
@@ -8225,12 +9326,8 @@ void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff(void)
 		return;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = grid::Grid::n_valid_elements();
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse_noret << <grid_dim, block_dim >> > (n, calc_node_value);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg_noret(bg_band_list(), n_bg_band(), n, calc_node_value);
 
 	float* dc_host = new float[n_cijk()];
 	cudaMemcpy(dc_host, dc_tmp, sizeof(float) * n_cijk(), cudaMemcpyDeviceToHost);
@@ -8249,8 +9346,14 @@ void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff(void)
 	dc_host = nullptr;
 }
 
+void grid::Grid::compute_spline_bg_selfsupp_constraint_dcoeff(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_bg_selfsupp_constraint_dcoeff_order<decltype(order)::value>(); });
+}
+
 //  Deal with drip
-void grid::Grid::compute_spline_background_drip_constraint(void) {
+template<int Order>
+void grid::Grid::compute_spline_background_drip_constraint_order(void) {
 	float print_angle = _opt_print_angle;
 	float angle_epsilon = drip_angle;
 
@@ -8285,75 +9388,11 @@ void grid::Grid::compute_spline_background_drip_constraint(void) {
 		}
 		float func_val = gpu_bg_ele_value[0][node_id];
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float pPNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float pPNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
-		float pPNZ[m_iM] = { 0.f };
-
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
-
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
-		{
-			Hessian[0][0] = 0.0f;
-			Hessian[0][1] = 0.0f;
-			Hessian[0][2] = 0.0f;
-			Hessian[1][0] = 0.0f;
-			Hessian[1][1] = 0.0f;
-			Hessian[1][2] = 0.0f;
-			Hessian[2][0] = 0.0f;
-			Hessian[2][1] = 0.0f;
-			Hessian[2][2] = 0.0f;
-		}
-		else
-		{
-			SplineBasisDeriX(p[0], 1, NX);   // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX);  // 2 means the first order derivative value
-			SplineBasisDeriX(p[0], 3, pPNX); // 3 means the second order derivative value
-
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
-			SplineBasisDeriY(p[1], 3, pPNY); // 3 means the second order derivative value
-
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
-			SplineBasisDeriZ(p[2], 3, pPNZ); // 3 means the second order derivative value
-
-			for (ir = i - m_iM; ir < i; ir++)
-			{
-				for (is = j - m_iM; is < j; is++)
-				{
-					for (it = k - m_iM; it < k; it++)
-					{
-						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
-
-						Hessian[0][0] += gpu_cijk[index] * pPNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[1][1] += gpu_cijk[index] * NX[ir - i + m_iM] * pPNY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[0][1] += gpu_cijk[index] * pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						Hessian[1][0] += gpu_cijk[index] * pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-
-						Hessian[2][2] += gpu_cijk[index] * NX[ir - i + m_iM] * NY[is - j + m_iM] * pPNZ[it - k + m_iM];
-						Hessian[0][2] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
-						Hessian[1][2] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * pNZ[it - k + m_iM];
-
-						Hessian[2][0] += gpu_cijk[index] * pNX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
-						Hessian[2][1] += gpu_cijk[index] * NX[ir - i + m_iM] * pNY[is - j + m_iM] * pNZ[it - k + m_iM];
-					}
-				}
-			}
-		}
-
+		// the Hessian was evaluated together with the normal by compute_spline_background_ele_fields
 		for (i = 0; i < 3; i++) {
 			for (j = 0; j < 3; j++)
 			{
-				int tmp = 3 * i + j;
-				gpu_bg_ele_hessian[tmp][node_id] = Hessian[i][j];
+				Hessian[i][j] = gpu_bg_ele_hessian[3 * i + j][node_id];
 			}
 		}
 
@@ -8402,12 +9441,8 @@ void grid::Grid::compute_spline_background_drip_constraint(void) {
 		return val;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = n_elements;
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse << <grid_dim, block_dim >> > ((float*)_gbuf.bg_drip_ele_value, n, calc_node);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg((float*)_gbuf.bg_drip_ele_value, bg_band_list(), n_bg_band(), n, calc_node);
 
 #ifdef ENABLE_MATLAB
 	float* host_spline_constrain = new float[n];
@@ -8437,6 +9472,11 @@ void grid::Grid::compute_spline_background_drip_constraint(void) {
 #endif
 }
 
+void grid::Grid::compute_spline_background_drip_constraint(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_background_drip_constraint_order<decltype(order)::value>(); });
+}
+
 float grid::Grid::global_bg_drip_constraint(void) {
 	float val = 0.f;
 
@@ -8483,7 +9523,8 @@ float grid::Grid::global_bg_drip_constraint(void) {
 	return val;
 }
 
-void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
+template<int Order>
+void grid::Grid::compute_spline_bg_drip_constraint_dcoeff_order(void) {
 	if (_layer != 0) return;
 
 	float* bg_direction = (float*)_gbuf.bg_ele_normal_direction;
@@ -8559,21 +9600,21 @@ void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
 
 		int i, j, k, ir, it, is, index;
 
-		float NX[m_iM] = { 0.f };
-		float pNX[m_iM] = { 0.f };
-		float pPNX[m_iM] = { 0.f };
-		float NY[m_iM] = { 0.f };
-		float pNY[m_iM] = { 0.f };
-		float pPNY[m_iM] = { 0.f };
-		float NZ[m_iM] = { 0.f };
-		float pNZ[m_iM] = { 0.f };
-		float pPNZ[m_iM] = { 0.f };
-
-		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + m_iM;
-		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + m_iM;
-		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + m_iM;
-
-		if ((i < m_iM) || (i > gnbasis[0]) || (j < m_iM) || (j > gnbasis[1]) || (k < m_iM) || (k > gnbasis[2]))
+		float NX[Order] = { 0.f };
+		float pNX[Order] = { 0.f };
+		float pPNX[Order] = { 0.f };
+		float NY[Order] = { 0.f };
+		float pNY[Order] = { 0.f };
+		float pPNY[Order] = { 0.f };
+		float NZ[Order] = { 0.f };
+		float pNZ[Order] = { 0.f };
+		float pPNZ[Order] = { 0.f };
+
+		i = (int)((p[0] - gnBoundMin[0]) / gnstep[0]) + Order;
+		j = (int)((p[1] - gnBoundMin[1]) / gnstep[1]) + Order;
+		k = (int)((p[2] - gnBoundMin[2]) / gnstep[2]) + Order;
+
+		if ((i < Order) || (i > gnbasis[0]) || (j < Order) || (j > gnbasis[1]) || (k < Order) || (k > gnbasis[2]))
 		{
 			for (int ii = 0; ii < 9; ii++)
 			{
@@ -8582,23 +9623,23 @@ void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
 		}
 		else
 		{
-			SplineBasisDeriX(p[0], 1, NX);   // 1 means the original function value
-			SplineBasisDeriX(p[0], 2, pNX);  // 2 means the first order derivative value
-			SplineBasisDeriX(p[0], 3, pPNX); // 3 means the second order derivative value
+			SplineBasisDeriX<Order>(p[0], 1, NX);   // 1 means the original function value
+			SplineBasisDeriX<Order>(p[0], 2, pNX);  // 2 means the first order derivative value
+			SplineBasisDeriX<Order>(p[0], 3, pPNX); // 3 means the second order derivative value
 
-			SplineBasisDeriY(p[1], 1, NY);
-			SplineBasisDeriY(p[1], 2, pNY);
-			SplineBasisDeriY(p[1], 3, pPNY); // 3 means the second order derivative value
+			SplineBasisDeriY<Order>(p[1], 1, NY);
+			SplineBasisDeriY<Order>(p[1], 2, pNY);
+			SplineBasisDeriY<Order>(p[1], 3, pPNY); // 3 means the second order derivative value
 
-			SplineBasisDeriZ(p[2], 1, NZ);
-			SplineBasisDeriZ(p[2], 2, pNZ);
-			SplineBasisDeriZ(p[2], 3, pPNZ); // 3 means the second order derivative value
+			SplineBasisDeriZ<Order>(p[2], 1, NZ);
+			SplineBasisDeriZ<Order>(p[2], 2, pNZ);
+			SplineBasisDeriZ<Order>(p[2], 3, pPNZ); // 3 means the second order derivative value
 
-			for (ir = i - m_iM; ir < i; ir++)
+			for (ir = i - Order; ir < i; ir++)
 			{
-				for (is = j - m_iM; is < j; is++)
+				for (is = j - Order; is < j; is++)
 				{
-					for (it = k - m_iM; it < k; it++)
+					for (it = k - Order; it < k; it++)
 					{
 						float val = 0.f;
 						float up = 0.f, down = 0.f;
@@ -8612,9 +9653,9 @@ void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
 						index = ir + is * gnbasis[0] + it * gnbasis[0] * gnbasis[1];
 
 						// for part.1 h_function
-						normal_dcijk[0] = direction * pNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[1] = direction * NX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						normal_dcijk[2] = direction * NX[ir - i + m_iM] * NY[is - j + m_iM] * pNZ[it - k + m_iM];
+						normal_dcijk[0] = direction * pNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[1] = direction * NX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						normal_dcijk[2] = direction * NX[ir - i + Order] * NY[is - j + Order] * pNZ[it - k + Order];
 						norm_dcijk = dot(normal_vector, normal_dcijk) / normal_vector_norm;
 
 						up = normal_dcijk[2] * normal_vector_norm - normal_vector[2] * norm_dcijk;
@@ -8636,10 +9677,10 @@ void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
 						dg_ = ddrip_upside_test(gphi_x, gphi_y, gdphi_x, gdphi_y, func_drip_alpha);
 
 						// for part.2 tilde_q
-						hessian_dcijk[0] += pPNX[ir - i + m_iM] * NY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[4] += NX[ir - i + m_iM] * pPNY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[1] += pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
-						hessian_dcijk[3] += pNX[ir - i + m_iM] * pNY[is - j + m_iM] * NZ[it - k + m_iM];
+						hessian_dcijk[0] += pPNX[ir - i + Order] * NY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[4] += NX[ir - i + Order] * pPNY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[1] += pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
+						hessian_dcijk[3] += pNX[ir - i + Order] * pNY[is - j + Order] * NZ[it - k + Order];
 
 						inner1 = hessian_vector[0];
 						inner2 = hessian_vector[0] * hessian_vector[4] - hessian_vector[1] * hessian_vector[3];
@@ -8689,7 +9730,7 @@ void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
 									* h_ * tilde_q1 * tilde_q2 * dnormal_distri(func_val_tmp, indicator_func_para);
 							}
 						}
-						dc_tmp[index] += val;
+						atomicAdd(&dc_tmp[index], val);
 					}
 				}
 			}
@@ -8697,12 +9738,8 @@ void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
 		return;
 	};
 
-	size_t grid_dim, block_dim;
 	int n = n_elements;
-	make_kernel_param(&grid_dim, &block_dim, n, 256);
-	traverse_noret << <grid_dim, block_dim >> > (n, calc_node_value);
-	cudaDeviceSynchronize();
-	cuda_error_check;
+	traverse_bg_noret(bg_band_list(), n_bg_band(), n, calc_node_value);
 
 	float* dc_host = new float[n_cijk()];
 	cudaMemcpy(dc_host, dc_tmp, sizeof(float) * n_cijk(), cudaMemcpyDeviceToHost);
@@ -8719,3 +9756,8 @@ void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void) {
 	delete[] dc_host;
 	dc_host = nullptr;
 }
+
+void grid::Grid::compute_spline_bg_drip_constraint_dcoeff(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { compute_spline_bg_drip_constraint_dcoeff_order<decltype(order)::value>(); });
+}
@@ -17,10 +17,15 @@
 #include "snippet.h"
 #include "set"
 #include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cmath>
 
 #include "MeshDefinition.h"
 
+class marchingCubeBase_t;
+
 //  ANSI escape codes
 #define RESET   "\033[0m"
 #define RED     "\033[31m"
@@ -34,12 +39,49 @@
 //printf("%sYellow Text%s\n", YELLOW, RESET);
 //printf("%sBlue Text%s\n", BLUE, RESET);
 
-constexpr static int m_iM = 3;                                       // The order of implicit spline
+constexpr static int m_iM = 3;                                       // The default order of implicit spline
 
 namespace grid {
 
 	class HierarchyGrid;
 
+	// lexicographic id x + y * reso + z * reso^2 inside the bit box, overflows int beyond reso 1290.
+	// compact ranks (vertex/element ids) stay int, they index the device buffers of active cells
+	typedef long long index_t;
+
+	// spline kernels are instantiated for these orders, -spline_order selects one at runtime
+	constexpr int min_spline_order = 2;
+	constexpr int max_spline_order = 5;
+
+	template<typename Fn>
+	inline auto dispatchSplineOrder(int order, Fn&& fn) {
+		switch (order) {
+		case 2: return fn(std::integral_constant<int, 2>());
+		case 3: return fn(std::integral_constant<int, 3>());
+		case 4: return fn(std::integral_constant<int, 4>());
+		case 5: return fn(std::integral_constant<int, 5>());
+		default:
+			printf("\033[31m-- unsupported spline order %d\033[0m\n", order);
+			exit(-1);
+		}
+	}
+
+	// the fused sensitivity filter is instantiated for up to this many fields
+	constexpr int max_filter_fields = 4;
+
+	template<typename Fn>
+	inline auto dispatchFilterFields(int nfield, Fn&& fn) {
+		switch (nfield) {
+		case 1: return fn(std::integral_constant<int, 1>());
+		case 2: return fn(std::integral_constant<int, 2>());
+		case 3: return fn(std::integral_constant<int, 3>());
+		case 4: return fn(std::integral_constant<int, 4>());
+		default:
+			printf("\033[31m-- unsupported number of filtered fields %d\033[0m\n", nfield);
+			exit(-1);
+		}
+	}
+
 	template<typename T>
 	struct BitCount {
 		static constexpr int value = sizeof(T) * 8;
@@ -119,7 +161,7 @@ namespace grid {
 		void buildChunkSat(void) {
 			_chunkSat.resize(_bitArray.size() + 1, 0);
 			int accu = 0;
-			for (int i = 0; i < _bitArray.size(); i++) {
+			for (size_t i = 0; i < _bitArray.size(); i++) {
 				_chunkSat[i] = accu;
 				accu += countOne(_bitArray[i]);
 			}
@@ -134,7 +176,7 @@ namespace grid {
 		BitSAT(std::vector<T>&& bitArray) noexcept : _bitArray(bitArray) { buildChunkSat(); }
 		// the sat sum at id-th element in bit array
 		int operator[](size_t id) {
-			int ent = id >> firstOne<sizeof(T) * 8>::value;
+			size_t ent = id >> firstOne<sizeof(T) * 8>::value;
 			int mod = id & size_mask;
 			return _chunkSat[ent] + countOne(_bitArray[ent] & ((T{ 1 } << mod) - 1));
 		}
@@ -145,7 +187,7 @@ namespace grid {
 
 		// the bit id of k-th 1
 		int operator()(size_t id) const {
-			int ent = id >> firstOne<sizeof(T) * 8>::value;
+			size_t ent = id >> firstOne<sizeof(T) * 8>::value;
 			int mod = id & size_mask;
 			T resword = _bitArray[ent];
 			if ((resword & (T{ 1 } << mod)) == 0) {
@@ -156,6 +198,275 @@ namespace grid {
 			}
 		}
 	};
+
+	/*
+		Two level sparse topology of a reso^3 bit box, a drop-in for BitSAT. The element traversals of the finest
+		layer run on it, on device through the uploaded tables (gTileSAT in Grid.cu).
+		The root table maps each 8x8x8 tile to an active leaf (or -1), a leaf stores the 512 bit mask of its
+		voxels and the rank offset of its 64 voxel rows inside the row. Together with the rank of the first
+		voxel of each row the ranks equal the lexicographic ranks of BitSAT, so ids and ranks can be mixed
+		between the two, while empty tiles cost one root entry only.
+	*/
+	class TileSAT {
+	public:
+		static constexpr int tile_bits = 3;
+		static constexpr int tile_dim = 1 << tile_bits;
+		static constexpr int tile_mask = tile_dim - 1;
+
+		struct Leaf {
+			// bit (ly * 8 + lx) of mask[lz]
+			uint64_t mask[tile_dim];
+			// active voxels in the row (ly, lz) before this leaf
+			uint16_t rowOffset[tile_dim * tile_dim];
+			int tileid;
+		};
+
+	private:
+		int _reso = 0;
+		int _ntile = 0;
+		size_t _total = 0;
+		std::vector<int> _root;
+		std::vector<Leaf> _leaves;
+		// rank of the first voxel of row y + z * reso
+		std::vector<int> _rowSat;
+		// leaves of the tile row ty + tz * ntile sorted by tx, in _rowLeaves[_rowLeafBegin[r] ... _rowLeafBegin[r + 1])
+		std::vector<int> _rowLeafBegin;
+		std::vector<int> _rowLeaves;
+
+		int rowSegment(const Leaf& leaf, int ly, int lz) const {
+			return (leaf.mask[lz] >> (ly * tile_dim)) & 0xff;
+		}
+
+	public:
+		TileSAT(void) = default;
+
+		template<typename T>
+		TileSAT(const std::vector<T>& bitArray, int reso) : _reso(reso) {
+			_ntile = (reso + tile_mask) >> tile_bits;
+			_root.resize(size_t(_ntile) * _ntile * _ntile, -1);
+			// activate leaves
+			for (size_t i = 0; i < bitArray.size(); i++) {
+				T word = bitArray[i];
+				while (word) {
+					T low = word & (~word + 1);
+					word ^= low;
+					int j = countOne(T(low - 1));
+					size_t id = i * BitCount<T>::value + j;
+					if (id >= size_t(reso) * reso * reso) break;
+					int pos[3] = { int(id % reso), int(id / reso % reso), int(id / reso / reso) };
+					int tileid = (pos[0] >> tile_bits) + ((pos[1] >> tile_bits) + (pos[2] >> tile_bits) * _ntile) * _ntile;
+					if (_root[tileid] == -1) {
+						_root[tileid] = _leaves.size();
+						_leaves.emplace_back();
+						_leaves.back().tileid = tileid;
+					}
+					Leaf& leaf = _leaves[_root[tileid]];
+					leaf.mask[pos[2] & tile_mask] |= uint64_t{ 1 } << ((pos[1] & tile_mask) * tile_dim + (pos[0] & tile_mask));
+				}
+			}
+			// the root is ordered by tile id, so its active entries come grouped by tile row and sorted by tx
+			_rowLeafBegin.resize(size_t(_ntile) * _ntile + 1);
+			_rowLeaves.reserve(_leaves.size());
+			for (size_t r = 0; r < size_t(_ntile) * _ntile; r++) {
+				_rowLeafBegin[r] = _rowLeaves.size();
+				for (int tx = 0; tx < _ntile; tx++) {
+					int leafid = _root[r * _ntile + tx];
+					if (leafid != -1) _rowLeaves.push_back(leafid);
+				}
+			}
+			_rowLeafBegin.back() = _rowLeaves.size();
+			// rank offsets, rows are visited in lexicographic order
+			_rowSat.resize(size_t(reso) * reso);
+			int accu = 0;
+			for (int z = 0; z < reso; z++) {
+				for (int y = 0; y < reso; y++) {
+					_rowSat[y + size_t(z) * reso] = accu;
+					int tilerow = (y >> tile_bits) + (z >> tile_bits) * _ntile;
+					int inrow = 0;
+					for (int k = _rowLeafBegin[tilerow]; k < _rowLeafBegin[tilerow + 1]; k++) {
+						Leaf& leaf = _leaves[_rowLeaves[k]];
+						leaf.rowOffset[(y & tile_mask) + (z & tile_mask) * tile_dim] = inrow;
+						inrow += countOne(rowSegment(leaf, y & tile_mask, z & tile_mask));
+					}
+					accu += inrow;
+				}
+			}
+			_total = accu;
+		}
+
+		template<typename T>
+		TileSAT(const BitSAT<T>& sat, int reso) : TileSAT(sat._bitArray, reso) {}
+
+		int reso(void) const { return _reso; }
+
+		size_t total(void) const { return _total; }
+
+		size_t n_leaves(void) const { return _leaves.size(); }
+
+		size_t n_tiles(void) const { return _root.size(); }
+
+		int n_tiledim(void) const { return _ntile; }
+
+		// raw tables for the device copy
+		const std::vector<int>& root(void) const { return _root; }
+
+		const std::vector<Leaf>& leaves(void) const { return _leaves; }
+
+		const std::vector<int>& rowSat(void) const { return _rowSat; }
+
+		size_t memoryBytes(void) const {
+			return (_root.size() + _rowSat.size() + _rowLeafBegin.size() + _rowLeaves.size()) * sizeof(int) + _leaves.size() * sizeof(Leaf);
+		}
+
+		// number of active voxels in the row (y, z)
+		int rowCount(int y, int z) const {
+			size_t row = y + size_t(z) * _reso;
+			return (row + 1 < _rowSat.size() ? _rowSat[row + 1] : int(_total)) - _rowSat[row];
+		}
+
+		// the sat sum at id-th element of the box
+		int operator[](size_t id) const {
+			int pos[3] = { int(id % _reso), int(id / _reso % _reso), int(id / _reso / _reso) };
+			int ly = pos[1] & tile_mask, lz = pos[2] & tile_mask;
+			int rowbase = ((pos[1] >> tile_bits) + (pos[2] >> tile_bits) * _ntile) * _ntile;
+			int rank = _rowSat[pos[1] + size_t(pos[2]) * _reso];
+			int leafid = _root[rowbase + (pos[0] >> tile_bits)];
+			if (leafid != -1) {
+				const Leaf& leaf = _leaves[leafid];
+				return rank + leaf.rowOffset[ly + lz * tile_dim] + countOne(rowSegment(leaf, ly, lz) & ((1 << (pos[0] & tile_mask)) - 1));
+			}
+			// empty tile, end of the nearest active leaf on the left
+			for (int tx = (pos[0] >> tile_bits) - 1; tx >= 0; tx--) {
+				leafid = _root[rowbase + tx];
+				if (leafid == -1) continue;
+				const Leaf& leaf = _leaves[leafid];
+				return rank + leaf.rowOffset[ly + lz * tile_dim] + countOne(rowSegment(leaf, ly, lz));
+			}
+			return rank;
+		}
+
+		// the rank of id-th element, -1 if it is not active
+		int operator()(size_t id) const {
+			int pos[3] = { int(id % _reso), int(id / _reso % _reso), int(id / _reso / _reso) };
+			int tileid = (pos[0] >> tile_bits) + ((pos[1] >> tile_bits) + (pos[2] >> tile_bits) * _ntile) * _ntile;
+			int leafid = _root[tileid];
+			if (leafid == -1) return -1;
+			const Leaf& leaf = _leaves[leafid];
+			int ly = pos[1] & tile_mask, lz = pos[2] & tile_mask;
+			int seg = rowSegment(leaf, ly, lz);
+			int lx = pos[0] & tile_mask;
+			if (!(seg & (1 << lx))) return -1;
+			return _rowSat[pos[1] + size_t(pos[2]) * _reso] + leaf.rowOffset[ly + lz * tile_dim] + countOne(seg & ((1 << lx) - 1));
+		}
+
+		// call fn(id, rank) on the active voxels of one leaf, leaves are independent and may be visited in parallel
+		template<typename Fn>
+		void forEachActiveInLeaf(size_t leafid, Fn&& fn) const {
+			const Leaf& leaf = _leaves[leafid];
+			int tpos[3] = { leaf.tileid % _ntile * tile_dim, leaf.tileid / _ntile % _ntile * tile_dim, leaf.tileid / _ntile / _ntile * tile_dim };
+			for (int lz = 0; lz < tile_dim; lz++) {
+				if (leaf.mask[lz] == 0) continue;
+				int z = tpos[2] + lz;
+				for (int ly = 0; ly < tile_dim; ly++) {
+					int seg = rowSegment(leaf, ly, lz);
+					if (seg == 0) continue;
+					int y = tpos[1] + ly;
+					int rank = _rowSat[y + size_t(z) * _reso] + leaf.rowOffset[ly + lz * tile_dim];
+					for (int lx = 0; lx < tile_dim; lx++) {
+						if (!(seg & (1 << lx))) continue;
+						fn(size_t(tpos[0] + lx) + (size_t(y) + size_t(z) * _reso) * _reso, rank++);
+					}
+				}
+			}
+		}
+
+		// call fn(x, rank) on the active voxels of the row (y, z) in increasing x, only the active leaves of the row are visited
+		template<typename Fn>
+		void forEachActiveInRow(int y, int z, Fn&& fn) const {
+			int tilerow = (y >> tile_bits) + (z >> tile_bits) * _ntile;
+			int ly = y & tile_mask, lz = z & tile_mask;
+			int rank = _rowSat[y + size_t(z) * _reso];
+			for (int k = _rowLeafBegin[tilerow]; k < _rowLeafBegin[tilerow + 1]; k++) {
+				const Leaf& leaf = _leaves[_rowLeaves[k]];
+				int seg = rowSegment(leaf, ly, lz);
+				int x0 = leaf.tileid % _ntile * tile_dim;
+				for (int lx = 0; seg != 0; lx++, seg >>= 1) {
+					if (seg & 1) fn(x0 + lx, rank++);
+				}
+			}
+		}
+
+		// call fn(id, rank) on all active voxels, only active tiles are visited
+		template<typename Fn>
+		void forEachActive(Fn&& fn) const {
+			for (size_t i = 0; i < _leaves.size(); i++) forEachActiveInLeaf(i, fn);
+		}
+	};
+
+	// outputs of the fused spline evaluation, one array per field indexed by point, null fields are skipped
+	struct SplineFieldsSoA {
+		float* value = nullptr;
+		float* grad[3] = { nullptr, nullptr, nullptr };
+		float* hess[9] = { nullptr };             // 3x3 row major
+	};
+
+	// knot insertion between clamped uniform knot vectors of ncoarse and nfine spans on the same interval
+	// (nfine a multiple of ncoarse). Coarse basis j equals sum_r w[j][r] * fine basis (first[j] + r)
+	struct SplineRefinement1D {
+		std::vector<int> first;
+		std::vector<std::vector<float>> w;
+	};
+
+	void splineKnotInsertion1D(int order, int ncoarse, int nfine, SplineRefinement1D& ref);
+
+	// coefficients of a lattice of nb[0] x nb[1] x nb[2] bases refined by ref[axis] along each axis
+	void splineKnotInsertion3D(const SplineRefinement1D ref[3], const int nb[3], const float* src, float* dst);
+
+	// truncated hierarchical B-splines over dyadic refinements of the coefficient lattice. The finest level is
+	// the lattice itself, level l has nspan >> (nlevel - 1 - l) knot spans per axis on the same bound, and the
+	// cells of level l marked refined make up the domain of level l + 1. The design variables are the
+	// coefficients of the active (truncated) functions, R maps them to the lattice coefficients
+	class SplineHierarchy {
+	public:
+		static constexpr int max_levels = 6;
+	private:
+		int _order = 0;
+		int _nlevel = 0;
+		int _nspan[max_levels][3];
+		int _nbasis[max_levels][3];
+		SplineRefinement1D _refine[max_levels][3];  // level l to l + 1
+		std::vector<char> _refined[max_levels];     // per cell of level l
+		std::vector<int> _activeLevel;
+		std::vector<int> _activeId;
+		// R as rows for the forward map and as columns for the transpose, both evaluated in gather form
+		std::vector<int> _rowPtr, _rowCol;
+		std::vector<float> _rowVal;
+		std::vector<int> _colPtr, _colRow;
+		std::vector<float> _colVal;
+
+		void build(void);
+		bool cellInDomain(int l, int i, int j, int k) const;
+		// support of basis (i, j, k) of level l inside the domain of level l, or of level l + 1 if next
+		bool basisInDomain(int l, int i, int j, int k, bool next) const;
+	public:
+		// lattice of order with nspan knot spans per axis, returns the number of levels actually used (fewer if
+		// the span counts do not halve). Only the coarsest level is active afterwards
+		int init(int order, const int nspan[3], int nlevel);
+		int n_levels(void) const { return _nlevel; }
+		int n_design(void) const { return _activeId.size(); }
+		int n_coeffs(void) const { return _rowPtr.empty() ? 0 : _rowPtr.size() - 1; }
+		int n_active(int level) const;
+		// c = R * x
+		void forward(const float* x, float* c) const;
+		// dx = R^T * dc
+		void transpose(const float* dc, float* dx) const;
+		// refines by one level the cells whose coefficient hull straddles iso, and those whose summed |dc| lies
+		// in the top sens_ratio of the unrefined cells (dc may be null). Returns the number of refined cells
+		int refine(const float* c, const float* dc, float iso, float sens_ratio);
+		// design whose lattice coefficients are c, c must lie in the hierarchical space
+		void project(const float* c, float* x) const;
+	};
+
 	void wordReverse_g(size_t nword, unsigned int* wordlist);
 
 	void cubeGridSetSolidVertices(int reso, const std::vector<unsigned int>& solid_ebit, std::vector<unsigned int>& solid_vbit);
@@ -194,6 +505,46 @@ namespace grid {
 		exp2_drip
 	};
 
+	// where the multigrid kernels are executed
+	enum Backend {
+		cuda_backend,
+		host_backend     // OpenMP kernels on host memory
+	};
+
+	// how the displacement on the finest layer is solved
+	enum SolverMode {
+		mg_solver,       // stationary V-cycle iteration
+		pcg_solver,      // conjugate gradient preconditioned by one V-cycle
+		fpcg_solver      // flexible (Polak-Ribiere) conjugate gradient preconditioned by one V-cycle
+	};
+
+	// storage precision of the coarse stencils
+	enum Precision {
+		double_precision,
+		mixed_precision  // float coarse stencils, the finest layer (residual and update) stays double
+	};
+
+	// how the sensitivities are filtered
+	enum FilterMode {
+		gather_filter,    // exact weighted sum over the ball of the filter radius, on device
+		separable_filter  // separable gaussian of the same variance on host, cost independent of the radius
+	};
+
+	/*
+		symmetric stencil format : rxStencil[14][9][vertex]
+		only the neighbor blocks 0..13 of each vertex are stored (13 is the diagonal block),
+		block nei > 13 of vertex v is the transpose of block 26 - nei of its neighbor v2v[nei][v]
+	*/
+	constexpr int n_stencil_blocks = 14;
+
+	// entry k (row major) of the 3x3 block coupling vertex vid to its nei-th neighbor vn
+	template<typename T>
+	constexpr T stencil_entry(const T* rxstencil, size_t nv, int nei, int k, int vid, int vn) {
+		return nei < n_stencil_blocks ?
+			rxstencil[(nei * 9 + k) * nv + vid] :
+			rxstencil[((26 - nei) * 9 + k % 3 * 3 + k / 3) * nv + vn];
+	}
+
 	template<typename dt = double, int N = 3>
 	struct hostbufbackup_t {
 		std::vector<dt> _hostbuf[N];
@@ -223,6 +574,10 @@ namespace grid {
 		static Mode _mode;
 		static GlobalSSMode _ssmode;
 		static GlobalDripMode _dripmode;
+		static Backend _backend;
+		static Precision _precision;
+		static FilterMode _filterMode;
+		static float _power_penalty;
 		static void setOutDir(const std::string& outdir);
 		static void setMeshFile(const std::string& meshfile);
 		static const std::string& getOutDir(void);
@@ -304,6 +659,7 @@ namespace grid {
 			float* bg_ele_normal_direction;
 
 			float* bg_ele_buf;
+			int* bg_band;                        // background elements of the narrow band, the first _nBgBand entries
 			float* bg_ss_ele_value;
 			float* bg_drip_ele_value;
 			float* bg_ele_flag;                  // compute the support constraint: 1 (not support) 0 (support)
@@ -319,12 +675,16 @@ namespace grid {
 			//int* v2vcoarsecoarse[8];
 			int* v2v[27];
 			//double* rxStenil[27][9];
-			// stencil[27][9][vertex]
+			// stencil[14][9][vertex], see n_stencil_blocks
 			double* rxStencil;
+			// single precision stencil, replaces rxStencil in mixed precision
+			float* rxStencilF;
 
-			unsigned int* eActiveBits;
-			int* eActiveChunkSum;
-			int nword_ebits;
+			// element TileSAT of the finest layer, see setElementTiles
+			int* eTileRoot;
+			TileSAT::Leaf* eTileLeaves;
+			int* eTileRowSat;
+			int n_etileleaves;
 
 			float* g_sens;
 			float* c_sens;
@@ -346,8 +706,15 @@ namespace grid {
 			double* F[3];
 			double* R[3];
 			double* Fsupport[3];
+			// block vectors of n_rhs right hand sides, interleaved as [vertex][3][n_rhs]
+			double* Ublock;
+			double* Fblock;
+			double* Rblock;
 		} _gbuf;
 
+		static constexpr int max_block_rhs = 8;
+		int n_rhs = 0;
+
 		int n_vertices = 0;
 		int n_elements = 0;
 		int n_gsvertices = 0;
@@ -357,6 +724,25 @@ namespace grid {
 
 		std::vector<float> spline_bg_node[3];
 		std::vector<float> spline_bg_ele[3];
+
+		// narrow band of the background self-supporting evaluation, off for a width of 0
+		float _bgBandWidth = 0;
+		float _bgBandDrift = 0;              // accumulated largest coefficient move
+		std::vector<float> _bgBandCoeffs;    // coefficients at the last band update
+		std::vector<float> _bgBandValue;     // last evaluated spline value of each background element
+		std::vector<float> _bgBandStamp;     // drift at that evaluation
+		std::vector<int> _bgBandList;
+		int _nBgBand = 0;
+
+		// coefficients the current densities were evaluated from, kept by coeff2density_incremental
+		std::vector<float> _coeffsEvaluated;
+		std::vector<int> _changedElements;
+
+		// element tiles of the finest layer, owned by HierarchyGrid::eletilelist
+		const TileSAT* _etiles = nullptr;
+
+		// hierarchical design over the coefficient lattice, unused with a single level
+		SplineHierarchy _spHierarchy;
 				
 		std::map<std::string, double> _keyvalues;
 
@@ -524,11 +910,23 @@ namespace grid {
 
 		void applyK(double* u[3], double* f[3]);
 
+		void applyK_host(double* u[3], double* f[3]);
+
 		void applyAjointK(double* usrc[3], double* fdst[3]);
 
 		void filterSensitivity(double radii);
 		void filterVolSensitivity(double radii);
 
+		// filters nfield element fields (n_gselements each) in one traversal of the active elements, the neighbor
+		// lookups and weights are shared by all the fields. At most max_filter_fields
+		void filterSensitivities(int nfield, float* const sens[], double radii);
+
+		// approximation of the filter with a cost independent of the radius, on host (see FilterMode)
+		void filterSensitivities_separable(int nfield, float* const sens[], double radii);
+
+		// the gather filter of the host backend, the same weights and sums as filterSensitivities_kernel
+		void filterSensitivities_gather_host(int nfield, float* const sens[], double radii);
+
 		
 		Eigen::Matrix<double, 3, 1> outwardNormal(double p[3]);
 
@@ -598,8 +996,72 @@ namespace grid {
 			int * ebitflags
 		);
 
+		// takes the element tiles of the finest layer and uploads their tables, the element traversals are driven by them
+		void setElementTiles(gpu_manager_t& gm, const TileSAT& etiles);
+
 		void gs_relax(int n_times = 1);
 
+		// host versions of the multigrid kernels, buffers must be host resident
+		void gs_relax_host(int n_times = 1);
+
+		void update_residual_host(void);
+
+		void restrict_residual_host(void);
+
+		void prolongate_correction_host(void);
+
+		void lexico2gsorder_host(int* idmap, int n_id, int* ids, int n_mapid, int* mapped_ids, int* valuemap = nullptr);
+
+		void mark_surface_nodes_host(int nv, int* v2e[8], int* vflag);
+
+		static void v3_init_host(int n, double* v[3], double val[3]);
+
+		// dst = alpha * a + beta * b
+		static void v3_axpby_host(int n, double* dst[3], double alpha, double* a[3], double beta, double* b[3]);
+
+		static double v3_dot_host(int n, double* v[3], double* u[3]);
+
+		// uniform in [low, upp]
+		void v3_rand_host(double* v[3], double low, double upp);
+
+		void resetDirchlet_host(double* v[3]);
+
+		// multigrid kernels on block vectors, each stencil is loaded once for all right hand sides
+		void alloc_block(gpu_manager_t& gm, int nrhs);
+
+		void reset_block(double* blockv);
+
+		void gs_relax_block(int n_times = 1);
+
+		void update_residual_block(void);
+
+		void restrict_residual_block(void);
+
+		void prolongate_correction_block(void);
+
+		void solve_fem_block_host(void);
+
+		// 2-norm of each column
+		void block_norm(double* blockv, double* norms);
+
+		void v3_to_block(double* v[3], double* blockv, int col);
+
+		void block_to_v3(double* blockv, int col, double* v[3]);
+
+		void gs_relax_block_host(int n_times = 1);
+
+		void update_residual_block_host(void);
+
+		void restrict_residual_block_host(void);
+
+		void prolongate_correction_block_host(void);
+
+		void block_norm_host(double* blockv, double* norms);
+
+		void v3_to_block_host(double* v[3], double* blockv, int col);
+
+		void block_to_v3_host(double* blockv, int col, double* v[3]);
+
 		//void gs_adjoint_relax(int n_times = 1);
 
 		void reset_displacement(void);
@@ -612,6 +1074,11 @@ namespace grid {
 
 		void generate_spline_surface_nodes(float beta);
 
+		// isosurface of the spline on the lattice of compute_background_mcPoints_value (mc_ereso + 2 element centers per
+		// axis around the model box). Only the marching cube blocks whose spline cells have coefficients on both sides
+		// of the isovalue (convex hull property) are sampled, so the cost follows the surface area
+		void extract_spline_isosurface(int mc_ereso, marchingCubeBase_t& mc);
+
 		void generate_surface_nodes_by_MC(const std::string& fileName, int Nodes[3], std::vector<float>& surface_node_x, std::vector<float>& surface_node_y, std::vector<float>& surface_node_z, std::vector<float> bg_node[3], std::vector<float> mcPoints_in);
 
 		void compute_surface_nodes_in_model(std::vector<float>& surface_node_x, std::vector<float>& surface_node_y, std::vector<float>& surface_node_z);
@@ -651,6 +1118,12 @@ namespace grid {
 
 		void buildCoarsestSystem(void);
 
+		// rigid body modes in the null space of the coarsest system
+		void computeCoarsestKernel(void);
+
+		// sparse LDLT of the coarsest system with its kernel pinned, reused until the stencil changes
+		void factorizeCoarsestSystem(void);
+
 		void compute_gscolor(gpu_manager_t& gm, BitSAT<unsigned int>& vbitsat, BitSAT<unsigned int>& ebitsat, int vreso, int* vbitflaghost, int* ebitflaghost);
 
 		void enumerate_gs_subset(int nv, int ne, int* vflags, int* eflags, int& nv_gs, int& ne_gs, std::vector<int>& vlexi2gs, std::vector<int>& elexi2gs);
@@ -681,16 +1154,51 @@ namespace grid {
 
 		void set_spline_knot_series(void);
 
+		// knot series on a given (already enlarged) bound, keeps the spline in place on grids of another resolution
+		void set_spline_knot_series(const float boundmin[3], const float boundmax[3]);
+
 		void set_spline_knot_infoSymbol(void);  // include upload to device
 				
 		void coeff2density(void);
 
+		// CPU evaluation of coeff2density by sum factorisation, buffers must be host resident
+		void coeff2density_host(void);
+
+		// coeff2density restricted to the support of the coefficients that moved by more than tol since they were
+		// last evaluated, returns the number of recomputed elements. The first call evaluates every element
+		int coeff2density_incremental(float tol);
+
+		// gs ids of the elements recomputed by the last coeff2density_incremental, ascending
+		const std::vector<int>& changedElements(void) const { return _changedElements; }
+
+		// truncated hierarchical design with nlevel dyadic levels over the lattice, starting from the coarsest
+		void set_spline_hierarchy(int nlevel);
+		bool has_spline_hierarchy(void) { return _spHierarchy.n_levels() > 1; }
+		SplineHierarchy& spline_hierarchy(void) { return _spHierarchy; }
+		// number of design variables, the lattice coefficients without a hierarchy
+		int n_design(void) { return has_spline_hierarchy() ? _spHierarchy.n_design() : n_cijk(); }
+		// coeffs = R * design, design is a device buffer
+		void design2coeff(const float* design);
+		// ddesign = R^T * dcoeff, both device buffers
+		void dcoeff2design(const float* dcoeff, float* ddesign);
+		// refines around the isosurface of the current coefficients and where |dcoeff| is in the top sens_ratio,
+		// design receives the current coefficients in the refined basis. Returns the number of refined cells
+		int refine_spline_hierarchy(const float* dcoeff, float sens_ratio, std::vector<float>& design);
+
 		void ddensity2dcoeff(void);        // not use
 
 		void ddensity2dcoeff_update(void); // dE/dc = dE/drho * drho/dcijk
 
 		void dvol2dcoeff(void);            // dVol/dc = dVol/drho * drho/dcijk    
 
+		void dsens2dcoeff(void);           // both of the above, fused on host
+
+		// dcoeff[i] = N^T * dfield[i] for element fields (shell elements excluded), gather form without atomics
+		void dfield2dcoeff_host(int nfield, const float* const dfield[], float* const dcoeff[]);
+
+		// the same sums scattered by every element with atomics, the reference dfield2dcoeff_host is timed against
+		void dfield2dcoeff_host_scatter(int nfield, const float* const dfield[], float* const dcoeff[]);
+
 		void compute_background_mcPoints_value(std::vector<float>& bgnode_x, std::vector<float>& bgnode_y, std::vector<float>& bgnode_z, std::vector<float>& spline_value, int mc_ereso, float beta);
 
 		// constraint for surface point
@@ -715,6 +1223,23 @@ namespace grid {
 
 		//[mark] constraint for background point
 		//void compute_background_point(void);
+		// background elements whose spline value lies within width of the isosurface, rebuilt on every
+		// compute_spline_background_ele_value from the previous values. 0 evaluates all of them
+		void set_bg_band(float width);
+		// device list of the band, nullptr while it is off
+		const int* bg_band_list(void) { return _bgBandWidth > 0 ? _gbuf.bg_band : nullptr; }
+		int n_bg_band(void) { return _bgBandWidth > 0 ? _nBgBand : n_elements; }
+		void select_bg_band_candidates(void);
+		void rebuild_bg_band(const float* value);
+
+		// value, normal (gradient) and Hessian of the background elements in a single pass, replaces
+		// compute_spline_background_ele_value + compute_spline_background_ele_normal
+		void compute_spline_background_ele_fields(void);
+		// normal and Hessian of the surface points in a single pass
+		void compute_spline_surface_point_fields(void);
+		// fields of the spline at the points pts[.][id] for id in list (all n points if list is null)
+		void compute_spline_fields(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out);
+
 		void compute_spline_background_ele_value(void);
 		void compute_spline_background_ele_normal(void);
 		float correct_spline_background_ele_normal_direction(float beta);
@@ -735,6 +1260,38 @@ namespace grid {
 		// may gather them -- > not use
 		void compute_spline_surface_point_normal_dcoeff(void);
 		void compute_spline_surface_point_normal_norm_dcoeff(void);
+
+		// field count specialised body of filterSensitivities, dispatched on nfield
+		template<int NField> void filterSensitivities_gather(float* const sens[], double radii);
+
+		// order specialised bodies of the spline routines above, dispatched on n_order
+		template<int Order> void coeff2density_order(void);
+		template<int Order> void ddensity2dcoeff_order(void);
+		template<int Order> void ddensity2dcoeff_update_order(void);
+		template<int Order> void dvol2dcoeff_order(void);
+		template<int Order> void compute_background_mcPoints_value_order(std::vector<float>& bgnode_x, std::vector<float>& bgnode_y, std::vector<float>& bgnode_z, std::vector<float>& spline_value, int mc_ereso, float beta);
+		template<int Order> void compute_spline_surface_point_normal_order(void);
+		template<int Order> float correct_spline_surface_point_normal_direction_order(float beta);
+		template<int Order> void compute_spline_surface_point_normal_norm_dcoeff_order(void);
+		template<int Order> void compute_spline_selfsupp_constraint_dcoeff_order(void);
+		template<int Order> void compute_spline_drip_constraint_order(void);
+		template<int Order> void compute_spline_drip_constraint_dcoeff_order(void);
+		template<int Order> void compute_spline_drip_constraint_test_order(void);
+		template<int Order> void compute_spline_drip_constraint_dcoeff_test_order(void);
+		template<int Order> void compute_spline_background_ele_value_order(void);
+		template<int Order> void compute_spline_background_ele_normal_order(void);
+		template<int Order> float correct_spline_background_ele_normal_direction_order(float beta);
+		template<int Order> void compute_spline_bg_selfsupp_constraint_dcoeff_order(void);
+		template<int Order> void compute_spline_background_drip_constraint_order(void);
+		template<int Order> void compute_spline_bg_drip_constraint_dcoeff_order(void);
+		template<int Order> void coeff2density_host_order(void);
+		template<int Order> void compute_spline_fields_order(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out);
+		template<int Order> void compute_spline_fields_host_order(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out);
+		template<int Order> int coeff2density_incremental_order(float tol);
+		template<int Order> void coeff2density_host_masked_order(const char* dirtybox, std::vector<int>& changed);
+		template<int Order> void dfield2dcoeff_host_order(int nfield, const float* const dfield[], float* const dcoeff[]);
+		template<int Order> void dfield2dcoeff_host_scatter_order(int nfield, const float* const dfield[], float* const dcoeff[]);
+		template<int Order> void extract_spline_isosurface_order(int mc_ereso, marchingCubeBase_t& mc);
 		
 		double unitizeForce(void);
 
@@ -778,6 +1335,21 @@ namespace grid {
 
 		bool hasSupport(void) { return _mode == with_support_constrain_force_direction || _mode == with_support_free_force; }
 
+		bool onHost(void) { return _backend == host_backend; }
+
+		bool mixedPrecision(void) { return _precision == mixed_precision; }
+
+		// coarse stencil buffer in current precision
+		void* stencil_buf(void) { return mixedPrecision() ? (void*)_gbuf.rxStencilF : (void*)_gbuf.rxStencil; }
+
+		size_t stencil_bytes(void) { return (mixedPrecision() ? sizeof(float) : sizeof(double)) * n_stencil_blocks * 9 * n_gsvertices; }
+
+		// (re)allocate the coarse stencil in current precision
+		void alloc_stencil(gpu_manager_t& gm);
+
+		// stencil converted to double, rxdata[14][9][vertex]
+		void download_stencil(std::vector<double>& rxdata);
+
 		void initrho2matlab(const std::string& nam);
 		void rho2matlab(const std::string& nam);
 
@@ -866,6 +1438,9 @@ namespace grid {
 	public:
 		std::vector<BitSAT<unsigned int>> elesatlist;
 		std::vector<BitSAT<unsigned int>> vrtsatlist;
+		// sparse 8^3 tile copies of elesatlist/vrtsatlist, host loops only visit active tiles
+		std::vector<TileSAT> eletilelist;
+		std::vector<TileSAT> vrttilelist;
 
 		std::function<bool(double[3])> _inLoadArea;
 		std::function<bool(double[3])> _inFixedArea;
@@ -883,6 +1458,15 @@ namespace grid {
 
 		GlobalDripMode _dripmode;
 
+		SolverMode _solvermode = mg_solver;
+
+		// number of V-cycles since last reset, used to compare solver modes
+		size_t _n_vcycles = 0;
+
+		// vectors of pcg_solve on the finest layer, kept across calls and reallocated when its size changes
+		double* _pcgbuf[7][3] = {};
+		int _pcg_nv = 0;
+
 		//std::vector<float> _pcoords;
 		//std::vector<int> _trifaces;
 
@@ -923,6 +1507,8 @@ namespace grid {
 
 		void setSolidShellElement(const std::vector<unsigned int>& ebitfine, BitSAT<unsigned int>& esat, float box[2][3], int ereso, std::vector<int>& eflags);
 
+		void buildTileTopology(void);
+
 		// MARK: to be updated
 		void setinModelVertice(const std::vector<unsigned int>& vbitfine, BitSAT<unsigned int>& esat, float box[2][3], int vreso, std::vector<int>& vflags);
 
@@ -958,6 +1544,21 @@ namespace grid {
 
 		void setDripMode(GlobalDripMode mode);
 
+		void setBackend(Backend backend);
+
+		// switch the stencil precision, stencils of built layers are reallocated and restricted again
+		void setPrecision(Precision precision);
+
+		Precision getPrecision(void) { return Grid::_precision; }
+
+		void setFilterMode(FilterMode mode) { Grid::_filterMode = mode; }
+
+		FilterMode getFilterMode(void) { return Grid::_filterMode; }
+
+		void setSolverMode(SolverMode mode);
+
+		SolverMode getSolverMode(void) { return _solvermode; }
+
 		void setPrintAngle(float default_angle_ratio, float opt_angle_ratio);
 
 		static std::string getModeStr(Mode mode);
@@ -985,6 +1586,9 @@ namespace grid {
 
 		void genFromMesh(const std::vector<float>& pcoords, const std::vector<int>& facevertices, Mesh& inputmesh);
 
+		// releases every layer and its device buffers, genFromMesh builds the hierarchy again afterwards
+		void clear(void);
+
 		void genFromMesh(const std::vector<unsigned int> &solid_bit, int out_reso[3]);
 
 		void resetAllResidual(void);
@@ -993,6 +1597,10 @@ namespace grid {
 
 		void restrict_stencil_nondyadic(Grid& dstcoarse, Grid& srcfine);
 
+		void restrict_stencil_dyadic_host(Grid& dstcoarse, Grid& srcfine);
+
+		void restrict_stencil_nondyadic_host(Grid& dstcoarse, Grid& srcfine);
+
 		//void restrict_adjoint_stencil_nondyadic(Grid& dstcoarse, Grid& srcfine);
 
 		//void restrict_adjoint_stencil_dyadic(Grid& dstcoarse, Grid& srcfine);
@@ -1064,6 +1672,29 @@ namespace grid {
 
 		double v_halfcycle(int depth, int pre_relax = 1, int post_relax = 1);
 
+		// one V-cycle on current force and displacement of the finest layer, the residual is not updated
+		void v_cycle_sweep(int pre_relax = 1, int post_relax = 1);
+
+		// z = M^-1 r, where M^-1 is one V-cycle started from zero displacement
+		void v_cycle_precondition(double* r[3], double* z[3], int pre_relax = 1, int post_relax = 1);
+
+		// solve K u = f on the finest layer with V-cycle preconditioned CG, starting from current displacement.
+		// project is applied to the residual and the preconditioned residual (e.g. removing rigid motion).
+		// return the relative residual
+		double pcg_solve(double rel_tol, int max_itn, bool flexible, std::function<void(double**)> project = nullptr);
+
+		void alloc_pcg_workspace(void);
+
+		size_t n_vcycles(void) { return _n_vcycles; }
+
+		// allocate block vectors of nrhs right hand sides on all layers
+		void enable_block(int nrhs);
+
+		// one V-cycle on the block force and displacement of the finest layer, return the maximal relative residual
+		double v_cycle_block(int pre_relax = 1, int post_relax = 1);
+
+		void reset_vcycle_count(void) { _n_vcycles = 0; }
+
 		//double adjoint_v_cycle(void);
 
 		void test_vcycle(void);
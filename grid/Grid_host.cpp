@@ -0,0 +1,2180 @@
+#include "Grid.h"
+#include "templateMatrix.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <ctime>
+#include "Eigen/Sparse"
+#include "Eigen/IterativeLinearSolvers"
+#include "marchingCubeBase_t.h"
+
+using namespace grid;
+
+#define DIRICHLET_DIAGONAL_WEIGHT 1e6f
+
+// host copy of the template matrix, row major
+alignas(64) static double hTemplateMatrix[24][24];
+
+static void loadTemplateMatrixHost(void) {
+	const Eigen::Matrix<Scalar, 24, 24>& ke = getTemplateMatrix();
+	for (int i = 0; i < 24; i++) {
+		for (int j = 0; j < 24; j++) {
+			hTemplateMatrix[i][j] = ke(i, j);
+		}
+	}
+}
+
+// stored block of the symmetric stencil rxstencil[14][9][n], nei < n_stencil_blocks
+template<typename T>
+static inline T& stencilEntry(T* rxstencil, size_t n, int nei, int k, int vid) {
+	return rxstencil[(nei * 9 + k) * n + vid];
+}
+
+// coarse stencil buffer of precision T
+template<typename T> static T* stencilBuf(Grid& g);
+template<> double* stencilBuf<double>(Grid& g) { return g._gbuf.rxStencil; }
+template<> float* stencilBuf<float>(Grid& g) { return g._gbuf.rxStencilF; }
+
+// weight (4-i)(4-j)(4-k)/64 of the non dyadic interpolation
+static inline double nondyadicWeight(int i, int j, int k) {
+	return (4 - i) * (4 - j) * (4 - k) / 64.;
+}
+
+// local id (in 3x3x3 neighborhood) of the vj-th vertex of the e-th element around a vertex
+static inline int elementVertexLid(int e, int vj) {
+	return (vj % 2 + e % 2) + (vj % 4 / 2 + e % 4 / 2) * 3 + (vj / 4 + e / 4) * 9;
+}
+
+// accumulate K*u over the 8 elements around vid, fixed vertices contribute zero displacement.
+// if S is given, the center vertex is excluded from KU and its diagonal block is summed to S
+template<bool WithSupport>
+static inline void elementKU(
+	int vid, const float* rholist, float power,
+	int* const v2e[8], int* const v2v[27], const int* vflag,
+	double* const U[3], double KU[3], double* S
+) {
+	for (int e = 0; e < 8; e++) {
+		int eid = v2e[e][vid];
+		if (eid == -1) continue;
+		double penalty = powf(rholist[eid], power);
+		int vi = 7 - e;
+
+		if (S != nullptr) {
+			for (int i = 0; i < 9; i++) {
+				S[i] += penalty * hTemplateMatrix[vi * 3 + i / 3][vi * 3 + i % 3];
+			}
+		}
+
+		// gather element displacement
+		alignas(64) double ue[24];
+		for (int vj = 0; vj < 8; vj++) {
+			int vj_lid = elementVertexLid(e, vj);
+			int vj_vid = v2v[vj_lid][vid];
+			bool skip = vj_vid == -1 || (S != nullptr && vj_lid == 13);
+			if (WithSupport && !skip) skip = vflag[vj_vid] & Grid::Bitmask::mask_supportnodes;
+			for (int j = 0; j < 3; j++) {
+				ue[vj * 3 + j] = skip ? 0. : U[j][vj_vid];
+			}
+		}
+
+		for (int row = 0; row < 3; row++) {
+			const double* kr = hTemplateMatrix[vi * 3 + row];
+			double s = 0;
+#pragma omp simd reduction(+:s)
+			for (int j = 0; j < 24; j++) {
+				s += kr[j] * ue[j];
+			}
+			KU[row] += penalty * s;
+		}
+	}
+}
+
+// solve the 3x3 diagonal block in Gauss-Seidel order
+static inline void blockGaussSeidel(int vid, const double s[3][3], const double KeU[3], double* const U[3], double* const F[3]) {
+	double newU[3] = { U[0][vid],U[1][vid],U[2][vid] };
+	newU[0] = (F[0][vid] - s[0][1] * newU[1] - s[0][2] * newU[2] - KeU[0]) / s[0][0];
+	newU[1] = (F[1][vid] - s[1][0] * newU[0] - s[1][2] * newU[2] - KeU[1]) / s[1][1];
+	newU[2] = (F[2][vid] - s[2][0] * newU[0] - s[2][1] * newU[1] - KeU[2]) / s[2][2];
+	U[0][vid] = newU[0]; U[1][vid] = newU[1]; U[2][vid] = newU[2];
+}
+
+// one GS color of the on-the-fly-assembly smoother, vertices in a color are not coupled
+template<bool WithSupport>
+static void gs_relax_OTFA_host_kernel(
+	int nv_gsset, int gs_offset, const float* rholist, float power,
+	int* const v2e[8], int* const v2v[27], const int* vflag,
+	double* const U[3], double* const F[3]
+) {
+#pragma omp parallel for schedule(static)
+	for (int k = 0; k < nv_gsset; k++) {
+		int vid = gs_offset + k;
+		int flag = vflag[vid];
+		if (flag & Grid::Bitmask::mask_invalid) continue;
+		if (v2v[13][vid] == -1) continue;
+
+		double KeU[3] = { 0. };
+		double S[9] = { 0. };
+
+		if (WithSupport && (flag & Grid::Bitmask::mask_supportnodes)) {
+			// fixed node, the diagonal block is identity on each element
+			for (int e = 0; e < 8; e++) {
+				if (v2e[e][vid] == -1) continue;
+				S[0] += 1; S[4] += 1; S[8] += 1;
+			}
+		}
+		else {
+			elementKU<WithSupport>(vid, rholist, power, v2e, v2v, vflag, U, KeU, S);
+		}
+
+		blockGaussSeidel(vid, reinterpret_cast<double(*)[3]>(S), KeU, U, F);
+	}
+}
+
+// one GS color of the stencil smoother on coarse layers
+template<typename T>
+static void gs_relax_stencil_host_kernel(
+	int n_vgstotal, int nv_gsset, int gs_offset, T* rxstencil,
+	int* const v2v[27], const int* vflag, double* const U[3], double* const F[3]
+) {
+#pragma omp parallel for schedule(static)
+	for (int k = 0; k < nv_gsset; k++) {
+		int vid = gs_offset + k;
+		if (vflag[vid] & Grid::Bitmask::mask_invalid) continue;
+
+		double Au[3] = { 0. };
+		for (int nei = 0; nei < 27; nei++) {
+			if (nei == 13) continue;
+			int neigh = v2v[nei][vid];
+			if (neigh == -1) continue;
+			double u[3] = { U[0][neigh],U[1][neigh],U[2][neigh] };
+			for (int row = 0; row < 3; row++) {
+				for (int col = 0; col < 3; col++) {
+					Au[row] += stencil_entry(rxstencil, n_vgstotal, nei, row * 3 + col, vid, neigh) * u[col];
+				}
+			}
+		}
+
+		double s[3][3];
+		for (int i = 0; i < 9; i++) s[i / 3][i % 3] = stencilEntry(rxstencil, n_vgstotal, 13, i, vid);
+		blockGaussSeidel(vid, s, Au, U, F);
+	}
+}
+
+void Grid::gs_relax_host(int n_times)
+{
+	if (is_dummy()) return;
+	if (_layer == 0) loadTemplateMatrixHost();
+	for (int n = 0; n < n_times; n++) {
+		int gs_offset = 0;
+		for (int i = 0; i < 8; i++) {
+			if (_layer != 0 && mixedPrecision()) {
+				gs_relax_stencil_host_kernel(n_gsvertices, gs_num[i], gs_offset, _gbuf.rxStencilF, _gbuf.v2v, _gbuf.vBitflag, _gbuf.U, _gbuf.F);
+			}
+			else if (_layer != 0) {
+				gs_relax_stencil_host_kernel(n_gsvertices, gs_num[i], gs_offset, _gbuf.rxStencil, _gbuf.v2v, _gbuf.vBitflag, _gbuf.U, _gbuf.F);
+			}
+			else if (hasSupport()) {
+				gs_relax_OTFA_host_kernel<true>(gs_num[i], gs_offset, _gbuf.rho_e, _power_penalty, _gbuf.v2e, _gbuf.v2v, _gbuf.vBitflag, _gbuf.U, _gbuf.F);
+			}
+			else {
+				gs_relax_OTFA_host_kernel<false>(gs_num[i], gs_offset, _gbuf.rho_e, _power_penalty, _gbuf.v2e, _gbuf.v2v, _gbuf.vBitflag, _gbuf.U, _gbuf.F);
+			}
+			gs_offset += gs_num[i];
+		}
+	}
+}
+
+// residual of the stencil on coarse layers
+template<typename T>
+static void update_residual_stencil_host_kernel(
+	int nv, T* rx, int* const v2v[27], const int* vflag, double* const U[3], double* const F[3], double* const R[3]
+) {
+#pragma omp parallel for schedule(static)
+	for (int vid = 0; vid < nv; vid++) {
+		if (vflag[vid] & Grid::Bitmask::mask_invalid) continue;
+		double KU[3] = { 0. };
+		for (int nei = 0; nei < 27; nei++) {
+			int vj = v2v[nei][vid];
+			if (vj == -1) continue;
+			double u[3] = { U[0][vj],U[1][vj],U[2][vj] };
+			for (int row = 0; row < 3; row++) {
+				for (int col = 0; col < 3; col++) {
+					KU[row] += stencil_entry(rx, nv, nei, row * 3 + col, vid, vj) * u[col];
+				}
+			}
+		}
+		for (int i = 0; i < 3; i++) R[i][vid] = F[i][vid] - KU[i];
+	}
+}
+
+void Grid::update_residual_host(void)
+{
+	if (is_dummy()) return;
+	int nv = n_gsvertices;
+	double** U = _gbuf.U, ** F = _gbuf.F, ** R = _gbuf.R;
+	int** v2v = _gbuf.v2v;
+	const int* vflag = _gbuf.vBitflag;
+	if (_layer == 0) {
+		loadTemplateMatrixHost();
+		bool withSupport = hasSupport();
+		const float* rho = _gbuf.rho_e;
+		float power = _power_penalty;
+		int** v2e = _gbuf.v2e;
+#pragma omp parallel for schedule(static)
+		for (int vid = 0; vid < nv; vid++) {
+			double KU[3] = { 0. };
+			if (withSupport) {
+				if (!(vflag[vid] & Bitmask::mask_supportnodes)) {
+					elementKU<true>(vid, rho, power, v2e, v2v, vflag, U, KU, nullptr);
+				}
+			}
+			else {
+				elementKU<false>(vid, rho, power, v2e, v2v, vflag, U, KU, nullptr);
+			}
+			for (int i = 0; i < 3; i++) R[i][vid] = F[i][vid] - KU[i];
+		}
+	}
+	else if (mixedPrecision()) {
+		update_residual_stencil_host_kernel(nv, _gbuf.rxStencilF, v2v, vflag, U, F, R);
+	}
+	else {
+		update_residual_stencil_host_kernel(nv, _gbuf.rxStencil, v2v, vflag, U, F, R);
+	}
+}
+
+void Grid::applyK_host(double* u[3], double* f[3])
+{
+	if (_layer != 0) return;
+	loadTemplateMatrixHost();
+	int nv = n_gsvertices;
+	bool withSupport = hasSupport();
+	const float* rho = _gbuf.rho_e;
+	float power = _power_penalty;
+	int** v2e = _gbuf.v2e;
+	int** v2v = _gbuf.v2v;
+	const int* vflag = _gbuf.vBitflag;
+#pragma omp parallel for schedule(static)
+	for (int vid = 0; vid < nv; vid++) {
+		double KU[3] = { 0. };
+		int flag = vflag[vid];
+		if (flag & Bitmask::mask_invalid) {
+			// invalid node has zero force
+		}
+		else if (withSupport && (flag & Bitmask::mask_supportnodes)) {
+			// identity on fixed nodes
+			for (int i = 0; i < 3; i++) KU[i] = u[i][vid];
+		}
+		else if (withSupport) {
+			elementKU<true>(vid, rho, power, v2e, v2v, vflag, u, KU, nullptr);
+		}
+		else {
+			elementKU<false>(vid, rho, power, v2e, v2v, vflag, u, KU, nullptr);
+		}
+		for (int i = 0; i < 3; i++) f[i][vid] = KU[i];
+	}
+}
+
+void Grid::restrict_residual_host(void)
+{
+	int nv = n_gsvertices;
+	double** F = _gbuf.F;
+	double** Rfine = fineGrid->_gbuf.R;
+	if (_layer == 2 && is_skip()) {
+		int** v2vfinec = _gbuf.v2vfinecenter;
+		int** vfine2vfine = fineGrid->_gbuf.v2v;
+#pragma omp parallel for schedule(static)
+		for (int vid = 0; vid < nv; vid++) {
+			// visited flag of the 7x7x7 fine vertices around the coarse vertex
+			bool visited[7 * 7 * 7] = { false };
+			double sumR[3] = { 0. };
+			for (int i = 0; i < 64; i++) {
+				int vff = v2vfinec[i][vid];
+				if (vff == -1) continue;
+				int basepos[3] = { i % 4 * 2 - 3,i % 16 / 4 * 2 - 3,i / 16 * 2 - 3 };
+				for (int dx = -1; dx <= 1; dx++) {
+					int xj = basepos[0] + dx;
+					if (xj <= -4 || xj >= 4) continue;
+					for (int dy = -1; dy <= 1; dy++) {
+						int yj = basepos[1] + dy;
+						if (yj <= -4 || yj >= 4) continue;
+						for (int dz = -1; dz <= 1; dz++) {
+							int zj = basepos[2] + dz;
+							if (zj <= -4 || zj >= 4) continue;
+							int jid = xj + 3 + (yj + 3) * 7 + (zj + 3) * 49;
+							if (visited[jid]) continue;
+							visited[jid] = true;
+							int djid = (dx + 1) + (dy + 1) * 3 + (dz + 1) * 9;
+							int vj_vid = vfine2vfine[djid][vff];
+							if (vj_vid == -1) continue;
+							double weight = nondyadicWeight(abs(xj), abs(yj), abs(zj));
+							for (int k = 0; k < 3; k++) sumR[k] += weight * Rfine[k][vj_vid];
+						}
+					}
+				}
+			}
+			for (int k = 0; k < 3; k++) F[k][vid] = sumR[k];
+		}
+	}
+	else if (_layer == 0) {
+		msg() << "\033[31mCannot restrict residual to finest layer" << "\033[0m" << std::endl;
+	}
+	else {
+		int** v2vfine = _gbuf.v2vfine;
+		const double w[4] = { 1.0,1.0 / 2,1.0 / 4,1.0 / 8 };
+#pragma omp parallel for schedule(static)
+		for (int vid = 0; vid < nv; vid++) {
+			double res[3] = { 0. };
+			for (int j = 0; j < 27; j++) {
+				int neigh = v2vfine[j][vid];
+				if (neigh == -1) continue;
+				double weight = w[abs(j % 3 - 1) + abs(j % 9 / 3 - 1) + abs(j / 9 - 1)];
+				for (int i = 0; i < 3; i++) res[i] += Rfine[i][neigh] * weight;
+			}
+			for (int i = 0; i < 3; i++) F[i][vid] = res[i];
+		}
+	}
+}
+
+void Grid::prolongate_correction_host(void)
+{
+	if (is_dummy()) return;
+	int nv = n_gsvertices;
+	double** U = _gbuf.U;
+	double** Ucoarse = coarseGrid->_gbuf.U;
+	int** v2vcoarse = _gbuf.v2vcoarse;
+	const int* vflag = _gbuf.vBitflag;
+	// the coarse element spans 4 fine elements on the non dyadic layer, 2 otherwise
+	int span = (_layer == 0 && is_skip()) ? 4 : 2;
+	double wnorm = span * span * span;
+#pragma omp parallel for schedule(static)
+	for (int vid = 0; vid < nv; vid++) {
+		int flag = vflag[vid];
+		if (flag & Bitmask::mask_invalid) continue;
+		int posInE[3] = {
+			((flag & Bitmask::mask_xmod7) >> Bitmask::offset_xmod7) % span,
+			((flag & Bitmask::mask_ymod7) >> Bitmask::offset_ymod7) % span,
+			((flag & Bitmask::mask_zmod7) >> Bitmask::offset_zmod7) % span
+		};
+		double c[3] = { 0. };
+		for (int i = 0; i < 8; i++) {
+			int vcoarsepos[3] = { i % 2 * span, i % 4 / 2 * span, i / 4 * span };
+			int wpos[3] = { abs(vcoarsepos[0] - posInE[0]), abs(vcoarsepos[1] - posInE[1]), abs(vcoarsepos[2] - posInE[2]) };
+			if (wpos[0] >= span || wpos[1] >= span || wpos[2] >= span) continue;
+			int vcoarseid = v2vcoarse[i][vid];
+			if (vcoarseid == -1) continue;
+			double weight = (span - wpos[0]) * (span - wpos[1]) * (span - wpos[2]) / wnorm;
+			for (int j = 0; j < 3; j++) c[j] += weight * Ucoarse[j][vcoarseid];
+		}
+		for (int i = 0; i < 3; i++) U[i][vid] += c[i];
+	}
+}
+
+void Grid::lexico2gsorder_host(int* idmap, int n_id, int* ids, int n_mapid, int* mapped_ids, int* valuemap /*= nullptr*/)
+{
+	std::vector<int> oldids(ids, ids + n_id);
+	std::fill(mapped_ids, mapped_ids + n_mapid, -1);
+#pragma omp parallel for
+	for (int i = 0; i < n_id; i++) {
+		int newvalue = oldids[i];
+		if (valuemap != nullptr && newvalue != -1) newvalue = valuemap[newvalue];
+		mapped_ids[idmap != nullptr ? idmap[i] : i] = newvalue;
+	}
+}
+
+void Grid::mark_surface_nodes_host(int nv, int* v2e[8], int* vflag)
+{
+#pragma omp parallel for
+	for (int vid = 0; vid < nv; vid++) {
+		bool solid_flag[2][2][2];
+		for (int i = 0; i < 8; i++) {
+			solid_flag[i % 2][i % 4 / 2][i / 4] = v2e[i][vid] != -1;
+		}
+		bool axisHasNeighbor[3] = { false, false, false };
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 2; j++) {
+				axisHasNeighbor[0] |= solid_flag[0][i][j] && solid_flag[1][i][j];
+				axisHasNeighbor[1] |= solid_flag[i][0][j] && solid_flag[i][1][j];
+				axisHasNeighbor[2] |= solid_flag[i][j][0] && solid_flag[i][j][1];
+			}
+		}
+		bool surf = (!axisHasNeighbor[0]) || (!axisHasNeighbor[1]) || (!axisHasNeighbor[2]);
+		if (surf) {
+			vflag[vid] |= Bitmask::mask_surfacenodes;
+		}
+		else {
+			vflag[vid] &= ~(int)Bitmask::mask_surfacenodes;
+		}
+	}
+}
+
+void Grid::v3_init_host(int n, double* v[3], double val[3])
+{
+	for (int i = 0; i < 3; i++) {
+		double* vi = v[i];
+		double c = val[i];
+#pragma omp parallel for simd
+		for (int k = 0; k < n; k++) vi[k] = c;
+	}
+}
+
+void Grid::v3_axpby_host(int n, double* dst[3], double alpha, double* a[3], double beta, double* b[3])
+{
+	for (int i = 0; i < 3; i++) {
+		double* d = dst[i], * ai = a[i], * bi = b[i];
+#pragma omp parallel for simd
+		for (int k = 0; k < n; k++) d[k] = alpha * ai[k] + beta * bi[k];
+	}
+}
+
+double Grid::v3_dot_host(int n, double* v[3], double* u[3])
+{
+	double s = 0;
+	for (int i = 0; i < 3; i++) {
+		double* vi = v[i], * ui = u[i];
+#pragma omp parallel for simd reduction(+:s)
+		for (int k = 0; k < n; k++) s += vi[k] * ui[k];
+	}
+	return s;
+}
+
+void Grid::v3_rand_host(double* v[3], double low, double upp)
+{
+	// fixed size chunks, each with its own engine, keep the fill parallel
+	constexpr int chunk = 1 << 16;
+	int n = n_gsvertices;
+	int nchunk = (n + chunk - 1) / chunk;
+	unsigned int seed = (unsigned int)time(nullptr);
+	for (int i = 0; i < 3; i++) {
+		double* vi = v[i];
+#pragma omp parallel for
+		for (int c = 0; c < nchunk; c++) {
+			std::mt19937_64 gen(seed + c * 3 + i);
+			std::uniform_real_distribution<double> dist(low, upp);
+			int kend = (std::min)(n, (c + 1) * chunk);
+			for (int k = c * chunk; k < kend; k++) vi[k] = dist(gen);
+		}
+	}
+}
+
+void Grid::resetDirchlet_host(double* v[3])
+{
+	int* vflag = _gbuf.vBitflag;
+#pragma omp parallel for
+	for (int vid = 0; vid < n_gsvertices; vid++) {
+		int flag = vflag[vid];
+		if ((flag & Bitmask::mask_supportnodes) && !(flag & Bitmask::mask_invalid)) {
+			for (int i = 0; i < 3; i++) v[i][vid] = 0;
+		}
+	}
+}
+
+// block vectors are interleaved as [vertex][3][n_rhs], the stencil (or element matrix) entries are loaded once
+// for all right hand sides
+static constexpr int MaxRhs = Grid::max_block_rhs;
+
+static inline void blockGaussSeidel(int K, const double s[9], const double Au[3][MaxRhs], double* u, const double* f) {
+	for (int k = 0; k < K; k++) {
+		double u0 = u[k], u1 = u[K + k], u2 = u[2 * K + k];
+		u0 = (f[k] - s[1] * u1 - s[2] * u2 - Au[0][k]) / s[0];
+		u1 = (f[K + k] - s[3] * u0 - s[5] * u2 - Au[1][k]) / s[4];
+		u2 = (f[2 * K + k] - s[6] * u0 - s[7] * u1 - Au[2][k]) / s[8];
+		u[k] = u0; u[K + k] = u1; u[2 * K + k] = u2;
+	}
+}
+
+template<typename T>
+static inline void blockStencilKU(int K, int vid, int n, T* rxstencil, int* const v2v[27], const double* U, bool skipCenter, double KU[3][MaxRhs]) {
+	for (int nei = 0; nei < 27; nei++) {
+		if (skipCenter && nei == 13) continue;
+		int neigh = v2v[nei][vid];
+		if (neigh == -1) continue;
+		double s[9];
+		for (int i = 0; i < 9; i++) s[i] = stencil_entry(rxstencil, n, nei, i, vid, neigh);
+		const double* un = U + (size_t)neigh * 3 * K;
+		for (int row = 0; row < 3; row++) {
+			double* kur = KU[row];
+#pragma omp simd
+			for (int k = 0; k < K; k++) {
+				kur[k] += s[row * 3] * un[k] + s[row * 3 + 1] * un[K + k] + s[row * 3 + 2] * un[2 * K + k];
+			}
+		}
+	}
+}
+
+// block version of elementKU
+template<bool WithSupport>
+static inline void blockElementKU(
+	int K, int vid, const float* rholist, float power,
+	int* const v2e[8], int* const v2v[27], const int* vflag,
+	const double* U, double KU[3][MaxRhs], double* S
+) {
+	for (int e = 0; e < 8; e++) {
+		int eid = v2e[e][vid];
+		if (eid == -1) continue;
+		double penalty = powf(rholist[eid], power);
+		int vi = 7 - e;
+		if (S != nullptr) {
+			for (int i = 0; i < 9; i++) {
+				S[i] += penalty * hTemplateMatrix[vi * 3 + i / 3][vi * 3 + i % 3];
+			}
+		}
+		for (int vj = 0; vj < 8; vj++) {
+			int vj_lid = elementVertexLid(e, vj);
+			if (S != nullptr && vj_lid == 13) continue;
+			int vj_vid = v2v[vj_lid][vid];
+			if (vj_vid == -1) continue;
+			if (WithSupport && (vflag[vj_vid] & Grid::Bitmask::mask_supportnodes)) continue;
+			const double* un = U + (size_t)vj_vid * 3 * K;
+			for (int row = 0; row < 3; row++) {
+				const double* kr = hTemplateMatrix[vi * 3 + row] + vj * 3;
+				double ke0 = penalty * kr[0], ke1 = penalty * kr[1], ke2 = penalty * kr[2];
+				double* kur = KU[row];
+#pragma omp simd
+				for (int k = 0; k < K; k++) {
+					kur[k] += ke0 * un[k] + ke1 * un[K + k] + ke2 * un[2 * K + k];
+				}
+			}
+		}
+	}
+}
+
+template<bool WithSupport>
+static void gs_relax_OTFA_block_host_kernel(
+	int K, int nv_gsset, int gs_offset, const float* rholist, float power,
+	int* const v2e[8], int* const v2v[27], const int* vflag, double* U, const double* F
+) {
+#pragma omp parallel for schedule(static)
+	for (int n = 0; n < nv_gsset; n++) {
+		int vid = gs_offset + n;
+		int flag = vflag[vid];
+		if (flag & Grid::Bitmask::mask_invalid) continue;
+		if (v2v[13][vid] == -1) continue;
+
+		double KeU[3][MaxRhs] = { 0. };
+		double S[9] = { 0. };
+		if (WithSupport && (flag & Grid::Bitmask::mask_supportnodes)) {
+			for (int e = 0; e < 8; e++) {
+				if (v2e[e][vid] == -1) continue;
+				S[0] += 1; S[4] += 1; S[8] += 1;
+			}
+		}
+		else {
+			blockElementKU<WithSupport>(K, vid, rholist, power, v2e, v2v, vflag, U, KeU, S);
+		}
+		blockGaussSeidel(K, S, KeU, U + (size_t)vid * 3 * K, F + (size_t)vid * 3 * K);
+	}
+}
+
+// one GS color of the block stencil smoother on coarse layers
+template<typename T>
+static void gs_relax_stencil_block_host_kernel(
+	int K, int nv, int nv_gsset, int gs_offset, T* rx, int* const v2v[27], const int* vflag, double* U, const double* F
+) {
+#pragma omp parallel for schedule(static)
+	for (int k = 0; k < nv_gsset; k++) {
+		int vid = gs_offset + k;
+		if (vflag[vid] & Grid::Bitmask::mask_invalid) continue;
+		double Au[3][MaxRhs] = { 0. };
+		blockStencilKU(K, vid, nv, rx, v2v, U, true, Au);
+		double s[9];
+		for (int j = 0; j < 9; j++) s[j] = stencilEntry(rx, nv, 13, j, vid);
+		blockGaussSeidel(K, s, Au, U + (size_t)vid * 3 * K, F + (size_t)vid * 3 * K);
+	}
+}
+
+void Grid::gs_relax_block_host(int n_times)
+{
+	if (is_dummy()) return;
+	if (_layer == 0) loadTemplateMatrixHost();
+	int K = n_rhs;
+	double* U = _gbuf.Ublock;
+	const double* F = _gbuf.Fblock;
+	for (int n = 0; n < n_times; n++) {
+		int gs_offset = 0;
+		for (int i = 0; i < 8; i++) {
+			if (_layer != 0 && mixedPrecision()) {
+				gs_relax_stencil_block_host_kernel(K, n_gsvertices, gs_num[i], gs_offset, _gbuf.rxStencilF, _gbuf.v2v, _gbuf.vBitflag, U, F);
+			}
+			else if (_layer != 0) {
+				gs_relax_stencil_block_host_kernel(K, n_gsvertices, gs_num[i], gs_offset, _gbuf.rxStencil, _gbuf.v2v, _gbuf.vBitflag, U, F);
+			}
+			else if (hasSupport()) {
+				gs_relax_OTFA_block_host_kernel<true>(K, gs_num[i], gs_offset, _gbuf.rho_e, _power_penalty, _gbuf.v2e, _gbuf.v2v, _gbuf.vBitflag, U, F);
+			}
+			else {
+				gs_relax_OTFA_block_host_kernel<false>(K, gs_num[i], gs_offset, _gbuf.rho_e, _power_penalty, _gbuf.v2e, _gbuf.v2v, _gbuf.vBitflag, U, F);
+			}
+			gs_offset += gs_num[i];
+		}
+	}
+}
+
+void Grid::update_residual_block_host(void)
+{
+	if (is_dummy()) return;
+	int nv = n_gsvertices;
+	int K = n_rhs;
+	const double* U = _gbuf.Ublock, * F = _gbuf.Fblock;
+	double* R = _gbuf.Rblock;
+	int** v2v = _gbuf.v2v;
+	const int* vflag = _gbuf.vBitflag;
+	if (_layer == 0) loadTemplateMatrixHost();
+	bool withSupport = hasSupport();
+	bool floatStencil = mixedPrecision();
+#pragma omp parallel for schedule(static)
+	for (int vid = 0; vid < nv; vid++) {
+		double KU[3][MaxRhs] = { 0. };
+		if (_layer != 0) {
+			if (vflag[vid] & Bitmask::mask_invalid) continue;
+			if (floatStencil) {
+				blockStencilKU(K, vid, nv, _gbuf.rxStencilF, v2v, U, false, KU);
+			}
+			else {
+				blockStencilKU(K, vid, nv, _gbuf.rxStencil, v2v, U, false, KU);
+			}
+		}
+		else if (withSupport) {
+			if (!(vflag[vid] & Bitmask::mask_supportnodes)) {
+				blockElementKU<true>(K, vid, _gbuf.rho_e, _power_penalty, _gbuf.v2e, v2v, vflag, U, KU, nullptr);
+			}
+		}
+		else {
+			blockElementKU<false>(K, vid, _gbuf.rho_e, _power_penalty, _gbuf.v2e, v2v, vflag, U, KU, nullptr);
+		}
+		for (int row = 0; row < 3; row++) {
+			size_t base = ((size_t)vid * 3 + row) * K;
+			for (int k = 0; k < K; k++) R[base + k] = F[base + k] - KU[row][k];
+		}
+	}
+}
+
+void Grid::restrict_residual_block_host(void)
+{
+	if (_layer == 0) {
+		msg() << "\033[31mCannot restrict residual to finest layer" << "\033[0m" << std::endl;
+		return;
+	}
+	int nv = n_gsvertices;
+	int K = n_rhs;
+	double* F = _gbuf.Fblock;
+	const double* Rfine = fineGrid->_gbuf.Rblock;
+	if (_layer == 2 && is_skip()) {
+		int** v2vfinec = _gbuf.v2vfinecenter;
+		int** vfine2vfine = fineGrid->_gbuf.v2v;
+#pragma omp parallel for schedule(static)
+		for (int vid = 0; vid < nv; vid++) {
+			bool visited[7 * 7 * 7] = { false };
+			double sumR[3][MaxRhs] = { 0. };
+			for (int i = 0; i < 64; i++) {
+				int vff = v2vfinec[i][vid];
+				if (vff == -1) continue;
+				int basepos[3] = { i % 4 * 2 - 3,i % 16 / 4 * 2 - 3,i / 16 * 2 - 3 };
+				for (int dx = -1; dx <= 1; dx++) {
+					int xj = basepos[0] + dx;
+					if (xj <= -4 || xj >= 4) continue;
+					for (int dy = -1; dy <= 1; dy++) {
+						int yj = basepos[1] + dy;
+						if (yj <= -4 || yj >= 4) continue;
+						for (int dz = -1; dz <= 1; dz++) {
+							int zj = basepos[2] + dz;
+							if (zj <= -4 || zj >= 4) continue;
+							int jid = xj + 3 + (yj + 3) * 7 + (zj + 3) * 49;
+							if (visited[jid]) continue;
+							visited[jid] = true;
+							int djid = (dx + 1) + (dy + 1) * 3 + (dz + 1) * 9;
+							int vj_vid = vfine2vfine[djid][vff];
+							if (vj_vid == -1) continue;
+							double weight = nondyadicWeight(abs(xj), abs(yj), abs(zj));
+							const double* rn = Rfine + (size_t)vj_vid * 3 * K;
+							for (int c = 0; c < 3; c++) {
+								for (int k = 0; k < K; k++) sumR[c][k] += weight * rn[c * K + k];
+							}
+						}
+					}
+				}
+			}
+			for (int c = 0; c < 3; c++) {
+				for (int k = 0; k < K; k++) F[((size_t)vid * 3 + c) * K + k] = sumR[c][k];
+			}
+		}
+	}
+	else {
+		int** v2vfine = _gbuf.v2vfine;
+		const double w[4] = { 1.0,1.0 / 2,1.0 / 4,1.0 / 8 };
+#pragma omp parallel for schedule(static)
+		for (int vid = 0; vid < nv; vid++) {
+			double res[3][MaxRhs] = { 0. };
+			for (int j = 0; j < 27; j++) {
+				int neigh = v2vfine[j][vid];
+				if (neigh == -1) continue;
+				double weight = w[abs(j % 3 - 1) + abs(j % 9 / 3 - 1) + abs(j / 9 - 1)];
+				const double* rn = Rfine + (size_t)neigh * 3 * K;
+				for (int c = 0; c < 3; c++) {
+					for (int k = 0; k < K; k++) res[c][k] += weight * rn[c * K + k];
+				}
+			}
+			for (int c = 0; c < 3; c++) {
+				for (int k = 0; k < K; k++) F[((size_t)vid * 3 + c) * K + k] = res[c][k];
+			}
+		}
+	}
+}
+
+void Grid::prolongate_correction_block_host(void)
+{
+	if (is_dummy()) return;
+	int nv = n_gsvertices;
+	int K = n_rhs;
+	double* U = _gbuf.Ublock;
+	const double* Ucoarse = coarseGrid->_gbuf.Ublock;
+	int** v2vcoarse = _gbuf.v2vcoarse;
+	const int* vflag = _gbuf.vBitflag;
+	int span = (_layer == 0 && is_skip()) ? 4 : 2;
+	double wnorm = span * span * span;
+#pragma omp parallel for schedule(static)
+	for (int vid = 0; vid < nv; vid++) {
+		int flag = vflag[vid];
+		if (flag & Bitmask::mask_invalid) continue;
+		int posInE[3] = {
+			((flag & Bitmask::mask_xmod7) >> Bitmask::offset_xmod7) % span,
+			((flag & Bitmask::mask_ymod7) >> Bitmask::offset_ymod7) % span,
+			((flag & Bitmask::mask_zmod7) >> Bitmask::offset_zmod7) % span
+		};
+		double c[3][MaxRhs] = { 0. };
+		for (int i = 0; i < 8; i++) {
+			int vcoarsepos[3] = { i % 2 * span, i % 4 / 2 * span, i / 4 * span };
+			int wpos[3] = { abs(vcoarsepos[0] - posInE[0]), abs(vcoarsepos[1] - posInE[1]), abs(vcoarsepos[2] - posInE[2]) };
+			if (wpos[0] >= span || wpos[1] >= span || wpos[2] >= span) continue;
+			int vcoarseid = v2vcoarse[i][vid];
+			if (vcoarseid == -1) continue;
+			double weight = (span - wpos[0]) * (span - wpos[1]) * (span - wpos[2]) / wnorm;
+			const double* uc = Ucoarse + (size_t)vcoarseid * 3 * K;
+			for (int j = 0; j < 3; j++) {
+				for (int k = 0; k < K; k++) c[j][k] += weight * uc[j * K + k];
+			}
+		}
+		for (int j = 0; j < 3; j++) {
+			for (int k = 0; k < K; k++) U[((size_t)vid * 3 + j) * K + k] += c[j][k];
+		}
+	}
+}
+
+void Grid::block_norm_host(double* blockv, double* norms)
+{
+	int nv = n_gsvertices;
+	int K = n_rhs;
+	for (int k = 0; k < K; k++) {
+		double s = 0;
+#pragma omp parallel for reduction(+:s)
+		for (int vid = 0; vid < nv; vid++) {
+			for (int i = 0; i < 3; i++) {
+				double e = blockv[((size_t)vid * 3 + i) * K + k];
+				s += e * e;
+			}
+		}
+		norms[k] = sqrt(s);
+	}
+}
+
+void Grid::v3_to_block_host(double* v[3], double* blockv, int col)
+{
+	int K = n_rhs;
+#pragma omp parallel for
+	for (int vid = 0; vid < n_gsvertices; vid++) {
+		for (int i = 0; i < 3; i++) blockv[((size_t)vid * 3 + i) * K + col] = v[i][vid];
+	}
+}
+
+void Grid::block_to_v3_host(double* blockv, int col, double* v[3])
+{
+	int K = n_rhs;
+#pragma omp parallel for
+	for (int vid = 0; vid < n_gsvertices; vid++) {
+		for (int i = 0; i < 3; i++) v[i][vid] = blockv[((size_t)vid * 3 + i) * K + col];
+	}
+}
+
+// coarse stencil from the fine stencil, rxcoarse = R * rxfine * P
+template<typename T>
+static void restrict_stencil_dyadic_host_kernel(Grid& dstcoarse, Grid& srcfine) {
+	int nv_coarse = dstcoarse.n_gsvertices, nv_fine = srcfine.n_gsvertices;
+	T* rxcoarse = stencilBuf<T>(dstcoarse);
+	T* rxfine = stencilBuf<T>(srcfine);
+	int** v2vfine = dstcoarse._gbuf.v2vfine;
+	int** vfine2vfine = srcfine._gbuf.v2v;
+	const double w[4] = { 1.0,1.0 / 2,1.0 / 4,1.0 / 8 };
+#pragma omp parallel for schedule(dynamic, 256)
+	for (int vid = 0; vid < nv_coarse; vid++) {
+		double coarseStencil[n_stencil_blocks][9] = { 0. };
+		for (int i = 0; i < 27; i++) {
+			int neipos[3] = { i % 3 + 1 ,i % 9 / 3 + 1 ,i / 9 + 1 };
+			double weight = w[abs(neipos[0] - 2) + abs(neipos[1] - 2) + abs(neipos[2] - 2)];
+			int vn = v2vfine[i][vid];
+			if (vn == -1) continue;
+			for (int j = 0; j < 27; j++) {
+				int vjn = vfine2vfine[j][vn];
+				if (vjn == -1) continue;
+				int vjpos[3] = { neipos[0] + j % 3 - 1 ,neipos[1] + j % 9 / 3 - 1 ,neipos[2] + j / 9 - 1 };
+				double kij[9];
+				for (int k = 0; k < 9; k++) kij[k] = stencil_entry(rxfine, nv_fine, j, k, vn, vjn) * weight;
+				// only the stored blocks of the coarse stencil are accumulated
+				for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
+					int wsplitpos[3] = { abs(vsplit % 3 * 2 - vjpos[0]), abs(vsplit % 9 / 3 * 2 - vjpos[1]), abs(vsplit / 9 * 2 - vjpos[2]) };
+					if (wsplitpos[0] >= 2 || wsplitpos[1] >= 2 || wsplitpos[2] >= 2) continue;
+					double wsplit = w[wsplitpos[0] + wsplitpos[1] + wsplitpos[2]];
+					for (int k = 0; k < 9; k++) coarseStencil[vsplit][k] += wsplit * kij[k];
+				}
+			}
+		}
+		for (int i = 0; i < n_stencil_blocks; i++) {
+			for (int k = 0; k < 9; k++) stencilEntry(rxcoarse, nv_coarse, i, k, vid) = coarseStencil[i][k];
+		}
+	}
+}
+
+// coarse stencil assembled on the fly from the fine densities
+template<typename T>
+static void restrict_stencil_dyadic_OTFA_host_kernel(Grid& dstcoarse, Grid& srcfine) {
+	int nv_coarse = dstcoarse.n_gsvertices;
+	T* rxcoarse = stencilBuf<T>(dstcoarse);
+	int** v2vfine = dstcoarse._gbuf.v2vfine;
+	int** vfine2efine = srcfine._gbuf.v2e;
+	const float* rhofine = srcfine._gbuf.rho_e;
+	float power = Grid::_power_penalty;
+	const double w[4] = { 1.0,1.0 / 2,1.0 / 4,1.0 / 8 };
+#pragma omp parallel for schedule(dynamic, 256)
+	for (int vid = 0; vid < nv_coarse; vid++) {
+		double coarseStencil[n_stencil_blocks][9] = { 0. };
+		bool visited[64] = { false };
+		for (int i = 0; i < 27; i++) {
+			int neipos[3] = { i % 3 + 1 ,i % 9 / 3 + 1 ,i / 9 + 1 };
+			int vn = v2vfine[i][vid];
+			if (vn == -1) continue;
+			for (int j = 0; j < 8; j++) {
+				int epos[3] = { neipos[0] + j % 2 - 1,neipos[1] + j % 4 / 2 - 1,neipos[2] + j / 4 - 1 };
+				int eposid = epos[0] + epos[1] * 4 + epos[2] * 16;
+				if (visited[eposid]) continue;
+				visited[eposid] = true;
+				int eid = vfine2efine[j][vn];
+				if (eid == -1) continue;
+				double rho_p = powf(rhofine[eid], power);
+				for (int vi = 0; vi < 8; vi++) {
+					int wipos[3] = { abs(epos[0] + vi % 2 - 2) , abs(epos[1] + vi % 4 / 2 - 2) , abs(epos[2] + vi / 4 - 2) };
+					if (wipos[0] >= 2 || wipos[1] >= 2 || wipos[2] >= 2) continue;
+					double wi_p = w[wipos[0] + wipos[1] + wipos[2]] * rho_p;
+					for (int vj = 0; vj < 8; vj++) {
+						int vjpos[3] = { epos[0] + vj % 2,epos[1] + vj % 4 / 2,epos[2] + vj / 4 };
+						for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
+							int wspos[3] = { abs(vsplit % 3 * 2 - vjpos[0]), abs(vsplit % 9 / 3 * 2 - vjpos[1]), abs(vsplit / 9 * 2 - vjpos[2]) };
+							if (wspos[0] >= 2 || wspos[1] >= 2 || wspos[2] >= 2) continue;
+							double wkw = wi_p * w[wspos[0] + wspos[1] + wspos[2]];
+							for (int k = 0; k < 9; k++) {
+								coarseStencil[vsplit][k] += wkw * hTemplateMatrix[vi * 3 + k / 3][vj * 3 + k % 3];
+							}
+						}
+					}
+				}
+			}
+		}
+		for (int i = 0; i < n_stencil_blocks; i++) {
+			for (int k = 0; k < 9; k++) stencilEntry(rxcoarse, nv_coarse, i, k, vid) = coarseStencil[i][k];
+		}
+	}
+}
+
+void HierarchyGrid::restrict_stencil_dyadic_host(Grid& dstcoarse, Grid& srcfine)
+{
+	bool floatStencil = dstcoarse.mixedPrecision();
+	if (srcfine._layer == 0) {
+		loadTemplateMatrixHost();
+		if (floatStencil) restrict_stencil_dyadic_OTFA_host_kernel<float>(dstcoarse, srcfine);
+		else restrict_stencil_dyadic_OTFA_host_kernel<double>(dstcoarse, srcfine);
+	}
+	else {
+		if (floatStencil) restrict_stencil_dyadic_host_kernel<float>(dstcoarse, srcfine);
+		else restrict_stencil_dyadic_host_kernel<double>(dstcoarse, srcfine);
+	}
+}
+
+// coarse stencil of the non dyadic layer, assembled on the fly from the finest densities
+template<bool WithSupport, typename T>
+static void restrict_stencil_nondyadic_OTFA_host_kernel(Grid& dstcoarse, Grid& srcfine) {
+	int nv_coarse = dstcoarse.n_gsvertices;
+	T* rxcoarse = stencilBuf<T>(dstcoarse);
+	int** v2vfinec = dstcoarse._gbuf.v2vfinecenter;
+	int** vfine2efine = srcfine._gbuf.v2e;
+	int** vfine2vfine = srcfine._gbuf.v2v;
+	const int* vfineflag = srcfine._gbuf.vBitflag;
+	const float* rhofine = srcfine._gbuf.rho_e;
+	float power = Grid::_power_penalty;
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int vid = 0; vid < nv_coarse; vid++) {
+		double coarseStencil[n_stencil_blocks][9] = { 0. };
+		// traverse the fine element centers (vertices on fine fine grid)
+		for (int i = 0; i < 64; i++) {
+			int i2[3] = { (i % 4) * 2 + 1 ,(i % 16 / 4) * 2 + 1 ,(i / 16) * 2 + 1 };
+			int vn = v2vfinec[i][vid];
+			if (vn == -1) continue;
+			for (int j = 0; j < 8; j++) {
+				int efineid = vfine2efine[j][vn];
+				if (efineid == -1) continue;
+				double rho_p = powf(rhofine[efineid], power);
+				int epos[3] = { i2[0] + j % 2 - 1,i2[1] + j % 4 / 2 - 1,i2[2] + j / 4 - 1 };
+
+				bool vfix[8] = { false };
+				if (WithSupport) {
+					for (int k = 0; k < 8; k++) {
+						int vklid = j % 2 + k % 2 + (j / 2 % 2 + k / 2 % 2) * 3 + (j / 4 + k / 4) * 9;
+						int vkvid = vfine2vfine[vklid][vn];
+						vfix[k] = vkvid != -1 && (vfineflag[vkvid] & Grid::Bitmask::mask_supportnodes);
+					}
+				}
+
+				for (int ki = 0; ki < 8; ki++) {
+					int wipos[3] = { abs(epos[0] + ki % 2 - 4),abs(epos[1] + ki % 4 / 2 - 4),abs(epos[2] + ki / 4 - 4) };
+					if (wipos[0] >= 4 || wipos[1] >= 4 || wipos[2] >= 4) continue;
+					double wi = nondyadicWeight(wipos[0], wipos[1], wipos[2]);
+					for (int kj = 0; kj < 8; kj++) {
+						int kjpos[3] = { epos[0] + kj % 2 , epos[1] + kj % 4 / 2 , epos[2] + kj / 4 };
+						double wk[9];
+						for (int k = 0; k < 9; k++) wk[k] = wi * rho_p * hTemplateMatrix[ki * 3 + k / 3][kj * 3 + k % 3];
+						if (WithSupport && (vfix[kj] || vfix[ki])) {
+							for (int k = 0; k < 9; k++) {
+								wk[k] = (ki == kj && k / 3 == k % 3) ? wi * DIRICHLET_DIAGONAL_WEIGHT : 0;
+							}
+						}
+						for (int vsplit = 0; vsplit < n_stencil_blocks; vsplit++) {
+							int wjpos[3] = { abs(vsplit % 3 * 4 - kjpos[0]), abs(vsplit % 9 / 3 * 4 - kjpos[1]), abs(vsplit / 9 * 4 - kjpos[2]) };
+							if (wjpos[0] >= 4 || wjpos[1] >= 4 || wjpos[2] >= 4) continue;
+							double wj = nondyadicWeight(wjpos[0], wjpos[1], wjpos[2]);
+							for (int k = 0; k < 9; k++) coarseStencil[vsplit][k] += wk[k] * wj;
+						}
+					}
+				}
+			}
+		}
+		for (int i = 0; i < n_stencil_blocks; i++) {
+			for (int k = 0; k < 9; k++) stencilEntry(rxcoarse, nv_coarse, i, k, vid) = coarseStencil[i][k];
+		}
+	}
+}
+
+void HierarchyGrid::restrict_stencil_nondyadic_host(Grid& dstcoarse, Grid& srcfine)
+{
+	loadTemplateMatrixHost();
+	bool floatStencil = dstcoarse.mixedPrecision();
+	if (dstcoarse.hasSupport()) {
+		if (floatStencil) restrict_stencil_nondyadic_OTFA_host_kernel<true, float>(dstcoarse, srcfine);
+		else restrict_stencil_nondyadic_OTFA_host_kernel<true, double>(dstcoarse, srcfine);
+	}
+	else {
+		if (floatStencil) restrict_stencil_nondyadic_OTFA_host_kernel<false, float>(dstcoarse, srcfine);
+		else restrict_stencil_nondyadic_OTFA_host_kernel<false, double>(dstcoarse, srcfine);
+	}
+}
+
+// B-spline basis at x, the same recursion as SplineBasisX/Y/Z on device
+template<int Order>
+static void splineBasisHost(const float* knot, float boundmin, float step, float x, float N[Order + 1]) {
+	float left[Order], right[Order];
+	N[0] = 1.f;
+	int l = (int)((x - boundmin) / step) + Order - 1;
+	for (int j = 1; j < Order; j++) {
+		left[j] = x - knot[l + 1 - j];
+		right[j] = knot[l + j] - x;
+		float saved = 0.f;
+		for (int r = 0; r < j; r++) {
+			float temp = N[r] / (right[r + 1] + left[j - r]);
+			N[r] = saved + right[r + 1] * temp;
+			saved = left[j - r] * temp;
+		}
+		N[j] = saved;
+	}
+	N[Order] = 0.f;
+}
+
+// basis of one axis sampled at the element centers, first[i] is the first coefficient of the
+// support (-1 if the center is outside the knot range) and N[i * Order + r] the r-th basis value
+struct AxisBasisTable {
+	std::vector<int> first;
+	std::vector<float> N;
+};
+
+template<int Order>
+static void buildAxisBasisTable(int axis, int ereso, float origin, float eh, const float* knot, AxisBasisTable& tab) {
+	const int order = Order;
+	tab.first.resize(ereso);
+	tab.N.resize(size_t(ereso) * Order, 0.f);
+	for (int i = 0; i < ereso; i++) {
+		float pos = origin + i * eh + 0.5 * eh;
+		int span = (int)((pos - Grid::m_3sBoundMin[axis]) / Grid::m_sStep[axis]) + order;
+		if (span < order || span > Grid::spbasis[axis]) {
+			tab.first[i] = -1;
+			continue;
+		}
+		float Ni[Order + 1];
+		splineBasisHost<Order>(knot, Grid::m_3sBoundMin[axis], Grid::m_sStep[axis], pos, Ni);
+		tab.first[i] = span - order;
+		for (int r = 0; r < order; r++) tab.N[size_t(i) * Order + r] = Ni[r];
+	}
+}
+
+// sum factorised evaluation, the coefficient lattice is contracted along z once per slab and along y once
+// per row, so that every element only costs one contraction along x
+template<int Order>
+void Grid::coeff2density_host_order(void)
+{
+	const int order = Order;
+	const int ereso = _ereso;
+	const float eh = elementLength();
+	const float mindensity = _min_density;
+
+	AxisBasisTable tab[3];
+	for (int i = 0; i < 3; i++) buildAxisBasisTable<Order>(i, ereso, _box[0][i], eh, _gbuf.KnotSer[i], tab[i]);
+
+	const float* cijk = _gbuf.coeffs;
+	const size_t nb0 = spbasis[0], nb01 = size_t(spbasis[0]) * spbasis[1];
+	const TileSAT& esat = *_etiles;
+	const int* eidmap = _gbuf.eidmap;
+	const int* eflag = _gbuf.eBitflag;
+	float* rho = _gbuf.rho_e;
+
+	std::fill(rho, rho + n_gselements, 0.f);
+
+#pragma omp parallel
+	{
+		// coefficients contracted along z, and along z and y
+		std::vector<float> cz(nb01);
+		std::vector<float> cyz(nb0);
+
+#pragma omp for schedule(dynamic, 1)
+		for (int z = 0; z < ereso; z++) {
+			int kz = tab[2].first[z];
+			const float* Nz = &tab[2].N[size_t(z) * Order];
+			bool slabContracted = false;
+			for (int y = 0; y < ereso; y++) {
+				if (esat.rowCount(y, z) == 0) continue;
+
+				int jy = tab[1].first[y];
+				bool rowValid = kz != -1 && jy != -1;
+				if (rowValid) {
+					if (!slabContracted) {
+#pragma omp simd
+						for (size_t ij = 0; ij < nb01; ij++) {
+							float s = 0;
+							for (int t = 0; t < order; t++) s += cijk[ij + (kz + t) * nb01] * Nz[t];
+							cz[ij] = s;
+						}
+						slabContracted = true;
+					}
+					const float* Ny = &tab[1].N[size_t(y) * Order];
+#pragma omp simd
+					for (size_t i = 0; i < nb0; i++) {
+						float s = 0;
+						for (int t = 0; t < order; t++) s += cz[i + (jy + t) * nb0] * Ny[t];
+						cyz[i] = s;
+					}
+				}
+
+				esat.forEachActiveInRow(y, z, [&](int x, int eid) {
+					int ix = tab[0].first[x];
+					float val = -0.2f;
+					if (rowValid && ix != -1) {
+						const float* Nx = &tab[0].N[size_t(x) * Order];
+						val = 0;
+						for (int t = 0; t < order; t++) val += cyz[ix + t] * Nx[t];
+					}
+					int egsid = eidmap != nullptr ? eidmap[eid] : eid;
+					val = std::clamp(val, mindensity, 1.f);
+					if (eflag[egsid] & mask_shellelement) val = 1;
+					rho[egsid] = val;
+				});
+			}
+		}
+	}
+}
+
+void Grid::coeff2density_host(void)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { coeff2density_host_order<decltype(order)::value>(); });
+}
+
+// coeff2density_host restricted to the elements whose support box (first coefficient per axis) is flagged in
+// dirtybox, the few flagged elements are summed directly over their Order^3 coefficients
+template<int Order>
+void Grid::coeff2density_host_masked_order(const char* dirtybox, std::vector<int>& changed)
+{
+	const int ereso = _ereso;
+	const float eh = elementLength();
+	const float mindensity = _min_density;
+
+	AxisBasisTable tab[3];
+	for (int i = 0; i < 3; i++) buildAxisBasisTable<Order>(i, ereso, _box[0][i], eh, _gbuf.KnotSer[i], tab[i]);
+
+	const float* cijk = _gbuf.coeffs;
+	const size_t nb0 = spbasis[0], nb01 = size_t(spbasis[0]) * spbasis[1];
+	const int nq0 = spbasis[0] - Order + 1, nq1 = spbasis[1] - Order + 1, nq2 = spbasis[2] - Order + 1;
+	const TileSAT& esat = *_etiles;
+	const int* eidmap = _gbuf.eidmap;
+	const int* eflag = _gbuf.eBitflag;
+	float* rho = _gbuf.rho_e;
+
+	// dirty boxes projected to (qy, qz), clean rows are skipped without walking their bits
+	std::vector<char> rowDirty(size_t(nq1) * nq2, 0);
+	for (size_t r = 0; r < rowDirty.size(); r++) {
+		rowDirty[r] = std::any_of(dirtybox + r * nq0, dirtybox + (r + 1) * nq0, [](char d) { return d != 0; });
+	}
+
+	std::vector<std::vector<int>> slabChanged(ereso);
+
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int z = 0; z < ereso; z++) {
+		int kz = tab[2].first[z];
+		if (kz == -1) continue;
+		const float* Nz = &tab[2].N[size_t(z) * Order];
+		for (int y = 0; y < ereso; y++) {
+			int jy = tab[1].first[y];
+			if (jy == -1 || !rowDirty[jy + size_t(kz) * nq1]) continue;
+			const float* Ny = &tab[1].N[size_t(y) * Order];
+			const char* boxrow = dirtybox + (jy + size_t(kz) * nq1) * nq0;
+
+			esat.forEachActiveInRow(y, z, [&](int x, int eid) {
+				int ix = tab[0].first[x];
+				if (ix == -1 || !boxrow[ix]) return;
+				const float* Nx = &tab[0].N[size_t(x) * Order];
+				float val = 0;
+				for (int t2 = 0; t2 < Order; t2++) {
+					for (int t1 = 0; t1 < Order; t1++) {
+						const float* c = cijk + ix + (jy + t1) * nb0 + (kz + t2) * nb01;
+						float s = 0;
+						for (int t0 = 0; t0 < Order; t0++) s += c[t0] * Nx[t0];
+						val += s * Ny[t1] * Nz[t2];
+					}
+				}
+				int egsid = eidmap != nullptr ? eidmap[eid] : eid;
+				val = std::clamp(val, mindensity, 1.f);
+				if (eflag[egsid] & mask_shellelement) val = 1;
+				rho[egsid] = val;
+				slabChanged[z].push_back(egsid);
+			});
+		}
+	}
+
+	for (int z = 0; z < ereso; z++) changed.insert(changed.end(), slabChanged[z].begin(), slabChanged[z].end());
+}
+
+// values, first and second derivatives of the basis along one axis, the same recursion as SplineBasisDers on device
+template<int Order>
+static void splineBasisDersHost(const float* knot, float boundmin, float step, float x, float ders[3][Order]) {
+	int l = (int)((x - boundmin) / step) + Order - 1;
+	float ndu[Order][Order], a[2][Order], left[Order], right[Order];
+	ndu[0][0] = 1.f;
+	for (int j = 1; j < Order; j++) {
+		left[j] = x - knot[l + 1 - j];
+		right[j] = knot[l + j] - x;
+		float saved = 0.f;
+		for (int r = 0; r < j; r++) {
+			ndu[j][r] = right[r + 1] + left[j - r];
+			float temp = ndu[r][j - 1] / ndu[j][r];
+			ndu[r][j] = saved + right[r + 1] * temp;
+			saved = left[j - r] * temp;
+		}
+		ndu[j][j] = saved;
+	}
+	for (int j = 0; j < Order; j++) {
+		ders[0][j] = ndu[j][Order - 1];
+		ders[1][j] = 0.f;
+		ders[2][j] = 0.f;
+	}
+	const int nder = std::min(Order - 1, 2);
+	for (int r = 0; r < Order; r++) {
+		int s1 = 0, s2 = 1;
+		a[0][0] = 1.f;
+		for (int k = 1; k <= nder; k++) {
+			float d = 0.f;
+			int rk = r - k, pk = Order - 1 - k;
+			if (r >= k) {
+				a[s2][0] = a[s1][0] / ndu[pk + 1][rk];
+				d = a[s2][0] * ndu[rk][pk];
+			}
+			int j1 = rk >= -1 ? 1 : -rk;
+			int j2 = r - 1 <= pk ? k - 1 : Order - 1 - r;
+			for (int j = j1; j <= j2; j++) {
+				a[s2][j] = (a[s1][j] - a[s1][j - 1]) / ndu[pk + 1][rk + j];
+				d += a[s2][j] * ndu[rk + j][pk];
+			}
+			if (r <= pk) {
+				a[s2][k] = -a[s1][k - 1] / ndu[pk + 1][r];
+				d += a[s2][k] * ndu[r][pk];
+			}
+			ders[k][r] = d;
+			std::swap(s1, s2);
+		}
+	}
+	int r = Order - 1;
+	for (int k = 1; k <= nder; k++) {
+		for (int j = 0; j < Order; j++) ders[k][j] *= r;
+		r *= (Order - 1 - k);
+	}
+}
+
+// value, gradient and Hessian of the spline at a list of points. Points are processed in blocks of
+// fieldBlock lanes, the basis tables of a block are stored lane-innermost so that the coefficient
+// contraction runs vectorised across the points of the block
+template<int Order>
+void Grid::compute_spline_fields_host_order(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out)
+{
+	constexpr int fieldBlock = 16;
+	const int npts = list != nullptr ? nlist : n;
+	const int nblock = (npts + fieldBlock - 1) / fieldBlock;
+	const float* cijk = _gbuf.coeffs;
+	const int nb0 = spbasis[0], nb01 = spbasis[0] * spbasis[1];
+
+#pragma omp parallel for schedule(static)
+	for (int blk = 0; blk < nblock; blk++) {
+		int nlane = std::min(fieldBlock, npts - blk * fieldBlock);
+		int id[fieldBlock], base[fieldBlock];
+		alignas(64) float D[3][3][Order][fieldBlock];
+		alignas(64) float f[10][fieldBlock] = {};     // v, gx, gy, gz, hxx, hyy, hzz, hxy, hxz, hyz
+
+		// lanes past the end repeat the last point, points outside the knot range get zero tables
+		for (int b = 0; b < fieldBlock; b++) {
+			int k = blk * fieldBlock + std::min(b, nlane - 1);
+			id[b] = list != nullptr ? list[k] : k;
+			float ders[3][3][Order];
+			int first[3];
+			bool inside = true;
+			for (int i = 0; i < 3; i++) {
+				float x = pts[i][id[b]];
+				int span = (int)((x - m_3sBoundMin[i]) / m_sStep[i]) + Order;
+				if (span < Order || span > spbasis[i]) { inside = false; break; }
+				first[i] = span - Order;
+				splineBasisDersHost<Order>(_gbuf.KnotSer[i], m_3sBoundMin[i], m_sStep[i], x, ders[i]);
+			}
+			for (int i = 0; i < 3; i++)
+				for (int d = 0; d < 3; d++)
+					for (int r = 0; r < Order; r++) D[i][d][r][b] = inside ? ders[i][d][r] : 0.f;
+			base[b] = inside ? first[0] + first[1] * nb0 + first[2] * nb01 : 0;
+		}
+
+		for (int t = 0; t < Order; t++) {
+			// (dx, dy) = 00 10 20 01 11 02
+			alignas(64) float cxy[6][fieldBlock] = {};
+			for (int s = 0; s < Order; s++) {
+				alignas(64) float cx[3][fieldBlock] = {};
+				const int off = s * nb0 + t * nb01;
+				for (int r = 0; r < Order; r++) {
+#pragma omp simd
+					for (int b = 0; b < fieldBlock; b++) {
+						float c = cijk[base[b] + off + r];
+						cx[0][b] += c * D[0][0][r][b];
+						cx[1][b] += c * D[0][1][r][b];
+						cx[2][b] += c * D[0][2][r][b];
+					}
+				}
+#pragma omp simd
+				for (int b = 0; b < fieldBlock; b++) {
+					cxy[0][b] += cx[0][b] * D[1][0][s][b];
+					cxy[1][b] += cx[1][b] * D[1][0][s][b];
+					cxy[2][b] += cx[2][b] * D[1][0][s][b];
+					cxy[3][b] += cx[0][b] * D[1][1][s][b];
+					cxy[4][b] += cx[1][b] * D[1][1][s][b];
+					cxy[5][b] += cx[0][b] * D[1][2][s][b];
+				}
+			}
+#pragma omp simd
+			for (int b = 0; b < fieldBlock; b++) {
+				float n0 = D[2][0][t][b], n1 = D[2][1][t][b], n2 = D[2][2][t][b];
+				f[0][b] += cxy[0][b] * n0;
+				f[1][b] += cxy[1][b] * n0;
+				f[2][b] += cxy[3][b] * n0;
+				f[3][b] += cxy[0][b] * n1;
+				f[4][b] += cxy[2][b] * n0;
+				f[5][b] += cxy[5][b] * n0;
+				f[6][b] += cxy[0][b] * n2;
+				f[7][b] += cxy[4][b] * n0;
+				f[8][b] += cxy[1][b] * n1;
+				f[9][b] += cxy[3][b] * n1;
+			}
+		}
+
+		// Hessian entry -> field, row major
+		static const int hessField[9] = { 4, 7, 8, 7, 5, 9, 8, 9, 6 };
+		for (int b = 0; b < nlane; b++) {
+			if (out.value != nullptr) out.value[id[b]] = f[0][b];
+			for (int i = 0; i < 3; i++) if (out.grad[i] != nullptr) out.grad[i][id[b]] = f[1 + i][b];
+			for (int i = 0; i < 9; i++) if (out.hess[i] != nullptr) out.hess[i][id[b]] = f[hessField[i]][b];
+		}
+	}
+}
+
+// called from coeff2density_incremental_order and compute_spline_fields_order in Grid.cu
+template void Grid::coeff2density_host_masked_order<2>(const char* dirtybox, std::vector<int>& changed);
+template void Grid::coeff2density_host_masked_order<3>(const char* dirtybox, std::vector<int>& changed);
+template void Grid::coeff2density_host_masked_order<4>(const char* dirtybox, std::vector<int>& changed);
+template void Grid::coeff2density_host_masked_order<5>(const char* dirtybox, std::vector<int>& changed);
+template void Grid::compute_spline_fields_host_order<2>(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out);
+template void Grid::compute_spline_fields_host_order<3>(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out);
+template void Grid::compute_spline_fields_host_order<4>(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out);
+template void Grid::compute_spline_fields_host_order<5>(int n, float* const pts[3], const int* list, int nlist, const SplineFieldsSoA& out);
+
+// transpose of coeff2density_host, each slab is contracted along x and y by one thread, then every coefficient
+// layer gathers the slabs in its support in a fixed order, no atomics and the same sums for any thread count
+template<int Order>
+void Grid::dfield2dcoeff_host_order(int nfield, const float* const dfield[], float* const dcoeff[])
+{
+	const int order = Order;
+	const int ereso = _ereso;
+	const float eh = elementLength();
+
+	AxisBasisTable tab[3];
+	for (int i = 0; i < 3; i++) buildAxisBasisTable<Order>(i, ereso, _box[0][i], eh, _gbuf.KnotSer[i], tab[i]);
+
+	const size_t nb0 = spbasis[0], nb01 = size_t(spbasis[0]) * spbasis[1];
+	const int nb2 = spbasis[2];
+	const TileSAT& esat = *_etiles;
+	const int* eidmap = _gbuf.eidmap;
+	const int* eflag = _gbuf.eBitflag;
+
+	// field values contracted along x and y, slab[z][field][is][ir]
+	std::vector<float> slab(size_t(ereso) * nfield * nb01, 0.f);
+	std::vector<char> slabActive(ereso, 0);
+
+#pragma omp parallel
+	{
+		std::vector<float> row(size_t(nfield) * nb0);
+
+#pragma omp for schedule(dynamic, 1)
+		for (int z = 0; z < ereso; z++) {
+			if (tab[2].first[z] == -1) continue;
+			float* S = &slab[size_t(z) * nfield * nb01];
+			for (int y = 0; y < ereso; y++) {
+				int jy = tab[1].first[y];
+				if (jy == -1 || esat.rowCount(y, z) == 0) continue;
+
+				bool rowHit = false;
+				esat.forEachActiveInRow(y, z, [&](int x, int eid) {
+					int ix = tab[0].first[x];
+					int egsid = eidmap != nullptr ? eidmap[eid] : eid;
+					if (ix == -1 || (eflag[egsid] & mask_shellelement)) return;
+					if (!rowHit) {
+						std::fill(row.begin(), row.end(), 0.f);
+						rowHit = true;
+					}
+					const float* Nx = &tab[0].N[size_t(x) * Order];
+					for (int f = 0; f < nfield; f++) {
+						float g = dfield[f][egsid];
+						for (int t = 0; t < order; t++) row[f * nb0 + ix + t] += Nx[t] * g;
+					}
+				});
+				if (!rowHit) continue;
+
+				const float* Ny = &tab[1].N[size_t(y) * Order];
+				for (int f = 0; f < nfield; f++) {
+					for (int t = 0; t < order; t++) {
+						float* Sf = S + f * nb01 + (jy + t) * nb0;
+						const float* rf = &row[f * nb0];
+						float w = Ny[t];
+#pragma omp simd
+						for (size_t i = 0; i < nb0; i++) Sf[i] += w * rf[i];
+					}
+				}
+				slabActive[z] = 1;
+			}
+		}
+
+		// gather along z
+#pragma omp for
+		for (int it = 0; it < nb2; it++) {
+			for (int f = 0; f < nfield; f++) std::fill(dcoeff[f] + it * nb01, dcoeff[f] + (it + 1) * nb01, 0.f);
+			for (int z = 0; z < ereso; z++) {
+				int kz = tab[2].first[z];
+				if (kz == -1 || !slabActive[z] || it < kz || it >= kz + order) continue;
+				float w = tab[2].N[size_t(z) * Order + it - kz];
+				for (int f = 0; f < nfield; f++) {
+					float* dst = dcoeff[f] + it * nb01;
+					const float* src = &slab[(size_t(z) * nfield + f) * nb01];
+#pragma omp simd
+					for (size_t ij = 0; ij < nb01; ij++) dst[ij] += w * src[ij];
+				}
+			}
+		}
+	}
+}
+
+void Grid::dfield2dcoeff_host(int nfield, const float* const dfield[], float* const dcoeff[])
+{
+	dispatchSplineOrder(n_order, [&](auto order) { dfield2dcoeff_host_order<decltype(order)::value>(nfield, dfield, dcoeff); });
+}
+
+// scatter form of dfield2dcoeff_host, every element adds its Order^3 products to the lattice with atomics as the device
+// kernels do. The sums depend on the thread order
+template<int Order>
+void Grid::dfield2dcoeff_host_scatter_order(int nfield, const float* const dfield[], float* const dcoeff[])
+{
+	const int ereso = _ereso;
+	const float eh = elementLength();
+
+	AxisBasisTable tab[3];
+	for (int i = 0; i < 3; i++) buildAxisBasisTable<Order>(i, ereso, _box[0][i], eh, _gbuf.KnotSer[i], tab[i]);
+
+	const size_t nb0 = spbasis[0], nb01 = size_t(spbasis[0]) * spbasis[1];
+	const TileSAT& esat = *_etiles;
+	const int* eidmap = _gbuf.eidmap;
+	const int* eflag = _gbuf.eBitflag;
+
+	for (int f = 0; f < nfield; f++) std::fill(dcoeff[f], dcoeff[f] + n_cijk(), 0.f);
+
+	int nleaf = esat.n_leaves();
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int l = 0; l < nleaf; l++) {
+		esat.forEachActiveInLeaf(l, [&](size_t bid, int eid) {
+			int pos[3] = { int(bid % ereso), int(bid / ereso % ereso), int(bid / ereso / ereso) };
+			int ix = tab[0].first[pos[0]], jy = tab[1].first[pos[1]], kz = tab[2].first[pos[2]];
+			if (ix == -1 || jy == -1 || kz == -1) return;
+			int egsid = eidmap != nullptr ? eidmap[eid] : eid;
+			if (eflag[egsid] & mask_shellelement) return;
+			const float* Nx = &tab[0].N[size_t(pos[0]) * Order];
+			const float* Ny = &tab[1].N[size_t(pos[1]) * Order];
+			const float* Nz = &tab[2].N[size_t(pos[2]) * Order];
+			for (int f = 0; f < nfield; f++) {
+				float g = dfield[f][egsid];
+				for (int t2 = 0; t2 < Order; t2++) {
+					for (int t1 = 0; t1 < Order; t1++) {
+						float gyz = g * Ny[t1] * Nz[t2];
+						float* c = dcoeff[f] + ix + (jy + t1) * nb0 + (kz + t2) * nb01;
+						for (int t0 = 0; t0 < Order; t0++) {
+#pragma omp atomic
+							c[t0] += gyz * Nx[t0];
+						}
+					}
+				}
+			}
+		});
+	}
+}
+
+void Grid::dfield2dcoeff_host_scatter(int nfield, const float* const dfield[], float* const dcoeff[])
+{
+	dispatchSplineOrder(n_order, [&](auto order) { dfield2dcoeff_host_scatter_order<decltype(order)::value>(nfield, dfield, dcoeff); });
+}
+
+// the lattice and the values of compute_background_mcPoints_value_order: the spline minus 0.5 at the element centers,
+// -0.2 outside the knot range and 0 outside the model box. The spline is bounded on each spline cell by the min and
+// max of its Order^3 coefficients, the marching cube blocks only take the bounds of the cells of their unclamped points
+template<int Order>
+void Grid::extract_spline_isosurface_order(int mc_ereso, marchingCubeBase_t& mc)
+{
+	const int order = Order;
+	const float level = 0.5f;
+	const float tol = 1e-5f;
+	const int npoint = mc_ereso + 2;
+	const int block = marchingCubeBase_t::block_cells;
+	const int nblock = (npoint - 2) / block + 1;
+
+	std::vector<float> cijk(n_cijk());
+	gpu_manager_t::download_buf(cijk.data(), _gbuf.coeffs, sizeof(float) * cijk.size());
+	const size_t nb0 = spbasis[0], nb01 = size_t(spbasis[0]) * spbasis[1];
+
+	float eh[3], origin[3];
+	AxisBasisTable tab[3];
+	std::vector<char> clamped[3];
+	// per axis and block, the range of the first coefficient over the unclamped points and whether a point is clamped
+	std::vector<int> bfirst[3], blast[3];
+	std::vector<char> bclamped[3];
+	for (int i = 0; i < 3; i++) {
+		eh[i] = (_mbox[1][i] - _mbox[0][i]) / mc_ereso;
+		origin[i] = _mbox[0][i] - eh[i];
+		std::vector<float> knot(spknotspan[i]);
+		gpu_manager_t::download_buf(knot.data(), _gbuf.KnotSer[i], sizeof(float) * knot.size());
+		buildAxisBasisTable<Order>(i, npoint, origin[i], eh[i], knot.data(), tab[i]);
+
+		clamped[i].resize(npoint);
+		for (int p = 0; p < npoint; p++) {
+			float pos = origin[i] + p * eh[i] + 0.5 * eh[i];
+			clamped[i][p] = tab[i].first[p] == -1 || pos < _mbox[0][i] || pos > _mbox[1][i];
+		}
+		bfirst[i].resize(nblock, spbasis[i]);
+		blast[i].resize(nblock, -1);
+		bclamped[i].resize(nblock, 0);
+		for (int b = 0; b < nblock; b++) {
+			for (int p = b * block; p <= (std::min)(b * block + block, npoint - 1); p++) {
+				if (clamped[i][p]) { bclamped[i][b] = 1; continue; }
+				bfirst[i][b] = (std::min)(bfirst[i][b], tab[i].first[p]);
+				blast[i][b] = (std::max)(blast[i][b], tab[i].first[p]);
+			}
+		}
+	}
+
+	// coefficient bounds of the spline cells, by running min / max along each axis
+	int ncell[3];
+	for (int i = 0; i < 3; i++) ncell[i] = spbasis[i] - order + 1;
+	std::vector<float> lo(cijk), hi(cijk), lotmp(cijk.size()), hitmp(cijk.size());
+	int ext[3] = { spbasis[0], spbasis[1], spbasis[2] };
+	size_t stride[3] = { 1, nb0, nb01 };
+	for (int ax = 0; ax < 3; ax++) {
+		ext[ax] = ncell[ax];
+		int n = ext[0] * ext[1] * ext[2];
+#pragma omp parallel for schedule(static)
+		for (int id = 0; id < n; id++) {
+			size_t cid = id % ext[0] + id / ext[0] % ext[1] * nb0 + id / (ext[0] * ext[1]) * nb01;
+			float l = lo[cid], h = hi[cid];
+			for (int t = 1; t < order; t++) {
+				l = (std::min)(l, lo[cid + t * stride[ax]]);
+				h = (std::max)(h, hi[cid + t * stride[ax]]);
+			}
+			lotmp[cid] = l;
+			hitmp[cid] = h;
+		}
+		lo.swap(lotmp);
+		hi.swap(hitmp);
+	}
+
+	auto mayCross = [&](int bi, int bj, int bk) {
+		int bid[3] = { bi, bj, bk };
+		bool anyClamped = false;
+		for (int i = 0; i < 3; i++) {
+			if (bfirst[i][bid[i]] > blast[i][bid[i]]) return false;
+			anyClamped = anyClamped || bclamped[i][bid[i]];
+		}
+		float bmin = 1e30f, bmax = -1e30f;
+		for (int k = bfirst[2][bk]; k <= blast[2][bk]; k++) {
+			for (int j = bfirst[1][bj]; j <= blast[1][bj]; j++) {
+				for (int i = bfirst[0][bi]; i <= blast[0][bi]; i++) {
+					size_t cid = i + j * nb0 + k * nb01;
+					bmin = (std::min)(bmin, lo[cid]);
+					bmax = (std::max)(bmax, hi[cid]);
+				}
+			}
+		}
+		// the clamped points are below the level
+		return bmax > level - tol && (anyClamped || bmin <= level + tol);
+	};
+
+	auto value = [&](int x, int y, int z) {
+		int p[3] = { x, y, z };
+		if (clamped[0][x] || clamped[1][y] || clamped[2][z]) {
+			// outside the knot range if still in the box
+			bool inBox = true;
+			for (int i = 0; i < 3; i++) {
+				float pos = origin[i] + p[i] * eh[i] + 0.5 * eh[i];
+				inBox = inBox && pos >= _mbox[0][i] && pos <= _mbox[1][i];
+			}
+			return (inBox ? -0.2f : 0.f) - level;
+		}
+		const float* Nx = &tab[0].N[size_t(x) * Order];
+		const float* Ny = &tab[1].N[size_t(y) * Order];
+		const float* Nz = &tab[2].N[size_t(z) * Order];
+		const float* c = &cijk[tab[0].first[x] + tab[1].first[y] * nb0 + tab[2].first[z] * nb01];
+		float val = 0;
+		for (int t = 0; t < order; t++) {
+			for (int s = 0; s < order; s++) {
+				float row = 0;
+				for (int r = 0; r < order; r++) row += c[r + s * nb0 + t * nb01] * Nx[r];
+				val += row * Ny[s] * Nz[t];
+			}
+		}
+		return val - level;
+	};
+
+	int npoints[3] = { npoint, npoint, npoint };
+	float first[3] = { origin[0] + 0.5f * eh[0], origin[1] + 0.5f * eh[1], origin[2] + 0.5f * eh[2] };
+	mc.setLattice(npoints, first, eh);
+	mc.extract(value, 0.f, mayCross);
+}
+
+void Grid::extract_spline_isosurface(int mc_ereso, marchingCubeBase_t& mc)
+{
+	dispatchSplineOrder(n_order, [&](auto order) { extract_spline_isosurface_order<decltype(order)::value>(mc_ereso, mc); });
+}
+
+// The filter weight 1 - 6r^2 + 8r^3 - 3r^4 of filterSensitivity_kernel (r relative to the radius R) is replaced by the
+// gaussian of the same variance per axis (R^2 / 12 in the continuum), which is separable. Small gaussians are convolved
+// directly, larger ones by three box filters of running sums (Wells), so the cost per element does not depend on the radius
+struct SeparableFilter1D {
+	std::vector<float> taps;   // direct kernel of half width taps.size() / 2, empty for the box passes
+	int boxRadius[3];
+};
+
+static void makeSeparableFilter(double radii, SeparableFilter1D& flt) {
+	const int max_half_taps = 4;
+	// variance of the discrete weights, the continuum value is off for small radii
+	double sigma2 = radii * radii / 12;
+	int R = radii + 0.5;
+	if (R <= 16) {
+		double wsum = 0, w2sum = 0;
+		for (int x = -R; x <= R; x++) {
+			for (int y = -R; y <= R; y++) {
+				for (int z = -R; z <= R; z++) {
+					double r2 = x * x + y * y + z * z;
+					if (r2 > radii * radii) continue;
+					double r = std::sqrt(r2) / radii;
+					double w = 1 - 6 * r * r + 8 * r * r * r - 3 * r * r * r * r;
+					wsum += w;
+					w2sum += w * x * x;
+				}
+			}
+		}
+		sigma2 = w2sum / wsum;
+	}
+	int half = std::ceil(3 * std::sqrt(sigma2));
+	flt.taps.clear();
+	if (half <= max_half_taps) {
+		// width of the sampled gaussian whose taps have the variance sigma2
+		auto tapVariance = [&](double s2) {
+			double w = 0, w2 = 0;
+			for (int i = -half; i <= half; i++) {
+				w += std::exp(-i * i / (2 * s2));
+				w2 += i * i * std::exp(-i * i / (2 * s2));
+			}
+			return w2 / w;
+		};
+		double lo = 1e-3, hi = 4 * sigma2 + 1;
+		for (int it = 0; it < 50; it++) {
+			double mid = (lo + hi) / 2;
+			if (tapVariance(mid) < sigma2) lo = mid; else hi = mid;
+		}
+		for (int i = -half; i <= half; i++) flt.taps.emplace_back(std::exp(-i * i / (2 * lo)));
+		return;
+	}
+	// widths wl, wl + 2 of the n boxes whose composition has the variance sigma2
+	const int n = 3;
+	int wl = std::sqrt(12 * sigma2 / n + 1);
+	if (wl % 2 == 0) wl--;
+	int m = std::round((12 * sigma2 - n * wl * wl - 4 * n * wl - 3 * n) / (-4 * wl - 4));
+	for (int i = 0; i < n; i++) flt.boxRadius[i] = (i < m ? wl : wl + 2) / 2;
+}
+
+// filters nch <= max_filter_fields + 1 interleaved channels of a line of length n in place, zero outside the line. tmp holds n * nch floats
+static void separableFilterLine(const SeparableFilter1D& flt, int n, int nch, float* line, float* tmp) {
+	if (!flt.taps.empty()) {
+		int half = flt.taps.size() / 2;
+		std::fill(tmp, tmp + size_t(n) * nch, 0.f);
+		for (int i = 0; i < n; i++) {
+			int tbegin = (std::max)(-half, -i), tend = (std::min)(half, n - 1 - i);
+			for (int t = tbegin; t <= tend; t++) {
+				float w = flt.taps[t + half];
+				for (int c = 0; c < nch; c++) tmp[i * nch + c] += w * line[(i + t) * nch + c];
+			}
+		}
+		std::copy(tmp, tmp + size_t(n) * nch, line);
+		return;
+	}
+	for (int pass = 0; pass < 3; pass++) {
+		int r = flt.boxRadius[pass];
+		float scale = 1.f / (2 * r + 1);
+		// running sums over [i - r, i + r], the channels advance together so a line is swept once per pass
+		double s[max_filter_fields + 1] = {};
+		for (int i = 0; i < (std::min)(r, n); i++) {
+			for (int c = 0; c < nch; c++) s[c] += line[i * nch + c];
+		}
+		for (int i = 0; i < n; i++) {
+			if (i + r < n) { for (int c = 0; c < nch; c++) s[c] += line[(i + r) * nch + c]; }
+			if (i - r - 1 >= 0) { for (int c = 0; c < nch; c++) s[c] -= line[(i - r - 1) * nch + c]; }
+			for (int c = 0; c < nch; c++) tmp[i * nch + c] = s[c] * scale;
+		}
+		std::copy(tmp, tmp + size_t(n) * nch, line);
+	}
+}
+
+// channel 0 of the lattice is the active mask, the others the masked fields. After the filter the fields are divided by
+// the filtered mask, which normalises the weights over the active neighbors like the gather filter does
+static void separableFilterLattice(const SeparableFilter1D& flt, int ereso, int nch, float* lattice) {
+	const size_t stride[3] = { size_t(nch), size_t(nch) * ereso, size_t(nch) * ereso * ereso };
+	for (int ax = 0; ax < 3; ax++) {
+		const size_t s1 = stride[(ax + 1) % 3], s2 = stride[(ax + 2) % 3];
+		const size_t sa = stride[ax];
+#pragma omp parallel
+		{
+			std::vector<float> line(size_t(ereso) * nch), tmp(size_t(ereso) * nch);
+#pragma omp for schedule(dynamic, 16)
+			for (int l = 0; l < ereso * ereso; l++) {
+				float* base = lattice + (l % ereso) * s1 + (l / ereso) * s2;
+				bool empty = true;
+				for (int i = 0; i < ereso; i++) {
+					const float* src = base + i * sa;
+					for (int c = 0; c < nch; c++) line[i * nch + c] = src[c];
+					empty = empty && src[0] == 0;
+				}
+				if (empty) continue;
+				separableFilterLine(flt, ereso, nch, line.data(), tmp.data());
+				for (int i = 0; i < ereso; i++) {
+					float* dst = base + i * sa;
+					for (int c = 0; c < nch; c++) dst[c] = line[i * nch + c];
+				}
+			}
+		}
+	}
+}
+
+void Grid::filterSensitivities_separable(int nfield, float* const sens[], double radii)
+{
+	if (nfield < 1 || nfield > max_filter_fields) {
+		printf("\033[31m-- unsupported number of filtered fields %d\033[0m\n", nfield);
+		exit(-1);
+	}
+
+	// channel 0 is the mask, the fields follow
+	const int nch = nfield + 1;
+	const int ereso = _ereso;
+	const TileSAT& esat = *_etiles;
+
+	std::vector<int> eidmap;
+	std::vector<float> field(size_t(n_gselements) * nfield);
+	if (_gbuf.eidmap != nullptr) {
+		eidmap.resize(n_elements);
+		gpu_manager_t::download_buf(eidmap.data(), _gbuf.eidmap, sizeof(int) * n_elements);
+	}
+	for (int f = 0; f < nfield; f++) {
+		gpu_manager_t::download_buf(field.data() + size_t(f) * n_gselements, sens[f], sizeof(float) * n_gselements);
+	}
+
+	SeparableFilter1D flt;
+	makeSeparableFilter(radii, flt);
+
+	std::vector<float> lattice(size_t(ereso) * ereso * ereso * nch, 0.f);
+	auto forActive = [&](auto&& fn) {
+		int nleaf = esat.n_leaves();
+#pragma omp parallel for schedule(static)
+		for (int l = 0; l < nleaf; l++) {
+			esat.forEachActiveInLeaf(l, [&](size_t bid, int eid) { fn(index_t(bid), eidmap.empty() ? eid : eidmap[eid]); });
+		}
+	};
+
+	forActive([&](index_t bid, int egsid) {
+		lattice[bid * nch] = 1.f;
+		for (int f = 0; f < nfield; f++) lattice[bid * nch + 1 + f] = field[size_t(f) * n_gselements + egsid];
+	});
+
+	separableFilterLattice(flt, ereso, nch, lattice.data());
+
+	// the gather filter leaves zero on the inactive gs elements
+	std::fill(field.begin(), field.end(), 0.f);
+	forActive([&](index_t bid, int egsid) {
+		float mask = lattice[bid * nch];
+		for (int f = 0; f < nfield; f++) field[size_t(f) * n_gselements + egsid] = lattice[bid * nch + 1 + f] / mask;
+	});
+
+	for (int f = 0; f < nfield; f++) {
+		gpu_manager_t::upload_buf(sens[f], field.data() + size_t(f) * n_gselements, sizeof(float) * n_gselements);
+	}
+}
+
+void Grid::filterSensitivities_gather_host(int nfield, float* const sens[], double radii)
+{
+	if (nfield < 1 || nfield > max_filter_fields) {
+		printf("\033[31m-- unsupported number of filtered fields %d\033[0m\n", nfield);
+		exit(-1);
+	}
+
+	const int ereso = _ereso;
+	const TileSAT& esat = *_etiles;
+	const int* eidmap = _gbuf.eidmap;
+
+	// interleaved copy of the fields, the inactive gs elements stay zero after the filter
+	std::vector<float> src(size_t(n_gselements) * nfield);
+	for (int f = 0; f < nfield; f++) {
+		for (int i = 0; i < n_gselements; i++) {
+			src[size_t(i) * nfield + f] = sens[f][i];
+			sens[f][i] = 0;
+		}
+	}
+
+	const float R2 = radii * radii;
+	const int R = radii + 0.5;
+	auto fr = [](float r) {
+		float r2 = r * r;
+		return 1 - 6 * r2 + 8 * r2 * r - 3 * r2 * r2;
+	};
+
+	int nleaf = esat.n_leaves();
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int l = 0; l < nleaf; l++) {
+		esat.forEachActiveInLeaf(l, [&](size_t bid, int eid) {
+			int bpos[3] = { int(bid % ereso), int(bid / ereso % ereso), int(bid / ereso / ereso) };
+			double gsum[max_filter_fields] = {};
+			float weightSum = 0;
+			for (int x = -R; x <= R; x++) {
+				int nx = bpos[0] + x;
+				if (nx < 0 || nx >= ereso) continue;
+				for (int y = -R; y <= R; y++) {
+					int ny = bpos[1] + y;
+					if (ny < 0 || ny >= ereso) continue;
+					for (int z = -R; z <= R; z++) {
+						int nz = bpos[2] + z;
+						if (nz < 0 || nz >= ereso) continue;
+						float r2 = x * x + y * y + z * z;
+						if (r2 > R2) continue;
+						int n_eid = esat(nx + (ny + size_t(nz) * ereso) * ereso);
+						if (n_eid == -1) continue;
+						if (eidmap != nullptr) n_eid = eidmap[n_eid];
+						float w = fr(std::sqrt(r2 / R2));
+						const float* n_src = &src[size_t(n_eid) * nfield];
+						for (int f = 0; f < nfield; f++) gsum[f] += w * n_src[f];
+						weightSum += w;
+					}
+				}
+			}
+			int egsid = eidmap != nullptr ? eidmap[eid] : eid;
+			for (int f = 0; f < nfield; f++) sens[f][egsid] = gsum[f] / weightSum;
+		});
+	}
+}
+
+void grid::splineKnotInsertion1D(int order, int ncoarse, int nfine, SplineRefinement1D& ref)
+{
+	// Boehm insertion of the missing fine knots into the coarse knot vector, applied to the identity so that
+	// row i of P ends up holding the fine coefficient i of every coarse basis. Knots in units of a fine span
+	int p = order - 1;
+	int h = nfine / ncoarse;
+	int nc = ncoarse + p;
+	std::vector<double> U;
+	for (int j = 0; j <= ncoarse + 2 * p; j++) U.push_back((std::min)((std::max)(j - p, 0), ncoarse) * h);
+	std::vector<std::vector<double>> P(nc, std::vector<double>(nc, 0));
+	for (int i = 0; i < nc; i++) P[i][i] = 1;
+	for (int t = 1; t < nfine; t++) {
+		if (t % h == 0) continue;
+		int r = std::upper_bound(U.begin(), U.end(), double(t)) - U.begin() - 1;
+		// i is compared against the signed knot span r - p, so the bound is taken as int
+		const int nq = int(P.size()) + 1;
+		std::vector<std::vector<double>> Q(nq);
+		for (int i = 0; i < nq; i++) {
+			if (i <= r - p) Q[i] = P[i];
+			else if (i >= r + 1) Q[i] = P[i - 1];
+			else {
+				double a = (t - U[i]) / (U[i + p] - U[i]);
+				Q[i].resize(nc);
+				for (int j = 0; j < nc; j++) Q[i][j] = a * P[i][j] + (1 - a) * P[i - 1][j];
+			}
+		}
+		U.insert(U.begin() + r + 1, double(t));
+		P.swap(Q);
+	}
+	ref.first.assign(nc, 0);
+	ref.w.assign(nc, {});
+	for (int j = 0; j < nc; j++) {
+		int lo = int(P.size()), hi = -1;
+		for (size_t i = 0; i < P.size(); i++) if (P[i][j] != 0) { lo = (std::min)(lo, int(i)); hi = int(i); }
+		ref.first[j] = lo;
+		for (int i = lo; i <= hi; i++) ref.w[j].push_back(P[i][j]);
+	}
+}
+
+void grid::splineKnotInsertion3D(const SplineRefinement1D ref[3], const int nb[3], const float* src, float* dst)
+{
+	// one axis at a time, x fastest as in the coefficient lattice
+	int n[3] = { nb[0], nb[1], nb[2] };
+	std::vector<float> cur(src, src + size_t(n[0]) * n[1] * n[2]), next;
+	for (int ax = 0; ax < 3; ax++) {
+		int nf = 0;
+		for (int q = 0; q < n[ax]; q++) nf = (std::max)(nf, ref[ax].first[q] + int(ref[ax].w[q].size()));
+		int m[3] = { n[0], n[1], n[2] };
+		m[ax] = nf;
+		next.assign(size_t(m[0]) * m[1] * m[2], 0.f);
+		int stride[3] = { 1, n[0], n[0] * n[1] };
+		int mstride[3] = { 1, m[0], m[0] * m[1] };
+		// the OpenMP loop keeps a signed counter, a line count fits in int like the lattice sizes
+		int nline = int(size_t(n[0]) * n[1] * n[2] / n[ax]);
+#pragma omp parallel for
+		for (int line = 0; line < nline; line++) {
+			// the line is given by the two other indices
+			int o1 = (ax + 1) % 3, o2 = (ax + 2) % 3;
+			int i1 = line % n[o1], i2 = line / n[o1];
+			const float* s = cur.data() + size_t(i1) * stride[o1] + size_t(i2) * stride[o2];
+			float* d = next.data() + size_t(i1) * mstride[o1] + size_t(i2) * mstride[o2];
+			for (int q = 0; q < n[ax]; q++) {
+				float v = s[size_t(q) * stride[ax]];
+				for (size_t r = 0; r < ref[ax].w[q].size(); r++) d[(ref[ax].first[q] + r) * mstride[ax]] += ref[ax].w[q][r] * v;
+			}
+		}
+		n[ax] = nf;
+		cur.swap(next);
+	}
+	std::copy(cur.begin(), cur.end(), dst);
+}
+
+int SplineHierarchy::init(int order, const int nspan[3], int nlevel)
+{
+	nlevel = (std::min)(nlevel, max_levels);
+	while (nlevel > 1) {
+		int d = 1 << (nlevel - 1);
+		if (nspan[0] % d == 0 && nspan[1] % d == 0 && nspan[2] % d == 0) break;
+		nlevel--;
+	}
+	_order = order;
+	_nlevel = nlevel;
+	for (int l = 0; l < nlevel; l++) {
+		for (int a = 0; a < 3; a++) {
+			_nspan[l][a] = nspan[a] >> (nlevel - 1 - l);
+			_nbasis[l][a] = _nspan[l][a] + order - 1;
+		}
+		if (l + 1 < nlevel) {
+			for (int a = 0; a < 3; a++) splineKnotInsertion1D(order, _nspan[l][a], 2 * _nspan[l][a], _refine[l][a]);
+			_refined[l].assign(size_t(_nspan[l][0]) * _nspan[l][1] * _nspan[l][2], 0);
+		}
+		else {
+			_refined[l].clear();
+		}
+	}
+	build();
+	return nlevel;
+}
+
+int SplineHierarchy::n_active(int level) const
+{
+	return std::count(_activeLevel.begin(), _activeLevel.end(), level);
+}
+
+bool SplineHierarchy::cellInDomain(int l, int i, int j, int k) const
+{
+	if (l == 0) return true;
+	const int* s = _nspan[l - 1];
+	return _refined[l - 1][(i >> 1) + (j >> 1) * s[0] + (k >> 1) * s[0] * s[1]];
+}
+
+bool SplineHierarchy::basisInDomain(int l, int i, int j, int k, bool next) const
+{
+	if (next && l + 1 >= _nlevel) return false;
+	// basis i of an axis is supported on the cells i - order + 1 .. i
+	const int* s = _nspan[l];
+	int lo[3] = { i - _order + 1, j - _order + 1, k - _order + 1 };
+	int hi[3] = { i, j, k };
+	for (int a = 0; a < 3; a++) { lo[a] = (std::max)(lo[a], 0); hi[a] = (std::min)(hi[a], s[a] - 1); }
+	for (int ck = lo[2]; ck <= hi[2]; ck++) {
+		for (int cj = lo[1]; cj <= hi[1]; cj++) {
+			for (int ci = lo[0]; ci <= hi[0]; ci++) {
+				bool in = next ? _refined[l][ci + cj * s[0] + ck * s[0] * s[1]] : cellInDomain(l, ci, cj, ck);
+				if (!in) return false;
+			}
+		}
+	}
+	return true;
+}
+
+void SplineHierarchy::build(void)
+{
+	// a basis of level l is active if its support lies in the domain of level l but not in that of level l + 1
+	_activeLevel.clear();
+	_activeId.clear();
+	for (int l = 0; l < _nlevel; l++) {
+		const int* nb = _nbasis[l];
+		for (int k = 0; k < nb[2]; k++) {
+			for (int j = 0; j < nb[1]; j++) {
+				for (int i = 0; i < nb[0]; i++) {
+					if (!basisInDomain(l, i, j, k, false) || basisInDomain(l, i, j, k, true)) continue;
+					_activeLevel.push_back(l);
+					_activeId.push_back(i + j * nb[0] + k * nb[0] * nb[1]);
+				}
+			}
+		}
+	}
+
+	// columns of R: each active basis is carried to the lattice level by knot insertion, truncated on the
+	// way by dropping the finer bases whose support lies in the finer domain
+	int ndesign = _activeId.size();
+	const int* nbf = _nbasis[_nlevel - 1];
+	std::vector<std::vector<int>> colRow(ndesign);
+	std::vector<std::vector<float>> colVal(ndesign);
+#pragma omp parallel for schedule(dynamic, 16)
+	for (int a = 0; a < ndesign; a++) {
+		int l = _activeLevel[a];
+		const int* nb = _nbasis[l];
+		int id = _activeId[a];
+		int lo[3] = { id % nb[0], id / nb[0] % nb[1], id / (nb[0] * nb[1]) };
+		int n[3] = { 1, 1, 1 };
+		std::vector<float> box(1, 1.f), next;
+		for (int lv = l; lv + 1 < _nlevel; lv++) {
+			// refine the box one axis at a time
+			for (int ax = 0; ax < 3; ax++) {
+				const SplineRefinement1D& ref = _refine[lv][ax];
+				int nlo = ref.first[lo[ax]];
+				int nhi = 0;
+				for (int q = lo[ax]; q < lo[ax] + n[ax]; q++) nhi = (std::max)(nhi, ref.first[q] + int(ref.w[q].size()));
+				int m[3] = { n[0], n[1], n[2] };
+				m[ax] = nhi - nlo;
+				next.assign(size_t(m[0]) * m[1] * m[2], 0.f);
+				for (int k = 0; k < n[2]; k++) {
+					for (int j = 0; j < n[1]; j++) {
+						for (int i = 0; i < n[0]; i++) {
+							float v = box[i + j * n[0] + k * n[0] * n[1]];
+							if (v == 0) continue;
+							int src[3] = { i, j, k };
+							int q = lo[ax] + src[ax];
+							int dst[3] = { i, j, k };
+							for (size_t r = 0; r < ref.w[q].size(); r++) {
+								dst[ax] = ref.first[q] + int(r) - nlo;
+								next[dst[0] + dst[1] * m[0] + dst[2] * m[0] * m[1]] += ref.w[q][r] * v;
+							}
+						}
+					}
+				}
+				lo[ax] = nlo;
+				n[ax] = m[ax];
+				box.swap(next);
+			}
+			// truncation against the domain of level lv + 1
+			for (int k = 0; k < n[2]; k++) {
+				for (int j = 0; j < n[1]; j++) {
+					for (int i = 0; i < n[0]; i++) {
+						float& v = box[i + j * n[0] + k * n[0] * n[1]];
+						if (v != 0 && basisInDomain(lv + 1, lo[0] + i, lo[1] + j, lo[2] + k, false)) v = 0;
+					}
+				}
+			}
+		}
+		for (int k = 0; k < n[2]; k++) {
+			for (int j = 0; j < n[1]; j++) {
+				for (int i = 0; i < n[0]; i++) {
+					float v = box[i + j * n[0] + k * n[0] * n[1]];
+					if (v == 0) continue;
+					colRow[a].push_back(lo[0] + i + (lo[1] + j) * nbf[0] + (lo[2] + k) * nbf[0] * nbf[1]);
+					colVal[a].push_back(v);
+				}
+			}
+		}
+	}
+
+	int ncoeff = nbf[0] * nbf[1] * nbf[2];
+	_colPtr.assign(ndesign + 1, 0);
+	for (int a = 0; a < ndesign; a++) _colPtr[a + 1] = _colPtr[a] + colRow[a].size();
+	_colRow.resize(_colPtr[ndesign]);
+	_colVal.resize(_colPtr[ndesign]);
+	_rowPtr.assign(ncoeff + 1, 0);
+	for (int a = 0; a < ndesign; a++) {
+		std::copy(colRow[a].begin(), colRow[a].end(), _colRow.begin() + _colPtr[a]);
+		std::copy(colVal[a].begin(), colVal[a].end(), _colVal.begin() + _colPtr[a]);
+		for (int r : colRow[a]) _rowPtr[r + 1]++;
+	}
+	for (int r = 0; r < ncoeff; r++) _rowPtr[r + 1] += _rowPtr[r];
+	_rowCol.resize(_rowPtr[ncoeff]);
+	_rowVal.resize(_rowPtr[ncoeff]);
+	std::vector<int> fill(_rowPtr.begin(), _rowPtr.end() - 1);
+	for (int a = 0; a < ndesign; a++) {
+		for (int e = _colPtr[a]; e < _colPtr[a + 1]; e++) {
+			int pos = fill[_colRow[e]]++;
+			_rowCol[pos] = a;
+			_rowVal[pos] = _colVal[e];
+		}
+	}
+}
+
+void SplineHierarchy::forward(const float* x, float* c) const
+{
+	int ncoeff = n_coeffs();
+#pragma omp parallel for
+	for (int r = 0; r < ncoeff; r++) {
+		float sum = 0;
+		for (int e = _rowPtr[r]; e < _rowPtr[r + 1]; e++) sum += _rowVal[e] * x[_rowCol[e]];
+		c[r] = sum;
+	}
+}
+
+void SplineHierarchy::transpose(const float* dc, float* dx) const
+{
+	int ndesign = n_design();
+#pragma omp parallel for
+	for (int a = 0; a < ndesign; a++) {
+		float sum = 0;
+		for (int e = _colPtr[a]; e < _colPtr[a + 1]; e++) sum += _colVal[e] * dc[_colRow[e]];
+		dx[a] = sum;
+	}
+}
+
+int SplineHierarchy::refine(const float* c, const float* dc, float iso, float sens_ratio)
+{
+	// the spline on a cell lies in the hull of the lattice coefficients supported there
+	struct Candidate { int level; int cell; float score; bool cross; };
+	std::vector<Candidate> cand;
+	const int* nbf = _nbasis[_nlevel - 1];
+	for (int l = 0; l + 1 < _nlevel; l++) {
+		const int* s = _nspan[l];
+		int h = 1 << (_nlevel - 1 - l);
+		for (int k = 0; k < s[2]; k++) {
+			for (int j = 0; j < s[1]; j++) {
+				for (int i = 0; i < s[0]; i++) {
+					int cell = i + j * s[0] + k * s[0] * s[1];
+					if (_refined[l][cell] || !cellInDomain(l, i, j, k)) continue;
+					int lo[3] = { i * h, j * h, k * h };
+					int hi[3] = { (i + 1) * h - 1 + _order - 1, (j + 1) * h - 1 + _order - 1, (k + 1) * h - 1 + _order - 1 };
+					float cmin = 1e30f, cmax = -1e30f, score = 0;
+					for (int bk = lo[2]; bk <= hi[2]; bk++) {
+						for (int bj = lo[1]; bj <= hi[1]; bj++) {
+							for (int bi = lo[0]; bi <= hi[0]; bi++) {
+								int id = bi + bj * nbf[0] + bk * nbf[0] * nbf[1];
+								cmin = (std::min)(cmin, c[id]);
+								cmax = (std::max)(cmax, c[id]);
+								if (dc) score += std::abs(dc[id]);
+							}
+						}
+					}
+					cand.push_back({ l, cell, score, cmin < iso && cmax > iso });
+				}
+			}
+		}
+	}
+
+	float threshold = 1e30f;
+	int ntop = cand.size() * sens_ratio;
+	if (dc && ntop > 0) {
+		std::vector<float> scores;
+		for (auto& cd : cand) scores.push_back(cd.score);
+		std::nth_element(scores.begin(), scores.begin() + ntop - 1, scores.end(), std::greater<float>());
+		threshold = (std::max)(scores[ntop - 1], 1e-30f);
+	}
+
+	// a marked cell takes along its neighbours up to half the support, so that every basis of the next level
+	// touching it fits into the refined region. A thin region would not activate any finer basis
+	int nrefine = 0;
+	std::vector<char> marked[max_levels];
+	for (int l = 0; l + 1 < _nlevel; l++) marked[l].assign(_refined[l].size(), 0);
+	for (auto& cd : cand) {
+		if (cd.cross || cd.score >= threshold) marked[cd.level][cd.cell] = 1;
+	}
+	for (int l = 0; l + 1 < _nlevel; l++) {
+		const int* s = _nspan[l];
+		int r = _order / 2;
+		for (size_t cell = 0; cell < marked[l].size(); cell++) {
+			if (!marked[l][cell]) continue;
+			int i = int(cell % s[0]), j = int(cell / s[0] % s[1]), k = int(cell / (s[0] * s[1]));
+			for (int ck = (std::max)(k - r, 0); ck <= (std::min)(k + r, s[2] - 1); ck++) {
+				for (int cj = (std::max)(j - r, 0); cj <= (std::min)(j + r, s[1] - 1); cj++) {
+					for (int ci = (std::max)(i - r, 0); ci <= (std::min)(i + r, s[0] - 1); ci++) {
+						char& ref = _refined[l][ci + cj * s[0] + ck * s[0] * s[1]];
+						if (ref || !cellInDomain(l, ci, cj, ck)) continue;
+						ref = 1;
+						nrefine++;
+					}
+				}
+			}
+		}
+	}
+	if (nrefine > 0) build();
+	return nrefine;
+}
+
+void SplineHierarchy::project(const float* c, float* x) const
+{
+	int ndesign = n_design();
+	int ncoeff = n_coeffs();
+	// start from the R weighted averages, exact where a single level is active
+	Eigen::VectorXd x0(ndesign), b(ncoeff);
+	for (int a = 0; a < ndesign; a++) {
+		double sum = 0, wsum = 0;
+		for (int e = _colPtr[a]; e < _colPtr[a + 1]; e++) { sum += _colVal[e] * c[_colRow[e]]; wsum += _colVal[e]; }
+		x0[a] = wsum > 0 ? sum / wsum : 0;
+	}
+	for (int r = 0; r < ncoeff; r++) b[r] = c[r];
+	std::vector<Eigen::Triplet<double>> trip;
+	for (int a = 0; a < ndesign; a++) {
+		for (int e = _colPtr[a]; e < _colPtr[a + 1]; e++) trip.emplace_back(_colRow[e], a, _colVal[e]);
+	}
+	Eigen::SparseMatrix<double> R(ncoeff, ndesign);
+	R.setFromTriplets(trip.begin(), trip.end());
+	Eigen::LeastSquaresConjugateGradient<Eigen::SparseMatrix<double>> solver;
+	solver.setTolerance(1e-8);
+	solver.compute(R);
+	Eigen::VectorXd xs = solver.solveWithGuess(b, x0);
+	for (int a = 0; a < ndesign; a++) x[a] = xs[a];
+}
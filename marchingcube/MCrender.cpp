@@ -142,38 +142,51 @@ void MCImplicitRender::InitData()
 	}
 }
 
+// the background nodes are a regular lattice in the order x + y * nX + z * nX * nY, the values are read in
+// place by the parallel extractor which outputs the shared vertices in mcSurface. Triangles is refilled from it
+// for the OpenMesh transfers, numOfTriangles always counts the entries of Triangles
 void MCImplicitRender::RunMarchingCubesTestPotential(float& minValuePotential, std::vector<float> bg_node[3], std::vector<float>& mcPoints_inner_val)
 {
-	mcPoints.clear();
+	mcSurface.clear();
+	delete[] Triangles;	//first free the previous allocated memory
+	Triangles = nullptr;
+	numOfTriangles = 0;
 	int n = bg_node->size();
-	mcPoints.resize(n);
-	if (mcPoints_inner_val.size() == bg_node->size())
+	if (n == 0 || mcPoints_inner_val.size() != size_t(n) || n != nX * nY * nZ)
 	{
-		for (int i = 0; i < n; i++)
-		{
-			mp4vector verr(bg_node[0][i], bg_node[1][i], bg_node[2][i], mcPoints_inner_val[i]);
-			mcPoints[i] = verr;
-		}
+		return;
 	}
-	
-	if (mcPoints.size() == 0)
+	int Nodes[3] = { nX, nY, nZ };
+	mcSurface.setLattice(Nodes, bg_node);
+	mcSurface.extract(mcPoints_inner_val, minValuePotential);
+	numOfTriangles = mcSurface.n_faces();
+	const std::vector<int>& faces = mcSurface.getFaces();
+	const std::vector<float>& vx = mcSurface.getVertices(0);
+	const std::vector<float>& vy = mcSurface.getVertices(1);
+	const std::vector<float>& vz = mcSurface.getVertices(2);
+	Triangles = new TRIANGLE[numOfTriangles];
+	for (int i = 0; i < numOfTriangles; i++)
 	{
-		return;
+		TRIANGLE& tri = Triangles[i];
+		for (int h = 0; h < 3; h++)
+		{
+			int v = faces[3 * i + h];
+			tri.p[h] = Point3(vx[v], vy[v], vz[v]);
+		}
+		// the indexed mesh has no gradients, the corners take the face normal
+		Point3 nrm = (tri.p[1] - tri.p[0]) % (tri.p[2] - tri.p[0]);
+		nrm.normalize_cond();
+		for (int h = 0; h < 3; h++) tri.norm[h] = nrm;
 	}
-	//delete[] Triangles;	  //first free the previous allocated memory
-	//Triangles = nullptr;
-	Triangles = MarchingCubes(nX - 1, nY - 1, nZ - 1, 1.0, 1.0, 1.0, minValuePotential, mcPoints, numOfTriangles);
 	int num = 0;
-	for (int i = 0; i < mcPoints.size(); i++)
+	for (int i = 0; i < n; i++)
 	{
-		if (mcPoints[i].val < 1e-6)
+		if (mcPoints_inner_val[i] < 1e-6)
 		{
-			//std::cout << mcPoints[i].x << "," << mcPoints[i].y << "," << mcPoints[i].z << "," << mcPoints[i].val << "," << std::endl;
 			num++;
 		}
 	}
-	std::cout << "-- sample nodes number : " << num  << "/" << mcPoints.size() << "(" << nX << ", " << nY << ", " << nZ << ") " << std::endl;
-	mcPoints.clear();
+	std::cout << "-- sample nodes number : " << num  << "/" << n << "(" << nX << ", " << nY << ", " << nZ << ") " << std::endl;
 }
 
 void MCImplicitRender::RunMarchingCubesTest()
@@ -441,55 +454,12 @@ void MCImplicitRender::InnerTransferToOpenMesh(std::vector<float>& surface_node_
 	mesh.garbage_collection();
 }
 
+// the vertices of the last RunMarchingCubesTestPotential, each shared by its adjacent triangles
 void MCImplicitRender::save_to_surface_node(std::vector<float>& surface_node_x, std::vector<float>& surface_node_y, std::vector<float>& surface_node_z)
 {
-	MyMesh mesh;
-	for (int i = 0; i < numOfTriangles; i++)
-	{
-		std::vector<OpenMesh::VertexHandle>  points;
-		for (int j = 0; j < 3; j++)
-		{
-			points.push_back(mesh.add_vertex(Triangles[i].p[j]));
-		}
-		mesh.add_face(points);
-	}
-
-	std::vector<float> vert[3];
-	std::vector<float> vert_fine[3];
-	std::vector<float> vert_final[3];
-	Point3 p;
-
-	for (const auto& vh : mesh.vertices())
-	{
-		p = mesh.point(vh);
-		for (int i = 0; i < 3; i++)
-		{
-			vert[0].push_back(p[0]);
-			vert[1].push_back(p[1]);
-			vert[2].push_back(p[2]);
-		}
-	}
-	for (int i = 0; i < vert->size(); i = i + 3)
-	{
-		vert_fine[0].push_back(vert[0][i]);
-		vert_fine[1].push_back(vert[1][i]);
-		vert_fine[2].push_back(vert[2][i]);
-	}
-	std::cout << "Surface node number( before sampled ): " << vert_fine->size() << std::endl;
-	surface_node_x = vert_fine[0];
-	surface_node_y = vert_fine[1];
-	surface_node_z = vert_fine[2];
-
-	for (int i = 0; i < 3; i++)
-	{
-		std::vector<float>().swap(vert[i]);
-		std::vector<float>().swap(vert_fine[i]);
-		std::vector<float>().swap(vert_final[i]);
-	}
-
-	delete[] Triangles;
-	Triangles = nullptr;
-	mesh.garbage_collection();
+	mcSurface.getVertices(surface_node_x, surface_node_y, surface_node_z);
+	std::cout << "Surface node number( before sampled ): " << surface_node_x.size() << std::endl;
+	mcSurface.clear();
 }
 
 void MCImplicitRender::TransferToOpenMesh()
@@ -6,6 +6,7 @@
 #include <gl/glut.h>
 //#include <QKeyEvent>
 #include "MarchingCube.h"
+#include "marchingCubeBase_t.h"
 #include "ImplicitFunction.h"
 //#include "mycommon.h"
 
@@ -66,8 +67,9 @@ public:
 	TriMesh3D		*surfaceMesh;
 	std::vector<mp4vector> mcPoints;
 	std::vector<mp4vector> mcBoundary;
-	TRIANGLE * Triangles;
-	TRIANGLE * TrianglesBoundary;
+	TRIANGLE * Triangles = nullptr;
+	TRIANGLE * TrianglesBoundary = nullptr;
+	marchingCubeBase_t mcSurface;
 	int numOfTriangles;
 	int numOfTrianglesBoundary;
 
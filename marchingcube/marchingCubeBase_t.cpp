@@ -1 +1,278 @@
 #include "marchingCubeBase_t.h"
+#include "MCTable.h"
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+
+// cube vertices and edges in the numbering of MCTable.h, an edge is the lattice edge along edgeAxis
+// starting at the vertex edgeCorner
+static const int cornerOffset[8][3] = { {0,0,0},{1,0,0},{1,1,0},{0,1,0},{0,0,1},{1,0,1},{1,1,1},{0,1,1} };
+static const int edgeAxis[12] = { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 };
+static const int edgeCorner[12] = { 0, 1, 3, 0, 4, 5, 7, 4, 0, 1, 2, 3 };
+
+void marchingCubeBase_t::setLattice(const int npoints[3], const float origin[3], const float step[3])
+{
+	for (int i = 0; i < 3; i++) {
+		_npoints[i] = npoints[i];
+		_origin[i] = origin[i];
+		_step[i] = step[i];
+	}
+}
+
+void marchingCubeBase_t::setLattice(const int npoints[3], const std::vector<float> node[3])
+{
+	float origin[3] = { node[0][0], node[1][0], node[2][0] };
+	int stride[3] = { 1, npoints[0], npoints[0] * npoints[1] };
+	float step[3];
+	for (int i = 0; i < 3; i++) {
+		step[i] = npoints[i] > 1 ? node[i][stride[i]] - node[i][0] : 1.f;
+	}
+	setLattice(npoints, origin, step);
+}
+
+void marchingCubeBase_t::clear(void)
+{
+	for (int i = 0; i < 3; i++) std::vector<float>().swap(_vert[i]);
+	std::vector<int>().swap(_faces);
+}
+
+void marchingCubeBase_t::extract(const std::vector<float>& values, float isovalue)
+{
+	int nx = _npoints[0], nxy = _npoints[0] * _npoints[1];
+	extract([&](int i, int j, int k) { return values[i + j * nx + k * nxy]; }, isovalue);
+}
+
+void marchingCubeBase_t::extract(const ValueFunc& value, float isovalue)
+{
+	clear();
+	const int nx = _npoints[0], ny = _npoints[1], nz = _npoints[2];
+	if (nx < 2 || ny < 2 || nz < 2) return;
+
+	const int nxy = nx * ny;
+	const int64_t npts = int64_t(nxy) * nz;
+	const int nslab = (nz - 2) / slab_layers + 1;
+
+	// vertex of each crossed lattice edge, numbered within the slab owning the plane of its start point.
+	// The slab s owns the planes s * slab_layers ... (s + 1) * slab_layers - 1, the last one also the top plane
+	std::vector<int> edgeVert[3];
+	for (int i = 0; i < 3; i++) edgeVert[i].resize(npts, -1);
+	auto planeOwner = [&](int k) { return (std::min)(k / slab_layers, nslab - 1); };
+
+	std::vector<std::vector<float>> slabVert(nslab);
+	// triangles of a slab as keys axis * npts + id of their edges, resolved after all slabs numbered their vertices
+	std::vector<std::vector<int64_t>> slabFaces(nslab);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < nslab; s++) {
+		int k0 = s * slab_layers;
+		int k1 = (std::min)(k0 + slab_layers, nz - 1);
+		int kown = s == nslab - 1 ? k1 : k1 - 1;
+
+		// values of the planes k0 ... k1, the planes between two slabs are sampled by both
+		std::vector<float> val(size_t(k1 - k0 + 1) * nxy);
+		for (int k = k0; k <= k1; k++) {
+			for (int j = 0; j < ny; j++) {
+				for (int i = 0; i < nx; i++) {
+					val[size_t(k - k0) * nxy + i + j * nx] = value(i, j, k);
+				}
+			}
+		}
+
+		auto& vert = slabVert[s];
+		int nvert = 0;
+		for (int k = k0; k <= kown; k++) {
+			for (int j = 0; j < ny; j++) {
+				for (int i = 0; i < nx; i++) {
+					size_t lid = size_t(k - k0) * nxy + i + j * nx;
+					int64_t id = int64_t(k) * nxy + i + j * nx;
+					float v0 = val[lid];
+					int ijk[3] = { i, j, k };
+					size_t stride[3] = { 1, size_t(nx), size_t(nxy) };
+					for (int ax = 0; ax < 3; ax++) {
+						if (ijk[ax] + 1 >= _npoints[ax]) continue;
+						float v1 = val[lid + stride[ax]];
+						if ((v0 <= isovalue) == (v1 <= isovalue)) continue;
+						// same interpolation as LinearInterp in MarchingCube.cpp
+						float t = fabs(v1 - v0) > 0.00001 ? (isovalue - v0) / (v1 - v0) : 0.f;
+						for (int c = 0; c < 3; c++) {
+							vert.emplace_back(_origin[c] + _step[c] * (ijk[c] + (c == ax ? t : 0.f)));
+						}
+						edgeVert[ax][id] = nvert++;
+					}
+				}
+			}
+		}
+
+		auto& faces = slabFaces[s];
+		for (int k = k0; k < k1; k++) {
+			for (int j = 0; j < ny - 1; j++) {
+				for (int i = 0; i < nx - 1; i++) {
+					int cubeIndex = 0;
+					for (int n = 0; n < 8; n++) {
+						const int* o = cornerOffset[n];
+						if (val[size_t(k + o[2] - k0) * nxy + (i + o[0]) + (j + o[1]) * nx] <= isovalue) cubeIndex |= (1 << n);
+					}
+					if (!edgeTable[cubeIndex]) continue;
+					for (int n = 0; triTable[cubeIndex][n] != -1; n++) {
+						int e = triTable[cubeIndex][n];
+						const int* o = cornerOffset[edgeCorner[e]];
+						int64_t id = int64_t(k + o[2]) * nxy + (i + o[0]) + (j + o[1]) * nx;
+						faces.emplace_back(edgeAxis[e] * npts + id);
+					}
+				}
+			}
+		}
+	}
+
+	// global numbering of the vertices in slab order
+	std::vector<int> vertOffset(nslab + 1, 0), faceOffset(nslab + 1, 0);
+	for (int s = 0; s < nslab; s++) {
+		vertOffset[s + 1] = vertOffset[s] + slabVert[s].size() / 3;
+		faceOffset[s + 1] = faceOffset[s] + slabFaces[s].size();
+	}
+	for (int i = 0; i < 3; i++) _vert[i].resize(vertOffset[nslab]);
+	_faces.resize(faceOffset[nslab]);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < nslab; s++) {
+		const auto& vert = slabVert[s];
+		for (size_t n = 0; n < vert.size() / 3; n++) {
+			for (int c = 0; c < 3; c++) _vert[c][vertOffset[s] + n] = vert[n * 3 + c];
+		}
+		const auto& faces = slabFaces[s];
+		for (size_t n = 0; n < faces.size(); n++) {
+			int ax = faces[n] / npts;
+			int64_t id = faces[n] % npts;
+			_faces[faceOffset[s] + n] = edgeVert[ax][id] + vertOffset[planeOwner(id / nxy)];
+		}
+	}
+}
+
+void marchingCubeBase_t::extract(const ValueFunc& value, float isovalue, const BlockFunc& mayCross)
+{
+	clear();
+	const int nx = _npoints[0], ny = _npoints[1], nz = _npoints[2];
+	if (nx < 2 || ny < 2 || nz < 2) return;
+
+	const int nxy = nx * ny;
+	const int64_t npts = int64_t(nxy) * nz;
+	int nblock[3];
+	for (int i = 0; i < 3; i++) nblock[i] = (_npoints[i] - 2) / block_cells + 1;
+	const int nblocks = nblock[0] * nblock[1] * nblock[2];
+
+	std::vector<char> crossed(nblocks);
+#pragma omp parallel for schedule(static)
+	for (int b = 0; b < nblocks; b++) {
+		crossed[b] = mayCross(b % nblock[0], b / nblock[0] % nblock[1], b / (nblock[0] * nblock[1]));
+	}
+	std::vector<int> blocks;
+	for (int b = 0; b < nblocks; b++) {
+		if (crossed[b]) blocks.emplace_back(b);
+	}
+	const int nactive = blocks.size();
+
+	// vertices of a block as edge keys axis * npts + id and positions, its triangles in block local vertex ids.
+	// Edges on the faces between two blocks are computed by both and merged below
+	std::vector<std::vector<int64_t>> blockKeys(nactive);
+	std::vector<std::vector<float>> blockVert(nactive);
+	std::vector<std::vector<int>> blockFaces(nactive);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int n = 0; n < nactive; n++) {
+		int b = blocks[n];
+		int bid[3] = { b % nblock[0], b / nblock[0] % nblock[1], b / (nblock[0] * nblock[1]) };
+		int c0[3], m[3];
+		for (int i = 0; i < 3; i++) {
+			c0[i] = bid[i] * block_cells;
+			m[i] = (std::min)(c0[i] + block_cells, _npoints[i] - 1) - c0[i] + 1;
+		}
+		const int m01 = m[0] * m[1];
+
+		std::vector<float> val(size_t(m01) * m[2]);
+		for (int k = 0; k < m[2]; k++) {
+			for (int j = 0; j < m[1]; j++) {
+				for (int i = 0; i < m[0]; i++) {
+					val[i + j * m[0] + k * m01] = value(c0[0] + i, c0[1] + j, c0[2] + k);
+				}
+			}
+		}
+
+		std::vector<int> localVert(size_t(3) * m01 * m[2], -1);
+		auto& keys = blockKeys[n];
+		auto& vert = blockVert[n];
+		auto& faces = blockFaces[n];
+		const int stride[3] = { 1, m[0], m01 };
+		for (int k = 0; k < m[2] - 1; k++) {
+			for (int j = 0; j < m[1] - 1; j++) {
+				for (int i = 0; i < m[0] - 1; i++) {
+					int cubeIndex = 0;
+					for (int v = 0; v < 8; v++) {
+						const int* o = cornerOffset[v];
+						if (val[(i + o[0]) + (j + o[1]) * m[0] + (k + o[2]) * m01] <= isovalue) cubeIndex |= (1 << v);
+					}
+					if (!edgeTable[cubeIndex]) continue;
+					for (int t = 0; triTable[cubeIndex][t] != -1; t++) {
+						int e = triTable[cubeIndex][t];
+						int ax = edgeAxis[e];
+						const int* o = cornerOffset[edgeCorner[e]];
+						int lijk[3] = { i + o[0], j + o[1], k + o[2] };
+						int lid = lijk[0] + lijk[1] * m[0] + lijk[2] * m01;
+						int& lv = localVert[size_t(ax) * m01 * m[2] + lid];
+						if (lv == -1) {
+							float v0 = val[lid], v1 = val[lid + stride[ax]];
+							// same interpolation as LinearInterp in MarchingCube.cpp
+							float s = fabs(v1 - v0) > 0.00001 ? (isovalue - v0) / (v1 - v0) : 0.f;
+							for (int c = 0; c < 3; c++) {
+								vert.emplace_back(_origin[c] + _step[c] * (c0[c] + lijk[c] + (c == ax ? s : 0.f)));
+							}
+							int64_t id = int64_t(c0[2] + lijk[2]) * nxy + (c0[0] + lijk[0]) + (c0[1] + lijk[1]) * nx;
+							keys.emplace_back(ax * npts + id);
+							lv = keys.size() - 1;
+						}
+						faces.emplace_back(lv);
+					}
+				}
+			}
+		}
+	}
+
+	// merge the vertices of all blocks by edge key
+	std::vector<int> vertOffset(nactive + 1, 0), faceOffset(nactive + 1, 0);
+	for (int n = 0; n < nactive; n++) {
+		vertOffset[n + 1] = vertOffset[n] + blockKeys[n].size();
+		faceOffset[n + 1] = faceOffset[n] + blockFaces[n].size();
+	}
+	std::vector<std::pair<int64_t, int>> allKeys(vertOffset[nactive]);
+	for (int n = 0; n < nactive; n++) {
+		int nkey = blockKeys[n].size();
+		for (int v = 0; v < nkey; v++) allKeys[vertOffset[n] + v] = { blockKeys[n][v], vertOffset[n] + v };
+	}
+	std::sort(allKeys.begin(), allKeys.end());
+
+	// the first copy of a shared vertex writes its position
+	std::vector<int> merged(allKeys.size());
+	std::vector<char> firstCopy(allKeys.size(), 0);
+	int nvert = 0;
+	for (size_t v = 0; v < allKeys.size(); v++) {
+		if (v > 0 && allKeys[v].first == allKeys[v - 1].first) {
+			merged[allKeys[v].second] = nvert - 1;
+			continue;
+		}
+		firstCopy[allKeys[v].second] = 1;
+		merged[allKeys[v].second] = nvert++;
+	}
+	for (int c = 0; c < 3; c++) _vert[c].resize(nvert);
+	_faces.resize(faceOffset[nactive]);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int n = 0; n < nactive; n++) {
+		const auto& vert = blockVert[n];
+		for (size_t v = 0; v < blockKeys[n].size(); v++) {
+			if (!firstCopy[vertOffset[n] + v]) continue;
+			int g = merged[vertOffset[n] + v];
+			for (int c = 0; c < 3; c++) _vert[c][g] = vert[v * 3 + c];
+		}
+		const auto& faces = blockFaces[n];
+		for (size_t t = 0; t < faces.size(); t++) _faces[faceOffset[n] + t] = merged[vertOffset[n] + faces[t]];
+	}
+}
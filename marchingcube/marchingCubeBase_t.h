@@ -3,12 +3,65 @@
 #ifndef __MARCHING_CUBE_BASE_H
 #define __MARCHING_CUBE_BASE_H
 
+#include <vector>
+#include <functional>
+
+// Table driven marching cubes on a regular lattice of points, the lattice is cut into slabs along z which
+// are extracted in parallel. The vertices are indexed by the lattice edge they lie on, so each edge crossing
+// is computed once and the output is an indexed mesh with the vertices shared by the adjacent triangles.
+// The point (i, j, k) has the id i + j * npoints[0] + k * npoints[0] * npoints[1]
 class marchingCubeBase_t
 {
 public:
-	void extract();
+	// value at the lattice point (i, j, k), called from several threads at once
+	typedef std::function<float(int, int, int)> ValueFunc;
+
+	// whether the isosurface may cross the block (bi, bj, bk) of the cells [b * block_cells, (b + 1) * block_cells)
+	typedef std::function<bool(int, int, int)> BlockFunc;
+
+	static constexpr int block_cells = 8;
+
+	marchingCubeBase_t(void) = default;
+	marchingCubeBase_t(const int npoints[3], const float origin[3], const float step[3]) { setLattice(npoints, origin, step); }
+
+	// the points are at origin + (i, j, k) * step
+	void setLattice(const int npoints[3], const float origin[3], const float step[3]);
+
+	// the lattice of the given point coordinates in the id order above
+	void setLattice(const int npoints[3], const std::vector<float> node[3]);
+
+	// extracts the isosurface value = isovalue, the points with value <= isovalue are inside
+	void extract(const ValueFunc& value, float isovalue);
+
+	// extracts from sampled values in the id order
+	void extract(const std::vector<float>& values, float isovalue);
+
+	// extracts only in the blocks passing mayCross, the values are only requested there. The blocks must be
+	// bounded conservatively, a skipped block that is crossed leaves a hole. The vertices are ordered by edge
+	void extract(const ValueFunc& value, float isovalue, const BlockFunc& mayCross);
+
+	int n_vertices(void) const { return _vert[0].size(); }
+	int n_faces(void) const { return _faces.size() / 3; }
+
+	const std::vector<float>& getVertices(int axis) const { return _vert[axis]; }
+	void getVertices(std::vector<float>& x, std::vector<float>& y, std::vector<float>& z) const { x = _vert[0]; y = _vert[1]; z = _vert[2]; }
+
+	// three vertex ids per triangle
+	const std::vector<int>& getFaces(void) const { return _faces; }
+
+	void clear(void);
+
+private:
+	// cell layers of a slab, fixed so the output does not depend on the number of threads
+	static constexpr int slab_layers = 8;
+
+	int _npoints[3] = { 0, 0, 0 };
+	float _origin[3] = { 0, 0, 0 };
+	float _step[3] = { 1, 1, 1 };
+
+	std::vector<float> _vert[3];
+	std::vector<int> _faces;
 };
 
 
 #endif
-
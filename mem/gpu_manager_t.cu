@@ -12,6 +12,9 @@
 //#include "lib.cuh"
 #include "gpu_manager_t.h"
 #include "cudaCommon.cuh"
+#include "snippet.h"
+#include <cstdlib>
+#include <cstring>
 //#include "matlab_utils.h"
 
 
@@ -30,10 +33,26 @@ void deleteDeviceMemory(void* ptr) {
 	cuda_error_check;
 }
 
+void* mallocHostMemory(size_t size) {
+	// 64 bytes aligned for vectorized host kernels
+	return std::aligned_alloc(64, snippet::Round<64>(size));
+}
+
+void deleteHostMemory(void* ptr) {
+	std::free(ptr);
+}
+
+bool gpu_manager_t::host_memory = false;
+
+void gpu_manager_t::setHostMemory(bool on_host)
+{
+	host_memory = on_host;
+}
+
 gpu_manager_t::gpu_buf_t::gpu_buf_t(const std::string& name, size_t size)
 	:std::unique_ptr<void, std::function<void(void*)>>(
-		mallocDeviceMemory(size),
-		deleteDeviceMemory
+		host_memory ? mallocHostMemory(size) : mallocDeviceMemory(size),
+		host_memory ? deleteHostMemory : deleteDeviceMemory
 		)
 {
 	cuda_error_check;
@@ -61,6 +80,7 @@ gpu_manager_t::gpu_buf_t& gpu_manager_t::gpu_buf_t::operator=(gpu_buf_t&& tmp_bu
 void gpu_manager_t::upload_buf(void* dst, const void* src, size_t size)
 {
 	if (size == 0 || dst == nullptr)  return; 
+	if (host_memory) { memcpy(dst, src, size); return; }
 	cudaMemcpy(dst, src, size, cudaMemcpyHostToDevice);
 	cuda_error_check;
 }
@@ -68,6 +88,7 @@ void gpu_manager_t::upload_buf(void* dst, const void* src, size_t size)
 void gpu_manager_t::download_buf(void* host_dst, const void* dev_src, size_t n)
 {
 	if (host_dst == nullptr || n == 0) return;
+	if (host_memory) { memcpy(host_dst, dev_src, n); return; }
 	cudaMemcpy(host_dst, dev_src, n, cudaMemcpyDeviceToHost);
 	cuda_error_check;
 }
@@ -173,8 +194,21 @@ void gpu_manager_t::delete_buf(void * pbuf)
 	}
 }
 
+void gpu_manager_t::delete_bufs(const std::string& prefix)
+{
+	for (auto k = gpu_buf.begin(); k != gpu_buf.end();) {
+		if (k->_desc.compare(0, prefix.size(), prefix) == 0) {
+			k = gpu_buf.erase(k);
+		}
+		else {
+			k++;
+		}
+	}
+}
+
 void gpu_manager_t::initMem(void* pdata, size_t len, char value)
 {
+	if (host_memory) { memset(pdata, value, len); return; }
 	cudaMemset(pdata, value, len);
 	cuda_error_check;
 }
@@ -37,7 +37,15 @@ private:
 	/* GPU buf array */
 	std::vector<gpu_buf_t> gpu_buf;
 
+	/* allocate bufs in host memory instead of device memory */
+	static bool host_memory;
+
 public:
+	/* switch to host memory, must be set before any buf is added */
+	static void setHostMemory(bool on_host);
+
+	static bool onHost(void) { return host_memory; }
+
 	/* upload data from host to GPU buf allocated */
 	static void upload_buf(void* dst, const void* src, size_t size);
 
@@ -63,6 +71,9 @@ public:
 	void delete_buf(const std::string& name);
 	void delete_buf(void * pbuf);
 
+	/* delete all GPU bufs whose name starts with prefix */
+	void delete_bufs(const std::string& prefix);
+
 	size_t size(void);
 
 	static void pass_dev_buf_to_matlab(const char*name, float* dev_ptr, size_t n);
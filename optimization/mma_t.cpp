@@ -19,15 +19,17 @@ bool mma_t::update(Scalar* dev_df, Scalar** dg, Scalar* dev_g)
 {
 	toMatlab();
 
-	gv::gVector vdf = gVector::Map(dev_df, n_dim());
-	std::vector<gVector> vdg(n_constrain());
+	// the subproblem reads the sensitivities in place
+	gVectorMap vdf(dev_df, n_dim());
+	std::vector<gVectorMap> vdg;
 	std::vector<gVector*> vdg_ptr(n_constrain());
+	vdg.reserve(n_constrain());
 	for (int i = 0; i < n_constrain(); i++) {
-		vdg[i] = (gVector::Map(dg[i], n_dim()));
+		vdg.emplace_back(dg[i], n_dim());
 		vdg_ptr[i] = &vdg[i];
 	}
 
-	gv::gVector vg = gVector::Map(dev_g, n_constrain());
+	gVectorMap vg(dev_g, n_constrain());
 
 	vdf.toMatlab("df");
 	//gv::gVector::toMatlab("dg", dg, n_dim());
@@ -74,6 +76,17 @@ void MMA::mma_subproblem_t::clear()
 	}
 }
 
+void MMA::mma_subproblem_t::release(void)
+{
+	clear();
+	for (size_t i = 0; i < p.size(); i++) delete p[i];
+	for (size_t i = 0; i < q.size(); i++) delete q[i];
+	for (size_t i = 0; i < G.size(); i++) delete G[i];
+	p.clear();
+	q.clear();
+	G.clear();
+}
+
 MMA::mma_subproblem_t::~mma_subproblem_t()
 {
 	clear();
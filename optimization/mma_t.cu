@@ -37,33 +37,36 @@ bool MMA::mma_subproblem_t::init(gv::gVector* df, std::vector<gv::gVector*>& dg,
 
 		b = gVector(mma.n_constrain());
 
-		// initialize description
-		auto desc_stat = cusparseCreateMatDescr(&cuSolver.descr);
-		if (desc_stat != CUSPARSE_STATUS_SUCCESS) {
-			throw std::string("sparse matrix context create failed !");
-		}
-		cusparseSetMatType(cuSolver.descr, CUSPARSE_MATRIX_TYPE_GENERAL);
-		cusparseSetMatIndexBase(cuSolver.descr, CUSPARSE_INDEX_BASE_ZERO);
-		cusparseSetMatFillMode(cuSolver.descr, CUSPARSE_FILL_MODE_LOWER);
-		cusparseSetMatDiagType(cuSolver.descr, CUSPARSE_DIAG_TYPE_NON_UNIT);
-
-		// create sparse matrix context
-		auto stat = cusolverSpCreate(&cuSolver.spHandle);
-		if (stat != CUSOLVER_STATUS_SUCCESS) {
-			throw std::string("cusolver context create failed !");
-		}
+		// the sparse solver context lives on the device, there is none on the host backend
+		if (!gVector::onHost()) {
+			// initialize description
+			auto desc_stat = cusparseCreateMatDescr(&cuSolver.descr);
+			if (desc_stat != CUSPARSE_STATUS_SUCCESS) {
+				throw std::string("sparse matrix context create failed !");
+			}
+			cusparseSetMatType(cuSolver.descr, CUSPARSE_MATRIX_TYPE_GENERAL);
+			cusparseSetMatIndexBase(cuSolver.descr, CUSPARSE_INDEX_BASE_ZERO);
+			cusparseSetMatFillMode(cuSolver.descr, CUSPARSE_FILL_MODE_LOWER);
+			cusparseSetMatDiagType(cuSolver.descr, CUSPARSE_DIAG_TYPE_NON_UNIT);
+
+			// create sparse matrix context
+			auto stat = cusolverSpCreate(&cuSolver.spHandle);
+			if (stat != CUSOLVER_STATUS_SUCCESS) {
+				throw std::string("cusolver context create failed !");
+			}
 
-		// allocate gpu memory for row indices
-		int n = mma.n_dim();
-		int m = mma.n_constrain();
-		int n_elements = n + m + 1 + n * m * 2 + m * 4 + m * m;
-		cudaMalloc(&cuSolver.row_ptr, sizeof(int)*(n + m + 1 + m + 1));
-		cudaMalloc(&cuSolver.col_ptr, sizeof(int)*(n_elements));
-		cudaMalloc(&cuSolver.val_ptr, sizeof(gv::Scalar)*n_elements);
-		cudaMalloc(&cuSolver.b_ptr, sizeof(gv::Scalar)*(n + m + 1 + m));
-
-		cuSolver.n_nonzeros = n_elements;
-		cuSolver.nrows = n + m + 1 + m;
+			// allocate gpu memory for row indices
+			int n = mma.n_dim();
+			int m = mma.n_constrain();
+			int n_elements = n + m + 1 + n * m * 2 + m * 4 + m * m;
+			cudaMalloc(&cuSolver.row_ptr, sizeof(int)*(n + m + 1 + m + 1));
+			cudaMalloc(&cuSolver.col_ptr, sizeof(int)*(n_elements));
+			cudaMalloc(&cuSolver.val_ptr, sizeof(gv::Scalar)*n_elements);
+			cudaMalloc(&cuSolver.b_ptr, sizeof(gv::Scalar)*(n + m + 1 + m));
+
+			cuSolver.n_nonzeros = n_elements;
+			cuSolver.nrows = n + m + 1 + m;
+		}
 	}
 
 	// compute p , q
@@ -117,6 +120,7 @@ bool MMA::mma_subproblem_t::init(gv::gVector* df, std::vector<gv::gVector*>& dg,
 	//}
 	//d = gVector(dhost.size());
 	//d.set(dhost.data());
+	return true;
 }
 
 MMA::mma_subproblem_t::cuSolver_t::~cuSolver_t()
@@ -149,11 +153,11 @@ void MMA::mma_t::update(
 
 void mma_t::get_x(Scalar* dst)
 {
-	cudaMemcpy(dst, x.data(), sizeof(Scalar)*x.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(dst, x.size()) = x;
 }
 
 
-__device__ Scalar clamp_asym(Scalar val, Scalar low_value, Scalar up_value) {
+__host__ __device__ Scalar clamp_asym(Scalar val, Scalar low_value, Scalar up_value) {
 	if (val > up_value) return up_value;
 	if (val < low_value) return low_value;
 	return val;
@@ -172,9 +176,7 @@ void mma_t::adjust_asym(gv::gVector& dx0, gv::gVector& dx_1)
 	Scalar* xmin_ptr = xmin.data();
 
 	// adjust asymptotes
-	size_t grid_size, block_size;
-	make_kernel_param(&grid_size, &block_size, dx0.size(), 512);
-	traverse_noret << <grid_size, block_size >> > (dx0.size(), [=] __device__(int eid) {
+	auto adjust = [=] __host__ __device__(int eid) {
 		Scalar gamma = 1;
 		Scalar d1 = p1[eid], d2 = p2[eid];
 		if (d1*d2 > 0) gamma = 1.2;
@@ -219,7 +221,18 @@ void mma_t::adjust_asym(gv::gVector& dx0, gv::gVector& dx_1)
 
 		valpha[eid] = newalpha;
 		vbeta[eid] = newbeta;
-	});
+	};
+
+	int n = dx0.size();
+	if (gVector::onHost()) {
+#pragma omp parallel for
+		for (int eid = 0; eid < n; eid++) adjust(eid);
+		return;
+	}
+
+	size_t grid_size, block_size;
+	make_kernel_param(&grid_size, &block_size, n, 512);
+	traverse_noret << <grid_size, block_size >> > (n, adjust);
 	cudaDeviceSynchronize();
 	cuda_error_check;
 
@@ -385,7 +398,7 @@ std::pair<gv::Scalar, gv::Scalar> MMA::mma_subproblem_t::solve(gv::gVector* df,
 			}
 
 			for (int i = 0; i < mma.n_constrain(); i++) {
-				gproxy[i] = p[i + 1]->dot(1 / (mma.asym_u - mma.x)) + q[i + 1]->dot(1 / (mma.x - mma.asym_l));
+				gproxy[i] = gv::sum((*p[i + 1]) / (mma.asym_u - mma.x) + (*q[i + 1]) / (mma.x - mma.asym_l));
 			}
 
 			varphi_x = plambda / ((mma.asym_u - mma.x)*(mma.asym_u - mma.x)) - qlambda / ((mma.x - mma.asym_l)*(mma.x - mma.asym_l));
@@ -409,11 +422,12 @@ std::pair<gv::Scalar, gv::Scalar> MMA::mma_subproblem_t::solve(gv::gVector* df,
 			//w.toMatlab("w");
 #endif
 
-			Scalar max_t1inv = ((-1 / asym_clamp_factor) * (get_dx(dw) / (mma.x - mma.alpha))).max();
-			Scalar max_t2inv = ((1 / asym_clamp_factor) * (get_dx(dw) / (mma.beta - mma.x))).max();
+			// both bounds of x in one pass
+			auto dw_x = get_dx(dw);
+			Scalar max_t12inv = gv::max(((-1 / asym_clamp_factor) * (dw_x / (mma.x - mma.alpha))).max((1 / asym_clamp_factor) * (dw_x / (mma.beta - mma.x))));
 			Scalar max_t3inv = ((-1 / asym_clamp_factor)*get_artivar(dw) / get_artivar(w)).max();
-			//printf("max_tinv = (%f, %f, %f)\n", max_t1inv, max_t2inv, max_t3inv);
-			Scalar max_t = 1 / (std::max)((std::max)(max_t1inv, max_t2inv), (std::max)(max_t3inv, Scalar{ 1 }));
+			//printf("max_tinv = (%f, %f)\n", max_t12inv, max_t3inv);
+			Scalar max_t = 1 / (std::max)(max_t12inv, (std::max)(max_t3inv, Scalar{ 1 }));
 
 #ifdef __MMA_WITH_MATLAB
 			//((mma.alpha - mma.x) / get_dx(dw)).toMatlab("t1b");
@@ -582,72 +596,53 @@ std::pair<Scalar, Scalar> MMA::mma_subproblem_t::kkt_err(
 
 	update_pqlambda(new_lambda);
 
-	if (mma.n_dim() > mma.n_constrain())
-	{
-		kkt_err_tmp.resize(mma.n_dim());
-	}
-	else
-	{
-		kkt_err_tmp.resize(mma.n_constrain());
-	}
-	int tag = 0;
+	// each residual is reduced straight from its expression, no residual vector is written
+	auto add_err = [&](std::pair<Scalar, Scalar> sqr_inf, Scalar damp) {
+		err_sum += sqr_inf.first / (damp * damp);
+		err_max = (std::max)(err_max, sqr_inf.second / damp);
+	};
 
-	auto rex = gv::gVectorMap(kkt_err_tmp.data(), mma.n_dim());
-	rex = plambda / ((mma.asym_u - new_x)*(mma.asym_u - new_x)) - qlambda / ((new_x - mma.asym_l)*(new_x - mma.asym_l)) - new_xi + new_eta;
+	auto rex = plambda / ((mma.asym_u - new_x)*(mma.asym_u - new_x)) - qlambda / ((new_x - mma.asym_l)*(new_x - mma.asym_l)) - new_xi + new_eta;
 	rex.toMatlab("rex");
-	err_sum += rex.sqrnorm();
-	err_max = (std::max)(err_max, rex.infnorm());
+	add_err(rex.sqrnorm_infnorm(), 1);
 
-	auto rey = gv::gVectorMap(kkt_err_tmp.data(), mma.n_constrain());
-	rey = mma.c + mma.d * new_y - new_lambda - new_mu;
+	auto rey = mma.c + mma.d * new_y - new_lambda - new_mu;
 	rey.toMatlab("rey");
-	err_sum += rey.sqrnorm();
-	err_max = (std::max)(err_max, rey.infnorm());
+	add_err(rey.sqrnorm_infnorm(), 1);
 
-	err_sum += pow(mma.a0 - new_zeta - new_lambda.dot(mma.a), 2.0);
-	//std::cout << "rez = " << mma.a0 - new_zeta - new_lambda.dot(mma.a) << std::endl;
-	err_max = (std::max)(err_max, abs(mma.a0 - new_zeta - new_lambda.dot(mma.a)));
+	Scalar rez = mma.a0 - new_zeta - new_lambda.dot(mma.a);
+	err_sum += pow(rez, 2.0);
+	//std::cout << "rez = " << rez << std::endl;
+	err_max = (std::max)(err_max, abs(rez));
 
 	gv::gVector g(mma.n_constrain());
 	for (int i = 0; i < g.size(); i++) {
 		g[i] = ((*p[i + 1]) / (mma.asym_u - new_x) + (*q[i + 1]) / (new_x - mma.asym_l)).sum();
 	}
 
-	auto relam = gv::gVectorMap(kkt_err_tmp.data(), mma.n_constrain());
-	//tag += mma.n_constrain();
-	relam = g - mma.a*new_z - new_y + new_s - b;
+	auto relam = g - mma.a*new_z - new_y + new_s - b;
 	relam.toMatlab("relam");
-	err_sum += relam.sqrnorm() / (lambda_damp*lambda_damp);
-	err_max = (std::max)(err_max, relam.infnorm() / lambda_damp);
+	add_err(relam.sqrnorm_infnorm(), lambda_damp);
 
-	auto rexsi = gv::gVectorMap(kkt_err_tmp.data(), mma.n_dim());
-	//tag += mma.n_dim();
-	rexsi = new_xi * (new_x - mma.alpha) - mma.epsilon;
+	auto rexsi = new_xi * (new_x - mma.alpha) - mma.epsilon;
 	rexsi.toMatlab("rexsi");
-	err_sum += rexsi.sqrnorm();
-	err_max = (std::max)(err_max, rexsi.infnorm());
+	add_err(rexsi.sqrnorm_infnorm(), 1);
 
-	auto reeta = gv::gVectorMap(kkt_err_tmp.data(), mma.n_dim());
-	reeta = new_eta * (mma.beta - new_x) - mma.epsilon;
+	auto reeta = new_eta * (mma.beta - new_x) - mma.epsilon;
 	reeta.toMatlab("reeta");
-	err_sum += reeta.sqrnorm();
-	err_max = (std::max)(err_max, reeta.infnorm());
+	add_err(reeta.sqrnorm_infnorm(), 1);
 
-	auto remu = gv::gVectorMap(kkt_err_tmp.data(), mma.n_constrain());
-	remu = new_mu * new_y - mma.epsilon;
+	auto remu = new_mu * new_y - mma.epsilon;
 	remu.toMatlab("remu");
-	err_sum += remu.sqrnorm();
-	err_max = (std::max)(err_max, remu.infnorm());
+	add_err(remu.sqrnorm_infnorm(), 1);
 
 	err_sum += pow(new_zeta*new_z - mma.epsilon, 2.0);
 	//std::cout << "rezet = " << new_zeta * new_z - mma.epsilon << std::endl;
 	err_max = (std::max)(err_max, abs(new_zeta*new_z - mma.epsilon));
 
-	auto res = gv::gVectorMap(kkt_err_tmp.data(), mma.n_constrain());
-	res = new_lambda * new_s - mma.epsilon;
+	auto res = new_lambda * new_s - mma.epsilon;
 	res.toMatlab("res");
-	err_sum += res.sqrnorm();
-	err_max = (std::max)(err_max, res.infnorm());
+	add_err(res.sqrnorm_infnorm(), 1);
 
 #ifdef __MMA_WITH_MATLAB
 	//g.toMatlab("g");
@@ -771,14 +766,14 @@ void MMA::mma_subproblem_t::cuSolver_t::solve(gv::gVector& result)
 }
 
 
-gv::gVector MMA::mma_subproblem_t::get_dx(const gv::gVector& dw)
+gv::gVectorMap MMA::mma_subproblem_t::get_dx(gv::gVector& dw)
 {
-	return dw.slice(0, mma.n_dim());
+	return gVectorMap(dw.data(), mma.n_dim());
 }
 
-gv::gVector MMA::mma_subproblem_t::get_dy(gv::gVector& dw)
+gv::gVectorMap MMA::mma_subproblem_t::get_dy(gv::gVector& dw)
 {
-	return dw.slice(mma.n_dim(), mma.n_dim() + mma.n_constrain());
+	return gVectorMap(dw.data() + mma.n_dim(), mma.n_constrain());
 }
 
 Scalar MMA::mma_subproblem_t::get_dz(gv::gVector& dw)
@@ -787,11 +782,10 @@ Scalar MMA::mma_subproblem_t::get_dz(gv::gVector& dw)
 	return dw[start_id];
 }
 
-gv::gVector MMA::mma_subproblem_t::get_dlambda(gv::gVector& dw)
+gv::gVectorMap MMA::mma_subproblem_t::get_dlambda(gv::gVector& dw)
 {
 	int start_id = mma.n_dim() + mma.n_constrain() + 1;
-	int end_id = start_id + mma.n_constrain();
-	return dw.slice(start_id, end_id);
+	return gVectorMap(dw.data() + start_id, mma.n_constrain());
 }
 
 void mma_t::init_subproblem_variable(void) {
@@ -830,37 +824,66 @@ void mma_t::set_bound(Scalar uniform_lower_bound, Scalar uniform_upper_bound)
 	clamp_asymptotes();
 }
 
+void mma_t::transfer(int ndim, const std::function<void(const Scalar*, Scalar*)>& map)
+{
+	std::vector<Scalar> src(n_dim()), dst(ndim);
+	auto carry = [&](gVector& v) {
+		v.download(src.data());
+		map(src.data(), dst.data());
+		v.resize(ndim);
+		v.set(dst.data());
+	};
+	carry(x);
+	carry(lastdx);
+	carry(asym_l);
+	carry(asym_u);
+	carry(alpha);
+	carry(beta);
+	carry(xmin);
+	carry(xmax);
+	dx.resize(ndim);
+	dx.set(Scalar(0));
+	xi.resize(ndim);
+	eta.resize(ndim);
+	xi = (1 / (x - alpha)).max(1);
+	eta = (1 / (beta - x)).max(1);
+	gVector::Init(ndim);
+	subproblem.release();
+	// the buffers of the previous dimension will not be reused
+	gVector::releasePool();
+}
+
 void mma_t::get_w(gv::gVector& w)
 {
 	w.resize(n_w());
 
 	Scalar* ptr = w.data();
 	int offset = 0;
-	cudaMemcpy(ptr + offset, x.data(), sizeof(Scalar)*x.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, x.size()) = x;
 	offset += x.size();
 
-	cudaMemcpy(ptr + offset, y.data(), sizeof(Scalar)*y.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, y.size()) = y;
 	offset += y.size();
 
 	w[offset] = z;
 	offset += 1;
 
-	cudaMemcpy(ptr + offset, lambda.data(), sizeof(Scalar)*lambda.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, lambda.size()) = lambda;
 	offset += lambda.size();
 
-	cudaMemcpy(ptr + offset, xi.data(), sizeof(Scalar)*xi.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, xi.size()) = xi;
 	offset += xi.size();
 
-	cudaMemcpy(ptr + offset, eta.data(), sizeof(Scalar)*eta.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, eta.size()) = eta;
 	offset += eta.size();
 
-	cudaMemcpy(ptr + offset, mu.data(), sizeof(Scalar)*mu.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, mu.size()) = mu;
 	offset += mu.size();
 
 	w[offset] = zeta;
 	offset += 1;
 
-	cudaMemcpy(ptr + offset, s.data(), sizeof(Scalar)*s.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, s.size()) = s;
 
 	return;
 }
@@ -877,31 +900,31 @@ void mma_t::get_w(
 
 	Scalar* ptr = new_w.data();
 	int offset = 0;
-	cudaMemcpy(ptr + offset, new_x.data(), sizeof(Scalar)*new_x.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, new_x.size()) = new_x;
 	offset += new_x.size();
 
-	cudaMemcpy(ptr + offset, new_y.data(), sizeof(Scalar)*new_y.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, new_y.size()) = new_y;
 	offset += new_y.size();
 
 	new_w[offset] = new_z;
 	offset += 1;
 
-	cudaMemcpy(ptr + offset, new_lambda.data(), sizeof(Scalar)*new_lambda.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, new_lambda.size()) = new_lambda;
 	offset += new_lambda.size();
 
-	cudaMemcpy(ptr + offset, new_xi.data(), sizeof(Scalar)*new_xi.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, new_xi.size()) = new_xi;
 	offset += new_xi.size();
 
-	cudaMemcpy(ptr + offset, new_eta.data(), sizeof(Scalar)*new_eta.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, new_eta.size()) = new_eta;
 	offset += new_eta.size();
 
-	cudaMemcpy(ptr + offset, new_mu.data(), sizeof(Scalar)*new_mu.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, new_mu.size()) = new_mu;
 	offset += new_mu.size();
 
 	new_w[offset] = new_zeta;
 	offset += 1;
 
-	cudaMemcpy(ptr + offset, new_s.data(), sizeof(Scalar)*new_s.size(), cudaMemcpyDeviceToDevice);
+	gVector::Map(ptr + offset, new_s.size()) = new_s;
 
 	return;
 }
@@ -5,6 +5,7 @@
 
 #include "gpuVector.h"
 #include "vector"
+#include "functional"
 #include "cusparse.h"
 #include "cusolverSp.h"
 #include "Eigen/Sparse"
@@ -72,8 +73,6 @@ private:
 	Scalar      new_zeta;
 	gv::gVector new_s;
 
-	gv::gVector kkt_err_tmp;
-
 	struct cuSolver_t{
 		cusolverSpHandle_t spHandle;
 		// sparse matrix handle
@@ -111,10 +110,11 @@ private:
 	friend class mma_t;
 
 private:
-	gv::gVector get_dx(const gv::gVector& dw);
-	gv::gVector get_dy(gv::gVector& dw);
+	// views on the blocks of dw
+	gv::gVectorMap get_dx(gv::gVector& dw);
+	gv::gVectorMap get_dy(gv::gVector& dw);
 	Scalar get_dz(gv::gVector& dw);
-	gv::gVector get_dlambda(gv::gVector& dw);
+	gv::gVectorMap get_dlambda(gv::gVector& dw);
 
 	gv::gVectorMap get_artivar(gv::gVector& w) const;
 
@@ -130,6 +130,9 @@ public:
 
 	void clear();
 
+	// frees the buffers sized by the design dimension, the next solve allocates them again
+	void release(void);
+
 	mma_subproblem_t(mma_t& solver) :mma(solver) {};
 
 	~mma_subproblem_t();
@@ -227,6 +230,11 @@ public:
 
 	void toMatlab(void);
 
+	// carries the design, its last step and the asymptotes over to a design space of ndim variables by the linear
+	// map fn(src, dst) of host buffers. Weights >= 0 summing to one keep the asymptotes around the design and the
+	// bounds in place, the multipliers of the bounds start over
+	void transfer(int ndim, const std::function<void(const Scalar*, Scalar*)>& map);
+
 	void update(
 		gv::gVector& new_x, gv::gVector& new_y, Scalar new_z, gv::gVector& new_lambda,
 		gv::gVector& new_xi, gv::gVector& new_eta, gv::gVector& new_mu,
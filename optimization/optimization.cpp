@@ -4,6 +4,8 @@
 #include "binaryIO.h"
 #include "tictoc.h"
 #include <cstdlib>
+#include <algorithm>
+#include <memory>
 #include "mma_t.h"
 
 
@@ -13,15 +15,31 @@ grid::HierarchyGrid grids(gpu_manager);
 
 Parameter params;
 
+// input of buildGrids, kept to rebuild the grids at another resolution
+static std::vector<float> meshCoords;
+static std::vector<int> meshTrifaces;
+static Mesh meshInput;
+
 void buildGrids(const std::vector<float>& coords, const std::vector<int>& trifaces, Mesh& inputmesh) 
 {
 	//grids.lambdatest();
+	meshCoords = coords;
+	meshTrifaces = trifaces;
+	meshInput = inputmesh;
 
 	grids.set_prefer_reso(params.gridreso);
 	grids.set_skip_layer(true);
 	grids.genFromMesh(coords, trifaces, inputmesh);
 }
 
+static void rebuildGrids(int reso)
+{
+	grids.clear();
+	grids.set_prefer_reso(reso);
+	grids.genFromMesh(meshCoords, meshTrifaces, meshInput);
+	uploadTemplateMatrix();
+}
+
 void logParams(std::string file, std::string version_str, int argc, char** argv)
 {
 	std::ofstream ofs(grids.getPath(file));
@@ -51,6 +69,10 @@ void setParameters(
 	params.partitionx = partitionx;
 	params.partitiony = partitiony;
 	params.partitionz = partitionz;
+	if (spline_order < grid::min_spline_order || spline_order > grid::max_spline_order) {
+		printf("-- unsupported spline order %d, expected %d to %d\n", spline_order, grid::min_spline_order, grid::max_spline_order);
+		exit(-1);
+	}
 	params.spline_order = spline_order;
 	params.min_cijk = min_coeff;
 	params.max_cijk = max_coeff;
@@ -175,12 +197,286 @@ void setDripMode(const std::string& modestr)
 	}
 }
 
-void solveFEM(void)
+// the tests which only run the solver, the filters, the spline transpose and MMA. The design update and the topology
+// generation have no host path, an optimisation on host buffers would hand them to device kernels
+static const std::vector<std::string> hostBackendTests = {
+	"testeigensolvers", "testmixedprec", "testmmapool", "testfilterengines", "testcoefftranspose"
+};
+
+void setBackend(const std::string& backendstr, const std::string& testname)
+{
+	if (backendstr == "cuda") {
+		// the gVector backend keeps its build default (GVECTOR_HOST_BACKEND)
+		grids.setBackend(grid::Backend::cuda_backend);
+	}
+	else if (backendstr == "host") {
+		if (std::find(hostBackendTests.begin(), hostBackendTests.end(), testname) == hostBackendTests.end()) {
+			std::string names;
+			for (const auto& nam : hostBackendTests) names += " " + nam;
+			printf("\033[31m-- -backend=host only runs the solver tests, the design update and the topology generation are CUDA only\033[0m\n");
+			printf("\033[31m   use -testname with one of:%s\033[0m\n", names.c_str());
+			exit(-1);
+		}
+		grids.setBackend(grid::Backend::host_backend);
+		// MMA works on the host sensitivities in place
+		gv::gVector::setHostBackend(true);
+	}
+	else {
+		printf("-- unsupported backend\n");
+		exit(-1);
+	}
+}
+
+void setSolverMode(const std::string& solverstr)
+{
+	if (solverstr == "mg") {
+		grids.setSolverMode(grid::SolverMode::mg_solver);
+	}
+	else if (solverstr == "pcg") {
+		grids.setSolverMode(grid::SolverMode::pcg_solver);
+	}
+	else if (solverstr == "fpcg") {
+		grids.setSolverMode(grid::SolverMode::fpcg_solver);
+	}
+	else {
+		printf("-- unsupported solver\n");
+		exit(-1);
+	}
+}
+
+static std::string eigenSolver = "pm";
+
+static int nWorstModes = 3;
+
+void setEigenSolver(const std::string& solverstr, int nmodes)
+{
+	if (solverstr != "pm" && solverstr != "lobpcg") {
+		printf("-- unsupported eigen solver\n");
+		exit(-1);
+	}
+	if (nmodes < 1 || nmodes > grid::Grid::max_block_rhs) {
+		printf("-- number of modes should be in [1, %d]\n", grid::Grid::max_block_rhs);
+		exit(-1);
+	}
+	eigenSolver = solverstr;
+	nWorstModes = nmodes;
+}
+
+static double mixedPrecisionTol = 1e-3;
+
+void setPrecision(const std::string& precisionstr, double tol)
+{
+	if (precisionstr == "double") {
+		grids.setPrecision(grid::Precision::double_precision);
+	}
+	else if (precisionstr == "mixed") {
+		grids.setPrecision(grid::Precision::mixed_precision);
+	}
+	else {
+		printf("-- unsupported precision\n");
+		exit(-1);
+	}
+	mixedPrecisionTol = tol;
+}
+
+void setFilterMode(const std::string& filterstr)
+{
+	if (filterstr == "gather") {
+		grids.setFilterMode(grid::FilterMode::gather_filter);
+	}
+	else if (filterstr == "separable") {
+		grids.setFilterMode(grid::FilterMode::separable_filter);
+	}
+	else {
+		printf("-- unsupported filter engine\n");
+		exit(-1);
+	}
+}
+
+static float coeffUpdateTol = 0;
+
+void setCoeffUpdateTol(double tol)
+{
+	coeffUpdateTol = tol;
+}
+
+void updateDensityFromCoeff(void)
+{
+	if (coeffUpdateTol <= 0) {
+		grids[0]->coeff2density();
+		return;
+	}
+	int nchanged = grids[0]->coeff2density_incremental(coeffUpdateTol);
+	printf("-- density update on %d / %d elements\n", nchanged, grids[0]->n_rho());
+}
+
+static float bgBandWidth = 0;
+
+void setBgBandWidth(double width)
+{
+	bgBandWidth = width;
+}
+
+static int splineLevels = 1;
+static int splineRefineInterval = 10;
+// share of the unrefined cells refined for their sensitivity, on top of those crossed by the isosurface
+static float splineRefineSensRatio = 0.05f;
+
+void setSplineHierarchy(int nlevel, int refine_interval)
+{
+	splineLevels = nlevel;
+	splineRefineInterval = refine_interval;
+}
+
+static int continuationReso = 0;
+static int continuationItn = 0;
+static int continuationFactor = 1;
+
+void setContinuation(int coarse_reso, int coarse_itn, int partition_factor)
+{
+	continuationReso = coarse_reso;
+	continuationItn = coarse_itn;
+	continuationFactor = partition_factor;
+}
+
+int beginContinuation(void)
+{
+	if (continuationReso <= 0 || continuationItn <= 0) return 0;
+	int part[3] = { params.partitionx, params.partitiony, params.partitionz };
+	int factor = continuationFactor;
+	for (int i = 0; i < 3; i++) {
+		if ((part[i] + 1) % factor != 0 || (part[i] + 1) / factor < 2) factor = 1;
+	}
+	if (splineLevels > 1) factor = 1;
+	if (factor != continuationFactor) {
+		printf("\033[33m-- coarse partition not available, the continuation keeps the partition\033[0m\n");
+	}
+	continuationFactor = factor;
+	grids.set_spline_partition((part[0] + 1) / factor - 1, (part[1] + 1) / factor - 1, (part[2] + 1) / factor - 1, params.spline_order);
+	printf("-- continuation : %d iterations at resolution %d, partition %d %d %d\n", continuationItn, continuationReso,
+		grid::Grid::sppartition[0], grid::Grid::sppartition[1], grid::Grid::sppartition[2]);
+	rebuildGrids(continuationReso);
+	return continuationItn;
+}
+
+void continueOnFineGrids(MMA::mma_t& mma, const std::function<void(void)>& prepare)
+{
+	// the knot bound stays where the coarse stage put it, so the coarse lattice is nested in the fine one
+	float boundmin[3], boundmax[3];
+	int nbcoarse[3];
+	for (int i = 0; i < 3; i++) {
+		boundmin[i] = grid::Grid::m_3sBoundMin[i];
+		boundmax[i] = grid::Grid::m_3sBoundMax[i];
+		nbcoarse[i] = grid::Grid::spbasis[i];
+	}
+	grid::SplineHierarchy hierarchy = grids[0]->spline_hierarchy();
+
+	printf("-- continuation : rebuilding at resolution %d\n", params.gridreso);
+	grids.set_spline_partition(params.partitionx, params.partitiony, params.partitionz, params.spline_order);
+	rebuildGrids(params.gridreso);
+	prepare();
+	grids[0]->set_spline_knot_series(boundmin, boundmax);
+	grids[0]->set_spline_knot_infoSymbol();
+	grids[0]->uploadCoeffsSymbol();
+	grids[0]->spline_hierarchy() = hierarchy;
+
+	if (continuationFactor > 1) {
+		grid::SplineRefinement1D ref[3];
+		for (int i = 0; i < 3; i++) {
+			int ncoarse = nbcoarse[i] - params.spline_order + 1;
+			grid::splineKnotInsertion1D(params.spline_order, ncoarse, ncoarse * continuationFactor, ref[i]);
+		}
+		mma.transfer(grids[0]->n_cijk(), [&](const float* src, float* dst) { grid::splineKnotInsertion3D(ref, nbcoarse, src, dst); });
+	}
+}
+
+static void setDesign(float* design)
+{
+	if (grids[0]->has_spline_hierarchy())
+		grids[0]->design2coeff(design);
+	else
+		TestSuit::setCoeff(design);
+}
+
+// sensitivity of the design variables, the lattice one itself without a spline hierarchy
+static float* designSensitivity(float* dcoeff, gv::gVector& ddesign)
+{
+	if (!grids[0]->has_spline_hierarchy()) return dcoeff;
+	if (ddesign.size() != grids[0]->n_design()) ddesign.resize(grids[0]->n_design());
+	grids[0]->dcoeff2design(dcoeff, ddesign.data());
+	return ddesign.data();
+}
+
+// refines the spline hierarchy around the current design and restarts MMA from it in the refined basis,
+// the coefficients only change where the carried over design leaves the bounds
+static void refineDesign(std::unique_ptr<MMA::mma_t>& mma, int n_constraint)
+{
+	std::vector<float> design;
+	if (grids[0]->refine_spline_hierarchy(grids[0]->getCSens(), splineRefineSensRatio, design) == 0) return;
+	for (auto& x : design) x = (std::min)((std::max)(x, params.min_cijk), 1.f);
+	mma.reset(new MMA::mma_t(grids[0]->n_design(), n_constraint));
+	// the work vectors of the previous design dimension will not be reused
+	gv::gVector::releasePool();
+	mma->init(params.min_cijk, 1);
+	mma->get_x().set(design.data());
+	setDesign(mma->get_x().data());
+}
+
+// The V-cycle in mixed precision is an iterative refinement, the finest residual is double and only the
+// coarse correction uses float stencils. Refine the displacement of the final force until the double
+// residual meets the tolerance and report how far the compliance moved.
+// the check costs up to 50 V-cycles, it runs on the first worst case and then every interval-th one
+static const int mixedPrecisionCheckInterval = 10;
+
+static void checkMixedPrecisionCompliance(double c)
+{
+	if (grids.getPrecision() != grid::Precision::mixed_precision) return;
+	static int ncall = 0;
+	if (ncall++ % mixedPrecisionCheckInterval != 0) return;
+	double rel_res = solveDisplacement(mixedPrecisionTol, 50);
+	double c_ref = grids[0]->compliance();
+	double dev = std::abs(c_ref - c) / std::abs(c_ref);
+	grids[0]->_keyvalues["mu_dev"] = dev;
+	if (dev > mixedPrecisionTol) {
+		printf("\033[31m-- mixed precision compliance deviation %6.2e exceeds tolerance %6.2e (r_rel %6.2e)\033[0m\n", dev, mixedPrecisionTol, rel_res);
+	}
+	else {
+		printf("-- mixed precision compliance deviation %6.2e (tol %6.2e)\n", dev, mixedPrecisionTol);
+	}
+}
+
+double solveDisplacement(double rel_tol, int max_itn)
 {
 	double rel_res = 1;
-	while (rel_res > 1e-4) {
-		rel_res = grids.v_cycle();
+	if (grids.getSolverMode() == grid::SolverMode::mg_solver) {
+		int itn = 0;
+		while (rel_res > rel_tol && itn++ < max_itn) {
+			rel_res = grids.v_cycle();
+		}
 	}
+	else {
+		// rigid motion is not determined without support
+		auto project = [](double** u) { if (!grids.hasSupport()) displacementProject(u); };
+		bool flexible = grids.getSolverMode() == grid::SolverMode::fpcg_solver;
+		rel_res = grids.pcg_solve(rel_tol, max_itn, flexible, project);
+	}
+	return rel_res;
+}
+
+// displacement update in one power iteration. The stationary V-cycle only does one cycle warm started
+// from last displacement, the Krylov modes solve to a tolerance following the force change
+static double powerIterationSolve(double fch)
+{
+	if (grids.getSolverMode() == grid::SolverMode::mg_solver) {
+		return grids.v_cycle(1, 1);
+	}
+	double rel_tol = std::max(1e-6, std::min(1e-2, 1e-1 * fch));
+	return solveDisplacement(rel_tol, 50);
+}
+
+void solveFEM(void)
+{
+	solveDisplacement(1e-4, 1000);
 }
 
 void matlab_utils_test(void) {
@@ -256,11 +552,13 @@ double modifiedPM(void)
 
 	bool failed = false;
 
+	grids.reset_vcycle_count();
+
 	// 1e-5
 	while (itn++ < max_itn && (fch > 1e-4 || rel_res > 1e-2)) {
 #if 1
-		// do one v_cycle
-		rel_res = grids.v_cycle(1, 1);
+		// update displacement with selected solver
+		rel_res = powerIterationSolve(fch);
 #else
 		if (fchserial.arising() && itn > 30) {
 			rel_res = grids.v_halfcycle(1, 1, 1);
@@ -349,6 +647,10 @@ double modifiedPM(void)
 
 	printf("-- Worst Compliance %6.3e\n", worstCompliance);
 
+	printf("-- V-cycles %zu\n", grids.n_vcycles());
+
+	checkMixedPrecisionCompliance(worstCompliance);
+
 	return worstCompliance;
 }
 
@@ -536,8 +838,8 @@ double inCompleteModiPM(double fch_thres /*= 1e-2*/)
 
 	// 1e-5
 	while (itn++<max_itn && fch>fch_thres) {
-		// do one v_cycle
-		rel_res = grids.v_cycle(1, 1);
+		// update displacement with selected solver
+		rel_res = powerIterationSolve(fch);
 
 		// project to balanced load on load region
 		grids[0]->v3_copy(grids[0]->getDisplacement(), grids[0]->getForce());
@@ -605,11 +907,7 @@ double MGPSOR(void)
 		grids[0]->reset_displacement();
 
 		// Preconditioned SOR
-		double rel_res = 1;
-		int vit = 0;
-		while (rel_res > 1e-1 && vit++ < 3) {
-			rel_res = grids.v_cycle();
-		}
+		double rel_res = solveDisplacement(1e-1, 3);
 		grids[0]->displacement2matlab("u");
 		grids[0]->residual2matlab("r");
 		
@@ -626,6 +924,219 @@ double MGPSOR(void)
 	return c_worst;
 }
 
+struct v3buf_t { double* v[3]; };
+
+// vectors of LOBPCG, kept across the calls of the optimization loop and rebuilt when the grid or the block size
+// changes. The backend is fixed at startup, so the old vectors are freed by the current grid
+struct lobpcg_workspace_t {
+	int n = 0;
+	int m = 0;
+	// basis S = [X, W, P], the last two blocks are residual and search direction
+	std::vector<v3buf_t> S, KS, Xn, KXn, Pn, KPn;
+
+	void reserve(Grid& g, int nblock) {
+		if (n == g.n_gsvertices && m == nblock) return;
+		for (auto* buflist : { &S,&KS,&Xn,&KXn,&Pn,&KPn }) {
+			for (auto& b : *buflist) g.v3_destroy(b.v);
+		}
+		n = g.n_gsvertices; m = nblock;
+		S.resize(3 * m); KS.resize(3 * m); Xn.resize(m); KXn.resize(m); Pn.resize(m); KPn.resize(m);
+		for (auto* buflist : { &S,&KS,&Xn,&KXn,&Pn,&KPn }) {
+			for (auto& b : *buflist) g.v3_create(b.v);
+		}
+	}
+};
+
+static lobpcg_workspace_t lobpcgWorkspace;
+
+double LOBPCG(int nmodes, std::vector<double>* eigvalues /*= nullptr*/)
+{
+	Grid& g = *grids[0];
+	int m = (std::max)(1, (std::min)(nmodes, Grid::max_block_rhs));
+	bool nosupport = !grids.hasSupport();
+	int nload = n_loadnodes();
+
+	grids.enable_block(m);
+
+	lobpcgWorkspace.reserve(g, m);
+	auto& S = lobpcgWorkspace.S;
+	auto& KS = lobpcgWorkspace.KS;
+	auto& Xn = lobpcgWorkspace.Xn;
+	auto& KXn = lobpcgWorkspace.KXn;
+	auto& Pn = lobpcgWorkspace.Pn;
+	auto& KPn = lobpcgWorkspace.KPn;
+	// projection of the basis on load nodes, u^T P u = |P u|^2
+	std::vector<Eigen::VectorXd> LS(3 * m), LXn(m), LPn(m);
+
+	auto loadProject = [&](double* u[3], Eigen::VectorXd& lu) {
+		std::vector<double> fs[3];
+		getForceSupport(u, fs);
+		forceProject(fs);
+		lu.resize(nload * 3);
+		for (int i = 0; i < nload; i++) {
+			for (int j = 0; j < 3; j++) lu[i * 3 + j] = fs[j][i];
+		}
+	};
+
+	// dst = sum_j c[j] * src[j0 + j]
+	auto combine = [&](double* dst[3], std::vector<v3buf_t>& src, int j0, const Eigen::VectorXd& c) {
+		g.v3_copy(src[j0].v, dst);
+		g.v3_scale(dst, c[0]);
+		for (int j = 1; j < c.size(); j++) g.v3_add(dst, c[j], src[j0 + j].v);
+	};
+
+	// start from last worst displacement, the rest is random
+	for (int i = 0; i < m; i++) {
+		if (i == 0 && g.v3_norm(g.getDisplacement()) > 0) {
+			g.v3_copy(g.getDisplacement(), S[0].v);
+		}
+		else {
+			g.v3_rand(S[i].v, -1, 1);
+		}
+		g.resetDirchlet(S[i].v);
+		if (nosupport) displacementProject(S[i].v);
+		g.v3_normalize(S[i].v);
+		g.applyK(S[i].v, KS[i].v);
+		loadProject(S[i].v, LS[i]);
+	}
+
+	printf("\033[32m[LOBPCG]\n\033[0m");
+
+	grids.reset_vcycle_count();
+
+	Eigen::VectorXd lam(m);
+	lam.setZero();
+	std::vector<double> resnorm(m, 1);
+
+	int max_itn = 200;
+	double tol = 1e-3;
+	int nb = m;
+	int itn = 0;
+	while (itn < max_itn) {
+		// Rayleigh-Ritz on current basis
+		Eigen::MatrixXd A(nb, nb), B(nb, nb);
+		for (int i = 0; i < nb; i++) {
+			for (int j = i; j < nb; j++) {
+				A(i, j) = A(j, i) = LS[i].dot(LS[j]);
+				double bij = g.v3_dot(S[i].v, KS[j].v);
+				double bji = i == j ? bij : g.v3_dot(S[j].v, KS[i].v);
+				B(i, j) = B(j, i) = (bij + bji) / 2;
+			}
+		}
+
+		// B may be singular when the search directions are dependent, drop its null space
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigB(B);
+		double bmax = eigB.eigenvalues().maxCoeff();
+		std::vector<int> keep;
+		for (int i = 0; i < nb; i++) {
+			if (eigB.eigenvalues()[i] > 1e-12 * bmax) keep.push_back(i);
+		}
+		if (keep.size() < m) {
+			printf("\033[31m-- LOBPCG basis degenerated\033[0m\n");
+			break;
+		}
+		Eigen::MatrixXd T(nb, keep.size());
+		for (int i = 0; i < keep.size(); i++) {
+			T.col(i) = eigB.eigenvectors().col(keep[i]) / sqrt(eigB.eigenvalues()[keep[i]]);
+		}
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigA(T.transpose() * A * T);
+		// largest m Ritz pairs, descending
+		Eigen::MatrixXd C(nb, m);
+		for (int i = 0; i < m; i++) {
+			int col = keep.size() - 1 - i;
+			lam[i] = eigA.eigenvalues()[col];
+			C.col(i) = T * eigA.eigenvectors().col(col);
+		}
+
+		// update X and search direction P from the W, P part of the Ritz vectors
+		for (int i = 0; i < m; i++) {
+			combine(Xn[i].v, S, 0, C.col(i));
+			combine(KXn[i].v, KS, 0, C.col(i));
+			LXn[i] = Eigen::VectorXd::Zero(nload * 3);
+			for (int j = 0; j < nb; j++) LXn[i] += C(j, i) * LS[j];
+			if (nb > m) {
+				Eigen::VectorXd cp = C.col(i).tail(nb - m);
+				combine(Pn[i].v, S, m, cp);
+				combine(KPn[i].v, KS, m, cp);
+				LPn[i] = Eigen::VectorXd::Zero(nload * 3);
+				for (int j = m; j < nb; j++) LPn[i] += C(j, i) * LS[j];
+			}
+		}
+		for (int i = 0; i < m; i++) {
+			std::swap(S[i], Xn[i]); std::swap(KS[i], KXn[i]); std::swap(LS[i], LXn[i]);
+			if (nb > m) {
+				std::swap(S[2 * m + i], Pn[i]); std::swap(KS[2 * m + i], KPn[i]); std::swap(LS[2 * m + i], LPn[i]);
+			}
+		}
+
+		// residual P x - lam K x, stored in W
+		for (int i = 0; i < m; i++) {
+			double** w = S[m + i].v;
+			g.v3_copy(S[i].v, w);
+			forceProject(w);
+			g.v3_minus(w, lam[i], KS[i].v);
+			resnorm[i] = g.v3_norm(w) / LS[i].norm();
+		}
+
+		printf("--[%d] lam = %6.4e, r_rel = %6.2lf%%\n", itn, lam[0], resnorm[0] * 100);
+
+		if (*std::max_element(resnorm.begin(), resnorm.end()) < tol) break;
+
+		// precondition all residuals with one block V-cycle
+		for (int i = 0; i < m; i++) g.v3_to_block(S[m + i].v, g._gbuf.Fblock, i);
+		g.reset_block(g._gbuf.Ublock);
+		grids.v_cycle_block();
+		for (int i = 0; i < m; i++) {
+			double** w = S[m + i].v;
+			g.block_to_v3(g._gbuf.Ublock, i, w);
+			if (nosupport) displacementProject(w);
+			g.v3_normalize(w);
+			g.applyK(w, KS[m + i].v);
+			loadProject(w, LS[m + i]);
+		}
+
+		nb = itn == 0 ? 2 * m : 3 * m;
+		itn++;
+	}
+
+	// worst force f = P x / |P x|, displacement u = K^-1 f = lam x / |P x|, compliance f^T u = lam
+	double pxnorm = LS[0].norm();
+	g.v3_copy(S[0].v, g.getForce());
+	forceProject(g.getForce());
+	g.v3_scale(g.getForce(), 1.0 / pxnorm);
+	g.v3_copy(S[0].v, g.getDisplacement());
+	g.v3_scale(g.getDisplacement(), lam[0] / pxnorm);
+	getForceSupport(g.getForce(), g.getSupportForce());
+
+	printf("-- LOBPCG modes :");
+	for (int i = 0; i < m; i++) printf(" %6.4e", lam[i]);
+	printf("\n");
+	if (m > 1 && lam[1] > 0.99 * lam[0]) {
+		printf("\033[33m-- worst case is (nearly) degenerate, lam2/lam1 = %6.4lf\033[0m\n", lam[1] / lam[0]);
+	}
+	printf("-- V-cycles %zu\n", grids.n_vcycles());
+
+	if (eigvalues != nullptr) eigvalues->assign(lam.data(), lam.data() + m);
+
+	double worstCompliance = g.compliance();
+
+	if (isnan(worstCompliance)) { printf("\033[31m-- NaN occurred !\033[0m\n"); exit(-1); }
+
+	g._keyvalues["mu"] = worstCompliance;
+
+	printf("-- Worst Compliance %6.3e\n", worstCompliance);
+
+	return worstCompliance;
+}
+
+double worstCompliance(void)
+{
+	if (eigenSolver == "lobpcg") {
+		return LOBPCG(nWorstModes);
+	}
+	return modifiedPM();
+}
+
 double project_v_cycle(HierarchyGrid& grds) {
 	//forceProject(grds[0]->getForce());
 
@@ -715,7 +1226,7 @@ void optimization(void) {
 		// solve worst displacement by modified power method
 		auto t0 = tictoc::getTag();
 #if 1
-		double c_worst = modifiedPM();
+		double c_worst = worstCompliance();
 #else
 		double c_worst = MGPSOR();
 #endif
@@ -773,18 +1284,24 @@ void optimization_ss(void) {
 	printf("\033[33mOptimization with new self-supporting constraint... \n\033[0m");
 	//printf("%s Optimization with new self-supporting constraint...  %s\n", GREEN, RESET);
 	
+	// first iterations on coarse grids if a continuation is set
+	int coarseItn = beginContinuation();
+
 	// allocated total size
 	printf("[GPU] Total Mem :  %4.2lfGB\n", double(gpu_manager.size()) / 1024 / 1024 / 1024);
 
-	grids.testShell();
-	// 
-	grids.writeNodePos(grids.getPath("nodepos"), *grids[0]);
-	// generate element nodes (which the spline backgrund nodes)
-	grids.writeElementPos(grids.getPath("elepos"), *grids[0]);
-	grids[0]->uploadBgEle();
-	grids[0]->uploadBgEleSymbol();
+	auto prepareGrid = [&]() {
+		grids.testShell();
+		// 
+		grids.writeNodePos(grids.getPath("nodepos"), *grids[0]);
+		// generate element nodes (which the spline backgrund nodes)
+		grids.writeElementPos(grids.getPath("elepos"), *grids[0]);
+		grids[0]->uploadBgEle();
+		grids[0]->uploadBgEleSymbol();
 
-	grids[0]->randForce();
+		grids[0]->randForce();
+	};
+	prepareGrid();
 
 #if 1
 	// MARK: ADD user-defined input	
@@ -795,6 +1312,7 @@ void optimization_ss(void) {
 	grids[0]->set_spline_knot_infoSymbol();
 	grids[0]->uploadCoeffsSymbol();
 	grids[0]->coeff2density();
+	if (splineLevels > 1) grids[0]->set_spline_hierarchy(splineLevels);
 #elif 0	
 	initDensities(params.volume_ratio);
 #else
@@ -839,8 +1357,8 @@ void optimization_ss(void) {
 	con_value = new double[n_constraint];
 
 	// MMA
-	MMA::mma_t mma(grids[0]->n_cijk(), n_constraint);
-	mma.init(params.min_cijk, 1);
+	std::unique_ptr<MMA::mma_t> mma(new MMA::mma_t(grids[0]->n_design(), n_constraint));
+	mma->init(params.min_cijk, 1);
 	float sensScale = 1e6;
 	float volScale = 1e3;
 	float SSScale = 1e3;
@@ -855,6 +1373,7 @@ void optimization_ss(void) {
 		gdiffval[i] = gv::gVector(grids[0]->n_cijk());
 		gdiff[i] = gdiffval[i].data();
 	}
+	gv::gVector dfval(grids[0]->n_cijk());
 
 	while (itn++ < 100) {
 		printf("\n* \033[32mITER %d \033[0m*\n", itn);
@@ -864,12 +1383,14 @@ void optimization_ss(void) {
 		if (Vgoal < params.volume_ratio) Vgoal = params.volume_ratio;
 
 		//grids[0]->coeff2matlab("coeff_2");
+		if (coarseItn > 0 && itn == coarseItn + 1) continueOnFineGrids(*mma, prepareGrid);
 		if (itn > 1)
 		{
 			// set spline_coeff from mma (cpu2gpu)
-			TestSuit::setCoeff(mma.get_x().data());
+			setDesign(mma->get_x().data());
+			if (grids[0]->has_spline_hierarchy() && itn % splineRefineInterval == 0) refineDesign(mma, n_constraint);
 			// update coeff 2 density		
-			grids[0]->coeff2density();
+			updateDensityFromCoeff();
 		}
 		grids[0]->coeff2matlab("coeff_1");
 
@@ -896,7 +1417,7 @@ void optimization_ss(void) {
 		// solve worst displacement by modified power method
 		auto t0 = tictoc::getTag();
 #if 1
-		double c_worst = modifiedPM();
+		double c_worst = worstCompliance();
 #else
 		double c_worst = MGPSOR();
 #endif
@@ -1009,14 +1530,14 @@ void optimization_ss(void) {
 		TestSuit::scaleVector(grids[0]->getVolCSens(), grids[0]->n_cijk(), volScale);
 		gpu_manager_t::pass_dev_buf_to_matlab("csensscale", grids[0]->getCSens(), grids[0]->n_cijk());
 		gpu_manager_t::pass_dev_buf_to_matlab("volcsensscale", grids[0]->getVolCSens(), grids[0]->n_cijk());
-		gdiff[0] = grids[0]->getVolCSens();
+		gdiff[0] = designSensitivity(grids[0]->getVolCSens(), gdiffval[0]);
 		gval[0] = volScale * (vol - params.volume_ratio);                
 		std::cout << "-- TEST gv[0] : " << gval[0] << std::endl;
 
 #ifdef ENABLE_SELFSUPPORT
 		TestSuit::scaleVector(grids[0]->getSSCSens(), grids[0]->n_cijk(), SSScale);
 		gpu_manager_t::pass_dev_buf_to_matlab("sscsensscale", grids[0]->getSSCSens(), grids[0]->n_cijk());
-		gdiff[1] = grids[0]->getSSCSens();
+		gdiff[1] = designSensitivity(grids[0]->getSSCSens(), gdiffval[1]);
 		float ss_goal = 0.f;
 		//if (ss_value < 1e-3) {
 		//	ss_goal = 2e-4;
@@ -1028,7 +1549,7 @@ void optimization_ss(void) {
 #ifdef ENABLE_DRIP
 		TestSuit::scaleVector(grids[0]->getDripCSens(), grids[0]->n_cijk(), dripScale);		
 		gpu_manager_t::pass_dev_buf_to_matlab("dripcsensscale", grids[0]->getDripCSens(), grids[0]->n_cijk());
-		gdiff[2] = grids[0]->getDripCSens();
+		gdiff[2] = designSensitivity(grids[0]->getDripCSens(), gdiffval[2]);
 		gval[2] = dripScale * (drip_value);
 		std::cout << "-- TEST gv[2] : " << gval[2] << std::endl;
 #endif
@@ -1047,7 +1568,7 @@ void optimization_ss(void) {
 
 		std::cout << "-- TEST Heaviside beta : " << para_beta << std::endl;
 
-		mma.update(grids[0]->getCSens(), gdiff.data(), gval.data());
+		mma->update(designSensitivity(grids[0]->getCSens(), dfval), gdiff.data(), gval.data());
 
 #ifdef ENABLE_HEAVISIDE
 		if (itn % 20 == 0 && itn > 2 && para_beta < 8)
@@ -1194,7 +1715,7 @@ void deal_surface_points(float beta) {
 	printf("-- self-supporting time_1 = %6.4e  \n", tictoc::Duration<tictoc::ms>(t4, t5));
 
 	t4 = tictoc::getTag();
-	grids[0]->compute_spline_surface_point_normal();
+	grids[0]->compute_spline_surface_point_fields();
 	float direction = grids[0]->correct_spline_surface_point_normal_direction(beta); // mark false
 	grids[0]->compute_selfsupp_flag_actual();
 	grids[0]->compute_selfsupp_flag_virtual();
@@ -1222,9 +1743,9 @@ void deal_surface_points(float beta) {
 
 void deal_background_points(float beta) {
 	grids[0]->uploadbgSymbol2device();
+	grids[0]->set_bg_band(bgBandWidth);
 
-	grids[0]->compute_spline_background_ele_value();
-	grids[0]->compute_spline_background_ele_normal();
+	grids[0]->compute_spline_background_ele_fields();
 
 	float direction = grids[0]->correct_spline_background_ele_normal_direction(beta);
 	grids[0]->compute_background_selfsupp_flag_actual();
@@ -230,12 +230,9 @@ void computeSensitivity(void) {
 	cudaMemGetInfo(&free_mem, &total_mem);
 	std::cout << "Free Memory: " << free_mem / (1024 * 1024) << " MB  |  Total Memory: " << total_mem / (1024 * 1024) << " MB" << std::endl;
 
-	// rho_diff 2 coeff_diff
-	grids[0]->ddensity2dcoeff_update();
-
-	// vol: rho_diff 2 coeff_diff
+	// rho_diff and vol_diff 2 coeff_diff
 	// MARK[TODO]: need to fixed
-	grids[0]->dvol2dcoeff();
+	grids[0]->dsens2dcoeff();
 
 	cudaMemGetInfo(&free_mem, &total_mem);
 	std::cout << "Free Memory: " << free_mem / (1024 * 1024) << " MB  |  Total Memory: " << total_mem / (1024 * 1024) << " MB" << std::endl;
@@ -288,27 +285,20 @@ void computeSensitivity2(float beta) {
 	grids[0]->Volsens2matlab("volsensproj");
 #endif
 
-	// filter sensitivity 
-	grids[0]->filterSensitivity(params.filter_radius);
+	// filter sensitivity and vol sensitivity in one pass
+	float* sens[2] = { grids[0]->getSens(), grids[0]->getVolSens() };
+	grids[0]->filterSensitivities(2, sens, params.filter_radius);
 
 	// DEBUG
 	grids[0]->sens2matlab("sensfilt");
-
-	// filter vol sensitivity
-	grids[0]->filterVolSensitivity(params.filter_radius);
-
-	// DEBUG
 	grids[0]->Volsens2matlab("volsensfilt");
 
 	size_t free_mem, total_mem;
 	cudaMemGetInfo(&free_mem, &total_mem);
 	std::cout << "Free Memory: " << free_mem / (1024 * 1024) << " MB  |  Total Memory: " << total_mem / (1024 * 1024) << " MB" << std::endl;
 
-	// energy: rho_diff 2 coeff_diff
-	grids[0]->ddensity2dcoeff_update();
-
-	// vol: vol_diff 2 coeff_diff
-	grids[0]->dvol2dcoeff();
+	// energy and vol: rho_diff, vol_diff 2 coeff_diff
+	grids[0]->dsens2dcoeff();
 
 	cudaMemGetInfo(&free_mem, &total_mem);
 	std::cout << "Free Memory: " << free_mem / (1024 * 1024) << " MB  |  Total Memory: " << total_mem / (1024 * 1024) << " MB" << std::endl;
@@ -824,6 +814,7 @@ void uploadTemplateMatrix(void)
 	float power = params.power_penalty;
 	cudaMemcpyToSymbol(power_penalty, &power, sizeof(power_penalty));
 	cuda_error_check;
+	grid::Grid::_power_penalty = power;
 }
 
 void setDEBUG(bool debug)
@@ -8,8 +8,11 @@
 #include <filesystem>
 #include "MeshDefinition.h"
 #include "test_utils.h"
+#include <functional>
 //#include "CGALDefinition.h"
 
+namespace MMA { class mma_t; }
+
 extern grid::HierarchyGrid grids;
 
 struct Parameter {
@@ -57,6 +60,47 @@ void setSSMode(const std::string& modestr);
 
 void setDripMode(const std::string& modestr);
 
+// select where the multigrid solver runs, must be called before building the grids. The host backend is
+// only accepted for the solver tests, testname is the -testname of the run
+void setBackend(const std::string& backendstr, const std::string& testname);
+
+// select how the finest displacement is solved (mg/pcg/fpcg)
+void setSolverMode(const std::string& solverstr);
+
+// select the worst case eigen solver (pm/lobpcg) and the number of modes computed by lobpcg
+void setEigenSolver(const std::string& solverstr, int nmodes);
+
+// select the coarse stencil precision (double/mixed) and the reported compliance tolerance of mixed precision
+void setPrecision(const std::string& precisionstr, double tol);
+
+// select the sensitivity filter (gather/separable)
+void setFilterMode(const std::string& filterstr);
+
+// coefficients moving less than tol leave the densities untouched, 0 evaluates every element on each update
+void setCoeffUpdateTol(double tol);
+
+// densities of the current coefficients, restricted to the support of the moved ones by setCoeffUpdateTol
+void updateDensityFromCoeff(void);
+
+// background self-supporting points are only evaluated within width of the isosurface value, 0 evaluates all
+void setBgBandWidth(double width);
+
+// coarse-to-fine continuation: the first coarse_itn iterations of optimization_ss / testOrdinarySplineTopoptMMA
+// run on grids of coarse_reso, with (partition + 1) / partition_factor knot spans if that divides. 0 disables it
+void setContinuation(int coarse_reso, int coarse_itn, int partition_factor);
+
+// rebuilds the grids for the coarse stage, returns the number of coarse iterations (0 without continuation)
+int beginContinuation(void);
+
+// rebuilds the grids at gridreso with the full partition. The spline keeps its knot bound, so the design carries
+// over exactly (by knot insertion if the partition was coarsened) together with the MMA state. prepare sets up
+// the new finest grid (forces, background points) before the knot series is uploaded
+void continueOnFineGrids(MMA::mma_t& mma, const std::function<void(void)>& prepare);
+
+// truncated hierarchical spline design of nlevel levels over the partition lattice, refined around the boundary
+// every refine_interval iterations of optimization_ss. A single level optimizes the lattice coefficients
+void setSplineHierarchy(int nlevel, int refine_interval);
+
 void setDEBUG(bool debug = false);
 
 double solveAdjointSystem(void);
@@ -67,6 +111,9 @@ void selfTest(void);
 
 void solveFEM(void);
 
+// solve current force on the finest layer with selected solver, return the relative residual
+double solveDisplacement(double rel_tol, int max_itn);
+
 // solve the worst-case displacement using the modified power method, return the final compliance
 double modifiedPM(void);
 
@@ -83,6 +130,13 @@ double inCompleteModiPM(double fch_thres = 1e-2);
 
 double MGPSOR(void);
 
+// block LOBPCG on the pencil (P, K) preconditioned by block V-cycles, P projects to the balanced load on load nodes.
+// the worst force and displacement are left in the finest grid, eigvalues receives the top nmodes compliances
+double LOBPCG(int nmodes, std::vector<double>* eigvalues = nullptr);
+
+// worst compliance by the selected eigen solver
+double worstCompliance(void);
+
 void computeSensitivity(void);
 
 void computeSensitivity2(float beta);
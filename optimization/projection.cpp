@@ -65,8 +65,8 @@ void setNodes(BitSAT<unsigned int>& vbits, int vreso, const std::vector<int>& le
 			if (read_bit(word, j)) {
 				int vid = vidword + vidoffset;
 				int gsvid = lex2gs[vid];
-				int bitid = i * BitCount<unsigned int>::value + j;
-				int  p[3] = { bitid % vreso, bitid % vreso2 / vreso,bitid / vreso / vreso };
+				index_t bitid = index_t(i) * BitCount<unsigned int>::value + j;
+				int  p[3] = { int(bitid % vreso), int(bitid % vreso2 / vreso), int(bitid / vreso / vreso) };
 				Eigen::Matrix<double, 3, 3> phat;
 				phat << 0, -p[2], p[1],
 					p[2], 0, -p[0],
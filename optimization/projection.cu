@@ -168,6 +168,22 @@ void forceProject(double* f_dev[3])
 	//grids[0]->v3_toMatlab("f_dev", f_dev);
 	bool freeforce = grids.isForceFree();
 
+	// host resident force, project the load nodes in place
+	if (grids[0]->onHost()) {
+		const std::vector<int>& loadnodes = getLoadNodes();
+		std::vector<double> fshost[3];
+		for (int i = 0; i < 3; i++) {
+			fshost[i].resize(loadnodes.size());
+			for (int j = 0; j < loadnodes.size(); j++) fshost[i][j] = f_dev[i][loadnodes[j]];
+		}
+		forceProject(fshost);
+		for (int i = 0; i < 3; i++) {
+			std::fill(f_dev[i], f_dev[i] + _n_gsnodes, 0.);
+			for (int j = 0; j < loadnodes.size(); j++) f_dev[i][loadnodes[j]] = fshost[i][j];
+		}
+		return;
+	}
+
 	double* fsupport[3];
 	Grid::getTempBufArray(fsupport, 3, n_loadnodes());
 
@@ -306,6 +322,14 @@ void forceRestoreProjection(double* f_dev[3])
 
 void getForceSupport(double const * const f_dev[3], double* fsup[3])
 {
+	if (grids[0]->onHost()) {
+		const std::vector<int>& loadnodes = getLoadNodes();
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < loadnodes.size(); j++) fsup[i][j] = f_dev[i][loadnodes[j]];
+		}
+		return;
+	}
+
 	size_t grid_size, block_size;
 	make_kernel_param(&grid_size, &block_size, n_loadnodes(), 512);
 
@@ -332,6 +356,13 @@ void getForceSupport(double const * const f_dev[3], double* fsup[3])
 
 void getForceSupport(double const * const f_dev[3], std::vector<double> fs[3])
 {
+	if (grids[0]->onHost()) {
+		for (int i = 0; i < 3; i++) fs[i].resize(n_loadnodes());
+		double* fsp[3] = { fs[0].data(),fs[1].data(),fs[2].data() };
+		getForceSupport(f_dev, fsp);
+		return;
+	}
+
 	double* fsupport[3];
 	Grid::getTempBufArray(fsupport, 3, n_loadnodes());
 	getForceSupport(f_dev, fsupport);
@@ -332,6 +332,21 @@ void TestSuit::testMain(const std::string& testname)
 	else if (testname == "testeigensolvers") {
 		testDifferentEigenSolvers();
 	}
+	else if (testname == "testmixedprec") {
+		testMixedPrecision();
+	}
+	else if (testname == "testmmapool") {
+		testMMAPool();
+	}
+	else if (testname == "testsplinehierarchy") {
+		testSplineHierarchy();
+	}
+	else if (testname == "testfilterengines") {
+		testFilterEngines();
+	}
+	else if (testname == "testcoefftranspose") {
+		testCoeffTranspose();
+	}
 	else if (testname == "testinitforce") {
 		testDifferentInitForce();
 	}
@@ -977,23 +992,29 @@ void TestSuit::testOrdinarySplineTopoptMMA(void)
 {
 	//grids.lambdatest();
 
-	// set force
-	grids[0]->reset_force();
-	setForceSupport(getPreloadForce(), grids[0]->getForce());
+	// first iterations on coarse grids if a continuation is set
+	int coarseItn = beginContinuation();
 
-	if (!grids.hasSupport()) {
-		forceProject(grids[0]->getForce());
-	}
+	auto prepareGrid = [&]() {
+		// set force
+		grids[0]->reset_force();
+		setForceSupport(getPreloadForce(), grids[0]->getForce());
 
-	grids[0]->force2matlab("fn");
+		if (!grids.hasSupport()) {
+			forceProject(grids[0]->getForce());
+		}
 
-	grids.resetAllResidual();
-	grids[0]->reset_displacement();
-	grids.writeSupportForce(grids.getPath("fs"));
+		grids[0]->force2matlab("fn");
 
-	grids.testShell();
-	grids.writeNodePos(grids.getPath("nodepos"), *grids[0]);
-	grids.writeElementPos(grids.getPath("elepos"), *grids[0]);
+		grids.resetAllResidual();
+		grids[0]->reset_displacement();
+		grids.writeSupportForce(grids.getPath("fs"));
+
+		grids.testShell();
+		grids.writeNodePos(grids.getPath("nodepos"), *grids[0]);
+		grids.writeElementPos(grids.getPath("elepos"), *grids[0]);
+	};
+	prepareGrid();
 
 #if 1
 	// MARK: ADD user-defined input	
@@ -1071,12 +1092,13 @@ void TestSuit::testOrdinarySplineTopoptMMA(void)
 		Vc = Vgoal - params.volume_ratio;
 		if (Vgoal < params.volume_ratio) Vgoal = params.volume_ratio;
 
+		if (coarseItn > 0 && itn == coarseItn + 1) continueOnFineGrids(mma, prepareGrid);
 		grids[0]->coeff2matlab("coeff_2");
 		// set spline_coeff from mma (cpu2gpu)
 		setCoeff(mma.get_x().data());
 		// update coeff 2 density
 		grids[0]->coeff2matlab("coeff_1");
-		grids[0]->coeff2density();
+		updateDensityFromCoeff();
 		
 #ifdef ENABLE_HEAVISIDE
 		projectDensities(para_beta);
@@ -1337,7 +1359,7 @@ void TestSuit::testOrdinarySplineTopoptMMA_ss3(void)
 			// set spline_coeff from mma (cpu2gpu)
 			TestSuit::setCoeff(mma.get_x().data());
 			// update coeff 2 density		
-			grids[0]->coeff2density();
+			updateDensityFromCoeff();
 		}
 		grids[0]->coeff2matlab("coeff_1");
 
@@ -1822,7 +1844,7 @@ void TestSuit::testRobustSplineMMA(void)
 			// set spline_coeff from mma (cpu2gpu)
 			setCoeff(mma.get_x().data());
 			// update coeff 2 density		
-			grids[0]->coeff2density();
+			updateDensityFromCoeff();
 		}		
 		grids[0]->coeff2matlab("coeff_1");
 
@@ -2125,6 +2147,281 @@ void TestSuit::testDifferentEigenSolvers(void)
 	ofs.close();
 }
 
+void TestSuit::testMixedPrecision(void)
+{
+	if (FLAGS_inputdensity == "") {
+		initDensities(1);
+	} else {
+		grids.readDensity(FLAGS_inputdensity);
+	}
+
+	std::ofstream ofs(grids.getPath("mixedprecision.txt"));
+
+	ofs << "n_elements = " << grids[0]->n_gselements << std::endl;
+
+	// the same balanced unit force for both modes
+	double* f0[3];
+	grids[0]->v3_create(f0);
+	grids[0]->randForce();
+	forceProject(grids[0]->getForce());
+	grids[0]->unitizeForce();
+	grids[0]->v3_copy(grids[0]->getForce(), f0);
+
+	grid::Precision modes[2] = { grid::Precision::double_precision, grid::Precision::mixed_precision };
+	std::string modenames[2] = { "double", "mixed" };
+	double c_worst[2];
+
+	for (int k = 0; k < 2; k++) {
+		grids.setPrecision(modes[k]);
+		grids.update_stencil();
+
+		std::string nam = modenames[k];
+
+		// smoothing on coarse layers, the kernels reading the stencils
+		_TIC("t_gs_" + nam)
+		for (int i = 1; i < grids.n_grid(); i++) {
+			if (grids[i]->is_dummy()) continue;
+			grids[i]->gs_relax(20);
+			grids[i]->update_residual();
+		}
+		_TOC
+
+		// fixed number of V-cycles on the same force
+		grids[0]->v3_copy(f0, grids[0]->getForce());
+		grids[0]->reset_displacement();
+		double rel_res = 1;
+		_TIC("t_vcycle_" + nam)
+		for (int i = 0; i < 20; i++) rel_res = grids.v_cycle();
+		_TOC
+		double c_fem = grids[0]->compliance();
+
+		_TIC("t_mpm_" + nam)
+		c_worst[k] = modifiedPM();
+		_TOC
+		size_t n_vcycle = grids.n_vcycles();
+
+		printf("--[%s] gs %4.2lf ms, 20 V-cycles %4.2lf ms (r_rel %6.2e, c %6.4e), modiPM %4.2lf ms (%zu V-cycles, c_worst %6.4e)\n",
+			nam.c_str(), tictoc::get_record("t_gs_" + nam), tictoc::get_record("t_vcycle_" + nam), rel_res, c_fem,
+			tictoc::get_record("t_mpm_" + nam), n_vcycle, c_worst[k]);
+		ofs << "[" << nam << "] t_gs = " << tictoc::get_record("t_gs_" + nam) << " ms, t_vcycle = " << tictoc::get_record("t_vcycle_" + nam)
+			<< " ms, r_rel = " << rel_res << ", c = " << c_fem << ", t_mpm = " << tictoc::get_record("t_mpm_" + nam)
+			<< " ms, n_vcycle = " << n_vcycle << ", c_worst = " << c_worst[k] << std::endl;
+	}
+
+	double dev = std::abs(c_worst[1] - c_worst[0]) / std::abs(c_worst[0]);
+	printf("-- c_worst deviation %6.2e (tol %6.2e) %s\n", dev, FLAGS_mp_tol, dev > FLAGS_mp_tol ? "\033[31mfailed\033[0m" : "passed");
+	ofs << "deviation = " << dev << ", tol = " << FLAGS_mp_tol << std::endl;
+	ofs.close();
+
+	grids[0]->v3_destroy(f0);
+	grids.setPrecision(grid::Precision::double_precision);
+}
+
+void TestSuit::testMMAPool(void)
+{
+	// min sum (x - t_i)^2  s.t.  mean(x) - 0.2 <= 0, x in [0, 1]
+	int n = 1 << 20;
+	MMA::mma_t mma(n, 1);
+	mma.init(0.f, 1.f);
+
+	std::vector<gv::Scalar> t(n), x(n), df(n);
+	for (int i = 0; i < n; i++) t[i] = 0.5f + 0.4f * std::sin(i * 0.001f);
+
+	gv::gVector dfval(n), gdiffval(n, 1.f / n), gval(1);
+	gv::Scalar* gdiff[1] = { gdiffval.data() };
+
+	gv::gVector::PoolStats stats[2];
+	for (int itn = 0; itn < 2; itn++) {
+		mma.get_x(x.data());
+		double xsum = 0;
+		for (int i = 0; i < n; i++) {
+			df[i] = 2 * (x[i] - t[i]);
+			xsum += x[i];
+		}
+		dfval.set(df.data());
+		gval[0] = gv::Scalar(xsum / n - 0.2);
+
+		// the first update fills the pool, the next ones should be served from it
+		gv::gVector::resetPoolCounters();
+		_TIC("t_mma_" + std::to_string(itn))
+		mma.update(dfval.data(), gdiff, gval.data());
+		_TOC
+		stats[itn] = gv::gVector::poolStats();
+		printf("--[%d] %4.2lf ms, %zu requests, %zu allocs, %zu MB live, %zu MB cached\n", itn,
+			tictoc::get_record("t_mma_" + std::to_string(itn)), stats[itn].n_requests, stats[itn].n_allocs,
+			stats[itn].live_bytes >> 20, stats[itn].cached_bytes >> 20);
+	}
+
+	if (stats[1].n_allocs != 0) {
+		printf("\033[31m-- second MMA update allocated %zu buffers\033[0m\n", stats[1].n_allocs);
+		exit(-1);
+	}
+	printf("-- MMA pool passed\n");
+}
+
+void TestSuit::testSplineHierarchy(void)
+{
+	grid::SplineHierarchy sh;
+	int nspan[3] = { 32, 32, 32 };
+	int nlevel = sh.init(3, nspan, 3);
+
+	// refine around a sphere in the lattice, twice, so that three levels are active
+	for (int pass = 0; pass + 1 < nlevel; pass++) {
+		int nb = nspan[0] + 2;
+		std::vector<float> c(sh.n_coeffs());
+		for (size_t id = 0; id < c.size(); id++) {
+			double p[3] = { double(id % nb), double(id / nb % nb), double(id / (nb * nb)) };
+			double r = sqrt(pow(p[0] - nb / 2., 2) + pow(p[1] - nb / 2., 2) + pow(p[2] - nb / 2., 2));
+			c[id] = r < nb / 4. ? 1 : 0;
+		}
+		sh.refine(c.data(), nullptr, 0.5f, 0);
+	}
+	printf("-- %d levels, %d design variables, %d coefficients, active per level :", nlevel, sh.n_design(), sh.n_coeffs());
+	for (int l = 0; l < nlevel; l++) printf(" %d", sh.n_active(l));
+	printf("\n");
+
+	bool passed = true;
+
+	// <R x, d> = <x, R^T d>
+	Eigen::VectorXf x = Eigen::VectorXf::Random(sh.n_design());
+	Eigen::VectorXf d = Eigen::VectorXf::Random(sh.n_coeffs());
+	Eigen::VectorXf Rx(sh.n_coeffs()), RTd(sh.n_design());
+	sh.forward(x.data(), Rx.data());
+	sh.transpose(d.data(), RTd.data());
+	double lhs = Rx.cast<double>().dot(d.cast<double>());
+	double rhs = x.cast<double>().dot(RTd.cast<double>());
+	double adj_err = std::abs(lhs - rhs) / (std::max)(std::abs(lhs), 1e-30);
+	printf("-- <R x, d> = %.8e, <x, R^T d> = %.8e, rel err %6.2e\n", lhs, rhs, adj_err);
+	if (adj_err > 1e-5) passed = false;
+
+	// coefficients already in the hierarchical space are reproduced by project
+	Eigen::VectorXf xp(sh.n_design()), Rxp(sh.n_coeffs());
+	sh.project(Rx.data(), xp.data());
+	sh.forward(xp.data(), Rxp.data());
+	double proj_err = (Rxp - Rx).cwiseAbs().maxCoeff() / Rx.cwiseAbs().maxCoeff();
+	double design_err = (xp - x).cwiseAbs().maxCoeff() / x.cwiseAbs().maxCoeff();
+	printf("-- projection max rel err on coefficients %6.2e, on design %6.2e\n", proj_err, design_err);
+	if (proj_err > 1e-4) passed = false;
+
+	if (!passed) {
+		printf("\033[31m-- spline hierarchy failed\033[0m\n");
+		exit(-1);
+	}
+	printf("-- spline hierarchy passed\n");
+}
+
+void TestSuit::testFilterEngines(void)
+{
+	if (FLAGS_inputdensity == "") {
+		initDensities(1);
+	} else {
+		grids.readDensity(FLAGS_inputdensity);
+	}
+
+	std::ofstream ofs(grids.getPath("filterengines.txt"));
+
+	// the separable gaussian only matches the variance of the gather weights, its error relative to the field is
+	// about 3e-2 at R = 2 and falls with the radius
+	const double tol = 5e-2;
+	bool passed = true;
+
+	int ne = grids[0]->n_rho();
+	ofs << "n_elements = " << ne << std::endl;
+
+	// the same random field for both engines
+	Eigen::VectorXf s0 = (Eigen::VectorXf::Random(ne).array() + 1) / 2;
+	Eigen::VectorXf sg(ne), ss(ne);
+	float* sens[1] = { grids[0]->getSens() };
+
+	grid::FilterMode mode0 = grids.getFilterMode();
+	grid::FilterMode modes[2] = { grid::FilterMode::gather_filter, grid::FilterMode::separable_filter };
+	std::string modenames[2] = { "gather", "separable" };
+	Eigen::VectorXf* result[2] = { &sg, &ss };
+
+	for (double radii : { 2., 5., 10., 20. }) {
+		for (int k = 0; k < 2; k++) {
+			gpu_manager_t::upload_buf(sens[0], s0.data(), sizeof(float) * ne);
+			grids.setFilterMode(modes[k]);
+			std::string nam = "t_" + modenames[k] + "_" + std::to_string(int(radii));
+			_TIC(nam)
+			grids[0]->filterSensitivities(1, sens, radii);
+			_TOC
+			gpu_manager_t::download_buf(result[k]->data(), sens[0], sizeof(float) * ne);
+		}
+		std::string suffix = "_" + std::to_string(int(radii));
+		double t_gather = tictoc::get_record("t_gather" + suffix);
+		double t_separable = tictoc::get_record("t_separable" + suffix);
+		// error relative to the field and to the change made by the exact filter
+		double err = (ss - sg).norm() / sg.norm();
+		double err_ch = (ss - sg).norm() / (sg - s0).norm();
+		printf("-- R = %4.1lf, gather %8.2lf ms, separable %8.2lf ms, rel err %6.2e, rel err of change %6.2e\n",
+			radii, t_gather, t_separable, err, err_ch);
+		ofs << "R = " << radii << ", t_gather = " << t_gather << " ms, t_separable = " << t_separable
+			<< " ms, err = " << err << ", err_ch = " << err_ch << std::endl;
+		if (!(err <= tol)) passed = false;
+	}
+	ofs.close();
+
+	grids.setFilterMode(mode0);
+
+	if (!passed) {
+		printf("\033[31m-- filter engines differ by more than %6.2e\033[0m\n", tol);
+		exit(-1);
+	}
+	printf("-- filter engines passed\n");
+}
+
+void TestSuit::testCoeffTranspose(void)
+{
+	if (!grids[0]->onHost()) {
+		printf("\033[31m-- testcoefftranspose times the host operators, run it with -backend=host\033[0m\n");
+		exit(-1);
+	}
+
+	initCoeffs(params.volume_ratio);
+	grids[0]->set_spline_knot_series();
+	grids[0]->set_spline_knot_infoSymbol();
+	grids[0]->uploadCoeffsSymbol();
+	grids[0]->coeff2density();
+
+	std::ofstream ofs(grids.getPath("coefftranspose.txt"));
+
+	int ne = grids[0]->n_gselements;
+	int nc = grids[0]->n_cijk();
+	ofs << "n_elements = " << ne << ", n_coeffs = " << nc << std::endl;
+
+	// compliance and volume sensitivities, the two fields of the fused pass
+	Eigen::VectorXf g0 = Eigen::VectorXf::Random(ne), g1 = Eigen::VectorXf::Random(ne);
+	const float* dfield[2] = { g0.data(), g1.data() };
+	Eigen::VectorXf cg0(nc), cg1(nc), cs0(nc), cs1(nc);
+	float* cgather[2] = { cg0.data(), cg1.data() };
+	float* cscatter[2] = { cs0.data(), cs1.data() };
+
+	const int nrep = 5;
+	_TIC("t_gather")
+	for (int i = 0; i < nrep; i++) grids[0]->dfield2dcoeff_host(2, dfield, cgather);
+	_TOC
+	_TIC("t_scatter")
+	for (int i = 0; i < nrep; i++) grids[0]->dfield2dcoeff_host_scatter(2, dfield, cscatter);
+	_TOC
+	double t_gather = tictoc::get_record("t_gather") / nrep;
+	double t_scatter = tictoc::get_record("t_scatter") / nrep;
+
+	double err = (std::max)((cg0 - cs0).norm() / cs0.norm(), (cg1 - cs1).norm() / cs1.norm());
+	printf("-- gather %8.2lf ms, atomic scatter %8.2lf ms, speedup %5.2lf, rel err %6.2e\n", t_gather, t_scatter, t_scatter / t_gather, err);
+	ofs << "t_gather = " << t_gather << " ms, t_scatter = " << t_scatter << " ms, err = " << err << std::endl;
+	ofs.close();
+
+	// float sums in another order
+	const double tol = 1e-4;
+	if (!(err <= tol)) {
+		printf("\033[31m-- gather and scatter transpose differ by more than %6.2e\033[0m\n", tol);
+		exit(-1);
+	}
+	if (t_gather >= t_scatter) printf("\033[31m-- gather transpose is not faster than the atomic scatter\033[0m\n");
+	printf("-- coefficient transpose passed\n");
+}
+
 void TestSuit::testDifferentInitForce(void)
 {
 	std::vector<std::string> vdbfiles;
@@ -46,6 +46,16 @@ public:
 
 	static void testDifferentEigenSolvers(void);
 
+	static void testMixedPrecision(void);           // double vs mixed precision stencils
+
+	static void testMMAPool(void);                  // MMA updates served from the gVector pool
+
+	static void testSplineHierarchy(void);          // adjointness and projection of the hierarchical spline map
+
+	static void testFilterEngines(void);            // separable vs gather sensitivity filter
+
+	static void testCoeffTranspose(void);           // gather vs atomic scatter transpose of the spline map, on host
+
 	static void testDifferentInitForce(void);
 
 	static void testMemoryUsage(void);